@@ -13,6 +13,7 @@
 
 #include "gene_core.h"
 #include "msd.sort.h"
+#include "lsd.sort.h"
 #include "../Core/ONElib.h"
 
 #include "VGPschema.h"
@@ -23,8 +24,10 @@ int    VERBOSE;        //  Verbose mode?
 int    NTHREADS;       //  # of threads to use for parallized sorts
 int    HISTOGRAM;      //  Histogram bar-code counts
 int    VALID;          //  Threshold above which bar-code is considered valid
+int64  MEMORY;         //  Max. bytes for the array of compressed pairs (-M), else 0
+char  *SORT_PATH;      //  Directory for spill files when pairs exceed MEMORY
 
-static char *Usage = "[-vH] [-t<int(100)>] [-T<int(4)>] <clouds:irp>";
+static char *Usage = "[-vH] [-t<int(100)>] [-T<int(4)>] [-M<int>] [-P<dir(/tmp)>] <clouds:irp>";
 
 static uint8 bit[8] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80 };
 
@@ -399,156 +402,14 @@ typedef struct
     int64       *bucks;   //  To seed top level sort
   } Sort_Arg;
 
-  //  Simple LSD radix sort of uint32's
-
-#undef TEST_LSORT
-
-void LSD_sort(int64 nelem, uint32 *src, uint32 *trg)
-{ int64  ptrs[512];
-
-  int64 *Cptr = ptrs;
-  int64 *Nptr = ptrs + 256;
-
-  int64    i;
-  int      j, b;
-
-  //  If first pass, then explicitly sweep to get Cptr counts
-
-  { uint32  v;
-#if __ORDER_LITTLE_ENDIAN__ == __BYTE_ORDER__
-    uint8  *p = ((uint8 *) &v);
-#else
-    uint8  *p = ((uint8 *) &v) + 3;
-#endif
-
-    for (j = 0; j < 256; j++)
-      Cptr[j] = 0;
-
-    for (i = 0; i < nelem; i++)
-      { v = src[i];
-        Cptr[*p] += 1;
-      }
-  }
-
-  //  For each requested byte b in order, radix sort
-
-  for (b = 0; b < 4; b++)
-    { int Cbyte, Nbyte;
+  //  LSD radix sort of the uint32 codes of a thread, least significant byte first
 
 #if __ORDER_LITTLE_ENDIAN__ == __BYTE_ORDER__
-      Cbyte  = b;
-      Nbyte  = b+1;
+static int Code_Bytes[5] = { 0, 1, 2, 3, -1 };
 #else
-      Cbyte  = 3-b;
-      Nbyte  = 2-b;
-#endif
-
-#ifdef TEST_LSORT
-      printf("\nSorting byte %d (next %d)\n",Cbyte,Nbyte);
-      fflush(stdout);
-      printf("\nBUCKETS %d\n",Cbyte);
-      for (j = 0; j < 256; j++)
-        printf(" %3d: %10lld\n",j,Cptr[j]);
-      fflush(stdout);
+static int Code_Bytes[5] = { 3, 2, 1, 0, -1 };
 #endif
 
-      //  Convert Cptr from counts to fingers
-
-      { int64 x, y;
-
-        x = 0;
-        for (j = 0; j < 256; j++)
-          { y = Cptr[j];
-            Cptr[j] = x;
-            x += y;
-          }
-      }
-
-      //  Radix sort from src to trg
-
-      { uint32  v;
-        uint8  *p = ((uint8 *) &v) + Cbyte;
-        uint8  *n = ((uint8 *) &v) + Nbyte;
-        uint8   d;
-        int64   x;
-
-        if (b == 3)
-          for (i = 0; i < nelem; i++)
-            { v = src[i];
-              d = *p;
-              x = Cptr[d]++;
-              trg[x] = v;
-            }
-        else
-          { for (j = 0; j < 256; j++)
-              Nptr[j] = 0;
-            for (i = 0; i < nelem; i++)
-              { v = src[i]; 
-                d = *p;
-                x = Cptr[d]++;
-                trg[x] = v;
-                Nptr[*n] += 1;
-              }
-          }
-      }
-    
-      //  Flip roles of data and ptr vectors
-
-      { int64  *p;
-        uint32 *d;
-
-        d   = src;
-        src = trg;
-        trg = d;
-
-        p    = Cptr;
-        Cptr = Nptr;
-        Nptr = p;
-      }
-
-#ifdef TEST_LSORT
-      { int64  c;
-
-        printf("\nLSORT %d\n",Cbyte);
-        for (c = 0; c < 300; c++)
-          { for (j = 0; j < 4; j++)
-              printf(" %02x",((uint8 *) (src+c))[j]);
-            printf("\n");
-          }
-        printf("\n");
-        for (c = nelem/2-150; c < nelem/2+150; c++)
-          { for (j = 0; j < 4; j++)
-              printf(" %02x",((uint8 *) (src+c))[j]);
-            printf("\n");
-          }
-        printf("\n");
-        for (c = nelem-300; c < nelem; c++)
-          { for (j = 0; j < 4; j++)
-              printf(" %02x",((uint8 *) (src+c))[j]);
-            printf("\n");
-          }
-        printf("\n");
-
-        for (c = 1; c < nelem; c++)
-          { for (j = Cbyte; j >= 0; j--)
-              if (((uint8 *) (src+c))[j] > ((uint8 *) (src+(c-1)))[j])
-                break;
-              else if (((uint8 *) (src+c))[j] < ((uint8 *) (src+(c-1)))[j])
-                { printf("  Order: %lld",c);
-                  for (j = Cbyte; j >= 0; j--)
-                    printf(" %02x",((uint8 *) (src+(c+1)))[j]);
-                  printf(" vs");
-                  for (j = Cbyte; j >= 0; j--)
-                    printf(" %02x",((uint8 *) (src+c))[j]);
-                  printf("\n");
-                  break;
-                }
-          }
-      }
-#endif
-    }
-}
-
 static void *sort_thread(void *arg)
 { Sort_Arg *parm  = (Sort_Arg *) arg;
   int64     beg   = parm->beg;
@@ -560,7 +421,7 @@ static void *sort_thread(void *arg)
   int64  g, f, i;
   uint32 v;
 
-  LSD_sort(end-beg,codes+beg,vlist+beg);
+  LSD_Sort_Threads(end-beg,codes+beg,vlist+beg,4,4,Code_Bytes,1,0);  //  4 passes: result in codes
 
 #ifdef CHECK_SORT
   for (i = beg+1; i < end; i++)
@@ -1052,6 +913,58 @@ static void *bucket_thread(void *arg)
  *
  *****************************************************************************************/
 
+//  In external memory mode each thread has one spill file.  Its pairs are gathered in a
+//    buffer per round, and a full buffer is appended to the file as a chunk, recording the
+//    round and place of the chunk, so that a round is then read back chunk by chunk.
+
+typedef struct
+  { int          round;
+    int64        off;      //  Place of the chunk in the spill file
+    int64        len;
+  } Spill_Chunk;
+
+typedef struct
+  { FILE        *file;     //  Spill file of the thread, unbuffered as whole chunks are moved
+    int64        flen;     //  Bytes in the file so far
+    int64        chunk;    //  Size of the buffer of a round, a multiple of the pair size
+    uint8       *buf;      //  [nround] buffers of chunk bytes
+    int64       *bfill;    //  [nround] bytes in each buffer
+    int          nchunk;
+    int          maxchunk;
+    Spill_Chunk *chunks;   //  Chunks in file order
+  } Spill;
+
+static void spill_flush(Spill *s, int r)
+{ Spill_Chunk *c;
+
+  if (s->bfill[r] == 0)
+    return;
+  if (fwrite(s->buf + r*s->chunk,s->bfill[r],1,s->file) != 1)
+    { fprintf(stderr,"%s: Cannot write spill file in %s (disk full?)\n",Prog_Name,SORT_PATH);
+      exit (1);
+    }
+  if (s->nchunk == s->maxchunk)
+    { s->maxchunk = 1.2*s->maxchunk + 100;
+      s->chunks   = (Spill_Chunk *) Realloc(s->chunks,sizeof(Spill_Chunk)*s->maxchunk,
+                                            "Reallocating spill chunk list");
+      if (s->chunks == NULL)
+        exit (1);
+    }
+  c = s->chunks + s->nchunk++;
+  c->round = r;
+  c->off   = s->flen;
+  c->len   = s->bfill[r];
+  s->flen    += s->bfill[r];
+  s->bfill[r] = 0;
+}
+
+static inline void spill_pair(Spill *s, int r, uint8 *pair, int len)
+{ if (s->bfill[r] + len > s->chunk)
+    spill_flush(s,r);
+  memcpy(s->buf + r*s->chunk + s->bfill[r],pair,len);
+  s->bfill[r] += len;
+}
+
 typedef struct
   { OneFile     *vf;       //  OneFile for input
     int64        beg;      //  Range of reads to process
@@ -1063,6 +976,9 @@ typedef struct
     uint8       *ctype;
     uint8       *array;
     int64       *bptr;
+    Spill       *spill;    //  If not NULL then spill pairs to the round of their 1st byte
+    int         *round;
+    int          nround;
   } Load_Arg;
 
 static void *load_thread(void *arg)
@@ -1079,14 +995,23 @@ static void *load_thread(void *arg)
   int       rclen = parm->rclen;
   uint8    *array = parm->array;
   int64    *bptr  = parm->bptr;
+  Spill    *spill = parm->spill;
+  int      *round = parm->round;
 
   uint32 *dcode;
   uint8  *bcode, *fqvs;
   int64   o;
   uint32  v, c, p, bar, byte;
-  uint8  *aptr;
+  uint8  *aptr, *rbuf;
   int     t;
 
+  rbuf = NULL;
+  if (spill != NULL)
+    { rbuf = (uint8 *) Malloc(fclen+parm->fqlen+rclen+parm->rqlen,"Allocating pair buffer");
+      if (rbuf == NULL)
+        exit (1);
+    }
+
   fqvs  = vf->info['Q']->buffer;
   bcode = (uint8 *)  (vf->codecBuf);
   dcode = (uint32 *) (vf->codecBuf);
@@ -1115,7 +1040,10 @@ static void *load_thread(void *arg)
         }
 
       byte = *bcode;
-      aptr = array + bptr[byte];
+      if (spill != NULL)
+        aptr = rbuf;
+      else
+        aptr = array + bptr[byte];
 
       memcpy(aptr,bcode,fclen);
       aptr += fclen;
@@ -1130,7 +1058,10 @@ static void *load_thread(void *arg)
       oneReadLine(vf);
       aptr = Compress_QV(aptr,rlen,fqvs,qbits,map);
 
-      bptr[byte] = aptr - array;
+      if (spill != NULL)
+        spill_pair(spill,round[byte],rbuf,aptr-rbuf);
+      else
+        bptr[byte] = aptr - array;
 
       o += 2;
       if (o >= end)
@@ -1141,10 +1072,90 @@ static void *load_thread(void *arg)
         oneReadLine(vf);
     }
 
+  if (spill != NULL)
+    { int r;
+
+      for (r = 0; r < parm->nround; r++)
+        spill_flush(spill,r);
+      free(spill->buf);
+      free(spill->bfill);
+      spill->buf = NULL;
+    }
+  free(rbuf);
+
   return (NULL);
 }
 
 
+/****************************************************************************************
+ *
+ *  External memory mode: thread to load the pairs of a round from the chunks of the round
+ *    in its spill file into the round's array, at the same relative places they would have
+ *    in the full array
+ *
+ *****************************************************************************************/
+
+typedef struct
+  { Spill       *spill;    //  Spill file of this thread
+    int          round;
+    int64        rbeg;     //  Offset of the round in the full array
+    int64       *bptr;     //  Fingers of this thread into the full array
+    uint8       *array;    //  Array for the round
+    int          reclen;
+  } Fill_Arg;
+
+static void *fill_thread(void *arg)
+{ Fill_Arg *parm   = (Fill_Arg *) arg;
+  Spill    *spill  = parm->spill;
+  int64     rbeg   = parm->rbeg;
+  int64    *bptr   = parm->bptr;
+  uint8    *array  = parm->array;
+  int       reclen = parm->reclen;
+
+  Spill_Chunk *c;
+  uint8       *buf, *r;
+  int          k;
+
+  buf = (uint8 *) Malloc(spill->chunk,"Allocating spill read buffer");
+  if (buf == NULL)
+    exit (1);
+
+  for (k = 0, c = spill->chunks; k < spill->nchunk; k++, c++)
+    { if (c->round != parm->round)
+        continue;
+      if (fseeko(spill->file,c->off,SEEK_SET) != 0 || fread(buf,c->len,1,spill->file) != 1)
+        { fprintf(stderr,"%s: Cannot read spill file in %s\n",Prog_Name,SORT_PATH);
+          exit (1);
+        }
+      for (r = buf; r < buf + c->len; r += reclen)
+        { memcpy(array + (bptr[*r]-rbeg),r,reclen);
+          bptr[*r] += reclen;
+        }
+    }
+
+  free(buf);
+
+  return (NULL);
+}
+
+static FILE *spill_file()
+{ char *name;
+  FILE *f;
+  int   fd;
+
+  name = Strdup(Catenate(SORT_PATH,"/","VGPcloud.XXXXXX",""),"Allocating spill file name");
+  fd   = mkstemp(name);
+  if (fd < 0 || (f = fdopen(fd,"w+")) == NULL)
+    { fprintf(stderr,"%s: Cannot create spill file in %s\n",Prog_Name,SORT_PATH);
+      exit (1);
+    }
+  unlink(name);
+  free(name);
+  setvbuf(f,NULL,_IONBF,0);
+  return (f);
+}
+
+
 /****************************************************************************************
  *
  *  Thread to output sorted array of compressed pairs into a .10x file
@@ -1159,9 +1170,23 @@ typedef struct
     uint8       *inv;
     int          flen, rlen;
     int          reclen;
-    uint8       *array;
+    uint8       *array;    //  Sorted pairs [off,off+nrec) of the full array
+    int64        off;
+    int64        nrec;
+    uint32       last;     //  Bar-code of pair off-1 if off > 0
   } Out_Arg;
 
+  //  Does thread segment [beg,end) have pairs in [off,off+nrec), or start there if empty?
+
+static int in_round(Out_Arg *parm, int last_round)
+{ int64 top = parm->off + parm->nrec;
+
+  if (parm->beg < parm->end)
+    return (parm->beg < top && parm->end > parm->off);
+  else
+    return (parm->beg >= parm->off && (parm->beg < top || last_round));
+}
+
 static void *output_thread(void *arg)
 { Out_Arg  *parm   = (Out_Arg *) arg;
   OneFile  *vg     = parm->vg;
@@ -1173,6 +1198,7 @@ static void *output_thread(void *arg)
   int       rlen   = parm->rlen;
   int       reclen = parm->reclen;
   uint8    *array  = parm->array;
+  int64     off    = parm->off;
 
   uint8  qmask = (1<<qbits)-1;
   char  *data;
@@ -1181,7 +1207,10 @@ static void *output_thread(void *arg)
   uint32 code, last;
   uint8 *aptr;
   OneInfo *ls, *lx;
-  int    i;
+  int64  i, lo, hi;
+
+  lo = (beg > off ? beg : off);
+  hi = (end < off+parm->nrec ? end : off+parm->nrec);
 
   data = Malloc(2*(flen+rlen),"Allocating decompression buffers");
   forw = data;
@@ -1192,25 +1221,29 @@ static void *output_thread(void *arg)
   lx = vg->info['&'];
   ls = vg->info['S'];
 
-  if (lx->buffer != NULL)
-    { fprintf(stderr,"Surprised\n"); fflush(stdout);
-      free(lx->buffer);
-    }
-  lx->buffer  = Malloc((end-beg)*sizeof(I64),"Sequence index setup");
-  lx->bufSize = end-beg; 
+  if (lo == beg)       //  Start of this thread's segment (in the round that contains it)
+    { if (lx->buffer != NULL)
+        { fprintf(stderr,"Surprised\n"); fflush(stdout);
+          free(lx->buffer);
+        }
+      lx->buffer  = Malloc((end-beg)*sizeof(I64),"Sequence index setup");
+      lx->bufSize = end-beg; 
 
-  if ( ! vg->isLastLineBinary)      // terminate previous ascii line
-    fputc ('\n', vg->f);
-  vg->byte = ftello (vg->f);
-  vg->isLastLineBinary = true;
+      if ( ! vg->isLastLineBinary)      // terminate previous ascii line
+        fputc ('\n', vg->f);
+      vg->byte = ftello (vg->f);
+      vg->isLastLineBinary = true;
+    }
 
-  aptr = array + beg*reclen;
-  if (beg == 0)
+  aptr = array + (lo-off)*reclen;
+  if (lo == 0)
     last = *((uint32 *) array) - 1;
-  else
+  else if (lo > off)
     last = *((uint32 *) (aptr-reclen));
+  else
+    last = parm->last;
 
-  for (i = beg; i < end; i++)
+  for (i = lo; i < hi; i++)
     { code = *((uint32 *) aptr);
 
       aptr = Uncompress_SEQ(aptr,forw,flen);
@@ -1304,6 +1337,8 @@ int main(int argc, char *argv[])
 
     NTHREADS  = 4;
     VALID     = 100;
+    MEMORY    = 0;
+    SORT_PATH = "/tmp";
 
     j = 1;
     for (i = 1; i < argc; i++)
@@ -1318,6 +1353,16 @@ int main(int argc, char *argv[])
           case 'T':
             ARG_POSITIVE(NTHREADS,"Number of threads")
             break;
+          case 'M':
+            { int gb;
+
+              ARG_POSITIVE(gb,"Memory limit (GB)")
+              MEMORY = gb * 1073741824ll;
+            }
+            break;
+          case 'P':
+            SORT_PATH = argv[i]+2;
+            break;
         }
       else
         argv[j++] = argv[i];
@@ -1333,6 +1378,8 @@ int main(int argc, char *argv[])
         fprintf(stderr,"      -H: Display histogram of all bar code counts.\n");
         fprintf(stderr,"      -t: Threshold for valid bar-codes.\n");
         fprintf(stderr,"      -T: Use -T threads.\n");
+        fprintf(stderr,"      -M: Sort pairs in at most -M GB, in rounds spilling to disk.\n");
+        fprintf(stderr,"      -P: Directory for spill files.\n");
  
         exit (1);
       }
@@ -1712,13 +1759,25 @@ int main(int argc, char *argv[])
 
 
   //  Pass 2: Correct bar-codes when possible, build compressed pairs in a mem-mapped array in
-  //             sorted order of the 1st byte
+  //             sorted order of the 1st byte.  If the array would exceed MEMORY, then the
+  //             1st byte buckets are divided into rounds of at most 7/8ths of MEMORY bytes
+  //             (if possible), each thread writes its pairs to a spill file in chunks per round
+  //             from buffers taking the other 1/8th, and then each round is loaded, sorted,
+  //             and output in turn.  A round's array is exactly the part of
+  //             the full array it covers, so the output is the same.
 
   { int64  asize;
     uint8 *array;
     int    fclen, rclen;
     int    fqlen, rqlen;
     int    reclen;
+    int64  bsize[256];     //  Size in bytes of each 1st byte bucket
+    int    round[256];     //  Round in which each bucket is sorted
+    int64  rbeg[257];      //  Offset in the full array of each round
+    int    nround;
+    int64  rmax;           //  Size of the largest round
+    int64  limit;          //  Max. bytes for a round
+    Spill *spill;          //  [NTHREADS] spill files when nround > 1
 
     fclen  = (flen*2+7)/8; 
     rclen  = (rlen*2+7)/8; 
@@ -1727,30 +1786,87 @@ int main(int argc, char *argv[])
     reclen = fclen + fqlen + rclen + rqlen;
     asize  = reclen*ngood;
 
+    { int i, j;
+
+      for (i = NTHREADS*256-1; i >= 0; i--)
+        bucks[i] *= reclen;
+
+      for (j = 0; j < 255; j++)
+        bsize[j] = bucks[j+1] - bucks[j];
+      bsize[255] = asize - bucks[255];
+
+      limit = MEMORY;
+      while (1)
+        { nround  = 0;
+          rbeg[0] = 0;
+          for (j = 0; j < 256; j++)
+            { if (limit > 0 && (bucks[j]+bsize[j]) - rbeg[nround] > limit && bucks[j] > rbeg[nround])
+                rbeg[++nround] = bucks[j];
+              round[j] = nround;
+            }
+          rbeg[++nround] = asize;
+          if (nround == 1 || limit < MEMORY)
+            break;
+          limit = MEMORY - MEMORY/8;    //  Spilling, so keep 1/8th for the spill buffers
+        }
+
+      rmax = 0;
+      for (i = 0; i < nround; i++)
+        if (rbeg[i+1]-rbeg[i] > rmax)
+          rmax = rbeg[i+1]-rbeg[i];
+    }
+
     if (VERBOSE)
       { fprintf(stderr,"  Building compressed array of read pairs with valid bar-codes\n");
         fprintf(stderr,"    sorted on their 1st byte in a second scan of file\n");
         fprintf(stderr,"    Memory-mapped array size is %.1fGB (%d bytes/pair) ...\n",
                        asize/1073741824.,reclen);
+        if (nround > 1)
+          fprintf(stderr,"    Spilling to %s to sort in %d rounds of at most %.1fGB ...\n",
+                         SORT_PATH,nround,rmax/1073741824.);
         fflush(stderr);
       }
 
-    array = (uint8 *) mmap(NULL,asize,PROT_READ | PROT_WRITE,MAP_ANON | MAP_PRIVATE,-1,0);
+    array = (uint8 *) mmap(NULL,rmax,PROT_READ | PROT_WRITE,MAP_ANON | MAP_PRIVATE,-1,0);
     if (array == MAP_FAILED)
       { fprintf(stderr,"%s: Cannot create memory map\n",Prog_Name);
         exit (1);
       }
   
-    madvise(array, asize, POSIX_MADV_WILLNEED | POSIX_MADV_SEQUENTIAL);
+    madvise(array, rmax, POSIX_MADV_WILLNEED | POSIX_MADV_SEQUENTIAL);
+
+    spill = NULL;
+    if (nround > 1)
+      { int64 chunk;
+        int   i, r;
+
+        chunk = ((MEMORY/8) / (NTHREADS*nround)) / reclen * reclen;
+        if (chunk < reclen)
+          chunk = reclen;
+        spill = (Spill *) Malloc(sizeof(Spill)*NTHREADS,"Allocating spill files");
+        if (spill == NULL)
+          exit (1);
+        for (i = 0; i < NTHREADS; i++)
+          { spill[i].file     = spill_file();
+            spill[i].flen     = 0;
+            spill[i].chunk    = chunk;
+            spill[i].buf      = (uint8 *) Malloc(chunk*nround,"Allocating spill buffers");
+            spill[i].bfill    = (int64 *) Malloc(sizeof(int64)*nround,"Allocating spill buffers");
+            if (spill[i].buf == NULL || spill[i].bfill == NULL)
+              exit (1);
+            for (r = 0; r < nround; r++)
+              spill[i].bfill[r] = 0;
+            spill[i].nchunk   = 0;
+            spill[i].maxchunk = 0;
+            spill[i].chunks   = NULL;
+          }
+      }
 
     { Load_Arg  parm[NTHREADS];
       pthread_t threads[NTHREADS];
 
       int i;
 
-      for (i = NTHREADS*256-1; i >= 0; i--)
-        bucks[i] *= reclen;
-
       for (i = 0; i < NTHREADS; i++)
         { parm[i].vf     = vf+i;
           parm[i].beg    = (npairs * i) / NTHREADS;
@@ -1767,6 +1883,9 @@ int main(int argc, char *argv[])
           parm[i].fqlen  = fqlen;
           parm[i].rqlen  = rqlen;
           parm[i].array  = array;
+          parm[i].spill  = (spill == NULL ? NULL : spill + i);
+          parm[i].round  = round;
+          parm[i].nround = nround;
 #ifdef DEBUG
           load_thread(parm+i);
 #else
@@ -1782,46 +1901,29 @@ int main(int argc, char *argv[])
       free(ctype);
 
       if (VERBOSE)
-        { fprintf(stderr,"    Fill & 1st byte sort complete.\n");
-          fprintf(stderr,"  Commencing MSD sort of remaining 3 bytes ...\n");
+        { if (nround > 1)
+            fprintf(stderr,"    Spill complete.\n");
+          else
+            fprintf(stderr,"    Fill & 1st byte sort complete.\n");
           fflush(stderr);
         }
     }
-    //  External sort on remaining 3 bytes of bar-code (1st 4 bytes of each record)
-
-    { int64 *nucks = bucks + (NTHREADS-1)*256;
-      int64  x, y;
-      int    i;
-
-      x = 0;
-      for (i = 0; i < 256; i++)
-        { y = nucks[i];
-          bucks[i] = y-x;
-          x = y;
-        }
 
-      MSD_Sort(array,ngood,reclen,reclen,4,bucks,NTHREADS);
+    //  Open the output <input>.10x now as it is written a round at a time
 
-      free(bucks);
-    }
-
-    //  Output clouds to <input>.10x trimming 1st 23bp of forward reads.
-
-    { Out_Arg   parm[NTHREADS];
-      pthread_t threads[NTHREADS];
-      OneFile  *vg;
-      char     *pwd, *root, *gname;
-      int       i;
+    { Out_Arg      parm[NTHREADS];
+      pthread_t    threads[NTHREADS];
+      MSD_Context *ctx;
+      OneFile     *vg;
+      char        *pwd, *root, *gname;
+      int64        part[256];
+      uint32       plast;
+      int          i, j, k;
 
       pwd   = PathTo(argv[1]);
       root  = Root(argv[1],".irp");
       gname = Strdup(Catenate(pwd,"/",root,".10x"),"Allocating full path name");
 
-      if (VERBOSE)
-        { fprintf(stderr,"  Final scan to produce cloud grouped pairs in %s.10x ...\n",root);
-          fflush(stderr);
-        }
-
       vg = oneFileOpenWriteNew(gname,schema,"x10",true,NTHREADS);
       if (vg == NULL)
         { fprintf(stderr,"%s: Cannot open %s.10x for writing\n",Prog_Name,root);
@@ -1829,7 +1931,6 @@ int main(int argc, char *argv[])
         }
 
       free(gname);
-      free(root);
       free(pwd);
 
       oneInheritProvenance(vg,vf);
@@ -1839,16 +1940,6 @@ int main(int argc, char *argv[])
 
       oneFileClose(vf);
 
-      if (VERBOSE)
-        { if (NTHREADS > 1)
-            fprintf(stderr,"  Producing .10x segments in parallel\n");
-          else
-            fprintf(stderr,"  Producing .10x segments\n");
-          fflush(stderr);
-        }
-
-        //  Generate the data lines in parallel threads
-
       for (i = 0; i < NTHREADS; i++)
         { parm[i].vg     = vg+i;
           parm[i].beg    = (ngood * i) / NTHREADS;
@@ -1861,19 +1952,100 @@ int main(int argc, char *argv[])
           parm[i].array  = array;
         }
 
+      ctx   = New_MSD_Context(reclen,reclen,0,4,NTHREADS);
+      plast = 0;
+
+      for (k = 0; k < nround; k++)
+        { int64 nrec = (rbeg[k+1]-rbeg[k])/reclen;
+
+          //  Load the round from the spill files of each thread
+
+          if (nround > 1)
+            { Fill_Arg fparm[NTHREADS];
+
+              if (VERBOSE)
+                { fprintf(stderr,"  Round %d: loading ",k+1);
+                  Print_Number(nrec,0,stderr);
+                  fprintf(stderr," pairs\n");
+                  fflush(stderr);
+                }
+
+              for (i = 0; i < NTHREADS; i++)
+                { fparm[i].spill  = spill + i;
+                  fparm[i].round  = k;
+                  fparm[i].rbeg   = rbeg[k];
+                  fparm[i].bptr   = bucks + i*256;
+                  fparm[i].array  = array;
+                  fparm[i].reclen = reclen;
+                  pthread_create(threads+i,NULL,fill_thread,fparm+i);
+                }
+
+              for (i = 0; i < NTHREADS; i++)
+                pthread_join(threads[i],NULL);
+            }
+
+          //  Sort on remaining 3 bytes of bar-code (1st 4 bytes of each record)
+
+          if (VERBOSE)
+            { fprintf(stderr,"  Commencing MSD sort of remaining 3 bytes ...\n");
+              fflush(stderr);
+            }
+
+          for (j = 0; j < 256; j++)
+            part[j] = (round[j] == k ? bsize[j] : 0);
+
+          MSD_Sort_Context(ctx,array,nrec,part);
+
+          //  Output clouds trimming 1st 23bp of forward reads.
+
+          if (VERBOSE)
+            { if (k == 0)
+                fprintf(stderr,"  Final scan to produce cloud grouped pairs in %s.10x ...\n",root);
+              if (NTHREADS > 1)
+                fprintf(stderr,"  Producing .10x segments in parallel\n");
+              else
+                fprintf(stderr,"  Producing .10x segments\n");
+              fflush(stderr);
+            }
+
+            //  Generate the data lines in parallel threads
+
+          for (i = 0; i < NTHREADS; i++)
+            { parm[i].off  = rbeg[k]/reclen;
+              parm[i].nrec = nrec;
+              parm[i].last = plast;
+            }
+
 #ifdef DEBUG_OUT
-      for (i = 0; i < NTHREADS; i++)
-        { fprintf(stderr,"Thread %d\n",i); fflush(stderr);
-          output_thread(parm+i);
-        }
+          for (i = 0; i < NTHREADS; i++)
+            if (in_round(parm+i,k == nround-1))
+              { fprintf(stderr,"Thread %d\n",i); fflush(stderr);
+                output_thread(parm+i);
+              }
 #else
-      for (i = 0; i < NTHREADS; i++)
-        pthread_create(threads+i,NULL,output_thread,parm+i);
+          for (i = 0; i < NTHREADS; i++)
+            if (in_round(parm+i,k == nround-1))
+              pthread_create(threads+i,NULL,output_thread,parm+i);
 
-      for (i = 0; i < NTHREADS; i++)
-        pthread_join(threads[i],NULL);
+          for (i = 0; i < NTHREADS; i++)
+            if (in_round(parm+i,k == nround-1))
+              pthread_join(threads[i],NULL);
 #endif
 
+          if (nrec > 0)
+            plast = *((uint32 *) (array + (nrec-1)*reclen));
+        }
+
+      Free_MSD_Context(ctx);
+      free(bucks);
+      if (spill != NULL)
+        for (i = 0; i < NTHREADS; i++)
+          { fclose(spill[i].file);
+            free(spill[i].chunks);
+          }
+      free(spill);
+      free(root);
+
       if (VERBOSE)
         { fprintf(stderr,"  Cat'ing .10x segments\n");
           fflush(stderr);
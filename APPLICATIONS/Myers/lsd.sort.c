@@ -18,37 +18,36 @@
 #include <math.h>
 #include <pthread.h>
 
-#include "DB.h"
+#include "gene_core.h"
 #include "lsd.sort.h"
 
-typedef unsigned char uint8;
-typedef long long     int64;
-
 #undef TEST_LSORT
 
-static int    RSIZE;    //  Span between records
-static int    DSIZE;    //  Size of record
-
-static int    NTHREADS;       //  # of threads to use
-static int    VERBOSE;        //  Print each byte as it is sorted
+static int    NTHREADS = 1;   //  Defaults for LSD_Sort, set by Set_LSD_Params
+static int    VERBOSE  = 0;
 
 void Set_LSD_Params(int nthread, int verbose)
 { NTHREADS = nthread;
   VERBOSE  = verbose;
 }
 
-//  Global variables for every "lex_thread"
+//  Variables shared by every "lex_thread" of a sort, so concurrent sorts do not interfere
 
-static int      LEX_byte;   //  Current byte to sort on
-static int      LEX_next;   //  Next byte to sort on (if >= 0)
-static int64    LEX_zdiv;   //  Size of thread segments (in bytes)
-static uint8   *LEX_src;    //  Source data goes to ...
-static uint8   *LEX_trg;    //  Target data
+typedef struct
+  { int      RSIZE;      //  Span between records
+    int      DSIZE;      //  Size of record
+    int      LEX_byte;   //  Current byte to sort on
+    int      LEX_next;   //  Next byte to sort on (if >= 0)
+    int64    LEX_zdiv;   //  Size of thread segments (in bytes)
+    uint8   *LEX_src;    //  Source data goes to ...
+    uint8   *LEX_trg;    //  Target data
+  } Lex_Ctx;
 
 //  Thread control record
 
 typedef struct
-  { int64  beg;           //  Sort [beg,end) of LEX_src
+  { Lex_Ctx *ctx;
+    int64  beg;           //  Sort [beg,end) of LEX_src
     int64  end;
     int    check[256];    //  Not all of bucket will go to the same thread in the next cycle?
     int    next[256];     //  Thread assignment for next cycle (updated if check true)
@@ -60,15 +59,28 @@ typedef struct
 
 //  Threaded sorting pass
 
+//  Records of 4 or 8 bytes are moved as single words, as for the uint32 codes of VGPcloud
+
+#define MOVE(trg,src)				\
+  if (DSIZE == 8)				\
+    *((uint64 *) (trg)) = *((uint64 *) (src));	\
+  else if (DSIZE == 4)				\
+    *((uint32 *) (trg)) = *((uint32 *) (src));	\
+  else						\
+    memcpy(trg,src,DSIZE);
+
 static void *lex_thread(void *arg)
 { Lex_Arg *data   = (Lex_Arg *) arg;
+  Lex_Ctx *ctx    = data->ctx;
   int64   *sptr   = data->sptr;
   int64   *tptr   = data->tptr;
-  uint8   *src    = LEX_src;
-  uint8   *dig    = LEX_src + LEX_byte;
-  uint8   *nig    = LEX_src + LEX_next;
-  uint8   *trg    = LEX_trg;
-  int64    zdiv   = LEX_zdiv;
+  uint8   *src    = ctx->LEX_src;
+  uint8   *dig    = ctx->LEX_src + ctx->LEX_byte;
+  uint8   *nig    = ctx->LEX_src + ctx->LEX_next;
+  uint8   *trg    = ctx->LEX_trg;
+  int64    zdiv   = ctx->LEX_zdiv;
+  int      RSIZE  = ctx->RSIZE;
+  int      DSIZE  = ctx->DSIZE;
   int     *check  = data->check;
   int     *next   = data->next;
   int64   *thresh = data->thresh;
@@ -77,19 +89,19 @@ static void *lex_thread(void *arg)
   uint8       d;
 
   n = data->end;
-  if (LEX_next < 0)
+  if (ctx->LEX_next < 0)
     for (i = data->beg; i < n; i += RSIZE)
       { d = dig[i];
         x = tptr[d];
         tptr[d] += RSIZE;
-        memcpy(trg+x,src+i,DSIZE);
+        MOVE(trg+x,src+i)
       }
   else
     for (i = data->beg; i < n; i += RSIZE)
       { d = dig[i];
         x = tptr[d];
         tptr[d] += RSIZE;
-        memcpy(trg+x,src+i,DSIZE);
+        MOVE(trg+x,src+i)
         if (check[d])
           { if (x >= thresh[d])
               { next[d]   += 0x100;
@@ -106,7 +118,8 @@ static void *lex_thread(void *arg)
 static void *lexbeg_thread(void *arg)
 { Lex_Arg    *data  = (Lex_Arg *) arg;
   int64      *tptr  = data->tptr;
-  uint8      *dig   = LEX_src + LEX_byte;
+  uint8      *dig   = data->ctx->LEX_src + data->ctx->LEX_byte;
+  int         RSIZE = data->ctx->RSIZE;
 
   int64       i, n;
 
@@ -121,32 +134,43 @@ static void *lexbeg_thread(void *arg)
 //    Return a pointer to the array containing the final result.
 
 void *LSD_Sort(int64 nelem, void *src, void *trg, int rsize, int dsize, int *bytes)
+{ return (LSD_Sort_Threads(nelem,src,trg,rsize,dsize,bytes,NTHREADS,VERBOSE)); }
+
+void *LSD_Sort_Threads(int64 nelem, void *src, void *trg, int rsize, int dsize, int *bytes,
+                       int NTHREADS, int VERBOSE)
 { pthread_t threads[NTHREADS];
   Lex_Arg   parmx[NTHREADS];   //  Thread control record for sorting
+  Lex_Ctx   lex, *ctx = &lex;
 
   uint8   *xch;
   int64    x, y, asize;
   int      i, j, z, b;
+  int      RSIZE;
 
   asize = nelem*rsize;
-  RSIZE = rsize;
-  DSIZE = dsize;
+  RSIZE = ctx->RSIZE = rsize;
+  ctx->DSIZE = dsize;
 
-  LEX_zdiv = ((nelem-1)/NTHREADS + 1)*RSIZE;
-  LEX_src  = (uint8 *) src;
-  LEX_trg  = (uint8 *) trg;
+  ctx->LEX_zdiv = ((nelem-1)/NTHREADS + 1)*RSIZE;
+  ctx->LEX_src  = (uint8 *) src;
+  ctx->LEX_trg  = (uint8 *) trg;
+
+  if (nelem <= 0)
+    return (src);
 
   for (i = 0; i < NTHREADS; i++)
-    parmx[i].sptr = (int64 *) alloca(NTHREADS*256*sizeof(int64));
+    { parmx[i].ctx  = ctx;
+      parmx[i].sptr = (int64 *) alloca(NTHREADS*256*sizeof(int64));
+    }
 
   //  For each requested byte b in order, radix sort
 
   for (b = 0; bytes[b] >= 0; b++)
-    { LEX_byte  = bytes[b];
-      LEX_next  = bytes[b+1];
+    { ctx->LEX_byte  = bytes[b];
+      ctx->LEX_next  = bytes[b+1];
 
       if (VERBOSE)
-        { printf("     Sorting byte %d\n",LEX_byte);
+        { printf("     Sorting byte %d\n",ctx->LEX_byte);
           fflush(stdout);
         }
 
@@ -155,7 +179,7 @@ void *LSD_Sort(int64 nelem, void *src, void *trg, int rsize, int dsize, int *byt
       x = 0;
       for (i = 0; i < NTHREADS; i++)
         { parmx[i].beg = x;
-          x = LEX_zdiv*(i+1);
+          x = ctx->LEX_zdiv*(i+1);
           if (x > asize)
             x = asize;
           parmx[i].end = x;
@@ -188,7 +212,7 @@ void *LSD_Sort(int64 nelem, void *src, void *trg, int rsize, int dsize, int *byt
         }
 
 #ifdef TEST_LSORT
-      printf("\nBUCKETS %d\n",LEX_byte);
+      printf("\nBUCKETS %d\n",ctx->LEX_byte);
       for (j = 0; j < 255; j++)
         { printf(" %3d:",j);
           for (i = 0; i < NTHREADS; i++)
@@ -210,7 +234,7 @@ void *LSD_Sort(int64 nelem, void *src, void *trg, int rsize, int dsize, int *byt
       { int64 thr;
         int   nxt;
 
-        thr = LEX_zdiv;
+        thr = ctx->LEX_zdiv;
         nxt = 0;
         x = 0;
         for (j = 0; j < 256; j++)
@@ -225,7 +249,7 @@ void *LSD_Sort(int64 nelem, void *src, void *trg, int rsize, int dsize, int *byt
                 { parmx[i].check[j]  = 1;
                   parmx[i].thresh[j] = thr;
                   while (x >= thr)
-                    { thr += LEX_zdiv;
+                    { thr += ctx->LEX_zdiv;
                       nxt += 0x100;
                     }
                 }
@@ -240,34 +264,34 @@ void *LSD_Sort(int64 nelem, void *src, void *trg, int rsize, int dsize, int *byt
       for (i = 1; i < NTHREADS; i++)
         pthread_join(threads[i],NULL);
 
-      xch     = LEX_src;
-      LEX_src = LEX_trg;
-      LEX_trg = xch;
+      xch          = ctx->LEX_src;
+      ctx->LEX_src = ctx->LEX_trg;
+      ctx->LEX_trg = xch;
 
 #ifdef TEST_LSORT
       { int64  c;
-        uint8 *psort = LEX_src-RSIZE;
+        uint8 *psort = ctx->LEX_src-RSIZE;
 
-        printf("\nLSORT %d\n",LEX_byte);
+        printf("\nLSORT %d\n",ctx->LEX_byte);
         // for (c = 0; c < 1000*RSIZE; c += RSIZE)
         for (c = 10000*RSIZE; c < 11000*RSIZE; c += RSIZE)
           { printf(" %4lld: ",c/RSIZE);
-            for (j = 0; j < DSIZE; j++)
-              printf(" %02x",LEX_src[c+j]);
+            for (j = 0; j < ctx->DSIZE; j++)
+              printf(" %02x",ctx->LEX_src[c+j]);
             printf("\n");
           }
 
         for (c = RSIZE; c < asize; c += RSIZE)
-          { for (j = LEX_byte; j >= 2; j--)
-              if (LEX_src[c+j] > psort[c+j])
+          { for (j = ctx->LEX_byte; j >= 2; j--)
+              if (ctx->LEX_src[c+j] > psort[c+j])
                 break;
-              else if (LEX_src[c+j] < psort[c+j])
+              else if (ctx->LEX_src[c+j] < psort[c+j])
                 { printf("  Order: %lld",c/RSIZE);
-                  for (x = 2; x <= LEX_byte; x++)
+                  for (x = 2; x <= ctx->LEX_byte; x++)
                     printf(" %02x",psort[c+x]);
                   printf(" vs");
-                  for (x = 2; x <= LEX_byte; x++)
-                    printf(" %02x",LEX_src[c+x]);
+                  for (x = 2; x <= ctx->LEX_byte; x++)
+                    printf(" %02x",ctx->LEX_src[c+x]);
                   printf("\n");
                   break;
                 }
@@ -276,5 +300,5 @@ void *LSD_Sort(int64 nelem, void *src, void *trg, int rsize, int dsize, int *byt
 #endif
     }
 
-  return ((void *) LEX_src);
+  return ((void *) ctx->LEX_src);
 }
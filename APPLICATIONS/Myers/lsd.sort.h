@@ -5,4 +5,10 @@ void Set_LSD_Params(int nthread, int verbose);
 
 void *LSD_Sort(long long len, void *src, void *trg, int rsize, int dsize, int *bytes);
 
+  //  As LSD_Sort but with explicit parameters and no shared state, so sorts may run
+  //    concurrently, e.g. one single threaded sort per thread
+
+void *LSD_Sort_Threads(long long len, void *src, void *trg, int rsize, int dsize, int *bytes,
+                       int nthreads, int verbose);
+
 #endif // LSD_SORT
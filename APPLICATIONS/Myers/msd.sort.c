@@ -22,23 +22,40 @@
 #define GAP1  7
 #define GAP2  3
 
-static int S_thr0, S_thr1, S_thr2;
-static int S_gap1, S_gap2;
+#define POOL_SPLIT 4    //  Buckets bigger than 1/(POOL_SPLIT*nthreads) of a sort go to the pool
 
-static int    RSIZE;
-static int    DSIZE;
-static int    KSIZE;
-static int    PSIZE;
-
-static int    COFF;
-static int64  CMAX;
+typedef struct
+  { uint8 *array;
+    int64  asize;
+    int    digit;
+  } Task;
+
+struct MSD_Context
+  { int    RSIZE;     //  Span between records
+    int    DSIZE;     //  Size of record data
+    int    KOFF;      //  Offset of key in record
+    int    KSIZE;     //  Size of key
+    int    PSIZE;     //  Bytes of record after the key
+    int    S_thr0, S_thr1, S_thr2;
+    int    S_gap1, S_gap2;
+
+    int    nthreads;
+    int64  split;     //  Buckets of at least this many bytes are offered to idle threads
+
+    pthread_mutex_t lock;    //  Task pool: a stack of buckets still to be sorted
+    pthread_cond_t  wake;
+    Task  *task;
+    int    ntask;
+    int    maxtask;
+    int    idle;      //  # of threads waiting for a task
+  };
 
 #ifdef SHOW
 
-static void print_kmer(uint8 *x)
+static void print_kmer(MSD_Context *ctx, uint8 *x)
 { int i;
-  for (i = 0; i < KSIZE; i++)
-    printf(" %02x",x[i]);
+  for (i = 0; i < ctx->KSIZE; i++)
+    printf(" %02x",x[ctx->KOFF+i]);
 }
 
 #endif
@@ -58,9 +75,12 @@ static inline void mycpy(uint8 *a, uint8 *b, int n)
 
 #ifdef DEBUG
 
-static inline void sorted(uint8 *array, int64 asize, int level)
-{ int64 p, i;
+static inline void sorted(MSD_Context *ctx, uint8 *array, int64 asize, int level)
+{ int    RSIZE = ctx->RSIZE;
+  int    KSIZE = ctx->KSIZE;
+  int64  p, i;
 
+  array += ctx->KOFF;
   for (p = RSIZE; p < asize; p += RSIZE)
     if (mycmp(array + (p-RSIZE),array + p,KSIZE) > 0)
       { printf("Not sorted %12lld: ",p);
@@ -75,40 +95,44 @@ static inline void sorted(uint8 *array, int64 asize, int level)
 
 #endif
 
+//  Records are addressed at their current key digit, and when the key is at the start of
+//    a record only the bytes from that digit on need to move as the ones before are equal.
+//    Otherwise "back" bytes before the digit are moved too, i.e. the whole record.
 
-static inline void gap_sort(uint8 *array, int asize, int gap, int cmp)
-{ int    i, j, rem;
-  uint8  temp[RSIZE];
+static inline void gap_sort(uint8 *array, int asize, int gap, int cmp, int rem, int back, int rsize)
+{ int    i, j;
+  uint8  temp[rsize];
   uint8 *garray;
 
-  rem    = cmp + PSIZE;
   garray = array + gap;
-  for (i = gap; i < asize; i += RSIZE)
+  for (i = gap; i < asize; i += rsize)
     { j = i-gap;
       if (mycmp(array+j,array+i,cmp) <= 0)
         continue;
-      mycpy(temp,array+i,rem);
-      mycpy(array+i,array+j,rem);
+      mycpy(temp,array+i-back,rem);
+      mycpy(array+i-back,array+j-back,rem);
       for(j -= gap; j >= 0; j -= gap)
-        { if (mycmp(array+j,temp,cmp) <= 0)
+        { if (mycmp(array+j,temp+back,cmp) <= 0)
             break;
-          mycpy(garray+j,array+j,rem);
+          mycpy(garray+j-back,array+j-back,rem);
         }
-      mycpy(garray+j,temp,rem);
+      mycpy(garray+j-back,temp,rem);
     }
 }
 
-static inline void shell_sort(uint8 *array, int asize, int digit)
-{ int    cmp;
+static inline void shell_sort(MSD_Context *ctx, uint8 *array, int asize, int digit)
+{ int    cmp, back, rem;
 
-  cmp    = KSIZE-digit;
-  array += digit;
+  cmp    = ctx->KSIZE-digit;
+  back   = (ctx->KOFF ? ctx->KOFF+digit : 0);
+  rem    = cmp + ctx->PSIZE + back;
+  array += ctx->KOFF + digit;
 
-  if (asize > S_thr1)
-    gap_sort(array,asize,S_gap1,cmp);
-  if (asize > S_thr2)
-    gap_sort(array,asize,S_gap2,cmp);
-  gap_sort(array,asize,RSIZE,cmp);
+  if (asize > ctx->S_thr1)
+    gap_sort(array,asize,ctx->S_gap1,cmp,rem,back,ctx->RSIZE);
+  if (asize > ctx->S_thr2)
+    gap_sort(array,asize,ctx->S_gap2,cmp,rem,back,ctx->RSIZE);
+  gap_sort(array,asize,ctx->RSIZE,cmp,rem,back,ctx->RSIZE);
 }
 
 #ifdef PERMUTE_SORT_IDEA
@@ -162,18 +186,62 @@ static inline void shell_sort(uint8 *array, int asize, int digit)
 
 #endif
 
-static void radix_sort(uint8 *array, int64 asize, int digit)
-{ int64  n, len[256];
+static void sort_bucket(MSD_Context *ctx, uint8 *array, int64 asize, int digit);
+
+//  Task pool: push a bucket for any idle thread, or get the next bucket to sort, waiting
+//    while other threads may yet push work.  Returns 0 when all threads are idle and the
+//    pool is empty, i.e. the sort is complete.
+
+static void push_task(MSD_Context *ctx, uint8 *array, int64 asize, int digit)
+{ pthread_mutex_lock(&ctx->lock);
+  if (ctx->ntask >= ctx->maxtask)
+    { ctx->maxtask = 2*ctx->maxtask + 256;
+      ctx->task    = (Task *) realloc(ctx->task,sizeof(Task)*ctx->maxtask);
+      if (ctx->task == NULL)
+        { fprintf(stderr,"%s: Out of memory (Growing sort task pool)\n",Prog_Name);
+          exit (1);
+        }
+    }
+  ctx->task[ctx->ntask].array = array;
+  ctx->task[ctx->ntask].asize = asize;
+  ctx->task[ctx->ntask].digit = digit;
+  ctx->ntask += 1;
+  pthread_cond_signal(&ctx->wake);
+  pthread_mutex_unlock(&ctx->lock);
+}
+
+static int get_task(MSD_Context *ctx, Task *t)
+{ pthread_mutex_lock(&ctx->lock);
+  __atomic_add_fetch(&ctx->idle,1,__ATOMIC_RELAXED);
+  while (ctx->ntask == 0)
+    { if (ctx->idle == ctx->nthreads)
+        { pthread_cond_broadcast(&ctx->wake);
+          pthread_mutex_unlock(&ctx->lock);
+          return (0);
+        }
+      pthread_cond_wait(&ctx->wake,&ctx->lock);
+    }
+  __atomic_sub_fetch(&ctx->idle,1,__ATOMIC_RELAXED);
+  ctx->ntask -= 1;
+  *t = ctx->task[ctx->ntask];
+  pthread_mutex_unlock(&ctx->lock);
+  return (1);
+}
+
+static void radix_sort(MSD_Context *ctx, uint8 *array, int64 asize, int digit)
+{ int    RSIZE = ctx->RSIZE;
+  int    KSIZE = ctx->KSIZE;
+  int64  n, len[256];
   int    x;
 
   { uint8 *end[256];
-    uint8 *u, *arrow = array + digit;
+    uint8 *u, *arrow = array + ctx->KOFF + digit;
     int64  o;
-    int    rems;
+    int    rems, back;
     int    e;
 
     uint8 *off[256];
-    uint8  temp[DSIZE];
+    uint8  temp[ctx->DSIZE];
     uint8 *stack[SMAX];
 
     while (1)
@@ -204,7 +272,8 @@ static void radix_sort(uint8 *array, int64 asize, int digit)
         end[x] = u += len[x];
       }
 
-    rems = DSIZE-digit;
+    back = (ctx->KOFF ? ctx->KOFF+digit : 0);
+    rems = ctx->DSIZE - (ctx->KOFF+digit) + back;
     for (x = 0; x < 256; x++)
       { uint8   *p;
         int      t, s;
@@ -233,13 +302,13 @@ static void radix_sort(uint8 *array, int64 asize, int digit)
                     }
 
                 u = stack[--s];
-                mycpy(temp,u,rems);
+                mycpy(temp,u-back,rems);
 	        while (s > 0)
                   { p = stack[--s];
-                    mycpy(u,p,rems);
+                    mycpy(u-back,p-back,rems);
                     u = p;
                   }
-                mycpy(u,temp,rems);
+                mycpy(u-back,temp,rems);
               }
           }
       }
@@ -250,114 +319,321 @@ static void radix_sort(uint8 *array, int64 asize, int digit)
   if (digit < KSIZE)
     for (x = 0; x < 256; x++)
       { n = len[x];
-        if (n > S_thr0)
-          radix_sort(array, n, digit);
-        else if (n > RSIZE)
-          shell_sort(array, n, digit);
+        if (n >= ctx->split && __atomic_load_n(&ctx->idle,__ATOMIC_RELAXED) > 0)
+          push_task(ctx,array,n,digit);
+        else
+          sort_bucket(ctx,array,n,digit);
         array += n;
       }
 }
 
-typedef struct
-  { uint8 *array;
-    int    npart;
-    int64 *parts;
-    int64  offset;
-  } Arg;
-
-static int64 *Parts;
+static void sort_bucket(MSD_Context *ctx, uint8 *array, int64 asize, int digit)
+{ if (asize > ctx->S_thr0)
+    radix_sort(ctx,array,asize,digit);
+  else if (asize > ctx->RSIZE)
+    shell_sort(ctx,array,asize,digit);
+}
 
 static void *sort_thread(void *arg) 
-{ Arg *param = (Arg *) arg;
-
-  uint8   *array = param->array;
-  int      npart = param->npart;
-  int64   *parts = param->parts;
-  int64    off;
-  int      x;
-
-  if (KSIZE <= 0)
-    return (NULL);
-
-  off = param->offset;
-  for (x = 0; x < npart; x++)
-    { if (parts[x] == 0)
-        continue;
+{ MSD_Context *ctx = (MSD_Context *) arg;
+  Task         t;
 
+  while (get_task(ctx,&t))
+    {
 #ifdef DEBUG
-      printf("Thread %3ld: %12lld - %12lld\n",x+(parts-Parts),off,off+parts[x]);
+      printf("Bucket %12lld - %12lld at digit %d\n",
+             (int64) t.array,(int64) (t.array+t.asize),t.digit);
 #endif
+      radix_sort(ctx,t.array,t.asize,t.digit);
+    }
 
-      radix_sort(array + off, parts[x], 1);
+  return (NULL);
+}
 
-      off += parts[x];
+MSD_Context *New_MSD_Context(int rsize, int dsize, int koff, int ksize, int nthreads)
+{ MSD_Context *ctx;
+
+  if (koff + ksize > dsize || dsize > rsize || nthreads < 1)
+    { fprintf(stderr,"%s: Sort key [%d,%d) does not lie in record data [0,%d) of %d bytes\n",
+                     Prog_Name,koff,koff+ksize,dsize,rsize);
+      exit (1);
     }
 
-  return (NULL);
+  ctx = (MSD_Context *) Malloc(sizeof(MSD_Context),"Allocating sort context");
+  if (ctx == NULL)
+    exit (1);
+
+  ctx->RSIZE = rsize;
+  ctx->DSIZE = dsize;
+  ctx->KOFF  = koff;
+  ctx->KSIZE = ksize;
+  ctx->PSIZE = rsize - (koff+ksize);
+
+  ctx->S_thr0 = THR0*rsize;
+  ctx->S_thr1 = THR1*rsize;
+  ctx->S_thr2 = THR2*rsize;
+  ctx->S_gap1 = GAP1*rsize;
+  ctx->S_gap2 = GAP2*rsize;
+
+  ctx->nthreads = nthreads;
+  ctx->task     = NULL;
+  ctx->ntask    = 0;
+  ctx->maxtask  = 0;
+  ctx->idle     = 0;
+  pthread_mutex_init(&ctx->lock,NULL);
+  pthread_cond_init(&ctx->wake,NULL);
+
+  return (ctx);
 }
 
-void MSD_Sort(uint8 *array, int64 nelem, int rsize, int dsize, int ksize, int64 *part, int nthreads)
-{ pthread_t   threads[nthreads];
-  Arg         parms[nthreads];
-
-  int   x, n, beg;
-  int64 sum, thr, off;
-  int64 asize;
-
-  asize    = nelem*rsize;
-
-  Parts    = part;
-  RSIZE    = rsize;
-  DSIZE    = dsize;
-  KSIZE    = ksize;
-  PSIZE    = rsize - ksize;
-
-  COFF     = KSIZE-2;
-  CMAX     = RSIZE*0x7fff;
-
-  S_thr0 = THR0*RSIZE;
-  S_thr1 = THR1*RSIZE;
-  S_thr2 = THR2*RSIZE;
-  S_gap1 = GAP1*RSIZE;
-  S_gap2 = GAP2*RSIZE;
-
-  n   = 0;
-  thr = asize / nthreads;
-  off = 0;
-  sum = 0;
-  beg = 0;
-  for (x = 0; x < 256; x++)
-    { sum += part[x];
-      if (sum >= thr)
-        { parms[n].array  = array;
-          parms[n].npart  = (x+1) - beg;
-          parms[n].parts  = Parts + beg;
-          parms[n].offset = off;
-          n  += 1;
-          thr = (asize * (n+1))/nthreads;
-          beg = x+1;
-          off = sum;
+void Free_MSD_Context(MSD_Context *ctx)
+{ pthread_mutex_destroy(&ctx->lock);
+  pthread_cond_destroy(&ctx->wake);
+  free(ctx->task);
+  free(ctx);
+}
+
+//  Seed the pool with the top level buckets, smallest first so the largest are taken
+//    first, then sort with nthreads threads until the pool is empty and all are idle.
+
+static void pool_sort(MSD_Context *ctx, uint8 *array, int64 asize, int64 *part, int digit)
+{ int       nthreads = ctx->nthreads;
+  pthread_t threads[nthreads];
+  int64     off[256];
+  int       order[256];
+  int       x, y, z;
+
+  ctx->split = asize / (POOL_SPLIT*nthreads);
+  if (ctx->split <= ctx->S_thr0)      //  So pooled buckets are radix sorted as before
+    ctx->split = ctx->S_thr0+1;
+  ctx->ntask = 0;
+  ctx->idle  = 0;
+
+  if (part == NULL)
+    push_task(ctx,array,asize,digit);
+  else
+    { off[0] = 0;
+      for (x = 1; x < 256; x++)
+        off[x] = off[x-1] + part[x-1];
+      for (x = 0; x < 256; x++)
+        { z = x;
+          for (y = x; y > 0 && part[order[y-1]] > part[z]; y--)
+            order[y] = order[y-1];
+          order[y] = z;
+        }
+      for (x = 0; x < 256; x++)
+        { z = order[x];
+          if (part[z] > ctx->RSIZE)
+            push_task(ctx,array+off[z],part[z],digit);
         }
     }
 
 #ifdef DEBUG
-  for (x = 0; x < nthreads; x++)
-    sort_thread(parms+x);
+  ctx->nthreads = 1;
+  sort_thread(ctx);
+  ctx->nthreads = nthreads;
 #else
   for (x = 1; x < nthreads; x++)
-    pthread_create(threads+x,NULL,sort_thread,parms+x);
+    pthread_create(threads+x,NULL,sort_thread,ctx);
 
-  sort_thread(parms);
+  sort_thread(ctx);
 
   for (x = 1; x < nthreads; x++)
     pthread_join(threads[x],NULL);
 #endif
+}
+
+void MSD_Sort_Context(MSD_Context *ctx, uint8 *array, int64 nelem, int64 *part)
+{ int64 asize = nelem*ctx->RSIZE;
+
+  if (ctx->KSIZE <= 0 || nelem <= 1)
+    return;
+
+  if (part == NULL)
+    pool_sort(ctx,array,asize,NULL,0);
+  else if (ctx->KSIZE > 1)
+    pool_sort(ctx,array,asize,part,1);
 
 #ifdef DEBUG
-  sum = 0;
+  sorted(ctx,array,asize,0);
+#endif
+}
+
+void MSD_Sort(uint8 *array, int64 nelem, int rsize, int dsize, int ksize, int64 *part, int nthreads)
+{ MSD_Context *ctx;
+
+  ctx = New_MSD_Context(rsize,dsize,0,ksize,nthreads);
+  MSD_Sort_Context(ctx,array,nelem,part);
+  Free_MSD_Context(ctx);
+}
+
+
+/*******************************************************************************************
+ *
+ *  SPILL MODE: distribute records to 256 bucket files on a key byte, then sort each bucket
+ *    in memory in turn, re-spilling on the next key byte any bucket too big for memory.
+ *
+ ********************************************************************************************/
+
+struct MSD_Spill
+  { MSD_Context *ctx;
+    char        *dir;
+    int64        memory;      //  Bytes available to sort a bucket
+    int          digit;       //  Key byte that buckets are split on
+    int64        bufsize;     //  Bytes of in-memory buffer per bucket
+    uint8       *buf;         //  [256][bufsize] bucket buffers
+    int64        fill[256];   //  Bytes in each buffer
+    int64        count[256];  //  Records in each bucket
+    FILE        *file[256];   //  Spill file of each bucket, opened when first needed
+  };
+
+static MSD_Spill *open_spill(MSD_Context *ctx, char *dir, int64 memory, int digit)
+{ MSD_Spill *spill;
+  int64      rsize = ctx->RSIZE;
+  int        x;
+
+  spill = (MSD_Spill *) Malloc(sizeof(MSD_Spill),"Allocating sort spill");
+  if (spill == NULL)
+    exit (1);
+
+  spill->ctx     = ctx;
+  spill->dir     = dir;
+  spill->memory  = memory;
+  spill->digit   = digit;
+  spill->bufsize = ((memory/(4*256)) / rsize) * rsize;
+  if (spill->bufsize < rsize)
+    spill->bufsize = rsize;
+  spill->buf = (uint8 *) Malloc(256*spill->bufsize,"Allocating sort spill buffers");
+  if (spill->buf == NULL)
+    exit (1);
   for (x = 0; x < 256; x++)
-    { sorted(array+sum,part[x],0);
-      sum += part[x];
+    { spill->fill[x]  = 0;
+      spill->count[x] = 0;
+      spill->file[x]  = NULL;
     }
-#endif
+  return (spill);
+}
+
+MSD_Spill *Open_MSD_Spill(MSD_Context *ctx, char *dir, int64 memory)
+{ if (memory < 256*ctx->RSIZE)
+    memory = 256*ctx->RSIZE;
+  return (open_spill(ctx,dir,memory,0));
+}
+
+static void flush_bucket(MSD_Spill *spill, int x)
+{ if (spill->file[x] == NULL)
+    { char name[strlen(spill->dir) + 32];
+      int  fd;
+
+      sprintf(name,"%s/msd.sort.XXXXXX",spill->dir);
+      fd = mkstemp(name);
+      if (fd < 0)
+        { fprintf(stderr,"%s: Cannot create sort spill file in %s\n",Prog_Name,spill->dir);
+          exit (1);
+        }
+      unlink(name);
+      spill->file[x] = fdopen(fd,"w+");
+    }
+  if (fwrite(spill->buf + x*spill->bufsize,spill->fill[x],1,spill->file[x]) != 1)
+    { fprintf(stderr,"%s: Cannot write sort spill file in %s (disk full?)\n",
+                     Prog_Name,spill->dir);
+      exit (1);
+    }
+  spill->fill[x] = 0;
+}
+
+void Add_MSD_Spill(MSD_Spill *spill, uint8 *recs, int64 nelem)
+{ int    rsize   = spill->ctx->RSIZE;
+  int64  bufsize = spill->bufsize;
+  uint8 *key     = recs + spill->ctx->KOFF + spill->digit;
+  int64  i;
+  int    x;
+
+  for (i = 0; i < nelem; i++)
+    { x = key[i*rsize];
+      if (spill->fill[x] == bufsize)
+        flush_bucket(spill,x);
+      memcpy(spill->buf + (x*bufsize + spill->fill[x]),recs + i*rsize,rsize);
+      spill->fill[x]  += rsize;
+      spill->count[x] += 1;
+    }
+}
+
+//  Load each bucket into array in turn, sort it on the key bytes after the spill digit,
+//    and emit it.  A bucket larger than memory is streamed into a spill on the next digit.
+
+static int64 close_spill(MSD_Spill *spill, uint8 *array,
+                         void (*emit)(uint8 *array, int64 nelem, void *arg), void *arg)
+{ MSD_Context *ctx   = spill->ctx;
+  int64        rsize = ctx->RSIZE;
+  int64        total, n, size, got;
+  int          x;
+
+  total = 0;
+  for (x = 0; x < 256; x++)
+    { n = spill->count[x];
+      if (n == 0)
+        continue;
+      total += n;
+
+      if (n*rsize > spill->memory && spill->digit+1 < ctx->KSIZE)
+        { MSD_Spill *sub = open_spill(ctx,spill->dir,spill->memory,spill->digit+1);
+          int64      step = spill->memory / rsize;
+
+          if (spill->file[x] != NULL)
+            { rewind(spill->file[x]);
+              while ((got = fread(array,rsize,step,spill->file[x])) > 0)
+                Add_MSD_Spill(sub,array,got);
+              fclose(spill->file[x]);
+            }
+          Add_MSD_Spill(sub,spill->buf + x*spill->bufsize,spill->fill[x]/rsize);
+          close_spill(sub,array,emit,arg);
+          continue;
+        }
+
+      if (n*rsize > spill->memory)     //  All keys are equal: emit memory sized chunks
+        { int64 step = spill->memory / rsize;
+
+          rewind(spill->file[x]);
+          while ((got = fread(array,rsize,step,spill->file[x])) > 0)
+            emit(array,got,arg);
+          fclose(spill->file[x]);
+          if (spill->fill[x] > 0)
+            emit(spill->buf + x*spill->bufsize,spill->fill[x]/rsize,arg);
+          continue;
+        }
+
+      size = 0;
+      if (spill->file[x] != NULL)
+        { size = n*rsize - spill->fill[x];
+          rewind(spill->file[x]);
+          if (fread(array,size,1,spill->file[x]) != 1)
+            { fprintf(stderr,"%s: Cannot read back sort spill file in %s\n",
+                             Prog_Name,spill->dir);
+              exit (1);
+            }
+          fclose(spill->file[x]);
+        }
+      memcpy(array+size,spill->buf + x*spill->bufsize,spill->fill[x]);
+
+      if (spill->digit+1 < ctx->KSIZE && n > 1)
+        pool_sort(ctx,array,n*rsize,NULL,spill->digit+1);
+      emit(array,n,arg);
+    }
+
+  free(spill->buf);
+  free(spill);
+  return (total);
+}
+
+int64 Close_MSD_Spill(MSD_Spill *spill, void (*emit)(uint8 *array, int64 nelem, void *arg), void *arg)
+{ uint8 *array;
+  int64  total;
+
+  array = (uint8 *) Malloc(spill->memory,"Allocating sort spill bucket");
+  if (array == NULL)
+    exit (1);
+  total = close_spill(spill,array,emit,arg);
+  free(array);
+  return (total);
 }
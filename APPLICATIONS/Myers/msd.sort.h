@@ -1,7 +1,41 @@
 #ifndef MSD_SORT
 #define MSD_SORT
 
+#include "gene_core.h"
+
+  //  Sort nelem records of rsize bytes (of which the first dsize are data) on the ksize
+  //    key bytes starting at byte koff of each record, most significant byte first.  All
+  //    state for a sort is in its context, so sorts with different contexts may run at
+  //    the same time.  Threads take buckets from a shared pool, and a thread splitting a
+  //    large bucket hands its sub-buckets back to the pool while any thread is idle.
+
+typedef struct MSD_Context MSD_Context;
+
+MSD_Context *New_MSD_Context(int rsize, int dsize, int koff, int ksize, int nthreads);
+void         Free_MSD_Context(MSD_Context *ctx);
+
+  //  If part is not NULL then array is already partitioned on the first key byte and
+  //    part[x] is the number of bytes (not records) in bucket x, else part is computed.
+
+void MSD_Sort_Context(MSD_Context *ctx, uint8 *array, int64 nelem, int64 *part);
+
+  //  Original interface: key at the start of each record, array partitioned on byte 0
+
 void MSD_Sort(uint8 *array, int64 asize, int rsize, int dsize, int ksize,
               int64 *parts, int nthreads);
 
+  //  Spill mode for inputs larger than memory.  Records added are distributed on their first
+  //    key byte into buckets kept in temporary files in directory dir.  Close then loads,
+  //    sorts and passes each bucket in key order to emit, using at most about 1.25*memory
+  //    bytes.  A bucket larger than memory is spilled again on its next key byte.  Add is
+  //    not thread safe, so a caller with several producers must serialise its calls.
+
+typedef struct MSD_Spill MSD_Spill;
+
+MSD_Spill *Open_MSD_Spill(MSD_Context *ctx, char *dir, int64 memory);
+void       Add_MSD_Spill(MSD_Spill *spill, uint8 *recs, int64 nelem);
+int64      Close_MSD_Spill(MSD_Spill *spill,
+                           void (*emit)(uint8 *array, int64 nelem, void *arg), void *arg);
+                                  //  returns the number of records emitted
+
 #endif // MSD_SORT
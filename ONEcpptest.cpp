@@ -0,0 +1 @@
+ONElib.hpp
\ No newline at end of file
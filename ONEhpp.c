@@ -0,0 +1,263 @@
+/*  File: ONEhpp.c
+ *-------------------------------------------------------------------
+ * Description: generate a C++ header with typed records for the line types of a ONE schema
+ *   For each primary file type in the schema there is a namespace ONE_<type> holding the
+ *   schema text, a struct per line type with named and typed members plus read() and
+ *   write() in straight-line code, since field indices and types are fixed when the header
+ *   is generated, and a class File derived from ONEfile (ONElib.hpp) that opens files with
+ *   the schema, so that a file with a different layout fails to open with the reason.
+ *   Member names come from the comment on the definition line, e.g. "pos (0-indexed), base,
+ *   number" or "sequence: the DNA string", else are f0, f1, ...
+ * Exported functions:
+ *-------------------------------------------------------------------
+ */
+
+#include "ONElib.h"
+
+#include <string.h>		/* strcmp etc. */
+#include <stdlib.h>		/* for exit() */
+#include <stdarg.h>             /* for variable length argument lists */
+#include <ctype.h>
+
+void die (char *format, ...) ;
+
+#define MAX_NAME 64
+
+static char *reserved[] = { "read", "write", "lineType", "nField", "listField",
+			    "int", "char", "double", "float", "long", "short", "bool", "void",
+			    "auto", "case", "class", "const", "default", "delete", "do", "else",
+			    "enum", "for", "if", "new", "operator", "private", "protected",
+			    "public", "return", "static", "struct", "switch", "template", "this",
+			    "typename", "union", "using", "while", "and", "or", "not", "xor",
+			    "true", "false", 0 } ;
+
+static void makeName (char *name, char *s, char *e) /* identifier from the words in [s,e) */
+{
+  int n = 0 ;
+  while (s < e && n < MAX_NAME-1)
+    if (*s == '(')		/* drop parenthetical remarks */
+      { while (s < e && *s != ')') ++s ; if (s < e) ++s ; }
+    else if (isalnum ((int)*s))
+      name[n++] = tolower ((int)*s++) ;
+    else
+      { if (n && name[n-1] != '_') name[n++] = '_' ;
+	++s ;
+      }
+  while (n && name[n-1] == '_') --n ;
+  name[n] = 0 ;
+}
+
+static bool isGoodNames (char names[][MAX_NAME], int n, char t)
+{
+  int i, j ;
+  for (i = 0 ; i < n ; ++i)
+    { if (!*names[i] || isdigit ((int)*names[i])) return false ;
+      if (!names[i][1] && names[i][0] == t) return false ; /* same as the struct */
+      for (j = 0 ; reserved[j] ; ++j) if (!strcmp (names[i], reserved[j])) return false ;
+      for (j = 0 ; j < i ; ++j) if (!strcmp (names[i], names[j])) return false ;
+    }
+  return true ;
+}
+
+static void fieldNames (char names[][MAX_NAME], int n, char *comment, char t)
+{
+  int i ;
+  if (comment)
+    { char *colon = strchr (comment, ':') ;
+      char *s = colon ? colon+1 : comment, *e ;
+      if (n == 1 && colon)	/* "sequence: the DNA string" names the field sequence */
+	makeName (names[0], comment, colon) ;
+      else
+	for (i = 0 ; i < n ; ++i, s = e+1) /* "pos (0-indexed), base, number" */
+	  { e = s ; while (*e && *e != ',') ++e ;
+	    makeName (names[i], s, e) ;
+	    if (!*e && i < n-1) { names[n-1][0] = 0 ; break ; } /* too few names */
+	  }
+      if (isGoodNames (names, n, t)) return ;
+    }
+  for (i = 0 ; i < n ; ++i) sprintf (names[i], "f%d", i) ;
+}
+
+static void writeQuoted (FILE *f, char *s) /* as a C string literal without the quotes */
+{
+  for ( ; *s ; ++s)
+    if (*s == '"' || *s == '\\') fprintf (f, "\\%c", *s) ;
+    else fputc (*s, f) ;
+}
+
+static void writeSchemaText (FILE *f, OneSchema *vs)
+{
+  int i, j ;
+  fprintf (f, "static const char *schemaText =\n  \"P %d %s\\n\"\n",
+	   (int)strlen(vs->primary), vs->primary) ;
+  for (i = 0 ; i < vs->nSecondary ; ++i)
+    fprintf (f, "  \"S %d %s\\n\"\n", (int)strlen(vs->secondary[i]), vs->secondary[i]) ;
+  for (i = 0 ; i < vs->nDefn ; ++i)
+    { int k = vs->defnOrder[i] ;
+      fprintf (f, "  \"") ;
+      if (k & 0x80)
+	fprintf (f, "G %c 0", k & 0x7f) ;
+      else
+	{ OneInfo *vi = vs->info[k] ;
+	  fprintf (f, "%c %c %d", vi->isObject ? 'O' : 'D', k, vi->nField) ;
+	  for (j = 0 ; j < vi->nField ; ++j)
+	    fprintf (f, " %d %s", (int)strlen(oneTypeString[vi->fieldType[j]]),
+		     oneTypeString[vi->fieldType[j]]) ;
+	}
+      if (vs->defnComment[i]) { fputc (' ', f) ; writeQuoted (f, vs->defnComment[i]) ; }
+      fprintf (f, "\\n\"\n") ;
+    }
+  fprintf (f, "  ;\n\n") ;
+}
+
+static char *memberType[] = { 0, "int64_t", "double", "char", "string_view",
+			      "ONEspan<const int64_t>", "ONEspan<const double>",
+			      "ONEstringList", "string_view" } ;
+
+static void writeRecord (FILE *f, OneSchema *vs, char t, char *comment)
+{
+  OneInfo *vi = vs->info[(int)t] ;
+  int      i, n = vi->nField ;
+  char     names[32][MAX_NAME] ;
+
+  if (n > 32) die ("line type %c has %d fields - at most 32 allowed", t, n) ;
+  if (comment) while (isspace ((int)*comment)) ++comment ;
+  fieldNames (names, n, comment, t) ;
+
+  fprintf (f, "struct %c", t) ;
+  if (comment) { fprintf (f, "\t// ") ; fputs (comment, f) ; }
+  fprintf (f, "\n{ static constexpr char lineType = '%c' ;\n", t) ;
+  fprintf (f, "  static constexpr int  nField = %d ;\n", n) ;
+  for (i = 0 ; i < n ; ++i)
+    fprintf (f, "  %s %s ;\n", memberType[vi->fieldType[i]], names[i]) ;
+
+  fprintf (f, "\n  static %c read (C_1F::OneFile *of)\n  { %c r ;\n", t, t) ;
+  for (i = 0 ; i < n ; ++i)
+    switch (vi->fieldType[i])
+      {
+      case oneINT: fprintf (f, "    r.%s = of->field[%d].i ;\n", names[i], i) ; break ;
+      case oneREAL: fprintf (f, "    r.%s = of->field[%d].r ;\n", names[i], i) ; break ;
+      case oneCHAR: fprintf (f, "    r.%s = of->field[%d].c ;\n", names[i], i) ; break ;
+      case oneSTRING: case oneDNA:
+	fprintf (f, "    r.%s = string_view ((char*) C_1F::_oneList (of), of->field[%d].len & 0xffffffffffffffll) ;\n",
+		 names[i], i) ;
+	break ;
+      case oneINT_LIST:
+	fprintf (f, "    r.%s = ONEspan<const int64_t> ((int64_t*) C_1F::_oneList (of), of->field[%d].len & 0xffffffffffffffll) ;\n",
+		 names[i], i) ;
+	break ;
+      case oneREAL_LIST:
+	fprintf (f, "    r.%s = ONEspan<const double> ((double*) C_1F::_oneList (of), of->field[%d].len & 0xffffffffffffffll) ;\n",
+		 names[i], i) ;
+	break ;
+      case oneSTRING_LIST:
+	fprintf (f, "    r.%s = ONEstringList ((char*) C_1F::_oneList (of), of->field[%d].len & 0xffffffffffffffll) ;\n",
+		 names[i], i) ;
+	break ;
+      }
+  fprintf (f, "    return r ;\n  }\n") ;
+
+  fprintf (f, "\n  void write (C_1F::OneFile *of) const\n  {") ;
+  for (i = 0 ; i < n ; ++i)
+    switch (vi->fieldType[i])
+      {
+      case oneINT: fprintf (f, " of->field[%d].i = %s ;\n   ", i, names[i]) ; break ;
+      case oneREAL: fprintf (f, " of->field[%d].r = %s ;\n   ", i, names[i]) ; break ;
+      case oneCHAR: fprintf (f, " of->field[%d].c = %s ;\n   ", i, names[i]) ; break ;
+      default: break ;	/* the list is passed to oneWriteLine() */
+      }
+  if (vi->listEltSize)
+    { char *name = names[vi->listField] ;
+      fprintf (f, " C_1F::oneWriteLine (of, '%c', %s.size(), (void*) %s.data()) ;\n  }\n} ;\n\n",
+	       t, name, name) ;
+    }
+  else
+    fprintf (f, " C_1F::oneWriteLine (of, '%c', 0, 0) ;\n  }\n} ;\n\n", t) ;
+}
+
+static void writeNamespace (FILE *f, OneSchema *vs)
+{
+  int i ;
+  fprintf (f, "namespace ONE_%s {\n\n", vs->primary) ;
+  writeSchemaText (f, vs) ;
+  for (i = 0 ; i < vs->nDefn ; ++i)
+    if (!(vs->defnOrder[i] & 0x80))
+      writeRecord (f, vs, vs->defnOrder[i], vs->defnComment[i]) ;
+
+  fprintf (f, "class File : public ONEfile\n{\n public:\n") ;
+  fprintf (f, "  static const ONEschema &schema () { static ONEschema s (schemaText) ; return s ; }\n\n") ;
+  fprintf (f, "  File (const string &path, int nThreads = 1) // read, failing if the layout differs\n") ;
+  fprintf (f, "    : ONEfile (path, \"r\", schema(), \"%s\", nThreads) { }\n", vs->primary) ;
+  fprintf (f, "  File (const string &path, bool isBinary, int nThreads) // write\n") ;
+  fprintf (f, "    : ONEfile (path, isBinary ? \"wb\" : \"w\", schema(), \"%s\", nThreads) { }\n\n",
+	   vs->primary) ;
+  fprintf (f, "  template <class R> R    read () // the current line, which must be of type R\n") ;
+  fprintf (f, "  { if (lineType() != R::lineType)\n") ;
+  fprintf (f, "      throw runtime_error (string(\"reading \") + (lineType() ? string(1,lineType()) : \"end of data\")\n") ;
+  fprintf (f, "                           + \" as line type \" + R::lineType) ;\n") ;
+  fprintf (f, "    return R::read (handle()) ;\n  }\n") ;
+  fprintf (f, "  template <class R> void write (const R &r) { r.write (handle()) ; }\n") ;
+  fprintf (f, "} ;\n\n} // namespace ONE_%s\n\n", vs->primary) ;
+}
+
+int main (int argc, char **argv)
+{
+  char *outFileName = "-" ;
+  char *primary = 0 ;
+
+  --argc ; ++argv ;		/* drop the program name */
+  if (!argc)
+    { fprintf (stderr, "ONEhpp [options] schemafile\n") ;
+      fprintf (stderr, "  -o --output <filename>     output C++ header (default stdout)\n") ;
+      fprintf (stderr, "  -p --primary <type>        only this primary file type (default all)\n") ;
+      fprintf (stderr, "writes typed records for each line type: use 'ONEview -s' to get a schema file\n") ;
+      exit (0) ;
+    }
+
+  while (argc && **argv == '-')
+    if ((!strcmp (*argv, "-o") || !strcmp (*argv, "--output")) && argc >= 2)
+      { outFileName = argv[1] ; argc -= 2 ; argv += 2 ; }
+    else if ((!strcmp (*argv, "-p") || !strcmp (*argv, "--primary")) && argc >= 2)
+      { primary = argv[1] ; argc -= 2 ; argv += 2 ; }
+    else die ("unknown option %s - run without arguments to see options", *argv) ;
+
+  if (argc != 1) die ("need a single schema file as argument") ;
+
+  OneSchema *vs0 = oneSchemaCreateFromFile (argv[0]) ;
+  if (!vs0) die ("failed to read schema file %s", argv[0]) ;
+
+  FILE *f = strcmp (outFileName, "-") ? fopen (outFileName, "w") : stdout ;
+  if (!f) die ("failed to open output file %s", outFileName) ;
+
+  fprintf (f, "// generated by ONEhpp from %s - do not edit\n\n", argv[0]) ;
+  fprintf (f, "#include \"ONElib.hpp\"\n\n") ;
+
+  OneSchema *vs ;
+  int nWritten = 0 ;
+  for (vs = vs0->nxt ; vs ; vs = vs->nxt) /* vs0 is the header schema */
+    if (vs->primary && (!primary || !strcmp (primary, vs->primary)))
+      { writeNamespace (f, vs) ; ++nWritten ; }
+  if (!nWritten)
+    die ("no primary type %s in schema file %s", primary ? primary : "", argv[0]) ;
+
+  if (f != stdout) fclose (f) ;
+  oneSchemaDestroy (vs0) ;
+  exit (0) ;
+}
+
+/*********** utilities from RD's utils.[ch] ***************/
+
+void die (char *format, ...)
+{
+  va_list args ;
+
+  va_start (args, format) ;
+  fprintf (stderr, "FATAL ERROR: ") ;
+  vfprintf (stderr, format, args) ;
+  fprintf (stderr, "\n") ;
+  va_end (args) ;
+
+  exit (-1) ;
+}
+
+/********************* end of file ***********************/
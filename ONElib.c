@@ -39,6 +39,7 @@
 #include <unistd.h>
 #include <sys/uio.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <math.h>
 
 #define DEBUG
@@ -66,6 +67,27 @@ static void *mydup(size_t n, void *x, size_t size);
 #define dup(n,x,Type) (Type *) mydup(n,x,sizeof(Type))
 #define resize(x,nOld,nNew,Type) { Type* z = new((nNew),Type) ; if (nOld < nNew) memcpy(z,x,(nOld)*sizeof(Type)) ; else memcpy(z,x,(nNew)*sizeof(Type)) ; free(x) ; x = z ; }
 
+// performance counters per OneFile, compiled in with -DONE_PROFILE - see oneProfileReport()
+
+#ifdef ONE_PROFILE
+typedef struct OneProfile {
+  I64    nRead[128], bytesRead[128], nWrite[128], bytesWritten[128] ;
+  I64    nTrain[128], trainBytes[128], nEncode[128], encodeIn[128], encodeOut[128] ;
+  I64    nDecode[128], decodeIn[128], decodeOut[128] ;
+  double trainTime[128], encodeTime[128], decodeTime[128] ;
+  I64    nGoto, nSeek, nRealloc, reallocBytes, nMerge, mergeBytes ;
+  double mergeTime ;
+  FILE  *atClose ;            // report from oneFileClose() to here if set
+} OneProfile ;
+
+static inline double profileClock (void)
+{ struct timespec t ; clock_gettime (CLOCK_MONOTONIC, &t) ; return t.tv_sec + 1e-9*t.tv_nsec ; }
+
+#define PROFILE(...) __VA_ARGS__
+#else
+#define PROFILE(...)
+#endif
+
 // global required for parallelisation
 
 static pthread_mutex_t mutexInit = PTHREAD_MUTEX_INITIALIZER;
@@ -95,6 +117,234 @@ static _Thread_local char errorString[1024] ;
 
 char *oneErrorString (void) { return errorString ; }
 
+/***********************************************************************************
+ *
+ *    I/O BACKENDS
+ *      All reading and writing goes through a stdio FILE* in vf->f, so that the inner
+ *      loops can use getc()/fread()/fwrite() with stdio buffering. Non-file backends
+ *      are bound to a FILE* as custom streams (fopencookie() on Linux, funopen() on BSD
+ *      and MacOS), or for read-only memory images directly via fmemopen(). Each custom
+ *      stream keeps its own position, so several streams (e.g. one per reading thread)
+ *      can share a single underlying handle, serialised by a mutex.
+ *
+ **********************************************************************************/
+
+typedef struct OneIOSource {
+  OneIO            io ;        // user or internal callbacks, if not a memory image
+  void            *handle ;
+  pthread_mutex_t  lock ;      // serialises seek+read/write on handle across streams
+  int              nRef ;      // owning OneFile plus each open custom stream
+  const char      *image ;     // if non-zero then a read-only memory image of size bytes
+  size_t           size ;
+  bool             isMmap ;    // image was mmap()ed and must be unmapped
+} OneIOSource ;
+
+typedef struct {
+  OneIOSource *src ;
+  I64          pos ;           // private position of this stream
+} IOStream ;
+
+static OneIOSource *ioSourceCreate (OneIO *io, void *handle)
+{
+  OneIOSource *src = new0 (1, OneIOSource) ;
+  if (io) src->io = *io ;
+  src->handle = handle ;
+  src->lock = mutexInit ;
+  src->nRef = 1 ;
+  return src ;
+}
+
+static void ioSourceRelease (OneIOSource *src)
+{
+  pthread_mutex_lock (&src->lock) ;
+  int nRef = --src->nRef ;
+  pthread_mutex_unlock (&src->lock) ;
+  if (nRef > 0) return ;
+  if (src->isMmap) munmap ((void*) src->image, src->size) ;
+  if (src->io.close) (*src->io.close) (src->handle) ;
+  free (src) ;
+}
+
+static I64 ioStreamRead (IOStream *s, char *buf, I64 n)
+{
+  OneIOSource *src = s->src ;
+  if (!src->io.read) return -1 ;
+  pthread_mutex_lock (&src->lock) ;
+  if (src->io.seek && (*src->io.seek) (src->handle, s->pos, SEEK_SET))
+    n = -1 ;
+  else
+    n = (*src->io.read) (src->handle, buf, n) ;
+  pthread_mutex_unlock (&src->lock) ;
+  if (n > 0) s->pos += n ;
+  return n ;
+}
+
+static I64 ioStreamWrite (IOStream *s, const char *buf, I64 n)
+{
+  OneIOSource *src = s->src ;
+  if (!src->io.write) return -1 ;
+  pthread_mutex_lock (&src->lock) ;
+  if (src->io.seek && (*src->io.seek) (src->handle, s->pos, SEEK_SET))
+    n = -1 ;
+  else
+    n = (*src->io.write) (src->handle, buf, n) ;
+  pthread_mutex_unlock (&src->lock) ;
+  if (n > 0) s->pos += n ;
+  return n ;
+}
+
+static I64 ioStreamSeek (IOStream *s, I64 off, int whence)
+{
+  OneIOSource *src = s->src ;
+  switch (whence)
+    {
+    case SEEK_SET: break ;
+    case SEEK_CUR: off += s->pos ; break ;
+    case SEEK_END:
+      { I64 size = -1 ;
+	pthread_mutex_lock (&src->lock) ;
+	if (src->io.size)
+	  size = (*src->io.size) (src->handle) ;
+	else if (src->io.seek && src->io.tell && !(*src->io.seek) (src->handle, 0, SEEK_END))
+	  size = (*src->io.tell) (src->handle) ;
+	pthread_mutex_unlock (&src->lock) ;
+	if (size < 0) return -1 ;
+	off += size ;
+      }
+      break ;
+    default: return -1 ;
+    }
+  if (off < 0) return -1 ;
+  if (off != s->pos && !src->io.seek) return -1 ; // a pure stream can only report position
+  s->pos = off ;
+  return off ;
+}
+
+static int ioStreamClose (IOStream *s)
+{
+  ioSourceRelease (s->src) ;
+  free (s) ;
+  return 0 ;
+}
+
+#ifdef __linux__
+
+static ssize_t cookieRead (void *c, char *buf, size_t n)
+{ I64 k = ioStreamRead ((IOStream*)c, buf, n) ; return k < 0 ? -1 : k ; }
+
+static ssize_t cookieWrite (void *c, const char *buf, size_t n)
+{ I64 k = ioStreamWrite ((IOStream*)c, buf, n) ; return k < 0 ? 0 : k ; }
+
+static int cookieSeek (void *c, off64_t *off, int whence)
+{ I64 k = ioStreamSeek ((IOStream*)c, *off, whence) ;
+  if (k < 0) return -1 ;
+  *off = k ; return 0 ;
+}
+
+static int cookieClose (void *c) { return ioStreamClose ((IOStream*)c) ; }
+
+#else  // BSD, MacOS
+
+static int cookieRead (void *c, char *buf, int n)
+{ return (int) ioStreamRead ((IOStream*)c, buf, n) ; }
+
+static int cookieWrite (void *c, const char *buf, int n)
+{ return (int) ioStreamWrite ((IOStream*)c, buf, n) ; }
+
+static fpos_t cookieSeek (void *c, fpos_t off, int whence)
+{ return (fpos_t) ioStreamSeek ((IOStream*)c, off, whence) ; }
+
+static int cookieClose (void *c) { return ioStreamClose ((IOStream*)c) ; }
+
+#endif
+
+static FILE *ioSourceStream (OneIOSource *src, const char *path, const char *mode)
+{ // open a new stream with its own position on src, or on path if src is 0
+  FILE *f ;
+  
+  if (!src)
+    return fopen (path, mode) ;
+  if (src->image)
+    return fmemopen ((void*) src->image, src->size, "r") ;
+
+  IOStream *s = new0 (1, IOStream) ;
+  s->src = src ;
+#ifdef __linux__
+  cookie_io_functions_t funcs = { cookieRead, cookieWrite, cookieSeek, cookieClose } ;
+  f = fopencookie (s, mode, funcs) ;
+#else
+  f = funopen (s, cookieRead, cookieWrite, cookieSeek, cookieClose) ;
+#endif
+  if (!f) { free (s) ; return 0 ; }
+  pthread_mutex_lock (&src->lock) ;
+  ++src->nRef ;
+  pthread_mutex_unlock (&src->lock) ;
+  setvbuf (f, 0, _IOFBF, 1 << 16) ;
+  return f ;
+}
+
+/******************* growable memory backend ********************/
+
+// used for oneFileOpenWriteBuffer(), and for the slave files of parallel writes on non-file backends
+
+typedef struct {
+  char   *buf ;
+  I64     size, max, pos ;
+  void  **bufp ;      // if non-zero then on close hand buf over to the user via these
+  size_t *sizep ;
+} MemIO ;
+
+static I64 memRead (void *h, void *buf, I64 n)
+{ MemIO *m = (MemIO*) h ;
+  if (n > m->size - m->pos) n = m->size - m->pos ;
+  if (n <= 0) return 0 ;
+  memcpy (buf, m->buf + m->pos, n) ; m->pos += n ;
+  return n ;
+}
+
+static I64 memWrite (void *h, const void *buf, I64 n)
+{ MemIO *m = (MemIO*) h ;
+  if (m->pos + n > m->max)
+    { I64 max = m->max ? 2*m->max : 1 << 16 ;
+      while (max < m->pos + n) max *= 2 ;
+      char *x = new (max, char) ;
+      if (m->size) memcpy (x, m->buf, m->size) ;
+      free (m->buf) ; m->buf = x ; m->max = max ;
+    }
+  if (m->pos > m->size) memset (m->buf + m->size, 0, m->pos - m->size) ;
+  memcpy (m->buf + m->pos, buf, n) ; m->pos += n ;
+  if (m->pos > m->size) m->size = m->pos ;
+  return n ;
+}
+
+static int memSeek (void *h, I64 off, int whence)
+{ MemIO *m = (MemIO*) h ;
+  if (whence == SEEK_CUR) off += m->pos ; else if (whence == SEEK_END) off += m->size ;
+  if (off < 0) return -1 ;
+  m->pos = off ;
+  return 0 ;
+}
+
+static I64 memTell (void *h) { return ((MemIO*)h)->pos ; }
+static I64 memSize (void *h) { return ((MemIO*)h)->size ; }
+static int memClose (void *h)
+{ MemIO *m = (MemIO*) h ;
+  if (m->bufp) { *m->bufp = m->buf ; *m->sizep = m->size ; }
+  else free (m->buf) ;
+  free (m) ;
+  return 0 ;
+}
+
+static OneIO memIO = { memRead, memWrite, memSeek, memTell, memSize, memClose } ;
+
+static FILE *memStream (void) // a new read/write stream on its own growable memory buffer
+{
+  OneIOSource *src = ioSourceCreate (&memIO, new0 (1, MemIO)) ;
+  FILE *f = ioSourceStream (src, 0, "w+") ;
+  ioSourceRelease (src) ; // the stream now holds the only reference
+  return f ;
+}
+
 /***********************************************************************************
  *
  *    ONE_FILE CREATION & DESTRUCTION
@@ -116,6 +366,7 @@ static OneInfo *infoCreate (int nField)
 static OneInfo *infoDeepCopy (OneInfo *vi0)
 { OneInfo *vi = new (1, OneInfo) ;
   *vi = *vi0 ;
+  vi->buffer = 0 ; vi->bufSize = 0 ; vi->isUserBuf = false ; // buffers are never shared
   if (vi0->nField) vi->fieldType = dup (vi->nField, vi0->fieldType, OneType) ;
   if (vi0->listCodec && vi->listCodec != DNAcodec) vi->listCodec = vcCreate() ;
   if (vi0->index) vi->index = dup (vi->indexSize, vi0->index, I64) ;
@@ -261,12 +512,13 @@ static OneSchema *schemaLoadRecord (OneSchema *vs, OneFile *vf)
       break ;
     case 'G': // group another object type
       schemaAddGroup (vs, oneChar(vf,0)) ;
-      if (oneReadComment (vf)) vs->defnComment[vs->nDefn-1] = strdup (oneReadComment(vf)) ;
+      if (oneReadComment (vf) && vs->nDefn) vs->defnComment[vs->nDefn-1] = strdup (oneReadComment(vf)) ;
       break ;
     case 'O': // object type
     case 'D': // standard record type
       schemaAddInfoFromLine (vs, vf, oneChar(vf,0), vf->lineType) ;
-      if (oneReadComment (vf)) vs->defnComment[vs->nDefn-1] = strdup (oneReadComment(vf)) ;
+      if (oneReadComment (vf) && vs->nDefn) // non-alphabetic header lines are not in defnOrder
+	vs->defnComment[vs->nDefn-1] = strdup (oneReadComment(vf)) ;
       break ;
     default:
       die ("unrecognized schema line %d starting with %c", vf->line, vf->lineType) ;
@@ -276,16 +528,56 @@ static OneSchema *schemaLoadRecord (OneSchema *vs, OneFile *vf)
 }
 
 static void oneFileDestroy (OneFile *vf) ; // need a forward declaration here
-
-OneSchema *oneSchemaCreateFromFile (const char *filename)
+static OneFile *openReadStream (FILE *f, const char *path, OneIOSource *src, OneSchema *vsArg,
+				const char *fileType, int nthreads) ; // and here
+
+// the schemas for the universal header and footer (non-alphabetic) line types, and for
+// reading schema files, are parsed from memory via fmemopen(), so no temporary files are needed
+
+// NB if you change the header spec and add a record with more than 4 fields,
+//    change the assignment of ->nFieldMax in the 'P' section of schemaLoadRecord() above
+
+static char *schemaHeaderText =
+  "D 1 3 6 STRING 3 INT 3 INT         line 1: primary type, major, minor version\n"
+  "D 2 1 6 STRING                     optional subtype: subtype\n"
+  "D # 2 4 CHAR 3 INT                 count: linetype, count\n"
+  "D @ 2 4 CHAR 3 INT                 max: linetype, list max\n"
+  "D + 2 4 CHAR 3 INT                 total: linetype, list total\n"
+  "D % 4 4 CHAR 4 CHAR 4 CHAR 3 INT   group maxes: group, #/+, linetype, value\n"
+  "D ! 1 11 STRING_LIST               provenance: program, version, command, date\n"
+  "D < 2 6 STRING 3 INT               reference: filename, object count\n"
+  "D > 1 6 STRING                     deferred: filename\n"
+  "D ~ 3 4 CHAR 4 CHAR 11 STRING_LIST embedded schema linetype definition\n"
+  "D . 0                              blank line, anywhere in file\n"
+  "D $ 1 3 INT                        binary file - goto footer: isBigEndian\n"
+  "D ^ 0                              binary file: end of footer designation\n"
+  "D - 1 3 INT                        binary file: offset of start of footer\n"
+  "D & 2 4 CHAR 8 INT_LIST            binary file: li->index\n"
+  "D ; 2 4 CHAR 6 STRING              binary file: list codec\n"
+  "D / 1 6 STRING                     binary file: comment\n" ;
+
+static char *schemaDefText =
+  "P 3 def                      this is the primary file type for schemas\n"
+  "O P 1 6 STRING               primary type name\n"
+  "D S 1 6 STRING               secondary type name\n"
+  "D O 2 4 CHAR 11 STRING_LIST  define linetype for object type (indexed)\n"
+  "D G 1 4 CHAR                 define linetype for grouping another object\n"
+  "D D 2 4 CHAR 11 STRING_LIST  define linetype for other records\n"
+  "\n" ; // terminator
+
+static FILE *textStream (const char *text) // read-only stream on text, which must outlive it
 {
-  FILE *fs = fopen (filename, "r") ;
-  if (!fs) return 0 ;
-  fclose(fs);
+  FILE *f = fmemopen ((void*) text, strlen (text), "r") ;
+  if (!f) die ("ONE schema failure: fmemopen failed errno %d", errno) ;
+  return f ;
+}
 
+static OneSchema *schemaCreateFromStream (FILE *fs, const char *name)
+{ // parses the schema in fs, which is closed on return; name is only used in messages
   OneSchema *vs = new0 (1, OneSchema) ;
 
   OneFile *vf = new0 (1, OneFile) ;      // shell object to support bootstrap
+  PROFILE (vf->profile = new0 (1, OneProfile) ;)
   // bootstrap specification of linetypes to read schemas
   { OneInfo *vi ;
     vi = vf->info['P'] = infoCreate (1) ;  // to define the schema for parsing a .schema file
@@ -300,70 +592,26 @@ OneSchema *oneSchemaCreateFromFile (const char *filename)
     vf->field = new (2, OneField) ;
   }
 
-  // first load the universal header and footer (non-alphabetic) line types 
-  // do this by writing their schema into a temporary file and parsing it into the base schema
-  { errno = 0 ;
-    char template[64] ;
-// #define VALGRIND_MACOS
-#ifdef VALGRIND_MACOS // MacOS valgrind is missing functions to make temp files it seems
-    sprintf (template, "/tmp/OneSchema.%d", getpid()) ;
-    vf->f = fopen (template, "w+") ;
-    if (errno) die ("failed to open temporary file %s errno %d\n", template, errno) ;
-#else
-    strcpy (template, "/tmp/OneSchema.XXXXXX") ;
-    int fd = mkstemp (template) ;
-    if (errno) die ("failed to open temporary file %s errno %d\n", template, errno) ;
-    vf->f = fdopen (fd, "w+") ;
-    if (errno) die ("failed to assign temporary file to stream: errno %d\n", errno) ;
-#endif
-    unlink (template) ;                  // this ensures that the file is removed on closure
-    if (errno) die ("failed to remove temporary file %s errno %d\n", template, errno) ;
-  }
-
-  // NB if you change the header spec and add a record with more than 4 fields,
-  //    change the assignment of ->nFieldMax in the 'P' section of schemaLoadRecord() above
-  
-  fprintf (vf->f, "D 1 3 6 STRING 3 INT 3 INT         line 1: primary type, major, minor version\n") ;
-  fprintf (vf->f, "D 2 1 6 STRING                     optional subtype: subtype\n") ;
-  fprintf (vf->f, "D # 2 4 CHAR 3 INT                 count: linetype, count\n") ;
-  fprintf (vf->f, "D @ 2 4 CHAR 3 INT                 max: linetype, list max\n") ;
-  fprintf (vf->f, "D + 2 4 CHAR 3 INT                 total: linetype, list total\n") ;
-  fprintf (vf->f, "D %% 4 4 CHAR 4 CHAR 4 CHAR 3 INT  group maxes: group, #/+, linetype, value\n") ;
-  fprintf (vf->f, "D ! 1 11 STRING_LIST               provenance: program, version, command, date\n") ;
-  fprintf (vf->f, "D < 2 6 STRING 3 INT               reference: filename, object count\n") ;
-  fprintf (vf->f, "D > 1 6 STRING                     deferred: filename\n") ;
-  fprintf (vf->f, "D ~ 3 4 CHAR 4 CHAR 11 STRING_LIST embedded schema linetype definition\n") ;
-  fprintf (vf->f, "D . 0                              blank line, anywhere in file\n") ;
-  fprintf (vf->f, "D $ 1 3 INT                        binary file - goto footer: isBigEndian\n") ;
-  fprintf (vf->f, "D ^ 0                              binary file: end of footer designation\n") ;
-  fprintf (vf->f, "D - 1 3 INT                        binary file: offset of start of footer\n") ;
-  fprintf (vf->f, "D & 2 4 CHAR 8 INT_LIST            binary file: li->index\n") ;
-  fprintf (vf->f, "D ; 2 4 CHAR 6 STRING              binary file: list codec\n") ;
-  fprintf (vf->f, "D / 1 6 STRING                     binary file: comment\n") ;
-  if (fseek (vf->f, 0, SEEK_SET)) die ("ONE schema failure: cannot rewind tmp file") ;
+  // first load the universal header and footer (non-alphabetic) line types into the base schema
+  vf->f = textStream (schemaHeaderText) ;
   while (oneReadLine (vf))
     schemaLoadRecord (vs, vf) ;
+  fclose (vf->f) ;
 
-  // next reuse the temp file to load the schema for reading schemas
-  if (fseek (vf->f, 0, SEEK_SET)) die ("ONE schema failure: cannot rewind tmp file") ;
-  fprintf (vf->f, "P 3 def                      this is the primary file type for schemas\n") ;
-  fprintf (vf->f, "O P 1 6 STRING               primary type name\n") ;
-  fprintf (vf->f, "D S 1 6 STRING               secondary type name\n") ;
-  fprintf (vf->f, "D O 2 4 CHAR 11 STRING_LIST  define linetype for object type (indexed)\n") ;
-  fprintf (vf->f, "D G 1 4 CHAR                 define linetype for grouping another object\n") ;
-  fprintf (vf->f, "D D 2 4 CHAR 11 STRING_LIST  define linetype for other records\n") ;
-  fprintf (vf->f, "\n") ; // terminator
-  if (fseek (vf->f, 0, SEEK_SET)) die ("ONE schema failure: cannot rewind tmp file") ;
+  // next load the schema for reading schemas
+  vf->f = textStream (schemaDefText) ;
   OneSchema *vs0 = vs ;  // need this because loadInfo() updates vs on reading P lines
   vf->line = 0 ;
   while (oneReadLine (vf))
     vs = schemaLoadRecord (vs, vf) ;
   OneSchema *vsDef = vs ; // will need this to destroy it once the true schema is read
-  oneFileDestroy (vf) ;   // this will also effectively remove the temp file on closing
+  oneFileDestroy (vf) ;   // this also closes the stream
 
   // finally read the schema itself
-  if (!(vf = oneFileOpenRead (filename, vs0, "def", 1)))
-    return 0 ;
+  if (!(vf = openReadStream (fs, name, 0, vs0, "def", 1)))
+    { oneSchemaDestroy (vs0) ; // NB this also destroys vsDef which is still linked from vs0
+      return 0 ;
+    }
   vs = vs0 ; // set back to vs0, so next filetype spec will replace vsDef
   vs->nxt = 0 ;
   oneSchemaDestroy (vsDef) ; // no longer need this, and can destroy because unlinked from vs0
@@ -374,31 +622,30 @@ OneSchema *oneSchemaCreateFromFile (const char *filename)
   return vs0 ;
 }
 
+OneSchema *oneSchemaCreateFromFile (const char *filename)
+{
+  FILE *fs = fopen (filename, "r") ;
+  if (!fs) return 0 ;
+
+  return schemaCreateFromStream (fs, filename) ;
+}
+
 static char *schemaFixNewlines (const char *text)
-{ // replace literal "\n" by '\n' chars in text
-  char *newText = strdup (text) ;
-  char *s = newText, *t = s ;
-  while (*s)
-    if (*s == '\\' && s[1] == 'n')
-      { *t++ = '\n' ; s += 2 ; }
+{ // replace literal "\n" by '\n' chars in text, and ensure that text ends with '\n'
+  char *newText = new (strlen(text) + 2, char) ;
+  char *t = newText ;
+  while (*text)
+    if (*text == '\\' && text[1] == 'n')
+      { *t++ = '\n' ; text += 2 ; }
     else
-      *t++ = *s++ ;
+      *t++ = *text++ ;
+  if (t == newText || t[-1] != '\n') *t++ = '\n' ;
   *t = 0 ;
   return newText ;
 }
   
-OneSchema *oneSchemaCreateFromText (const char *text) // write to temp file and call CreateFromFile()
+OneSchema *oneSchemaCreateFromText (const char *text) // parse text directly from memory
 {
-  // Claude points out that the getpid() solution below is not threadsafe.  So it proposed the code below.
-  // static char template[64] ;
-  // sprintf (template, "/tmp/OneTextSchema-%d.schema", getpid()) ;
-  
-  char template[] = "/tmp/OneTextSchema-XXXXXX" ;
-  errno = 0 ;
-  int fd = mkstemp(template) ;
-  if (fd == -1) die ("failed to make temporary file %s for writing schema to - errno %d", template, errno) ;
-  FILE *f = fdopen(fd, "w") ;
-  if (!f) die ("failed to fdopen temporary file %s for writing schema to - errno %d", template, errno) ;
   char *fixedText = schemaFixNewlines (text) ;
   char *s = fixedText ;
   while (*s && *s != 'P')
@@ -406,22 +653,15 @@ OneSchema *oneSchemaCreateFromText (const char *text) // write to temp file and
       if (*s == '\n') ++s ;
     }
   if (!*s) die ("no P line in schema text") ;
-  fprintf (f, "%s\n", s) ;
-  free (fixedText) ;
-  fclose (f) ;
-  if (errno) die ("failed to write temporary file %s errno %d\n", template, errno) ;
 
-  OneSchema *vs = oneSchemaCreateFromFile (template) ;
-
-  errno = 0 ;
-  unlink (template) ;  // delete temporary file - not ideal: will remain if schemaCreate crashes
-  if (errno) die ("failed to remove temporary file %s errno %d\n", template, errno) ;
+  OneSchema *vs = schemaCreateFromStream (textStream (s), "schema text") ;
 
+  free (fixedText) ; // safe because the stream was closed in schemaCreateFromStream()
   return vs ;
 }
 
 static OneSchema *oneSchemaCreateDynamic (char *fileType, char *subType)
-{ // this is clean, but it seems a bit wasteful to create a temp file
+{
   char *text ;
   assert (fileType && strlen(fileType) > 0) ;
   assert (!subType || strlen(subType) > 0) ;
@@ -430,7 +670,7 @@ static OneSchema *oneSchemaCreateDynamic (char *fileType, char *subType)
     sprintf (text, "P %ld %s\nS %ld %s\n", strlen(fileType),fileType, strlen(subType), subType) ;
   else
     sprintf (text, "P %ld %s\n", strlen(fileType), fileType) ;
-  OneSchema *vs = oneSchemaCreateFromText (text) ;
+  OneSchema *vs = schemaCreateFromStream (textStream (text), "dynamic schema") ;
   free (text) ;
   return vs ;
 }
@@ -637,6 +877,8 @@ static OneFile *oneFileCreate (OneSchema **vsp, const char *type)
     vf->isBig = (*b == 0);
   }
 
+  PROFILE (vf->profile = new0 (1, OneProfile) ;)
+
   *vsp = vs ;
   return vf ;
 }
@@ -690,6 +932,7 @@ static void oneFileCleanupSlaves (OneFile *vf)
     { provRefDefCleanup (&vf[j]) ;
       if (vf[j].codecBuf   != NULL) free (vf[j].codecBuf);
       if (vf[j].f          != NULL) fclose (vf[j].f);
+      if (vf[j].profile    != NULL) free (vf[j].profile);
     }
 }
 
@@ -702,12 +945,14 @@ static void oneFileDestroy (OneFile *vf)
   provRefDefCleanup (vf) ;
   if (vf->codecBuf != NULL) free (vf->codecBuf);
   if (vf->f != NULL && vf->f != stdout) fclose (vf->f);
+  if (vf->ioSource) ioSourceRelease (vf->ioSource) ;
 
   for (i = 0; i < 128 ; i++)
     if (vf->info[i] != NULL)
       infoDestroy (vf->info[i]);
 
   if (vf->field) free (vf->field) ;
+  if (vf->profile) free (vf->profile) ;
 
   if (vf->headerText)
     { OneHeaderText *t = vf->headerText ;
@@ -890,6 +1135,7 @@ static inline void updateTotalAndBuffer (OneFile *vf, char t, I64 size, I64 nStr
     { if (li->buffer != NULL) free (li->buffer);
       li->bufSize = size + 0x10000 ;
       li->buffer  = new (li->bufSize*li->listEltSize, void);
+      PROFILE (++vf->profile->nRealloc ; vf->profile->reallocBytes += li->bufSize*li->listEltSize ;)
     }
 }
 
@@ -910,6 +1156,7 @@ static char *compactIntList (OneFile *vf, OneInfo *li, I64 len, char *buf, int *
 	    free (li->buffer);
 	  li->bufSize = len + 1;
 	  li->buffer = new (li->bufSize * sizeof(I64), void);
+	  PROFILE (++vf->profile->nRealloc ; vf->profile->reallocBytes += li->bufSize*sizeof(I64) ;)
 	}
       memcpy (li->buffer, buf, len*sizeof(I64)) ;
       buf = li->buffer ;
@@ -1074,16 +1321,50 @@ static void readStringList(OneFile *vf, char t, I64 len)
 
 bool addProvenance(OneFile *vf, OneProvenance *from, int n) ; // need forward declaration
 
+bool oneSetLineTypeMask (OneFile *vf, const char *lineTypes)
+{ int i ;
+
+  if (vf->isWrite) return false ;
+  if (!lineTypes) { vf->isMask = false ; return true ; }
+  for (i = 0 ; lineTypes[i] ; ++i)
+    if (lineTypes[i] < 0 || !vf->info[(int) lineTypes[i]])
+      { snprintf (errorString, 1024, "unknown line type %c in line type mask", lineTypes[i]) ;
+	return false ;
+      }
+  memset (vf->lineMask, 0, 128) ;
+  for (i = 0 ; lineTypes[i] ; ++i) vf->lineMask[(int) lineTypes[i]] = true ;
+  vf->lineMask['/'] = true ;       // comments of wanted lines are read with them
+  vf->isMask = true ;
+  return true ;
+}
+
+static void skipBytes (OneFile *vf, I64 n) // seek past long lists, so they are not read
+{ if (n <= 0) return ;
+  if (n > (1 << 16) && !fseek (vf->f, n, SEEK_CUR)) // fseek() drops the stdio buffer
+    { PROFILE (++vf->profile->nSeek ;)
+      return ;
+    }
+  while (n > 0)
+    { I64 k = (n < vf->codecBufSize) ? n : vf->codecBufSize ;
+      if ((I64) fread (vf->codecBuf, 1, k, vf->f) != k)
+	die ("ONE read error: failed to skip list size %lld", n) ;
+      n -= k ;
+    }
+}
+
 char oneReadLine (OneFile *vf)
-{ bool      isAscii;
+{ bool      isAscii, isSkip;
   U8        x;
   char      t;
   OneInfo  *li;
+  PROFILE (off_t profStart ;)
 
   assert (!vf->isWrite) ;
   assert (!vf->isFinal) ;
 
+ nextLine:                         // return here after a line of a type not in the mask
   vf->linePos = 0;                 // must come before first vfGetc()
+  PROFILE (profStart = ftello (vf->f) ;)
   x = vfGetc (vf);                 // read first char
   if (feof (vf->f) || x == '\n')   // blank line (x=='\n') is end of records marker before footer
     { vf->lineType = 0 ;           // additional marker of end of file
@@ -1111,6 +1392,8 @@ char oneReadLine (OneFile *vf)
     *(char*)(vf->info['/']->buffer) = 0 ;
 
   vf->nBits = 0 ;        // will use for any compressed data read in
+  vf->isIntListCompact = false ;
+  isSkip = vf->isMask && !vf->lineMask[(int) t] ;
   
   if (isAscii)           // read field by field according to ascii spec
     { int     i, j;
@@ -1162,6 +1445,8 @@ char oneReadLine (OneFile *vf)
             break;
 	  }
       readFlush (vf);
+      PROFILE (++vf->profile->nRead[(int)t] ; vf->profile->bytesRead[(int)t] += ftello (vf->f) - profStart ;)
+      if (isSkip) goto nextLine ;
     }
 
   else        // binary - block read fields and list, potentially compressed
@@ -1192,20 +1477,27 @@ char oneReadLine (OneFile *vf)
               else if (x & 0x1)    				  // list is compressed
                 { vf->nBits = ltfRead (vf->f) ;
 		  size_t bytes = (vf->nBits+7) >> 3 ;
-		  if (bytes > (size_t) vf->codecBufSize)
+		  if (isSkip)
+		    { skipBytes (vf, bytes) ; vf->nBits = 0 ; }
+		  else if (bytes > (size_t) vf->codecBufSize)
 		    { if (vf->codecBuf) free (vf->codecBuf) ;
 		      vf->codecBufSize = bytes + 1 ;
 		      vf->codecBuf = new (vf->codecBufSize, void) ;
 		    }
-                  if (fread (vf->codecBuf, bytes, 1, vf->f) != 1)
+                  if (!isSkip && fread (vf->codecBuf, bytes, 1, vf->f) != 1)
                     die ("ONE read error: fail to read compressed list");
                 }
               else if (li->fieldType[li->listField] == oneINT_LIST)
                 { I64 listSize  = (listLen-1) * vf->intListBytes ;
-                  if ((I64) fread (&(((I64*)li->buffer)[1]), 1, listSize, vf->f) != listSize)
+		  if (isSkip)
+		    skipBytes (vf, listSize) ;
+                  else if ((I64) fread (&(((I64*)li->buffer)[1]), 1, listSize, vf->f) != listSize)
                     die ("ONE read error: failed to read list size %lld", listSize);
-		  decompactIntList (vf, listLen, li->buffer, vf->intListBytes);
+		  else
+		    vf->isIntListCompact = true ; // decompacted by _oneList() if it is wanted
                 }
+	      else if (isSkip)
+		skipBytes (vf, listLen * li->listEltSize) ;
 	      else
                 { I64 listSize  = listLen * li->listEltSize ;
                   if ((I64) fread (li->buffer, 1, listSize, vf->f) != listSize)
@@ -1213,11 +1505,12 @@ char oneReadLine (OneFile *vf)
                 }
             }
 
-          if (li->fieldType[li->listField] == oneSTRING)
+          if (li->fieldType[li->listField] == oneSTRING && !isSkip)
             ((char *) li->buffer)[listLen] = '\0'; // 0 terminate
         }
 
     doneLine:
+      PROFILE (++vf->profile->nRead[(int)t] ; vf->profile->bytesRead[(int)t] += ftello (vf->f) - profStart ;)
 
       { U8 peek = getc(vf->f) ; // check if next line is a comment - if so then read it
 	ungetc(peek, vf->f) ;
@@ -1226,12 +1519,16 @@ char oneReadLine (OneFile *vf)
 	if (peek == '/') // a comment
 	  { OneField keepField0 = vf->field[0] ;
 	    I64 keepNbits = vf->nBits ; // will be reset in readLine
+	    bool keepCompact = vf->isIntListCompact ;
 	    oneReadLine (vf) ; // read comment line into vf->info['/']->buffer
 	    vf->lineType = t ;
 	    vf->field[0] = keepField0 ;
 	    vf->nBits = keepNbits ;
+	    vf->isIntListCompact = keepCompact ;
 	  }
       }
+
+      if (isSkip) goto nextLine ;
     }
 
   return t;
@@ -1251,14 +1548,23 @@ void *_oneList (OneFile *vf)
   OneInfo *li = vf->info[(int) vf->lineType] ;
 
   if (vf->nBits)
-    { if (li->fieldType[li->listField] == oneINT_LIST) // first elt is already in buffer
+    { PROFILE (double t0 = profileClock () ;)
+      if (li->fieldType[li->listField] == oneINT_LIST) // first elt is already in buffer
 	{ vcDecode (li->listCodec, vf->nBits, vf->codecBuf, (char*)&(((I64*)li->buffer)[1])) ;
 	  decompactIntList (vf, oneLen(vf), li->buffer, vf->intListBytes) ;
 	}
       else
 	vcDecode (li->listCodec, vf->nBits, vf->codecBuf, li->buffer) ;
+      PROFILE (int t = vf->lineType ; OneProfile *p = vf->profile ;
+	       ++p->nDecode[t] ; p->decodeIn[t] += (vf->nBits+7) >> 3 ;
+	       p->decodeOut[t] += oneLen(vf) * li->listEltSize ;
+	       p->decodeTime[t] += profileClock () - t0 ;)
       vf->nBits = 0 ; // so we don't do it again
     }
+  else if (vf->isIntListCompact)
+    { decompactIntList (vf, oneLen(vf), li->buffer, vf->intListBytes) ;
+      vf->isIntListCompact = false ;
+    }
   
   return li->buffer ;
 }
@@ -1268,8 +1574,13 @@ void *_oneCompressedList (OneFile *vf)
   OneInfo *li = vf->info[(int) vf->lineType] ;
 
   if (!vf->nBits && oneLen(vf) > 0)      // need to compress
-    vf->nBits = vcEncode (li->listCodec, oneLen(vf),
-			  vf->info[(int) vf->lineType]->buffer, vf->codecBuf);
+    { PROFILE (double t0 = profileClock () ;)
+      vf->nBits = vcEncode (li->listCodec, oneLen(vf),
+			    vf->info[(int) vf->lineType]->buffer, vf->codecBuf);
+      PROFILE (int t = vf->lineType ; OneProfile *p = vf->profile ;
+	       ++p->nEncode[t] ; p->encodeIn[t] += oneLen(vf) ; p->encodeOut[t] += (vf->nBits+7) >> 3 ;
+	       p->encodeTime[t] += profileClock () - t0 ;)
+    }
 
   return (void*) vf->codecBuf ;
 }
@@ -1348,42 +1659,124 @@ OneFile *readThreadMake (OneFile *vfOld, OneSchema *vs0, FILE **files)
  **********************************************************************************/
 
 OneFile *oneFileOpenRead (const char *path, OneSchema *vsArg, const char *fileType, int nthreads)
+{
+  FILE    *f ;
+  char    *localPath = (char*) path ;
+  OneFile *vf ;
+
+  if (strcmp (path, "-") == 0)
+    f = stdin;
+  else
+    { f = fopen (path, "r");
+      if (!f && fileType)
+	{ localPath = new (strlen(path) + strlen(fileType) + 2, char) ;
+	  strcpy (localPath, path) ; strcat (localPath, ".") ; strcat (localPath, fileType) ;
+	  f = fopen (localPath, "r") ;
+	}
+      if (!f)
+	{ if (localPath != path) free (localPath) ;
+	  return 0 ;
+	}
+    }
+
+  vf = openReadStream (f, localPath, 0, vsArg, fileType, nthreads) ;
+  if (localPath != path) free (localPath) ;
+  return vf ;
+}
+
+static OneFile *openReadSource (OneIOSource *src, const char *name, OneSchema *vsArg,
+				const char *fileType, int nthreads)
+{ // opens the master stream on src, which is released on failure without closing its handle
+  FILE    *f = ioSourceStream (src, name, "r") ;
+  OneFile *vf = 0 ;
+
+  if (!f)
+    snprintf (errorString, 1024, "ONEcode file open error %s: failed to open stream\n", name) ;
+  else
+    vf = openReadStream (f, name, src, vsArg, fileType, nthreads) ;
+  if (!vf)
+    { src->io.close = 0 ;
+      ioSourceRelease (src) ;
+    }
+  return vf ;
+}
+
+OneFile *oneFileOpenReadIO (OneIO *io, void *handle, OneSchema *vsArg,
+			    const char *fileType, int nthreads)
+{
+  if (!io || !io->read)
+    { snprintf (errorString, 1024, "ONEcode file open error: OneIO has no read function\n") ;
+      return NULL ;
+    }
+  if (nthreads > 1 && !io->seek)
+    { snprintf (errorString, 1024, "ONEcode file open error: parallel read needs OneIO seek\n") ;
+      return NULL ;
+    }
+  return openReadSource (ioSourceCreate (io, handle), "<OneIO>", vsArg, fileType, nthreads) ;
+}
+
+OneFile *oneFileOpenReadMmap (const char *path, OneSchema *vsArg, const char *fileType, int nthreads)
+{
+  struct stat status ;
+  void       *image ;
+  int         fd = open (path, O_RDONLY) ;
+
+  if (fd < 0 || fstat (fd, &status) < 0 || !S_ISREG(status.st_mode) || !status.st_size)
+    { if (fd >= 0) close (fd) ;
+      return oneFileOpenRead (path, vsArg, fileType, nthreads) ; // stdio handles all other cases
+    }
+  image = mmap (0, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0) ;
+  close (fd) ; // the mapping remains valid
+  if (image == MAP_FAILED)
+    return oneFileOpenRead (path, vsArg, fileType, nthreads) ;
+
+  OneIOSource *src = ioSourceCreate (0, 0) ;
+  src->image  = image ;
+  src->size   = status.st_size ;
+  src->isMmap = true ;
+  return openReadSource (src, path, vsArg, fileType, nthreads) ;
+}
+
+OneFile *oneFileOpenReadBuffer (const void *buf, size_t size, OneSchema *vsArg,
+				const char *fileType, int nthreads)
+{
+  if (!buf || !size)
+    { snprintf (errorString, 1024, "ONEcode file open error <buffer>: buffer is empty\n") ;
+      return NULL ;
+    }
+  OneIOSource *src = ioSourceCreate (0, 0) ;
+  src->image = buf ;
+  src->size  = size ;
+  return openReadSource (src, "<buffer>", vsArg, fileType, nthreads) ;
+}
+
+  // path is used for error messages and vf->fileName, and the slave streams if nthreads > 1
+  //   are opened on src if non-zero, else on path. f is closed on failure, but not src.
+
+static OneFile *openReadStream (FILE *f, const char *path, OneIOSource *src, OneSchema *vsArg,
+				const char *fileType, int nthreads)
 {
   OneFile   *vf ;
   off_t      startOff = 0, footOff;
   OneSchema *vsFile ;                // will be used to build schema from file
   OneSchema *vs0 ;                   // needed when making slave thread entries
   bool       isBareFile = false ;
-  char      *localPath = (char*) path ;
 
   assert (fileType == NULL || strlen(fileType) > 0) ;
 
-  // first open the file, read first header line if it exists, and create the OneFile object
+  // first read first header line if it exists, and create the OneFile object
   
-  { FILE *f ;
-    int   curLine = 0 ;
+  { int   curLine = 0 ;
     U8    c ;
 
-    if (strcmp (path, "-") == 0)
-      f = stdin;
-    else
-      { f = fopen (path, "r");
-	if (!f && fileType)
-	  { char *localPath = malloc (strlen(path) + strlen(fileType) + 2) ;
-	    strcpy (localPath, path) ; strcat (localPath, ".") ; strcat (localPath, fileType) ;
-	    f = fopen (localPath, "r") ;
-	  }
-	if (!f) return 0 ;
-      }
-    
 #define OPEN_ERROR1(x) \
-    { snprintf (errorString, 1024, "ONEcode file open error %s: %s\n", localPath, x) ; \
-      fclose(f) ; if (localPath != path) free(localPath) ; return NULL; }
+    { snprintf (errorString, 1024, "ONEcode file open error %s: %s\n", path, x) ; \
+      fclose(f) ; return NULL; }
 #define OPEN_ERROR3(x,y,z) \
-    { int nChar = snprintf (errorString, 1024, "ONEcode file open error %s: ", localPath) ; \
+    { int nChar = snprintf (errorString, 1024, "ONEcode file open error %s: ", path) ; \
     nChar += snprintf (errorString+nChar, 1024-nChar, x,y,z) ; \
     snprintf (errorString+nChar, 1024-nChar, "\n") ; \
-    fclose(f) ; if (localPath != path) free(localPath) ; return NULL ; }
+    fclose(f) ; return NULL ; }
     
     c = getc(f);
     if (feof(f))
@@ -1425,7 +1818,7 @@ OneFile *oneFileOpenRead (const char *path, OneSchema *vsArg, const char *fileTy
     
     vf->f = f;
     vf->line = curLine;
-    vf->fileName = strdup(localPath) ;
+    vf->fileName = strdup(path) ;
   }
 
   // read header and (optionally) footer
@@ -1454,12 +1847,12 @@ OneFile *oneFileOpenRead (const char *path, OneSchema *vsArg, const char *fileTy
       if (isBareFile) // can't have any special header lines
 	{ snprintf (errorString, 1024,
 		   "ONEcode file open error %s: if header exists it must begin with '1' line\n",
-		   localPath) ;
+		   path) ;
 	  oneFileDestroy (vf) ;
-	  if (localPath != path) free(localPath) ;
 	  return 0 ;
 	}
 
+      off_t lineStart = ftello (vf->f) ; // so we can record the sizes of footer lines
       oneReadLine(vf);  // can't fail because we checked file eof already
 
       switch (vf->lineType)
@@ -1598,6 +1991,7 @@ OneFile *oneFileOpenRead (const char *path, OneSchema *vsArg, const char *fileTy
 
           if (fseeko (vf->f, footOff, SEEK_SET) != 0)
             die ("ONE file error: can't seek to start of footer");
+	  vf->footerStart = footOff ;
 
           break;
 
@@ -1612,11 +2006,15 @@ OneFile *oneFileOpenRead (const char *path, OneSchema *vsArg, const char *fileTy
 	    assert (li->indexSize == oneLen(vf)) ;
 	    assert (li->index) ;
 	    memcpy (li->index, oneIntList(vf), oneLen(vf)*sizeof(I64)) ; // space allocated above
+	    li->indexBytes += ftello (vf->f) - lineStart ;
 	  }
           break;
 
         case ';':
-          vf->info[(int) oneChar(vf,0)]->listCodec = vcDeserialize (oneString(vf));
+	  { OneInfo *li = vf->info[(int) oneChar(vf,0)] ;
+	    li->listCodec = vcDeserialize (oneString(vf));
+	    li->codecBytes += ftello (vf->f) - lineStart ;
+	  }
           break;
 
         default:
@@ -1628,9 +2026,8 @@ OneFile *oneFileOpenRead (const char *path, OneSchema *vsArg, const char *fileTy
 
   if (!isBareFile && vsArg && !oneFileCheckSchema (vf, vsArg, false)) // check schema intersection
     { snprintf (errorString, 1024,
-		"ONEcode file open error %s: schema mismatch to code requirement\n", localPath) ;
+		"ONEcode file open error %s: schema mismatch to code requirement\n", path) ;
       oneFileDestroy (vf) ;
-      if (localPath != path) free(localPath) ; 
       return NULL ;
     }
 
@@ -1661,9 +2058,12 @@ OneFile *oneFileOpenRead (const char *path, OneSchema *vsArg, const char *fileTy
     { int i ;
       FILE **files = new (nthreads, FILE*) ;
 
-      if (strcmp (path, "-") == 0) die ("ONE error: parallel input incompatible with stdin as input");
+      if (!src && strcmp (path, "-") == 0)
+	die ("ONE error: parallel input incompatible with stdin as input");
 
-      for (i = 1 ; i < nthreads ; ++i) files[i] = fopen (path, "r") ;
+      for (i = 1 ; i < nthreads ; ++i)
+	if (!(files[i] = ioSourceStream (src, path, "r")))
+	  die ("ONE error: failed to open stream %d for parallel input", i) ;
       vf->share = nthreads ;
       vf = readThreadMake (vf, vs0, files) ;
       free (files) ;
@@ -1671,8 +2071,8 @@ OneFile *oneFileOpenRead (const char *path, OneSchema *vsArg, const char *fileTy
 
   if (!isBareFile)
     oneSchemaDestroy (vs0) ;
-    
-  if (localPath != path) free(localPath) ; 
+
+  vf->ioSource = src ; // master takes ownership
   return vf;
 }
 
@@ -1703,13 +2103,37 @@ OneFile *oneFileReopenRead (OneFile *vf)
   oneFileCleanupSlaves (vf) ;
   vf->isFinal = false ; // so we can now read it again
   vf->isWrite = false ; // now it will be readonly
+  { int i ;              // ensure the read buffers can hold the longest lists written
+    for (i = 0 ; i < 128 ; ++i)
+      { OneInfo *li = vf->info[i] ;
+	if (!li || !li->listEltSize || li->isUserBuf) continue ;
+	if (li->bufSize <= li->accum.max)
+	  { if (li->buffer) free (li->buffer) ;
+	    li->bufSize = li->accum.max + 1 ;
+	    li->buffer  = new (li->bufSize*li->listEltSize, void) ;
+	  }
+	if (li->listCodec && vf->codecBufSize <= li->accum.max*li->listEltSize)
+	  { free (vf->codecBuf) ;
+	    vf->codecBufSize = li->accum.max*li->listEltSize + 1 ;
+	    vf->codecBuf     = new (vf->codecBufSize, void) ;
+	  }
+      }
+  }
   oneGoto (vf, 0, 0) ; // go to start of data
-  if (vf->share == 1)
+  if (vf->share <= 1) // share is 0 for a single-threaded OneFile
     return vf ;
   else
     { OneSchema *vs0 = oneSchema (vf) ; // need this because of how oneFileCreate() works
-      return readThreadMake (vf, vs0, vf->tempReadFiles) ; // use the cached file handles
+      if (!vf->tempReadFiles && vf->ioSource) // written through a OneIO: open new streams on it
+	{ int i ;
+	  vf->tempReadFiles = new (vf->share, FILE*) ;
+	  for (i = 1 ; i < vf->share ; ++i)
+	    if (!(vf->tempReadFiles[i] = ioSourceStream (vf->ioSource, 0, "r")))
+	      die ("ONE error: failed to open stream %d for parallel reopen", i) ;
+	}
+      vf = readThreadMake (vf, vs0, vf->tempReadFiles) ; // use the cached file handles
       oneSchemaDestroy (vs0) ;
+      return vf ;
     }
 }
 
@@ -1753,6 +2177,7 @@ bool oneGoto (OneFile *of, char lineType, I64 i)
 
   I64 byte = li->index[i] ;
   if (fseek (of->f, byte, SEEK_SET) != 0) return false ;
+  PROFILE (++of->profile->nGoto ;)
 
   li->accum.count = i ? i-1 : 0 ;
 
@@ -1814,11 +2239,14 @@ static inline void allocateIndices (OneFile *vf, int i, I64 size)
     }
 }
 
+static OneFile *openWriteStream (FILE *f, const char *path, OneIOSource *src,
+				 OneSchema *vs, const char *fileType, bool isBinary,
+				 int nthreads, const char *tempPrefix, FILE **tempReadFiles) ;
+
 OneFile *oneFileOpenWriteNew (const char *path, OneSchema *vs, const char *fileType,
                               bool isBinary, int nthreads)
 { OneFile   *vf ;
   FILE      *f, **tempReadFiles = 0 ;
-  OneSchema *vs0 = vs ; // needed here because call to oneFileCreate changes vs
   char      *tempPath, *template ; // used for temporary files (thread files and if path is a dir)
 
   tempPath = new(strlen(path)+12, char) ;
@@ -1833,7 +2261,7 @@ OneFile *oneFileOpenWriteNew (const char *path, OneSchema *vs, const char *fileT
 	{ *template++ = '/' ;
 	  strcpy (template, "oneXXXXXX") ;
 	  int fd = mkstemp (tempPath) ;
-	  if (fd == -1) return NULL ;
+	  if (fd == -1) { free (tempPath) ; return NULL ; }
 	  f = fdopen (fd, "w+") ;
 	  if (nthreads > 1)
 	    { tempReadFiles = new (nthreads, FILE*) ;
@@ -1843,19 +2271,72 @@ OneFile *oneFileOpenWriteNew (const char *path, OneSchema *vs, const char *fileT
 	    }
 	  if (unlink(tempPath) < 0)
 	    die ("ONEfile error: failed to unlink temporary file %s for parallel write", tempPath) ;
+	  *template = 0 ; // slave temporary files go in the directory too
 	}
       else
 	{ f = fopen (path, "w");
-	  if (f == NULL) return NULL ;
+	  if (f == NULL) { free (tempPath) ; return NULL ; }
 	}
     }
 
+  vf = openWriteStream (f, path, 0, vs, fileType, isBinary, nthreads, tempPath, tempReadFiles) ;
+  free (tempPath) ;
+  return vf ;
+}
+
+OneFile *oneFileOpenWriteIO (OneIO *io, void *handle, OneSchema *vs, const char *fileType,
+			     bool isBinary, int nthreads)
+{ OneIOSource *src ;
+  FILE        *f ;
+  OneFile     *vf ;
+
+  if (!io || !io->write)
+    { snprintf (errorString, 1024, "ONEcode file open error: OneIO has no write function\n") ;
+      return NULL ;
+    }
+  src = ioSourceCreate (io, handle) ;
+  f = ioSourceStream (src, 0, "w+") ;
+  if (!f || !(vf = openWriteStream (f, "<OneIO>", src, vs, fileType, isBinary, nthreads, 0, 0)))
+    { if (f) fclose (f) ;
+      src->io.close = 0 ; // failed, so leave closing the handle to the caller
+      ioSourceRelease (src) ;
+      return NULL ;
+    }
+  return vf ;
+}
+
+OneFile *oneFileOpenWriteBuffer (void **bufp, size_t *sizep, OneSchema *vs, const char *fileType,
+				 bool isBinary, int nthreads)
+{ MemIO   *m ;
+  OneFile *vf ;
+
+  if (!bufp || !sizep) die ("ONE error: oneFileOpenWriteBuffer needs non-zero bufp and sizep") ;
+  *bufp = 0 ; *sizep = 0 ;
+  m = new0 (1, MemIO) ;
+  if (!(vf = oneFileOpenWriteIO (&memIO, m, vs, fileType, isBinary, nthreads)))
+    { free (m) ; return NULL ; }
+  m->bufp  = bufp ;
+  m->sizep = sizep ;
+  free (vf->fileName) ; vf->fileName = strdup ("<buffer>") ;
+  return vf ;
+}
+
+  // path is used for vf->fileName; if tempPrefix is non-zero then slaves write to unlinked
+  //   temporary files named tempPrefix + "oneXXXXXX", else to private memory streams
+
+static OneFile *openWriteStream (FILE *f, const char *path, OneIOSource *src,
+				 OneSchema *vs, const char *fileType, bool isBinary,
+				 int nthreads, const char *tempPrefix, FILE **tempReadFiles)
+{ OneFile   *vf ;
+  OneSchema *vs0 = vs ; // needed here because call to oneFileCreate changes vs
+
   vf = oneFileCreate (&vs, fileType) ;
   if (!vf) return NULL ;
 
   initialiseStats (vf) ;
   
   vf->f = f;
+  vf->ioSource = src ;
   vf->fileName = strdup (path) ;
   vf->isWrite  = true;
   vf->isBinary = isBinary;
@@ -1871,7 +2352,12 @@ OneFile *oneFileOpenWriteNew (const char *path, OneSchema *vs, const char *fileT
   if (nthreads > 1)
     { OneFile *v, *vf0 = vf ;
       int      i ;
-      char     name[100] ;
+      char    *tempPath = 0 ;
+
+      if (tempPrefix)
+	{ tempPath = new (strlen(tempPrefix)+12, char) ;
+	  strcpy (tempPath, tempPrefix) ;
+	}
 
       vf->share = nthreads ;
       if (tempReadFiles) vf->tempReadFiles = tempReadFiles ;
@@ -1898,22 +2384,28 @@ OneFile *oneFileOpenWriteNew (const char *path, OneSchema *vs, const char *fileT
 
           v->share = -i; // this is the key mark for the i'th slave
 
-	  strcpy (template, "oneXXXXXX") ;
-	  int fd = mkstemp (tempPath) ;
-	  if (fd == -1) return NULL ;
-	  f = fdopen (fd, "w+") ;
-          if (f == NULL)
-            die ("ONEfile error: cannot create temporary file %s for parallel write", name) ;
-	  if (unlink(tempPath) < 0)
-	    die ("ONEfile error: failed to unlink temporary file %s for parallel write", name) ;
+	  if (tempPath)
+	    { strcpy (tempPath + strlen(tempPrefix), "oneXXXXXX") ;
+	      int fd = mkstemp (tempPath) ;
+	      if (fd == -1)
+		die ("ONEfile error: cannot create temporary file %s for parallel write", tempPath) ;
+	      f = fdopen (fd, "w+") ;
+	      if (f == NULL)
+		die ("ONEfile error: cannot open temporary file %s for parallel write", tempPath) ;
+	      if (unlink(tempPath) < 0)
+		die ("ONEfile error: failed to unlink temporary file %s for parallel write", tempPath) ;
+	    }
+	  else if (!(f = memStream ()))
+	    die ("ONEfile error: cannot create memory stream for parallel write") ;
 	  v->f = f ;
 
 	  vf[i] = *v ;
 	  free (v) ;
 	}
+
+      if (tempPath) free (tempPath) ;
     }
 
-  free (tempPath) ;
   return vf;
 }
 
@@ -2398,6 +2890,7 @@ void oneWriteLine (OneFile *vf, char t, I64 listLen, void *listBuf)
 	{ fputc ('\n', vf->f) ;
 	  vf->byte = ftello (vf->f) ;
 	}
+      PROFILE (I64 profStart = vf->byte ;)
 
       if (li->isObject) // update index
 	{ if (li->accum.count >= li->indexSize)
@@ -2452,7 +2945,11 @@ void oneWriteLine (OneFile *vf, char t, I64 listLen, void *listBuf)
 		  vf->codecBufSize = listSize+1;
 		  vf->codecBuf     = new (vf->codecBufSize, void);
 		}
+	      PROFILE (double t0 = profileClock () ;)
 	      nBits = vcEncode (li->listCodec, listSize, listBuf, vf->codecBuf);
+	      PROFILE (++vf->profile->nEncode[(int)t] ; vf->profile->encodeIn[(int)t] += listSize ;
+		       vf->profile->encodeOut[(int)t] += (nBits+7) >> 3 ;
+		       vf->profile->encodeTime[(int)t] += profileClock () - t0 ;)
 	      vf->byte += ltfWrite (nBits, vf->f) ;
 	      if (fwrite (vf->codecBuf, ((nBits+7) >> 3), 1, vf->f) != 1)
 		die ("ONE write error: failed to write compressed list nBits %lld", nBits);
@@ -2464,13 +2961,18 @@ void oneWriteLine (OneFile *vf, char t, I64 listLen, void *listBuf)
 		     li->listField, listLen, listSize, listBuf);
 	      vf->byte += listSize;
 	      if (li->listCodec != NULL)
-		{ vcAddToTable (li->listCodec, listSize, listBuf);
+		{ PROFILE (double t0 = profileClock () ;)
+		  vcAddToTable (li->listCodec, listSize, listBuf);
 		  li->listTack += listSize;
+		  PROFILE (vf->profile->trainBytes[(int)t] += listSize ;
+			   vf->profile->trainTime[(int)t] += profileClock () - t0 ;)
 		  
 		  if (li->listTack > vf->codecTrainingSize)
-		    { if (vf->share == 0)
+		    { PROFILE (double t0 = profileClock () ;)
+		      if (vf->share == 0)
 			{ vcCreateCodec (li->listCodec, 1);
 			  li->isUseListCodec = true;
+			  PROFILE (++vf->profile->nTrain[(int)t] ;)
 			}
 		      else
 			{ OneFile  *ms;
@@ -2498,6 +3000,7 @@ void oneWriteLine (OneFile *vf, char t, I64 listLen, void *listBuf)
 				    vcAddHistogram (lx->listCodec,
 						    ms[i].info[(int) t]->listCodec);
 				  vcCreateCodec (lx->listCodec, 1);
+				  PROFILE (++vf->profile->nTrain[(int)t] ;)
 				  for (i = 1; i < ms->share; i++)
 				    { OneCodec *m = ms[i].info[(int) t]->listCodec;
 				      ms[i].info[(int) t]->listCodec = lx->listCodec;
@@ -2511,12 +3014,14 @@ void oneWriteLine (OneFile *vf, char t, I64 listLen, void *listBuf)
 			  
 			  pthread_mutex_unlock(&ms->listLock);
 			}
+		      PROFILE (vf->profile->trainTime[(int)t] += profileClock () - t0 ;)
 		    }
 		}
 	    }
 	}
 
     doneLine:
+      PROFILE (++vf->profile->nWrite[(int)t] ; vf->profile->bytesWritten[(int)t] += vf->byte - profStart ;)
 
       vf->isLastLineBinary = true;
     }
@@ -2528,6 +3033,7 @@ void oneWriteLine (OneFile *vf, char t, I64 listLen, void *listBuf)
 
       if (!vf->isLastLineBinary)      // terminate previous ascii line
 	fputc ('\n', vf->f);
+      PROFILE (off_t profStart = ftello (vf->f) ;)
 
       ++vf->line ; // only really needed when closing the file to see if we need to terminate it
       
@@ -2574,6 +3080,7 @@ void oneWriteLine (OneFile *vf, char t, I64 listLen, void *listBuf)
               writeStringList (vf, t, listLen, listBuf);
             break;
         }
+      PROFILE (++vf->profile->nWrite[(int)t] ; vf->profile->bytesWritten[(int)t] += ftello (vf->f) - profStart ;)
       vf->isLastLineBinary = false;
     }
 }
@@ -2678,22 +3185,15 @@ static void oneWriteFooter (OneFile *vf)
   //   accumulating counts/statistics for the file and merge thread stats into those for
   //   the master file (if a parallel OneFile).
 
-void oneFinalizeCounts(OneFile *vf)
+  // Merges the counts/statistics and indices of the slave threads of a parallel OneFile into
+  //   the master.  If isFinal, objects still open at the end of the last thread are closed,
+  //   else they are carried back into the master, to be continued by the next round of lines.
+
+static void mergeThreadCounts (OneFile *vf, bool isFinal)
 { int      ii, j, k ;
   OneInfo *li, *lk;
 
-  if (vf->share < 0)
-    die ("ONE write error: cannot call oneFileClose on a slave OneFile");
-
-  vf->isFinal = true; // needed to prevent infinite recursion
-
-  if (vf->share == 0)
-    { while (vf->objectFrame)
-	endObject (vf, vf->openObjects[vf->objectFrame]) ; // terminate open objects
-      return; 
-    }
-
-  int nthreads = vf->share; // if we get here then nthreads > 1
+  int nthreads = vf->share;
   
   // first we need to complete any objects left open at the end of files and update max count/total
   OneFile *vk, *vk1 ;
@@ -2723,7 +3223,7 @@ void oneFinalizeCounts(OneFile *vf)
 	    }
 	  --vk1->objectFrame ;
 	}
-      if (k == nthreads-1) // close any remaining open objects at the end of the final file
+      if (isFinal && k == nthreads-1) // close any remaining open objects at the end of the final file
 	while (vk->objectFrame)
 	  endObject (vk, vk->openObjects[vk->objectFrame]) ;
       
@@ -2732,7 +3232,7 @@ void oneFinalizeCounts(OneFile *vf)
 	{ int i = vf->defnOrder[ii] ;
 	  if (i & 0x80) continue ; // skip 'G' lines
 	  li = vf->info[i] ;
-	  if (li->isObject)
+	  if (li->isObject && li->stats && vk->info[i]->stats) // no stats when reading ascii
 	    for (s = li->stats, s1 = vk->info[i]->stats ; s->type ; ++s, ++s1)
 	      { if (s1->maxCount > s->maxCount) s->maxCount = s1->maxCount ;
 		if (s->isList && s1->maxTotal > s->maxTotal) s->maxTotal = s1->maxTotal ;
@@ -2754,7 +3254,8 @@ void oneFinalizeCounts(OneFile *vf)
 	}
 
       // finally stitch together the index - need to have fixed li->accum.count first
-      if (vf->isBinary && li->isObject)
+      // readers share the index from the file, so only do this when writing
+      if (vf->isWrite && vf->isBinary && li->isObject)
 	{ I64 oldIndexSize = li->indexSize ;
 	  li->indexSize = li->accum.count+1 ;
 	  resize (li->index, oldIndexSize, li->indexSize, I64) ;
@@ -2769,6 +3270,118 @@ void oneFinalizeCounts(OneFile *vf)
 	    }
 	}
     }
+
+  if (!isFinal) // carry objects open at the end of the last thread back into the master
+    { vk = &vf[nthreads-1] ;
+      for (j = 1 ; j <= vk->objectFrame ; ++j)
+	{ lk = vk->openObjects[j] ;
+	  int i ;
+	  for (i = 'A' ; i <= 'z' ; ++i) if (vk->info[i] == lk) break ;
+	  if (i <= 'z') li = vf->info[i] ; else die ("failed to find li") ;
+	  for (s = li->stats, s1 = lk->stats ; s->type ; ++s, ++s1) // restate start in master coords
+	    { s->count = vf->info[(int)s->type]->accum.count
+		- vk->info[(int)s->type]->accum.count + s1->count ;
+	      if (s->isList)
+		s->total = vf->info[(int)s->type]->accum.total
+		  - vk->info[(int)s->type]->accum.total + s1->total ;
+	    }
+	  vf->openObjects[++vf->objectFrame] = li ;
+	}
+      vk->objectFrame = 0 ;
+    }
+}
+
+  // After all input has been read, or all data has been written, this routine will finish
+  //   accumulating counts/statistics for the file and merge thread stats into those for
+  //   the master file (if a parallel OneFile).
+
+void oneFinalizeCounts(OneFile *vf)
+{
+  if (vf->share < 0)
+    die ("ONE write error: cannot call oneFileClose on a slave OneFile");
+
+  vf->isFinal = true; // needed to prevent infinite recursion
+
+  if (vf->share == 0)
+    { while (vf->objectFrame)
+	endObject (vf, vf->openObjects[vf->objectFrame]) ; // terminate open objects
+      return; 
+    }
+
+  mergeThreadCounts (vf, true) ; // if we get here then nthreads > 1
+}
+
+static void catThreadFiles (OneFile *vf) // appends the slave files to vf->f and rewinds them
+{ int   i ;
+  I64   size, n ;
+  char *buf = new (10000000, char);
+
+  for (i = 1; i < vf->share; i++)
+    { size = ftello (vf[i].f) ; // NB slave files are reused, so may extend beyond this
+      if (fseek (vf[i].f, 0L, SEEK_SET) != 0)
+	die ("ONEfile error: failed to rewind parallel file %d", i) ;
+      while (size > 0)
+	{ n = size < 10000000 ? size : 10000000 ;
+	  if ((I64) fread (buf, 1, n, vf[i].f) != n)
+	    die ("ONE write error: failed to read back parallel file %d", i) ;
+	  if ((I64) fwrite (buf, 1, n, vf->f) != n)
+	    die ("ONE write error: while cat'ing thread bits (oneFileClose)");
+	  size -= n ;
+	}
+      if (fseek (vf[i].f, 0L, SEEK_SET) != 0)
+	die ("ONEfile error: failed to rewind parallel file %d", i) ;
+    }
+  free (buf) ;
+}
+
+  // Lines written so far by the slave threads are appended to the master file, in thread order,
+  //   and the slaves are reset to write the next round.  This lets an ordered stream be written
+  //   in parallel, by giving each thread successive batches and merging after each round.
+
+void oneMergeThreads (OneFile *vf)
+{ int      i, ii ;
+  OneInfo *li ;
+  OneStat *s ;
+
+  if (vf->share < 0)
+    die ("ONE write error: cannot call oneMergeThreads on a slave OneFile");
+  if (!vf->isWrite || vf->isFinal || vf->share == 0) return ;
+
+  if (!vf->isHeaderOut && (vf->isBinary || !vf->isNoAsciiHeader))
+    { writeHeader (vf) ;
+      if (vf->isBinary) // as in oneWriteLine(), so that index[0] is the start of the data
+	{ fputc ('\n', vf->f) ;
+	  vf->byte = ftello (vf->f) ;
+	  vf->isLastLineBinary = true ;
+	  for (i = 'A' ; i <= 'z' ; i++)
+	    if (vf->info[i] && vf->info[i]->index)
+	      vf->info[i]->index[0] = vf->byte ;
+	}
+    }
+
+  PROFILE (double t0 = profileClock () ; off_t off0 = ftello (vf->f) ;)
+  mergeThreadCounts (vf, false) ;
+  catThreadFiles (vf) ;
+  if (vf->isBinary) vf->byte = ftello (vf->f) ;
+  PROFILE (++vf->profile->nMerge ; vf->profile->mergeBytes += ftello (vf->f) - off0 ;
+	   vf->profile->mergeTime += profileClock () - t0 ;)
+
+  for (i = 1 ; i < vf->share ; ++i) // reset the slaves as if newly opened
+    { OneFile *v = &vf[i] ;
+      for (ii = 0 ; ii < v->nDefn ; ++ii)
+	{ if (v->defnOrder[ii] & 0x80) continue ; // skip 'G' lines
+	  li = v->info[v->defnOrder[ii]] ;
+	  li->accum.count = li->accum.max = li->accum.total = 0 ;
+	  li->isFirst = true ;
+	  li->isClosed = false ;
+	  if (li->stats)
+	    for (s = li->stats ; s->type ; ++s)
+	      s->count = s->count0 = s->maxCount = s->total = s->total0 = s->maxTotal = 0 ;
+	}
+      vf->line += v->line ; v->line = 0 ;
+      v->byte = 0 ;
+      v->isLastLineBinary = v->isBinary ;
+    }
 }
 
 //
@@ -2781,17 +3394,10 @@ static void oneFinalize (OneFile *vf)
   if (!vf->isHeaderOut && (vf->isBinary || !vf->isNoAsciiHeader)) writeHeader (vf) ;
       
   if (vf->share > 0)
-    { int  i, nread ;
-      char *buf;
-      buf = new (10000000, char);
-      for (i = 1; i < vf->share; i++)
-	{ if (fseek (vf[i].f, 0L, SEEK_SET) != 0)
-	    die ("ONEfile error: failed to rewind parallel file %d", i) ;
-	  while (!feof(vf[i].f) && (nread = fread (buf,1,10000000,vf[i].f)) > 0)
-	    if ((int) fwrite(buf,1,nread,vf->f) != nread)
-	      die ("ONE write error: while cat'ing thread bits (oneFileClose)");
-	}
-      free(buf);
+    { PROFILE (double t0 = profileClock () ; off_t off0 = ftello (vf->f) ;)
+      catThreadFiles (vf) ;
+      PROFILE (++vf->profile->nMerge ; vf->profile->mergeBytes += ftello (vf->f) - off0 ;
+	       vf->profile->mergeTime += profileClock () - t0 ;)
     }
 
   if (vf->isBinary || vf->line)
@@ -2809,10 +3415,76 @@ void oneFileClose (OneFile *vf)
 
   if (vf->isWrite)
     oneFinalize (vf) ;
+  PROFILE (if (vf->profile->atClose) oneProfileReport (vf, vf->profile->atClose) ;)
   
   oneFileDestroy (vf);
 }
 
+/***********************************************************************************
+ *
+ *  PERFORMANCE COUNTERS
+ *
+ **********************************************************************************/
+
+bool oneProfileAtClose (OneFile *vf, FILE *f)
+{
+#ifdef ONE_PROFILE
+  vf->profile->atClose = f ;
+  return true ;
+#else
+  (void) vf ; (void) f ;
+  snprintf (errorString, 1024, "ONElib was compiled without -DONE_PROFILE") ;
+  return false ;
+#endif
+}
+
+bool oneProfileReport (OneFile *vf, FILE *f)
+{
+#ifdef ONE_PROFILE
+  OneProfile p, *q ;
+  int   k, t, nThreads = vf->share > 0 ? vf->share : 1 ;
+
+  memset (&p, 0, sizeof(OneProfile)) ; // sum over the threads
+  for (k = 0 ; k < nThreads ; ++k)
+    { q = vf[k].profile ;
+#define ADD(X) for (t = 0 ; t < 128 ; ++t) p.X[t] += q->X[t]
+      ADD(nRead) ; ADD(bytesRead) ; ADD(nWrite) ; ADD(bytesWritten) ;
+      ADD(nTrain) ; ADD(trainBytes) ; ADD(trainTime) ;
+      ADD(nEncode) ; ADD(encodeIn) ; ADD(encodeOut) ; ADD(encodeTime) ;
+      ADD(nDecode) ; ADD(decodeIn) ; ADD(decodeOut) ; ADD(decodeTime) ;
+#undef ADD
+      p.nGoto += q->nGoto ; p.nSeek += q->nSeek ;
+      p.nRealloc += q->nRealloc ; p.reallocBytes += q->reallocBytes ;
+      p.nMerge += q->nMerge ; p.mergeBytes += q->mergeBytes ; p.mergeTime += q->mergeTime ;
+    }
+
+  fprintf (f, "profile %s threads %d\n", vf->fileName ? vf->fileName : "-", nThreads) ;
+  for (t = 0 ; t < 128 ; ++t)
+    { if (p.nRead[t] || p.nWrite[t])
+	fprintf (f, "  line %c read %lld bytes %lld  written %lld bytes %lld\n", t,
+		 p.nRead[t], p.bytesRead[t], p.nWrite[t], p.bytesWritten[t]) ;
+      if (p.trainBytes[t] || p.nTrain[t])
+	fprintf (f, "  codec %c train %lld bytes %lld time %.3f\n", t,
+		 p.nTrain[t], p.trainBytes[t], p.trainTime[t]) ;
+      if (p.nEncode[t])
+	fprintf (f, "  codec %c encode %lld bytes %lld -> %lld time %.3f\n", t,
+		 p.nEncode[t], p.encodeIn[t], p.encodeOut[t], p.encodeTime[t]) ;
+      if (p.nDecode[t])
+	fprintf (f, "  codec %c decode %lld bytes %lld -> %lld time %.3f\n", t,
+		 p.nDecode[t], p.decodeIn[t], p.decodeOut[t], p.decodeTime[t]) ;
+    }
+  fprintf (f, "  goto %lld seek %lld realloc %lld bytes %lld\n",
+	   p.nGoto, p.nSeek, p.nRealloc, p.reallocBytes) ;
+  if (p.nMerge)
+    fprintf (f, "  merge %lld bytes %lld time %.3f\n", p.nMerge, p.mergeBytes, p.mergeTime) ;
+  return true ;
+#else
+  (void) vf ; (void) f ;
+  snprintf (errorString, 1024, "ONElib was compiled without -DONE_PROFILE") ;
+  return false ;
+#endif
+}
+
 /***********************************************************************************
  *
  *  Length limited Huffman Compressor/decompressor with special 2-bit compressor for DNA
@@ -117,6 +117,8 @@ typedef struct
     char      binaryTypePack;   // binary code for line type, bit 8 set.
                                 //     bit 0: list compressed
     I64       listTack;         // accumulated training data for this threads codeCodec (master)
+    I64       indexBytes;       // bytes of the '&' index line for this type in a binary footer
+    I64       codecBytes;       // bytes of the ';' codec line for this type in a binary footer
   } OneInfo;
 
   // the schema type - the first record is the header spec, then a linked list of primary classes
@@ -140,6 +142,17 @@ typedef struct OneHeaderText
     struct OneHeaderText *nxt ;
   } OneHeaderText ;
 
+  // callbacks for a user-supplied I/O backend - see oneFileOpenReadIO() below
+
+typedef struct
+  { I64  (*read)  (void *handle, void *buf, I64 n) ;        // bytes read, 0 at end, -1 on error
+    I64  (*write) (void *handle, const void *buf, I64 n) ;  // bytes written, -1 on error
+    int  (*seek)  (void *handle, I64 offset, int whence) ;  // like fseeko(): 0 on success
+    I64  (*tell)  (void *handle) ;                          // current offset
+    I64  (*size)  (void *handle) ;                          // total size, -1 if unknown
+    int  (*close) (void *handle) ;                          // called when the OneFile closes
+  } OneIO ;
+
   // The main OneFile type - this is the primary handle used by the end user
 
 typedef struct
@@ -156,6 +169,7 @@ typedef struct
     char           lineType;           // current lineType
     I64            line;               // current line number
     I64            byte;               // current byte position when writing binary
+    I64            footerStart;        // binary file being read: byte offset of the footer
     OneProvenance *provenance;         // if non-zero then count['!'] entries
     OneReference  *reference;          // if non-zero then count['<'] entries
     OneReference  *deferred;           // if non-zero then count['>'] entries
@@ -169,6 +183,7 @@ typedef struct
     // fields below here are private to the package
 
     FILE  *f;
+    struct OneIOSource *ioSource;  // non-zero if f is a stream on a OneIO or memory backend
 
     bool   isWrite;                // true if open for writing
     bool   isHeaderOut;            // true if header already written
@@ -185,6 +200,9 @@ typedef struct
     char  *codecBuf;
     I64    nBits;                  // number of bits of list currently in codecBuf
     I64    intListBytes;           // number of bytes per integer in the compacted INT_LIST
+    bool   isIntListCompact;       // INT_LIST in buffer still compacted - _oneList() expands it
+    bool   isMask;                 // if set, oneReadLine() skips line types not in lineMask
+    bool   lineMask[128];
     I64    linePos;                // current line position
     OneHeaderText *headerText;     // arbitrary descriptive text that goes with the header
     OneInfo *openObjects[128];     // stack of infos for open objects
@@ -196,6 +214,7 @@ typedef struct
     pthread_mutex_t fieldLock;     // Mutexs to protect training accumumulation stats when threaded
     pthread_mutex_t listLock;
     FILE* *tempReadFiles;          // array of file pointers to be used by oneFileReopen()
+    struct OneProfile *profile;    // performance counters if compiled with -DONE_PROFILE
   } OneFile;                       // the footer will be in the concatenated result.
 
 
@@ -237,8 +256,8 @@ OneSchema *oneSchemaCreateFromText (const char *text) ;
   //      D Q 1 6 STRING                     the phred encoded quality score + ASCII 33
   //      D N 4 4 REAL 4 REAL 4 REAL 4 REAL  signal to noise ratio in A, C, G, T channels
   //      G g 2 3 INT 6 STRING               group designator: number of objects, name
-  // The ...FromText() alternative writes the text to a temp file and reads it with 
-  //   oneSchemaCreateFromFile(). This allows code to set the schema.
+  // The ...FromText() alternative parses the text directly from memory in the same way as
+  //   oneSchemaCreateFromFile(), without touching the filesystem. This allows code to set the schema.
   // Internally a schema is a linked list of OneSchema objects, with the first holding
   //   the (hard-coded) schema for the header and footer, and the remainder each 
   //   corresponding to one primary file type.
@@ -291,6 +310,13 @@ char oneReadLine (OneFile *of) ;
   //   if at the end of the data section.  The content macros immediately below are
   //   used to access the information of the line most recently read.
 
+bool oneSetLineTypeMask (OneFile *of, const char *lineTypes) ;
+
+  // Restrict oneReadLine() to the line types in the string lineTypes, e.g. "SI"; 0 removes
+  //   the restriction.  Binary lines of other types are passed by seeking over their lists,
+  //   which are neither read nor decoded, though their counts are still kept up to date.
+  //   Returns false for an unknown line type.  Set it on each OneFile of a threaded read.
+
 void   *_oneList (OneFile *of) ;                // lazy codec decompression if required
 void   *_oneCompressedList (OneFile *of) ;      // lazy codec compression if required
 
@@ -322,6 +348,28 @@ char *oneReadComment (OneFile *of);
   // Can be called after oneReadLine() to read any optional comment text after the fixed fields.
   // Returns NULL if there is no comment.
 
+OneFile *oneFileOpenReadMmap (const char *path, OneSchema *schema, const char *type, int nthreads) ;
+
+  // As oneFileOpenRead(), but memory maps the file and reads it from memory, which avoids
+  //   read system calls and lets many threads share one copy of the file in the page cache.
+  //   Falls back to oneFileOpenRead() if path can not be mapped, e.g. stdin or a pipe.
+
+OneFile *oneFileOpenReadIO (OneIO *io, void *handle, OneSchema *schema, const char *type,
+			    int nthreads) ;
+
+  // As oneFileOpenRead(), but reads through the callbacks in io, passing them handle.
+  //   Only read is required; binary files need seek and size (or seek and tell) to reach
+  //   the footer, and nthreads > 1 needs seek. Streams for threads share the handle and
+  //   keep their own positions, so calls on handle are serialised with a mutex.
+  //   io->close(handle), if given, is called by oneFileClose(), but not if the open fails.
+
+OneFile *oneFileOpenReadBuffer (const void *buf, size_t size, OneSchema *schema, const char *type,
+				int nthreads) ;
+
+  // As oneFileOpenRead(), but reads a complete ONE file image (e.g. as made by 
+  //   oneFileOpenWriteBuffer()) from memory, e.g. shared memory.  The buffer is not copied,
+  //   so it must remain valid and unchanged until oneFileClose().
+
 //  WRITING ONE FILES:
 
 OneFile *oneFileOpenWriteNew (const char *path, OneSchema *schema, const char *type,
@@ -353,6 +401,23 @@ OneFile *oneFileOpenWriteFrom (const char *path, OneFile *ofIn,
 
 OneFile *oneFileReopenRead (OneFile *of);  // see end of preceding paragraph
 
+OneFile *oneFileOpenWriteIO (OneIO *io, void *handle, OneSchema *schema, const char *type,
+			     bool isBinary, int nthreads) ;
+
+  // As oneFileOpenWriteNew(), but writes through the callbacks in io (see oneFileOpenReadIO()).
+  //   write is required, and seek and tell are needed for binary output. Slave data for
+  //   nthreads > 1 is held in memory rather than in temporary files.  If io has read then
+  //   oneFileReopenRead() can be used to read back the result.
+
+OneFile *oneFileOpenWriteBuffer (void **bufp, size_t *sizep, OneSchema *schema, const char *type,
+				 bool isBinary, int nthreads) ;
+
+  // As oneFileOpenWriteNew(), but writes a complete ONE file image, including the footer
+  //   and indexes if binary, into memory, with no temporary files even if nthreads > 1.
+  //   On oneFileClose() *bufp is set to a malloc'ed buffer holding the image, which the
+  //   user must free, and *sizep to its size (cf. open_memstream()).  The image can be
+  //   read with oneFileOpenReadBuffer(), or directly via oneFileReopenRead().
+
 bool oneInheritProvenance (OneFile *of, OneFile *source);
 bool oneInheritReference  (OneFile *of, OneFile *source);
 bool oneInheritDeferred   (OneFile *of, OneFile *source);
@@ -395,6 +460,12 @@ static inline void oneWriteLineFrom (OneFile *of, OneFile *source)
 }
   // utility to transfer a line from source through to ref without the local code knowing the schema
 
+void oneMergeThreads (OneFile *of);
+
+  // For a file opened for writing with nthreads > 1, appends all lines written so far by the
+  //   slaves (of+1, of+2, ...) to the master in thread order, and resets the slaves. Call when
+  //   no thread is writing. Lets threads write successive batches of an ordered stream in rounds.
+
 // CLOSING FILES (FOR BOTH READ & WRITE):
 
 void oneFileClose (OneFile *of);
@@ -449,6 +520,18 @@ void oneUserBuffer (OneFile *of, char lineType, void *buffer);
   //   (if any) is freed.  The user must ensure that a buffer they supply is large
   //   enough. BTW, this buffer is overwritten with each new line read of the given type.
 
+//  PERFORMANCE COUNTERS:
+
+bool oneProfileReport (OneFile *of, FILE *f) ;
+bool oneProfileAtClose (OneFile *of, FILE *f) ;
+
+  // If ONElib is compiled with -DONE_PROFILE, each OneFile counts the lines and bytes read and
+  //   written per line type, codec training, encoding and decoding (calls, bytes in and out,
+  //   and time), gotos and long seeks, list buffer reallocations, and the time taken to merge
+  //   the files of threads.  oneProfileReport() writes these to f now, summed over the threads
+  //   of a parallel OneFile; oneProfileAtClose() writes them from oneFileClose(), so as to
+  //   include the final merge.  Without ONE_PROFILE there is no cost, and both return false.
+
 /***********************************************************************************
  *
  *    A BIT ABOUT THE FORMAT OF BINARY FILES
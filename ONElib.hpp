@@ -14,43 +14,108 @@
 #define ONEfile_h
 
 #include <string>
+#include <string_view>
 #include <stdexcept>
 #include <vector>
+#include <cstring>
+#include <utility>
+#if __cplusplus >= 202002L
+#include <span>
+#endif
 using namespace std ;
 
+#include <cstdio>	// system headers used by ONElib.h, included here so that they
+#include <cstdarg>	//   declare into the global namespace rather than C_1F
+#include <climits>
+#include <pthread.h>
+
 namespace C_1F {	// private namespace for C interface
 extern "C" { 
 #include "ONElib.h"
 }
 }
 
+  // ONEspan<T> is std::span<T> under C++20, else a minimal equivalent.  Spans and string_views
+  //   returned below borrow the file's line buffer, so are only valid until the next readLine().
+
+#if __cplusplus >= 202002L
+template <class T> using ONEspan = std::span<T> ;
+#else
+template <class T> class ONEspan
+{
+  T *p ; size_t n ;
+ public:
+  ONEspan () : p(0), n(0) { }
+  ONEspan (T *ptr, size_t len) : p(ptr), n(len) { }
+  T*     data () const { return p ; }
+  size_t size () const { return n ; }
+  bool   empty () const { return n == 0 ; }
+  T&     operator[] (size_t i) const { return p[i] ; }
+  T*     begin () const { return p ; }
+  T*     end () const { return p + n ; }
+} ;
+#endif
+
 class ONEschema
 {
  private:
   C_1F::OneSchema *os ;
   
  public:
-  ONEschema (const string &text) { os = C_1F::oneSchemaCreateFromText (text.c_str()) ; }
-  ~ONEschema () { C_1F::oneSchemaDestroy (os) ; }
+  ONEschema (const string &text)
+    { os = C_1F::oneSchemaCreateFromText (text.c_str()) ;
+      if (os == NULL) { throw runtime_error("failed to create ONEschema") ; }
+    }
+  ~ONEschema () { if (os) C_1F::oneSchemaDestroy (os) ; }
+  ONEschema (const ONEschema&) = delete ; // owns os, so move-only
+  ONEschema& operator= (const ONEschema&) = delete ;
+  ONEschema (ONEschema &&other) noexcept : os (exchange (other.os, nullptr)) { }
+  ONEschema& operator= (ONEschema &&other) noexcept
+    { if (this != &other) { if (os) C_1F::oneSchemaDestroy (os) ; os = exchange (other.os, nullptr) ; }
+      return *this ;
+    }
 
   friend class ONEfile ; 
 } ;
 
+  // The strings of a STRING_LIST, iterated in place as string_views
+
+class ONEstringList
+{
+  const char *s0 ; int64_t n ;
+ public:
+  ONEstringList () : s0(0), n(0) { }
+  ONEstringList (const char *s, int64_t len) : s0(s), n(len) { }
+  int64_t     size () const { return n ; }
+  const char *data () const { return s0 ; } // the strings concatenated, each 0-terminated
+  class iterator
+  { const char *s ; int64_t i ;
+   public:
+    iterator (const char *str, int64_t k) : s(str), i(k) { }
+    string_view operator* () const { return string_view (s) ; }
+    iterator&   operator++ () { s += strlen(s) + 1 ; ++i ; return *this ; }
+    bool        operator!= (const iterator &o) const { return i != o.i ; }
+  } ;
+  iterator begin () const { return iterator (s0, 0) ; }
+  iterator end () const { return iterator (s0, n) ; }
+} ;
+
 class ONEfile
 {
  private:
   C_1F::OneFile *of ;
+  vector<char>   stringListBuf ; // reused by writeLine() for string lists
   
  public:
   ONEfile (const string &path) // just to open an existing file for reading with one thread
     { of = NULL ;
       of = C_1F::oneFileOpenRead (path.c_str(), 0, 0, 1) ;
-      if (of == NULL) { throw runtime_error("failed to open ONEfile") ; } 
+      if (of == NULL) { throw runtime_error(string("failed to open ONEfile: ") + C_1F::oneErrorString()) ; } 
     }
   ONEfile (const string &path, int nthreads) // open an existing file for reading with nthreads
     { of = NULL ;
       of = C_1F::oneFileOpenRead (path.c_str(), 0, 0, nthreads) ;
-      if (of == NULL) { throw runtime_error("failed to open ONEfile") ; } 
+      if (of == NULL) { throw runtime_error(string("failed to open ONEfile: ") + C_1F::oneErrorString()) ; } 
     }
   ONEfile (const string &path, const string &mode, const ONEschema &schema, const string &type, int nthreads) // full version
     { of = NULL ;
@@ -61,7 +126,7 @@ class ONEfile
 	of = C_1F::oneFileOpenWriteNew (path.c_str(), schema.os, tc, true, nthreads) ;
       else if (mode[0] == 'w' && mode.size() == 1)
 	of = C_1F::oneFileOpenWriteNew (path.c_str(), schema.os, tc, false, nthreads) ;
-      if (of == NULL) { throw runtime_error("failed to open ONEfile") ; } 
+      if (of == NULL) { throw runtime_error(string("failed to open ONEfile: ") + C_1F::oneErrorString()) ; } 
     }
   ONEfile (const string &path, const string &mode, ONEfile &from, int nthreads)
     { of = NULL ;
@@ -69,22 +134,90 @@ class ONEfile
 	of = C_1F::oneFileOpenWriteFrom (path.c_str(), from.of, true, nthreads) ;
       else if (mode[0] == 'w' && mode.size() == 1)
 	of = C_1F::oneFileOpenWriteFrom (path.c_str(), from.of, false, nthreads) ;
-      if (of == NULL) { throw runtime_error("failed to open ONEfile") ; } 
+      if (of == NULL) { throw runtime_error(string("failed to open ONEfile: ") + C_1F::oneErrorString()) ; } 
+    }
+  ~ONEfile () { if (of) C_1F::oneFileClose (of) ; }
+  ONEfile (const ONEfile&) = delete ; // owns of, so a copy would close it twice
+  ONEfile& operator= (const ONEfile&) = delete ;
+  ONEfile (ONEfile &&other) noexcept
+    : of (exchange (other.of, nullptr)), stringListBuf (std::move (other.stringListBuf)) { }
+  ONEfile& operator= (ONEfile &&other) noexcept
+    { if (this != &other)
+	{ if (of) C_1F::oneFileClose (of) ;
+	  of = exchange (other.of, nullptr) ;
+	  stringListBuf = std::move (other.stringListBuf) ;
+	}
+      return *this ;
     }
-  ~ONEfile () { C_1F::oneFileClose (of) ; }
 
   bool      checkSchema (ONEschema &schema, bool isRequired)
   { return C_1F::oneFileCheckSchema (of, schema.os, isRequired) ; }
   bool      checkSchemaText (const string &text)
     { return C_1F::oneFileCheckSchemaText (of, text.c_str()) ; }
 
+  C_1F::OneFile *handle() { return of ; } // for the typed records made by ONEhpp
+
   char      readLine() { return C_1F::oneReadLine (of) ; }
+  bool      setLineTypeMask (const char *lineTypes) // see oneSetLineTypeMask(); NULL for all
+    { return C_1F::oneSetLineTypeMask (of, lineTypes) ; }
+
+  // range over lines: for (char t : f.lines()) { ... }
+
+  class LineIterator
+  { ONEfile *f ; char t ;
+   public:
+    LineIterator (ONEfile *file) : f(file), t(file ? file->readLine() : 0) { }
+    char          operator* () const { return t ; }
+    LineIterator& operator++ () { t = f->readLine() ; return *this ; }
+    bool          operator!= (const LineIterator &o) const { return t != o.t || (t && f != o.f) ; }
+  } ;
+  class LineRange
+  { ONEfile *f ;
+   public:
+    LineRange (ONEfile *file) : f(file) { }
+    LineIterator begin () { return LineIterator (f) ; }
+    LineIterator end () { return LineIterator (nullptr) ; }
+  } ;
+  LineRange lines () { return LineRange (this) ; }
+
+  // range over objects of type T: for (int64_t i : f.objects('S')) { ... } stops at each
+  //   object line and gives its number; the body may read on through the object's lines
+
+  class ObjectIterator
+  { ONEfile *f ; char T ; int64_t i ;
+    void next ()
+    { C_1F::OneInfo *li = f->of->info[(int)T] ;
+      if (i > 0 && !f->of->lineType) { i = -1 ; return ; } // the body reached the end
+      if (f->of->lineType != T || li->accum.count == i) // unless the body read the next one
+	while (C_1F::oneReadLine (f->of) && f->of->lineType != T) ;
+      i = f->of->lineType ? li->accum.count : -1 ;
+    }
+   public:
+    ObjectIterator (ONEfile *file, char lineType) : f(file), T(lineType), i(-1)
+      { if (f) { i = 0 ; next () ; } }
+    int64_t         operator* () const { return i ; }
+    ObjectIterator& operator++ () { next () ; return *this ; }
+    bool            operator!= (const ObjectIterator &o) const { return i != o.i ; }
+  } ;
+  class ObjectRange
+  { ONEfile *f ; char T ;
+   public:
+    ObjectRange (ONEfile *file, char lineType) : f(file), T(lineType) { }
+    ObjectIterator begin () { return ObjectIterator (f, T) ; }
+    ObjectIterator end () { return ObjectIterator (nullptr, T) ; }
+  } ;
+  ObjectRange objects (char lineType)
+    { if (!of->info[(int)lineType] || !of->info[(int)lineType]->isObject)
+	throw runtime_error("objects() needs an object line type") ;
+      return ObjectRange (this, lineType) ;
+    }
 
   int64_t   listLength()
     { return ((of)->field[((of)->info[(int)(of)->lineType]->listField)].len & 0xffffffffffffffll) ; }
   int64_t   getInt(int x) { return of->field[x].i ; }
   double    getReal(int x) { return of->field[x].r ; }
   char      getChar(int x) { return of->field[x].c ; }
+  template <class V> V get(int x) ; // typed field access: get<int64_t>, get<double>, get<char>
   int64_t*  getIntList() { return (int64_t*) C_1F::_oneList(of) ; }
   double*   getRealList() { return (double*) C_1F::_oneList(of) ; }
   char*     getDNAchar() { return (char*) _oneList(of) ; }
@@ -92,12 +225,26 @@ class ONEfile
   string    getString() { return (char *) C_1F::_oneList(of) ; }
   vector<string> getStringList ()
   { char *s = (char*) C_1F::_oneList(of) ;
-      int size = listLength() ;
+      int64_t i, size = listLength() ;
       vector<string> vs(size) ;
-      int i ; for (i = 0 ; i < size ; ++i) { vs[i] = strdup(s) ; s += strlen(s) + 1 ; }
+      for (i = 0 ; i < size ; ++i) { vs[i] = s ; s += strlen(s) + 1 ; }
       return vs ;
     }
 
+  // borrowing accessors: no copies, valid until the next readLine()
+
+  ONEspan<const int64_t> intList()
+    { return ONEspan<const int64_t> ((int64_t*) C_1F::_oneList(of), listLength()) ; }
+  ONEspan<const double>  realList()
+    { return ONEspan<const double> ((double*) C_1F::_oneList(of), listLength()) ; }
+  string_view            stringView()
+    { return string_view ((char*) C_1F::_oneList(of), listLength()) ; }
+  string_view            dna() { return stringView () ; }
+  ONEspan<const uint8_t> dna2bit()
+    { return ONEspan<const uint8_t> ((uint8_t*) C_1F::_oneCompressedList(of), (listLength()+3)/4) ; }
+  ONEstringList          stringList()
+    { return ONEstringList ((char*) C_1F::_oneList(of), listLength()) ; }
+
   char*     getComment() { return C_1F::oneReadComment(of) ; }
 
   bool      gotoObject(char lineType, int64_t i) { return C_1F::oneGoto (of, lineType, i) ; }
@@ -110,15 +257,18 @@ class ONEfile
   void      writeLine(char lineType) { C_1F::oneWriteLine(of, lineType, 0, 0) ; }
   void      writeLine(char lineType, int64_t listLen, void *listBuf)
     { C_1F::oneWriteLine(of, lineType, listLen, listBuf) ; }
-  void      writeLine(char lineType, string s)
-  { C_1F::oneWriteLine(of, lineType, s.length(), (void*) s.c_str()) ; }
+  void      writeLine(char lineType, string_view s)
+  { C_1F::oneWriteLine(of, lineType, s.length(), (void*) s.data()) ; }
+  template <class T> void writeLine(char lineType, ONEspan<T> list)
+  { C_1F::oneWriteLine(of, lineType, list.size(), (void*) list.data()) ; }
   void      writeLine(char lineType, const vector<string>& slist)
-    { int i, size = slist.size() ;
-      int totLen = 0 ; for (i = 0 ; i < size ; ++i) totLen += slist[i].length() ;
-      char *s, *s0 = new char[totLen+size] ;
-      for (i = 0, s = s0 ; i < size ; ++i, s += slist[i].length() + 1)
-	strcpy (s, slist[i].c_str()) ;
-      C_1F::oneWriteLine(of, lineType, size, s0) ;
+    { size_t i, size = slist.size(), totLen = 0 ;
+      for (i = 0 ; i < size ; ++i) totLen += slist[i].length() + 1 ;
+      stringListBuf.resize (totLen) ;
+      char *s = stringListBuf.data() ;
+      for (i = 0 ; i < size ; ++i)
+	{ memcpy (s, slist[i].c_str(), slist[i].length() + 1) ; s += slist[i].length() + 1 ; }
+      C_1F::oneWriteLine(of, lineType, size, stringListBuf.data()) ;
     }
   void      writeLineDNA2bit (char lineType, int64_t dnaLen, uint8_t *dnaBuf)
   { C_1F::oneWriteLineDNA2bit (of, lineType, dnaLen, dnaBuf) ; }
@@ -130,10 +280,10 @@ class ONEfile
   bool addProvenance(string prog, string version, string commandLine)
   { return C_1F::oneAddProvenance(of, prog.c_str(), version.c_str(),
 				  (char*)"%s", commandLine.c_str()); }
-  bool inheritProvenance (ONEfile source) { return C_1F::oneInheritProvenance (of, source.of) ; }
+  bool inheritProvenance (const ONEfile &source) { return C_1F::oneInheritProvenance (of, source.of) ; }
   bool addReference(string filename, int64_t count)
   { return C_1F::oneAddReference(of, filename.c_str(), count) ; }
-  bool inheritReference(ONEfile source) { return C_1F::oneInheritReference (of, source.of) ; }
+  bool inheritReference(const ONEfile &source) { return C_1F::oneInheritReference (of, source.of) ; }
 
   // some extra functions to hide readable class attributes
 
@@ -145,6 +295,10 @@ class ONEfile
   int64_t   total(char lineType) { return of->isWrite ? of->info[(int)lineType]->accum.total : of->info[(int)lineType]->given.total ; }
 } ;
 
+template <> inline int64_t ONEfile::get<int64_t>(int x) { return of->field[x].i ; }
+template <> inline double  ONEfile::get<double>(int x) { return of->field[x].r ; }
+template <> inline char    ONEfile::get<char>(int x) { return of->field[x].c ; }
+
 #ifdef TEST_HEADER
 
 // to use this link this file to a filename ending .cpp and compile with -D TEST_HEADER e.g.
@@ -169,9 +323,23 @@ int main (int argc, char *argv[])
 
   cout << "opened 1seq file " << string(argv[1]) << " with " << of.count('S') << " sequences\n" ;
   
-  while (of.readLine())
-    if (of.lineType() == 'S')
-      cout << "sequence length " << of.listLength() << "\n" ;
+  int64_t total = 0 ;
+  for (char t : of.lines())
+    if (t == 'S')
+      { string_view s = of.dna() ;
+	cout << "sequence length " << s.size() << " starting " << s.substr(0,10) << "\n" ;
+	total += s.size() ;
+      }
+  if (total != of.total('S')) { cerr << "total length mismatch\n" ; exit (1) ; }
+
+  ONEfile of2 (argv[1]) ;	// objects, reading on through each one for its identifier
+  ONEfile moved (std::move (of2)) ;
+  for (int64_t i : moved.objects('S'))
+    { int64_t len = moved.listLength() ;
+      while (moved.readLine() && moved.lineType() != 'S')
+	if (moved.lineType() == 'I')
+	  cout << "object " << i << " length " << len << " id " << moved.stringView() << "\n" ;
+    }
 }
 
 #endif
@@ -0,0 +1,516 @@
+/*  File: ONEsort.c
+ *-------------------------------------------------------------------
+ * Description: sort the objects of a binary ONE file by fields of their lines
+ *   Sort keys are made in one pass through the file, and held as fixed size records of
+ *   key words plus object number.  These are radix sorted in blocks of bounded size, in
+ *   parallel, and if there is more than one block they are spilled to temporary files.
+ *   Then a k-way merge gives the output order, and each object is copied across from its
+ *   place in the input, found via the object index.
+ * Exported functions:
+ *-------------------------------------------------------------------
+ */
+
+#include "ONElib.h"
+
+#include <string.h>		/* strcmp etc. */
+#include <stdlib.h>		/* for exit() */
+#include <stdarg.h>             /* for variable length argument lists */
+#include <pthread.h>
+
+// forward declarations of utilities at end of file from RD's utils.[ch]
+
+void die (char *format, ...) ;
+char *commandLine (int argc, char **argv) ;
+
+void *myalloc (size_t size) ;
+void *mycalloc (size_t number, size_t size) ;
+#define	new(n,type)	(type*)myalloc((n)*sizeof(type))
+#define	new0(n,type)	(type*)mycalloc((n),sizeof(type))
+
+void timeUpdate (FILE *f) ;	/* print time usage since last call to file */
+void timeTotal (FILE *f) ;	/* print full time usage since first call to timeUpdate */
+
+// end of utils declarations
+
+typedef unsigned long long U64 ;
+
+/* A record is, for each of nKey keys, a presence word (0 if the object has no key line,
+   so that it sorts first, else 1) and a value word ordered as unsigned, then the object
+   number.  A separate presence word leaves every value word free for real values. */
+
+#define MAX_KEY 8
+
+typedef struct {
+  char lineType ;		/* the first line of this type in the object gives the key */
+  int  field ;			/* if the field is the list then its length is used */
+} KeySpec ;
+
+static int     nKey ;
+static KeySpec keySpec[MAX_KEY] ;
+static int     keyWords ;	/* 2*nKey */
+static int     recWords ;	/* keyWords + 1 */
+static bool    isReverse = false ;
+
+static U64 keyWord (OneFile *vf, int field) /* maps field value to an unsigned order */
+{
+  OneInfo *li = vf->info[(int)vf->lineType] ;
+  U64 x = 0 ;
+  if (li->listEltSize && field == li->listField)
+    x = (U64) oneLen(vf) ;
+  else
+    switch (li->fieldType[field])
+      {
+      case oneINT: x = (U64) oneInt(vf,field) ^ ((U64)1 << 63) ; break ;
+      case oneCHAR: x = (U8) oneChar(vf,field) ; break ;
+      case oneREAL:
+	{ double f = oneReal(vf,field) ; memcpy (&x, &f, 8) ;
+	  x = (x >> 63) ? ~x : x ^ ((U64)1 << 63) ;
+	}
+	break ;
+      default: die ("can't sort on field %d of type %s", field, oneTypeString[li->fieldType[field]]) ;
+      }
+  return isReverse ? ~x : x ;
+}
+
+/******** LSD radix sort of blocks, one byte at a time, skipping constant bytes ********/
+
+typedef struct {
+  U64 *rec, *tmp ;		/* nRec records, tmp is space for the same */
+  I64  nRec ;
+} SortJob ;
+
+static void *radixSort (void *arg)
+{
+  SortJob *job = (SortJob*) arg ;
+  U64 *src = job->rec, *trg = job->tmp, *t ;
+  I64  i, n = job->nRec, count[256] ;
+  int  w, b ;
+
+  for (w = keyWords ; w-- ; )	/* least significant key word first */
+    for (b = 0 ; b < ((w & 1) ? 64 : 8) ; b += 8) /* presence words are 0 or 1 */
+      { memset (count, 0, sizeof(count)) ;
+	for (i = 0 ; i < n ; ++i) ++count[(src[i*recWords + w] >> b) & 0xff] ;
+	if (n && count[(src[w] >> b) & 0xff] == n) continue ; /* all the same */
+	I64 sum = 0 ;
+	for (i = 0 ; i < 256 ; ++i) { I64 c = count[i] ; count[i] = sum ; sum += c ; }
+	for (i = 0 ; i < n ; ++i) /* stable, so ties stay in object order */
+	  memcpy (trg + recWords*count[(src[i*recWords + w] >> b) & 0xff]++,
+		  src + i*recWords, recWords*sizeof(U64)) ;
+	t = src ; src = trg ; trg = t ;
+      }
+  if (src != job->rec) memcpy (job->rec, src, n*recWords*sizeof(U64)) ;
+  return 0 ;
+}
+
+/******** runs - sorted blocks in memory, or spilled to temporary files ********/
+
+#define RUN_BUF 4096		/* records buffered per run while merging */
+
+typedef struct {
+  FILE *f ;			/* 0 if in memory */
+  U64  *rec ;			/* current buffer */
+  I64   n, i ;			/* records in buffer, next one */
+  int   level ;			/* number of merges into this run, after the one into a block */
+} Run ;
+
+static int     nRun = 0, maxRun = 0 ;
+static Run    *runs = 0 ;
+
+static Run *runAdd (void)
+{
+  if (nRun == maxRun)
+    { maxRun = maxRun ? 2*maxRun : 64 ;
+      Run *r = new0 (maxRun, Run) ;
+      if (nRun) { memcpy (r, runs, nRun*sizeof(Run)) ; free (runs) ; }
+      runs = r ;
+    }
+  return &runs[nRun++] ;
+}
+
+static bool runNext (Run *r) /* makes r->rec + r->i*recWords the next record */
+{
+  if (++r->i < r->n) return true ;
+  if (!r->f) return false ;
+  if (!r->rec) r->rec = new (RUN_BUF*recWords, U64) ;
+  r->n = fread (r->rec, recWords*sizeof(U64), RUN_BUF, r->f) ;
+  r->i = 0 ;
+  if (r->n) return true ;
+  fclose (r->f) ; free (r->rec) ; r->f = 0 ; r->rec = 0 ;
+  return false ;
+}
+
+static inline U64 *runRec (Run *r) { return r->rec + r->i*recWords ; }
+
+static inline bool recLess (U64 *a, U64 *b) /* compare keys then object number */
+{
+  int w ;
+  for (w = 0 ; w < recWords ; ++w)
+    if (a[w] != b[w]) return a[w] < b[w] ;
+  return false ;
+}
+
+/* a merge is a binary heap of runs, smallest current record at the top */
+
+static Run **heap ;
+static int   nHeap ;
+
+static void heapDown (int k)
+{
+  while (true)
+    { int c = 2*k + 1 ;
+      if (c >= nHeap) return ;
+      if (c+1 < nHeap && recLess (runRec (heap[c+1]), runRec (heap[c]))) ++c ;
+      if (!recLess (runRec (heap[c]), runRec (heap[k]))) return ;
+      Run *t = heap[c] ; heap[c] = heap[k] ; heap[k] = t ;
+      k = c ;
+    }
+}
+
+static void heapStart (Run *r, int n)
+{
+  int i ;
+  heap = new (n, Run*) ; nHeap = 0 ;
+  for (i = 0 ; i < n ; ++i)
+    { r[i].i = -1 ;
+      if (runNext (&r[i])) heap[nHeap++] = &r[i] ;
+    }
+  for (i = nHeap/2 ; i-- ; ) heapDown (i) ;
+}
+
+static void heapPop (void) /* after the caller has used runRec (heap[0]) */
+{
+  if (!runNext (heap[0])) heap[0] = heap[--nHeap] ;
+  heapDown (0) ;
+}
+
+/* Each spilled run holds an open temporary file until the final merge, so the number of
+   runs must stay well below the open file limit.  A spilled block is merged across its
+   thread pieces into a single run, and whenever the last FAN_IN runs are all of the same
+   level they are merged into one run of the next level up, so there are at most FAN_IN-1
+   runs per level, and each record is rewritten once per level.
+*/
+
+#define FAN_IN 64
+
+static void mergeTail (int n) /* merge the last n runs into one run on disk */
+{
+  Run *r = runs + nRun - n ;
+  int  level = r[0].level + 1 ;	/* levels never increase along runs[] */
+  FILE *f = tmpfile () ;
+  if (!f) die ("failed to open temporary file for a merged run") ;
+  heapStart (r, n) ;
+  while (nHeap)
+    { if (fwrite (runRec (heap[0]), recWords*sizeof(U64), 1, f) != 1)
+	die ("failed to write a merged run - out of temporary disk space?") ;
+      heapPop () ;
+    }
+  free (heap) ;
+  rewind (f) ;
+  nRun -= n ;
+  r = runAdd () ;
+  memset (r, 0, sizeof(Run)) ; r->f = f ; r->level = level ;
+}
+
+static void sortBlock (U64 *rec, U64 *tmp, I64 nRec, int nThreads, bool isSpill)
+{
+  SortJob   *jobs = new (nThreads, SortJob) ;
+  pthread_t *threads = new (nThreads, pthread_t) ;
+  int i ;
+  for (i = 0 ; i < nThreads ; ++i) /* a thread per piece; each piece becomes a run */
+    { I64 start = (nRec * i) / nThreads, end = (nRec * (i+1)) / nThreads ;
+      jobs[i].rec = rec + start*recWords ;
+      jobs[i].tmp = tmp + start*recWords ;
+      jobs[i].nRec = end - start ;
+      pthread_create (&threads[i], 0, radixSort, &jobs[i]) ;
+    }
+  int nRun0 = nRun ;
+  for (i = 0 ; i < nThreads ; ++i)
+    { pthread_join (threads[i], 0) ;
+      if (!jobs[i].nRec) continue ;
+      Run *r = runAdd () ;
+      memset (r, 0, sizeof(Run)) ;
+      r->rec = jobs[i].rec ; r->n = jobs[i].nRec ;
+    }
+  if (isSpill && nRun > nRun0) /* merge the pieces into one run on disk */
+    { mergeTail (nRun - nRun0) ;
+      runs[nRun-1].level = 0 ;
+      while (nRun >= FAN_IN && runs[nRun-FAN_IN].level == runs[nRun-1].level)
+	mergeTail (FAN_IN) ;
+    }
+  free (jobs) ; free (threads) ;
+}
+
+/******** copying objects ********/
+
+static size_t fieldSize[128] ;
+
+static void transferLine (OneFile *vfIn, OneFile *vfOut)
+{ memcpy (vfOut->field, vfIn->field, fieldSize[(int)vfIn->lineType]) ;
+  oneWriteLine (vfOut, vfIn->lineType, oneLen(vfIn), oneString(vfIn)) ;
+  char *s = oneReadComment (vfIn) ; if (s) oneWriteComment (vfOut, "%s", s) ;
+}
+
+static void copyObject (OneFile *vfIn, OneFile *vfOut, char objType, I64 obj)
+{
+  if (!oneGoto (vfIn, objType, obj) || !oneReadLine (vfIn) || vfIn->lineType != objType)
+    die ("can't read object %c %lld", objType, obj) ;
+  bool *contains = vfIn->info[(int)objType]->contains ;
+  do transferLine (vfIn, vfOut) ;
+  while (oneReadLine (vfIn) && vfIn->lineType != objType && contains[(int)vfIn->lineType]) ;
+}
+
+/******** main ********/
+
+int main (int argc, char **argv)
+{
+  int   i ;
+  char *outFileName = "-" ;
+  bool  isVerbose = false ;
+  int   nThreads = 1 ;
+  I64   memory = 1000 ;		/* Mb for key records */
+
+  timeUpdate (0) ;
+
+  char *command = commandLine (argc, argv) ;
+  --argc ; ++argv ;		/* drop the program name */
+
+  if (!argc)
+    { fprintf (stderr, "ONEsort [options] onefile objectType key [key]*\n") ;
+      fprintf (stderr, "  key is T:f for field f (0-based) of the first T line in each object\n") ;
+      fprintf (stderr, "      if f is the list field then the list length is used\n") ;
+      fprintf (stderr, "  -o --output <filename>        output file name (default stdout)\n") ;
+      fprintf (stderr, "  -r --reverse                  sort in decreasing order\n") ;
+      fprintf (stderr, "  -T --threads <n>              number of threads for sorting [1]\n") ;
+      fprintf (stderr, "  -M --memory <Mb>              memory for sort keys before using disk [1000]\n") ;
+      fprintf (stderr, "  -v --verbose                  write commentary including timing\n") ;
+      fprintf (stderr, "input must be binary; e.g. 'ONEsort x.1aln A A:0 A:2', 'ONEsort -r x.1seq S S:0'\n") ;
+      fprintf (stderr, "output is binary; objects with equal keys stay in input order, objects\n") ;
+      fprintf (stderr, "without a key line sort first, and lines outside objects after the first are dropped\n") ;
+      exit (0) ;
+    }
+
+  while (argc && **argv == '-')
+    if ((!strcmp (*argv, "-o") || !strcmp (*argv, "--output")) && argc >= 2)
+      { outFileName = argv[1] ; argc -= 2 ; argv += 2 ; }
+    else if (!strcmp (*argv, "-r") || !strcmp (*argv, "--reverse"))
+      { isReverse = true ; --argc ; ++argv ; }
+    else if (!strcmp (*argv, "-v") || !strcmp (*argv, "--verbose"))
+      { isVerbose = true ; --argc ; ++argv ; }
+    else if ((!strcmp (*argv, "-T") || !strcmp (*argv, "--threads")) && argc >= 2)
+      { nThreads = atoi (argv[1]) ; if (nThreads < 1) nThreads = 1 ; argc -= 2 ; argv += 2 ; }
+    else if ((!strcmp (*argv, "-M") || !strcmp (*argv, "--memory")) && argc >= 2)
+      { memory = atoll (argv[1]) ; if (memory < 1) memory = 1 ; argc -= 2 ; argv += 2 ; }
+    else die ("unknown option %s - run without arguments to see options", *argv) ;
+
+  if (argc < 3) die ("need a binary ONE file, an object type and at least one key") ;
+
+  OneFile *vfIn = oneFileOpenRead (argv[0], 0, 0, 1) ; /* reads the header */
+  if (!vfIn) die ("failed to open one file %s", argv[0]) ;
+  if (!vfIn->isBinary) die ("%s is ascii - ONEsort needs the object index of a binary file", argv[0]) ;
+  char objType = *argv[1] ;
+  OneInfo *oi = vfIn->info[(int)objType] ;
+  if (argv[1][1] || !oi || !oi->isObject) die ("%s is not an object type in %s", argv[1], argv[0]) ;
+  if (!oi->index) die ("no index for object type %c", objType) ;
+
+  for (argc -= 2, argv += 2 ; argc ; --argc, ++argv)
+    { KeySpec *k = &keySpec[nKey] ;
+      if (nKey == MAX_KEY) die ("sorry, at most %d keys", MAX_KEY) ;
+      if ((*argv)[1] != ':' || (*argv)[2] < '0' || (*argv)[2] > '9') die ("bad key %s - need T:f", *argv) ;
+      k->lineType = **argv ; k->field = atoi (*argv + 2) ;
+      OneInfo *li = vfIn->info[(int)k->lineType] ;
+      if (!li || (k->lineType != objType && !oi->contains[(int)k->lineType]))
+	die ("key line type %c is not in objects of type %c", k->lineType, objType) ;
+      if (k->field >= li->nField) die ("line type %c has only %d fields", k->lineType, li->nField) ;
+      ++nKey ;
+    }
+  keyWords = 2*nKey ;
+  recWords = keyWords + 1 ;
+
+  /* pass 1: make the key records, sorting and spilling each block when full */
+
+  I64  maxRec = (memory << 20) / (2 * recWords * sizeof(U64)) ; /* 2 for the radix sort space */
+  if (maxRec < nThreads * RUN_BUF) maxRec = nThreads * RUN_BUF ;
+  U64 *rec = new (maxRec * recWords, U64), *tmp = new (maxRec * recWords, U64) ;
+  I64  nRec = 0, nObj = 0, nDropped = 0 ;
+  U64 *r = 0 ;
+  bool isOutside = false ;	/* since a line outside the current object */
+
+  while (oneReadLine (vfIn))
+    { char t = vfIn->lineType ;
+      if (t == objType)
+	{ if (nRec == maxRec) { sortBlock (rec, tmp, nRec, nThreads, true) ; nRec = 0 ; }
+	  r = rec + recWords * nRec++ ;
+	  memset (r, 0, keyWords * sizeof(U64)) ;
+	  r[keyWords] = ++nObj ;
+	  isOutside = false ;
+	}
+      else if (!r) continue ;	/* before the first object - copied across separately */
+      else if (isOutside || !oi->contains[(int)t]) /* copyObject() stops at such a line */
+	{ isOutside = true ; ++nDropped ; continue ; }
+      for (i = 0 ; i < nKey ; ++i)
+	if (keySpec[i].lineType == t && !r[2*i])
+	  { r[2*i] = 1 ; r[2*i+1] = keyWord (vfIn, keySpec[i].field) ; }
+    }
+
+  if (nRun) /* spill the last block too, so there is just a merge buffer per run */
+    { sortBlock (rec, tmp, nRec, nThreads, true) ; free (rec) ; rec = 0 ; }
+  else
+    sortBlock (rec, tmp, nRec, nThreads, false) ;
+  free (tmp) ;
+  if (isVerbose)
+    { fprintf (stderr, "made keys for %lld objects in %d sorted runs%s\n",
+	       nObj, nRun, rec ? "" : " on disk") ;
+      if (nDropped) fprintf (stderr, "  %lld lines outside objects will be dropped\n", nDropped) ;
+      timeUpdate (stderr) ;
+    }
+  else if (nDropped)
+    fprintf (stderr, "warning: dropping %lld lines outside %c objects\n", nDropped, objType) ;
+
+  /* pass 2: merge the runs and copy the objects across in sorted order */
+
+  OneFile *vfOut = oneFileOpenWriteFrom (outFileName, vfIn, true, 1) ;
+  if (!vfOut) die ("failed to open output file %s", outFileName) ;
+  oneAddProvenance (vfOut, "ONEsort", "0.0", command) ;
+  for (i = 0 ; i < 128 ; ++i)
+    if (vfIn->info[i]) fieldSize[i] = vfIn->info[i]->nField*sizeof(OneField) ;
+
+  if (!oneGoto (vfIn, objType, 0)) die ("can't go to the start of the data") ;
+  while (oneReadLine (vfIn) && vfIn->lineType != objType) /* lines before the first object */
+    transferLine (vfIn, vfOut) ;
+
+  while (nRun > FAN_IN) mergeTail (FAN_IN) ;
+  heapStart (runs, nRun) ;
+  while (nHeap)
+    { copyObject (vfIn, vfOut, objType, (I64) runRec(heap[0])[keyWords]) ;
+      heapPop () ;
+    }
+
+  oneFileClose (vfOut) ;
+  oneFileClose (vfIn) ;
+  free (heap) ; free (runs) ; if (rec) free (rec) ;
+
+  free (command) ;
+  if (isVerbose) timeTotal (stderr) ;
+
+  exit (0) ;
+}
+
+/*********** utilities from RD's utils.[ch] ***************/
+
+void die (char *format, ...)
+{
+  va_list args ;
+
+  va_start (args, format) ;
+  fprintf (stderr, "FATAL ERROR: ") ;
+  vfprintf (stderr, format, args) ;
+  fprintf (stderr, "\n") ;
+  va_end (args) ;
+
+  exit (-1) ;
+}
+
+char *commandLine (int argc, char **argv)
+{
+  int i, totLen = 0 ;
+  for (i = 0 ; i < argc ; ++i) totLen += 1 + strlen(argv[i]) ;
+  char *buf = new (totLen, char) ;
+  strcpy (buf, argv[0]) ;
+  for (i = 1 ; i < argc ; ++i) { strcat (buf, " ") ; strcat (buf, argv[i]) ; }
+  return buf ;
+}
+
+long totalAllocated = 0 ;
+
+void *myalloc (size_t size)
+{
+  void *p = (void*) malloc (size) ;
+  if (!p) die ("myalloc failure requesting %d bytes - totalAllocated %ld", size, totalAllocated) ;
+  totalAllocated += size ;
+  return p ;
+}
+
+void *mycalloc (size_t number, size_t size)
+{
+  void *p = (void*) calloc (number, size) ;
+  if (!p) die ("mycalloc failure requesting %d objects of size %d - totalAllocated %ld", number, size, totalAllocated) ;
+  totalAllocated += size*number ;
+  return p ;
+}
+
+/***************** rusage for timing information ******************/
+
+#include <sys/resource.h>
+#include <sys/time.h>
+#ifndef RUSAGE_SELF     /* to prevent "RUSAGE_SELF redefined" gcc warning, fixme if this is more intricate */
+#define RUSAGE_SELF 0
+#endif
+
+#ifdef RUSAGE_STRUCTURE_DEFINITIONS
+struct rusage {
+  struct timeval ru_utime; /* user time used */
+  struct timeval ru_stime; /* system time used */
+  long ru_maxrss;          /* integral max resident set size */
+  long ru_ixrss;           /* integral shared text memory size */
+  long ru_idrss;           /* integral unshared data size */
+  long ru_isrss;           /* integral unshared stack size */
+  long ru_minflt;          /* page reclaims */
+  long ru_majflt;          /* page faults */
+  long ru_nswap;           /* swaps */
+  long ru_inblock;         /* block input operations */
+  long ru_oublock;         /* block output operations */
+  long ru_msgsnd;          /* messages sent */
+  long ru_msgrcv;          /* messages received */
+  long ru_nsignals;        /* signals received */
+  long ru_nvcsw;           /* voluntary context switches */
+  long ru_nivcsw;          /* involuntary context switches */
+};
+
+struct timeval {
+  time_t       tv_sec;   /* seconds since Jan. 1, 1970 */
+  suseconds_t  tv_usec;  /* and microseconds */
+} ;
+#endif /* RUSAGE STRUCTURE_DEFINITIONS */
+
+static struct rusage rOld, rFirst ;
+static struct timeval tOld, tFirst ;
+
+void timeUpdate (FILE *f)
+{
+  static bool isFirst = 1 ;
+  struct rusage rNew ;
+  struct timeval tNew ;
+  int secs, usecs ;
+
+  getrusage (RUSAGE_SELF, &rNew) ;
+  gettimeofday(&tNew, 0) ;
+  if (!isFirst)
+    { secs = rNew.ru_utime.tv_sec - rOld.ru_utime.tv_sec ;
+      usecs =  rNew.ru_utime.tv_usec - rOld.ru_utime.tv_usec ;
+      if (usecs < 0) { usecs += 1000000 ; secs -= 1 ; }
+      fprintf (f, "user\t%d.%06d", secs, usecs) ;
+      secs = rNew.ru_stime.tv_sec - rOld.ru_stime.tv_sec ;
+      usecs =  rNew.ru_stime.tv_usec - rOld.ru_stime.tv_usec ;
+      if (usecs < 0) { usecs += 1000000 ; secs -= 1 ; }
+      fprintf (f, "\tsystem\t%d.%06d", secs, usecs) ;
+      secs = tNew.tv_sec - tOld.tv_sec ;
+      usecs =  tNew.tv_usec - tOld.tv_usec ;
+      if (usecs < 0) { usecs += 1000000 ; secs -= 1 ; }
+      fprintf (f, "\telapsed\t%d.%06d", secs, usecs) ;
+      fprintf (f, "\tallocated\t%.2f", totalAllocated/1000000000.0) ;   
+      fprintf (f, "\tmax_RSS\t%ld", rNew.ru_maxrss - rOld.ru_maxrss) ;
+      fputc ('\n', f) ;
+    }
+  else
+    { rFirst = rNew ;
+      tFirst = tNew ;
+      isFirst = false ;
+    }
+
+  rOld = rNew ;
+  tOld = tNew ;
+}
+
+void timeTotal (FILE *f) { rOld = rFirst ; tOld = tFirst ; timeUpdate (f) ; }
+
+/********************* end of file ***********************/
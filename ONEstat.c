@@ -25,13 +25,20 @@ void die (char *format, ...) ;
 void timeUpdate (FILE *f) ;
 void timeTotal (FILE *f) ;
 
+static void   readParallel (OneFile *vf, int nThreads, bool isDecode, I64 *usage) ;
+static double readSample (OneFile *vf, int nThreads, I64 nSample, I64 *usage) ;
+static void   footerReport (OneFile *vf, FILE *f) ;
+
 int main (int argc, char **argv)
 { int        i ;
   char      *fileType = 0 ;
   char      *outFileName = "-" ;
-  bool       isHeader = false, isUsage = false, isVerbose = false ;
+  bool       isHeader = false, isUsage = false, isVerbose = false, isProfile = false ;
+  bool       isFooter = false ;
+  I64        nSample = 0 ;
   char      *schemaFileName = 0 ;
   char      *checkText = 0 ;
+  int        nThreads = 1 ;
   
   timeUpdate (0) ;
 
@@ -46,6 +53,13 @@ int main (int argc, char **argv)
       fprintf (stderr, "  -H --header              output header accumulated from data\n") ;
       fprintf (stderr, "  -o --output <filename>   output to filename\n") ;
       fprintf (stderr, "  -u --usage               byte usage per line type; no other output\n") ;
+      fprintf (stderr, "  -s --sample <n>          with -u, estimate usage from n objects of a binary file\n") ;
+      fprintf (stderr, "  -F --footer              counts, object sizes and index/codec sizes of a binary\n") ;
+      fprintf (stderr, "                             file from its header and footer, without reading data\n") ;
+      fprintf (stderr, "  -p --profile             decode all lists, report ONElib counters to stderr\n") ;
+      fprintf (stderr, "                             needs ONElib compiled with -DONE_PROFILE\n") ;
+      fprintf (stderr, "  -T --threads <n>         read parts of the file in parallel [1]\n") ;
+      fprintf (stderr, "                             binary files split by object, ascii files at newlines\n") ;
       fprintf (stderr, "  -v --verbose             else only errors and requested output\n") ;
       fprintf (stderr, "ONEstat aborts on a syntactic parse error with a message.\n") ;
       fprintf (stderr, "Otherwise information is written to stderr about any inconsistencies\n") ;
@@ -59,6 +73,10 @@ int main (int argc, char **argv)
       { isHeader = true ; --argc ; ++argv ; }
     else if (!strcmp (*argv, "-u") || !strcmp (*argv, "--usage"))
       { isUsage = true ; --argc ; ++argv ; }
+    else if (!strcmp (*argv, "-F") || !strcmp (*argv, "--footer"))
+      { isFooter = true ; --argc ; ++argv ; }
+    else if (!strcmp (*argv, "-p") || !strcmp (*argv, "--profile"))
+      { isProfile = true ; --argc ; ++argv ; }
     else if (!strcmp (*argv, "-v") || !strcmp (*argv, "--verbose"))
       { isVerbose = true ; --argc ; ++argv ; }
     else if (argc > 1 && (!strcmp (*argv, "-t") || !strcmp (*argv, "--type")))
@@ -77,10 +95,23 @@ int main (int argc, char **argv)
       { outFileName = argv[1] ;
 	argc -= 2 ; argv += 2 ;
       }
+    else if (argc > 1 && (!strcmp (*argv, "-s") || !strcmp (*argv, "--sample")))
+      { nSample = atoll (argv[1]) ;
+	argc -= 2 ; argv += 2 ;
+	if (nSample < 1) die ("sample size %lld must be positive", nSample) ;
+      }
+    else if (argc > 1 && (!strcmp (*argv, "-T") || !strcmp (*argv, "--threads")))
+      { nThreads = atoi (argv[1]) ;
+	argc -= 2 ; argv += 2 ;
+	if (nThreads < 1) die ("number of threads %d must be positive", nThreads) ;
+      }
     else die ("unknown option %s - run without arguments to see options", *argv) ;
   
   if (argc != 1)
     die ("need to give a single data file as argument") ;
+  if (nSample && !isUsage)
+    die ("-s only applies to -u") ;
+  if (isFooter) nThreads = 1 ; // the data are not read
 
   //  Open subject file for reading and read header (if present)
   OneSchema *vs = 0 ;
@@ -88,7 +119,7 @@ int main (int argc, char **argv)
     { vs = oneSchemaCreateFromFile (schemaFileName) ;
       if (!vs) die ("failed to read schema file %s", schemaFileName) ;
     }
-  OneFile *vf = oneFileOpenRead (argv[0], vs, fileType, 1) ;
+  OneFile *vf = oneFileOpenRead (argv[0], vs, fileType, nThreads) ;
   if (!vf) die ("failed to open OneFile %s", argv[0]) ;
   oneSchemaDestroy (vs) ; // no longer needed
 
@@ -102,26 +133,35 @@ int main (int argc, char **argv)
   if (checkText)
     oneFileCheckSchemaText (vf, checkText) ;
 
-  vf->isCheckString = true ;
-
-  // if requesting usage, then 
-
-  if (isUsage)
-    { I64 usage[128] ; memset (usage, 0, 128*sizeof(I64)) ; 
-      off_t u, uLast = ftello (vf->f) ;
+  for (i = 0 ; i < nThreads ; ++i) vf[i].isCheckString = true ;
 
-      while (oneReadLine (vf))
-	{ u = ftello (vf->f) ; usage[(int)vf->lineType] += u-uLast ; uLast = u ; }
-      u = ftello (vf->f) ; usage[(int)vf->lineType] += u-uLast ; uLast = u ;
+  // if requesting usage or the footer report, then 
 
-      FILE *f ;
+  if (isUsage || isFooter)
+    { FILE *f = stdout ;
       if (strcmp (outFileName, "-") && !(f = fopen (outFileName, "w")))
 	die ("failed to open output file %s", outFileName) ;
+
+      if (isFooter)
+	footerReport (vf, f) ;
       else
-	f = stdout ;
+	{ I64 usage[128] ; memset (usage, 0, 128*sizeof(I64)) ; 
+	  double scale = 1.0 ;
+
+	  if (nSample)
+	    scale = readSample (vf, nThreads, nSample, usage) ;
+	  else if (nThreads > 1)
+	    readParallel (vf, nThreads, false, usage) ;
+	  else
+	    { off_t u, uLast = ftello (vf->f) ;
+	      while (oneReadLine (vf))
+		{ u = ftello (vf->f) ; usage[(int)vf->lineType] += u-uLast ; uLast = u ; }
+	    }
       
-      for (i = 'A' ; i < 128 ; ++i)
-	if (usage[i]) fprintf (f, "usage line type %c bytes %lld\n", (char)i,  usage[i]) ;
+	  for (i = 'A' ; i < 128 ; ++i)
+	    if (usage[i])
+	      fprintf (f, "usage line type %c bytes %lld\n", (char)i, (I64) (usage[i]*scale + 0.5)) ;
+	}
 
       if (f != stdout) fclose (f) ;
      }
@@ -130,13 +170,26 @@ int main (int argc, char **argv)
     {
       //  Read data portion of file checking syntax and group sizes (if present)
 
-      while (oneReadLine (vf)) ;
+      if (nThreads > 1)
+	readParallel (vf, nThreads, isProfile, 0) ;
+      else if (isProfile) // decode the lists too, as a user would
+	{ while (oneReadLine (vf))
+	    if (vf->info[(int)vf->lineType]->listEltSize) _oneList (vf) ;
+	}
+      else
+	while (oneReadLine (vf)) ;
+
+      if (isProfile && !oneProfileReport (vf, stderr))
+	fprintf (stderr, "no profile: %s\n", oneErrorString ()) ;
 
       if (isVerbose)
-	fprintf (stderr, "read %lld lines from OneFile %s type %s\n",
-		 vf->line, argv[0], vf->fileType) ;
+	{ I64 nLines = 0 ;
+	  for (i = 0 ; i < nThreads ; ++i) nLines += vf[i].line ;
+	  fprintf (stderr, "read %lld lines from OneFile %s type %s\n",
+		   nLines, argv[0], vf->fileType) ;
+	}
 
-      oneFinalizeCounts (vf) ;
+      oneFinalizeCounts (vf) ; // merges the counts from parallel readers
     
       //  Check count statistics for each line type versus those in header (if was present)
 
@@ -189,6 +242,208 @@ int main (int argc, char **argv)
   exit (0) ;
 }
 
+/********************* parallel reading *************************/
+
+typedef struct {
+  OneFile *vf ;
+  I64      nRange ;
+  off_t   *start, *end ;	// byte ranges to read - end < 0 means to the end of the data
+  bool     isDecode ;
+  I64      usage[128] ;		// bytes read per line type
+} Part ;
+
+static void *readPart (void *arg)
+{
+  Part    *p = (Part*) arg ;
+  OneFile *vf = p->vf ;
+  I64      r ;
+  off_t    u, uLast ;
+
+  for (r = 0 ; r < p->nRange ; ++r)
+    { uLast = p->start[r] ;
+      if (ftello (vf->f) != uLast && fseeko (vf->f, uLast, SEEK_SET))
+	die ("failed to seek to byte %lld", (I64) uLast) ;
+      while ((p->end[r] < 0 || uLast < p->end[r]) && oneReadLine (vf))
+	{ if (p->isDecode && vf->info[(int)vf->lineType]->listEltSize) _oneList (vf) ;
+	  u = ftello (vf->f) ; p->usage[(int)vf->lineType] += u - uLast ; uLast = u ;
+	}
+    }
+  return 0 ;
+}
+
+static void readParts (Part *part, int nThreads, I64 *usage)
+{
+  pthread_t *threads = calloc (nThreads, sizeof(pthread_t)) ;
+  int        i, k ;
+
+  for (k = 0 ; k < nThreads ; ++k) pthread_create (&threads[k], 0, readPart, &part[k]) ;
+  for (k = 0 ; k < nThreads ; ++k) pthread_join (threads[k], 0) ;
+  if (usage)
+    for (k = 0 ; k < nThreads ; ++k)
+      for (i = 0 ; i < 128 ; ++i) usage[i] += part[k].usage[i] ;
+  free (threads) ;
+}
+
+static char indexType (OneFile *vf) // the indexed object type with the most objects, else 0
+{
+  char T = 0 ;
+  I64  n = 0 ;
+  int  i ;
+
+  for (i = 'A' ; i <= 'z' ; ++i)
+    if (vf->info[i] && vf->info[i]->isObject && vf->info[i]->index && vf->info[i]->given.count > n)
+      { T = i ; n = vf->info[i]->given.count ; }
+  return T ;
+}
+
+/* The data are split between the nThreads readers of vf: binary files at object boundaries
+   taken from the index of the object type with most objects, ascii files after newlines.
+   Counts in each slave start from zero, so that oneFinalizeCounts() adds them up as it does
+   for a file written in parallel.  The ascii split assumes no newlines inside strings, and
+   line numbers in parse error messages are relative to the start of the part.
+*/
+
+static void readParallel (OneFile *vf, int nThreads, bool isDecode, I64 *usage)
+{
+  off_t *start = calloc (nThreads+1, sizeof(off_t)) ;
+  Part  *part = calloc (nThreads, sizeof(Part)) ;
+  int    i, k ;
+
+  start[0] = ftello (vf->f) ;
+  if (vf->isBinary)
+    { char T = indexType (vf) ;
+      I64  n = T ? vf->info[(int)T]->given.count : 0 ;
+      for (k = 1 ; k < nThreads ; ++k) // no objects leaves everything to the first reader
+	start[k] = T ? vf->info[(int)T]->index[1 + (n * k) / nThreads] : start[0] ;
+    }
+  else
+    { off_t size ;
+      int   c ;
+      if (fseeko (vf->f, 0, SEEK_END)) die ("failed to find the size of the file") ;
+      size = ftello (vf->f) ;
+      for (k = 1 ; k < nThreads ; ++k)
+	{ off_t off = start[0] + ((size - start[0]) * k) / nThreads ;
+	  if (off <= start[k-1]) { start[k] = start[k-1] ; continue ; }
+	  if (fseeko (vf->f, off-1, SEEK_SET)) die ("failed to seek to byte %lld", (I64) off-1) ;
+	  while ((c = getc (vf->f)) != EOF && c != '\n') ;
+	  start[k] = ftello (vf->f) ;
+	}
+      if (fseeko (vf->f, start[0], SEEK_SET)) die ("failed to return to the start of the data") ;
+    }
+  start[nThreads] = -1 ;
+
+  for (k = 0 ; k < nThreads ; ++k)
+    { OneFile *vk = vf + k ;
+      if (k > 0)
+	for (i = 0 ; i < 128 ; ++i)
+	  if (vk->info[i]) memset (&vk->info[i]->accum, 0, sizeof(OneCounts)) ;
+      part[k].vf = vk ;
+      part[k].nRange = 1 ;
+      part[k].start = &start[k] ;
+      part[k].end = &start[k+1] ;
+      part[k].isDecode = isDecode ;
+    }
+  readParts (part, nThreads, usage) ;
+
+  free (start) ; free (part) ;
+}
+
+/* Reads nSample objects evenly spaced through a binary file, in parallel, each from its
+   index entry up to the next.  Returns the factor to scale their usage to the whole data.
+*/
+
+static double readSample (OneFile *vf, int nThreads, I64 nSample, I64 *usage)
+{
+  char     T = indexType (vf) ;
+  int      k ;
+  I64      j, n, sampled = 0 ;
+
+  if (!vf->isBinary || !T) die ("-s needs a binary file with indexed objects") ;
+  n = vf->info[(int)T]->given.count ;
+  if (nSample > n) nSample = n ;
+
+  I64   *index = vf->info[(int)T]->index ;
+  off_t  dataStart = ftello (vf->f), dataEnd = vf->footerStart - 1 ; // before the blank line
+  off_t *start = calloc (nSample, sizeof(off_t)), *end = calloc (nSample, sizeof(off_t)) ;
+  for (j = 0 ; j < nSample ; ++j)
+    { I64 i = 1 + (n * j) / nSample ;
+      start[j] = index[i] ;
+      end[j] = (i < n) ? index[i+1] : dataEnd ;
+      sampled += end[j] - start[j] ;
+    }
+
+  Part *part = calloc (nThreads, sizeof(Part)) ;
+  for (k = 0 ; k < nThreads ; ++k)
+    { I64 j0 = (nSample * k) / nThreads, jN = (nSample * (k+1)) / nThreads ;
+      part[k].vf = vf + k ;
+      part[k].nRange = jN - j0 ;
+      part[k].start = start + j0 ;
+      part[k].end = end + j0 ;
+    }
+  readParts (part, nThreads, usage) ;
+
+  fprintf (stderr, "usage estimated from %lld of %lld objects of type %c, %lld of %lld bytes\n",
+	   nSample, n, T, sampled, (I64) (dataEnd - dataStart)) ;
+  free (start) ; free (end) ; free (part) ;
+  return sampled ? (double) (dataEnd - dataStart) / sampled : 0.0 ;
+}
+
+/********************* footer report *************************/
+
+/* Everything here comes from the header and footer read by oneFileOpenRead(): counts from
+   the '#', '@' and '+' lines, object sizes from differences between successive index
+   entries, and the sizes of the index and codec lines in the footer.
+*/
+
+static void footerReport (OneFile *vf, FILE *f)
+{
+  int   i, k ;
+  I64   j ;
+
+  if (!vf->isBinary) die ("-F needs a binary file - ascii files have no footer") ;
+
+  off_t dataStart = ftello (vf->f), dataEnd = vf->footerStart - 1 ; // before the blank line
+  if (fseeko (vf->f, 0, SEEK_END)) die ("failed to find the size of the file") ;
+  off_t size = ftello (vf->f) ;
+
+  fprintf (f, "file %s type %s bytes %lld header %lld data %lld footer %lld\n",
+	   vf->fileName, vf->fileType, (I64) size, (I64) dataStart,
+	   (I64) (dataEnd - dataStart), (I64) (size - vf->footerStart)) ;
+
+  for (k = 0 ; k < vf->nDefn ; ++k)
+    { i = vf->defnOrder[k] ;
+      if (i & 0x80) continue ; // skip the 'G' lines
+      OneInfo *li = vf->info[i] ;
+      if (!li->given.count) continue ;
+      fprintf (f, "line type %c count %lld", (char)i, li->given.count) ;
+      if (li->listEltSize)
+	fprintf (f, " max %lld total %lld", li->given.max, li->given.total) ;
+      if (li->indexBytes) fprintf (f, " index_bytes %lld", li->indexBytes) ;
+      if (li->codecBytes) fprintf (f, " codec_bytes %lld", li->codecBytes) ;
+      fputc ('\n', f) ;
+    }
+  if (vf->info['&']->codecBytes)
+    fprintf (f, "index codec_bytes %lld\n", vf->info['&']->codecBytes) ;
+  if (vf->info['/']->codecBytes)
+    fprintf (f, "comment codec_bytes %lld\n", vf->info['/']->codecBytes) ;
+
+  for (k = 0 ; k < vf->nDefn ; ++k) // sizes run from one object to the next of the same type
+    { i = vf->defnOrder[k] ;
+      if (i & 0x80) continue ;
+      OneInfo *li = vf->info[i] ;
+      I64      n = li->given.count ;
+      if (!li->isObject || !li->index || !n) continue ;
+      I64 total = 0, max = 0, x ;
+      for (j = 1 ; j <= n ; ++j)
+	{ x = ((j < n) ? li->index[j+1] : dataEnd) - li->index[j] ;
+	  total += x ;
+	  if (x > max) max = x ;
+	}
+      fprintf (f, "object type %c count %lld bytes %lld mean %.1f max %lld before_first %lld\n",
+	       (char)i, n, total, (double) total / n, max, li->index[1] - li->index[0]) ;
+    }
+}
+
 /********************* utilities *************************/
 
 
@@ -18,6 +18,7 @@
 #include <string.h>		/* strcmp etc. */
 #include <stdlib.h>		/* for exit() */
 #include <stdarg.h>             /* for variable length argument lists */
+#include <pthread.h>
 
 // forward declarations of utilities at end of file from RD's utils.[ch]
 
@@ -63,6 +64,414 @@ static void transferLine (OneFile *vfIn, OneFile *vfOut, size_t *fieldSize)
   char *s = oneReadComment (vfIn) ; if (s) oneWriteComment (vfOut, "%s", s) ;
 }
 
+/*********** filter expressions ***********/
+
+/* An expression such as 'S.len > 10000 && Q.mean >= 20' is compiled to postfix code over
+   terms T.x, each taken from the first T line of the object: x is a field number (the
+   list length for the list field), or len, count (number of T lines), sum, mean, min, max
+   of the list.  Terms are 0 if the object has no T line.  Evaluation is three-valued, so
+   an object is decided as soon as enough lines are read, skipping the rest of it, and
+   list statistics are only computed (so lists only decoded) if still needed.
+*/
+
+typedef enum { F_CONST, F_TERM, F_NEG, F_ADD, F_SUB, F_MUL, F_DIV,
+	       F_LT, F_LE, F_GT, F_GE, F_EQ, F_NE, F_NOT, F_AND, F_OR } FilterOp ;
+
+typedef enum { A_LEN = -1, A_COUNT = -2, A_SUM = -3, A_MEAN = -4, A_MIN = -5, A_MAX = -6 } FilterAttr ;
+
+typedef struct { FilterOp op ; int term ; double x ; } FilterCode ;
+typedef struct { char type ; int attr ; bool isList ; } FilterTerm ; /* isList if it decodes */
+
+typedef struct {
+  OneFile    *vf ;
+  char       *text, *s ;	/* s is the parse position */
+  FilterCode *code ;
+  int         nCode, maxCode ;
+  FilterTerm *term ;
+  int         nTerm, maxTerm ;
+  char        objType ;
+} Filter ;
+
+typedef struct {		/* evaluation state, one per thread */
+  double *val ;
+  bool   *isKnown ;
+  I64     count[128] ;
+  double *v ;			/* stack */
+  signed char *k ;		/* stack of known flags: -1 unknown, else 0/1 for truth */
+} FilterState ;
+
+static void filterError (Filter *f, char *msg)
+{ die ("filter error: %s at position %d in '%s'", msg, (int)(f->s - f->text), f->text) ; }
+
+static void filterEmit (Filter *f, FilterOp op, int term, double x)
+{
+  if (f->nCode == f->maxCode)
+    { int n = 2*f->maxCode + 16 ; resize (f->code, f->maxCode, n, FilterCode) ; f->maxCode = n ; }
+  f->code[f->nCode].op = op ; f->code[f->nCode].term = term ; f->code[f->nCode].x = x ;
+  ++f->nCode ;
+}
+
+static void filterSpace (Filter *f) { while (*f->s == ' ' || *f->s == '\t') ++f->s ; }
+
+static bool filterMatch (Filter *f, char *token)
+{
+  filterSpace (f) ;
+  int n = strlen (token) ;
+  if (strncmp (f->s, token, n)) return false ;
+  f->s += n ;
+  return true ;
+}
+
+static void filterOr (Filter *f) ;
+
+static void filterTerm (Filter *f, char T)
+{
+  static char *attrName[] = { "len", "count", "sum", "mean", "min", "max", 0 } ;
+  OneInfo *li = f->vf->info[(int)T] ;
+  if (!li) filterError (f, "unknown line type") ;
+  int i, attr = 0 ;
+  if (*f->s >= '0' && *f->s <= '9')
+    { while (*f->s >= '0' && *f->s <= '9') attr = attr*10 + (*f->s++ - '0') ;
+      if (attr >= li->nField) filterError (f, "field number too large for line type") ;
+      if (li->listEltSize && attr == li->listField) attr = A_LEN ;
+      else if (li->fieldType[attr] != oneINT && li->fieldType[attr] != oneREAL &&
+	       li->fieldType[attr] != oneCHAR)
+	filterError (f, "field is not INT, REAL, CHAR or a list") ;
+    }
+  else
+    { for (i = 0 ; attrName[i] ; ++i)
+	if (!strncmp (f->s, attrName[i], strlen(attrName[i]))) break ;
+      if (!attrName[i]) filterError (f, "unknown attribute") ;
+      f->s += strlen (attrName[i]) ;
+      attr = -1 - i ;
+      if (attr != A_COUNT && !li->listEltSize) filterError (f, "line type has no list") ;
+      if (attr < A_COUNT && li->fieldType[li->listField] == oneSTRING_LIST)
+	filterError (f, "can't take statistics of a STRING_LIST") ;
+    }
+  for (i = 0 ; i < f->nTerm ; ++i)
+    if (f->term[i].type == T && f->term[i].attr == attr) break ;
+  if (i == f->nTerm)
+    { if (f->nTerm == f->maxTerm)
+	{ int n = 2*f->maxTerm + 8 ; resize (f->term, f->maxTerm, n, FilterTerm) ; f->maxTerm = n ; }
+      f->term[i].type = T ; f->term[i].attr = attr ; f->term[i].isList = (attr < A_COUNT) ;
+      ++f->nTerm ;
+    }
+  filterEmit (f, F_TERM, i, 0) ;
+}
+
+static void filterPrimary (Filter *f)
+{
+  filterSpace (f) ;
+  char *s = f->s ;
+  if (*s == '(')
+    { ++f->s ; filterOr (f) ;
+      if (!filterMatch (f, ")")) filterError (f, "missing )") ;
+    }
+  else if (*s == '\'' && s[1] && s[2] == '\'')
+    { filterEmit (f, F_CONST, 0, (U8) s[1]) ; f->s += 3 ; }
+  else if ((*s >= '0' && *s <= '9') || *s == '.')
+    { char *e ; double x = strtod (s, &e) ; f->s = e ; filterEmit (f, F_CONST, 0, x) ; }
+  else if (*s > ' ' && *s < 127 && s[1] == '.')
+    { f->s += 2 ; filterTerm (f, *s) ; }
+  else
+    filterError (f, "expected a number, T.x term or (") ;
+}
+
+static void filterUnary (Filter *f)
+{
+  if (filterMatch (f, "-")) { filterUnary (f) ; filterEmit (f, F_NEG, 0, 0) ; }
+  else if (filterMatch (f, "!")) { filterUnary (f) ; filterEmit (f, F_NOT, 0, 0) ; }
+  else filterPrimary (f) ;
+}
+
+static void filterProduct (Filter *f)
+{
+  filterUnary (f) ;
+  while (true)
+    if (filterMatch (f, "*")) { filterUnary (f) ; filterEmit (f, F_MUL, 0, 0) ; }
+    else if (filterMatch (f, "/")) { filterUnary (f) ; filterEmit (f, F_DIV, 0, 0) ; }
+    else break ;
+}
+
+static void filterSum (Filter *f)
+{
+  filterProduct (f) ;
+  while (true)
+    if (filterMatch (f, "+")) { filterProduct (f) ; filterEmit (f, F_ADD, 0, 0) ; }
+    else if (filterMatch (f, "-")) { filterProduct (f) ; filterEmit (f, F_SUB, 0, 0) ; }
+    else break ;
+}
+
+static void filterCompare (Filter *f)
+{
+  filterSum (f) ;
+  FilterOp op ;		/* two character operators must be tested first */
+  if (filterMatch (f, "<=")) op = F_LE ;
+  else if (filterMatch (f, ">=")) op = F_GE ;
+  else if (filterMatch (f, "==")) op = F_EQ ;
+  else if (filterMatch (f, "!=")) op = F_NE ;
+  else if (filterMatch (f, "<")) op = F_LT ;
+  else if (filterMatch (f, ">")) op = F_GT ;
+  else return ;
+  filterSum (f) ;
+  filterEmit (f, op, 0, 0) ;
+}
+
+static void filterAnd (Filter *f)
+{
+  filterCompare (f) ;
+  while (filterMatch (f, "&&")) { filterCompare (f) ; filterEmit (f, F_AND, 0, 0) ; }
+}
+
+static void filterOr (Filter *f)
+{
+  filterAnd (f) ;
+  while (filterMatch (f, "||")) { filterAnd (f) ; filterEmit (f, F_OR, 0, 0) ; }
+}
+
+static Filter *filterCreate (OneFile *vf, char *text)
+{
+  Filter *f = new0 (1, Filter) ;
+  f->vf = vf ;
+  f->text = f->s = text ;
+  filterOr (f) ;
+  filterSpace (f) ;
+  if (*f->s) filterError (f, "unexpected character") ;
+
+  /* the object type is the innermost object type holding every line type in the filter */
+  int i, j, n = 0 ;
+  bool isCand[128] ;
+  for (j = 0 ; j < 128 ; ++j)
+    { OneInfo *lj = vf->info[j] ;
+      isCand[j] = (lj && lj->isObject) ;
+      for (i = 0 ; isCand[j] && i < f->nTerm ; ++i)
+	if (f->term[i].type != j && !lj->contains[(int)f->term[i].type]) isCand[j] = false ;
+    }
+  for (j = 0 ; j < 128 ; ++j)
+    if (isCand[j])
+      { for (i = 0 ; i < 128 ; ++i)
+	  if (i != j && isCand[i] && vf->info[j]->contains[i]) break ;
+	if (i == 128) { f->objType = j ; ++n ; }
+      }
+  if (!n) die ("no object type contains all the line types in filter '%s'", text) ;
+  if (n > 1) die ("filter '%s' does not determine a unique object type", text) ;
+  return f ;
+}
+
+static void filterDestroy (Filter *f)
+{ free (f->code) ; free (f->term) ; free (f) ; }
+
+static FilterState *filterStateCreate (Filter *f)
+{
+  FilterState *st = new0 (1, FilterState) ;
+  st->val = new0 (f->nTerm, double) ;
+  st->isKnown = new0 (f->nTerm, bool) ;
+  st->v = new0 (f->nCode, double) ;
+  st->k = new0 (f->nCode, signed char) ;
+  return st ;
+}
+
+static void filterStateDestroy (FilterState *st)
+{ free (st->val) ; free (st->isKnown) ; free (st->v) ; free (st->k) ; free (st) ; }
+
+static int filterEval (Filter *f, FilterState *st) /* returns -1 if not yet known, else 0/1 */
+{
+  double *v = st->v ;
+  signed char *k = st->k ;	/* -2 for a known number, -1 unknown, 0/1 known truth */
+  int i, n = 0 ;
+  for (i = 0 ; i < f->nCode ; ++i)
+    { FilterCode *c = &f->code[i] ;
+      switch (c->op)
+	{
+	case F_CONST: v[n] = c->x ; k[n++] = -2 ; break ;
+	case F_TERM:
+	  if (st->isKnown[c->term]) { v[n] = st->val[c->term] ; k[n++] = -2 ; }
+	  else k[n++] = -1 ;
+	  break ;
+	case F_NEG: v[n-1] = (k[n-1] >= 0) ? -k[n-1] : -v[n-1] ; if (k[n-1] >= 0) k[n-1] = -2 ; break ;
+	case F_NOT: if (k[n-1] >= 0) k[n-1] = !k[n-1] ; else if (k[n-1] == -2) k[n-1] = !v[n-1] ; break ;
+	case F_AND: case F_OR:
+	  { --n ;
+	    int a = (k[n-1] == -2) ? (v[n-1] != 0) : k[n-1] ;
+	    int b = (k[n] == -2) ? (v[n] != 0) : k[n] ;
+	    int stop = (c->op == F_AND) ? 0 : 1 ; /* a known value that decides the result */
+	    if (a == stop || b == stop) k[n-1] = stop ;
+	    else if (a < 0 || b < 0) k[n-1] = -1 ;
+	    else k[n-1] = !stop ;
+	  }
+	  break ;
+	default:		/* binary arithmetic and comparisons */
+	  { --n ;
+	    if (k[n-1] == -1 || k[n] == -1) { k[n-1] = -1 ; break ; }
+	    double a = (k[n-1] >= 0) ? k[n-1] : v[n-1], b = (k[n] >= 0) ? k[n] : v[n] ;
+	    k[n-1] = -2 ;
+	    switch (c->op)
+	      {
+	      case F_ADD: v[n-1] = a + b ; break ;
+	      case F_SUB: v[n-1] = a - b ; break ;
+	      case F_MUL: v[n-1] = a * b ; break ;
+	      case F_DIV: v[n-1] = b ? a / b : 0 ; break ;
+	      case F_LT: k[n-1] = (a < b) ; break ;
+	      case F_LE: k[n-1] = (a <= b) ; break ;
+	      case F_GT: k[n-1] = (a > b) ; break ;
+	      case F_GE: k[n-1] = (a >= b) ; break ;
+	      case F_EQ: k[n-1] = (a == b) ; break ;
+	      case F_NE: k[n-1] = (a != b) ; break ;
+	      default: break ;
+	      }
+	  }
+	}
+    }
+  if (k[0] == -2) return (v[0] != 0) ;
+  return k[0] ;
+}
+
+static double filterListStat (OneFile *vf, int attr)
+{
+  OneInfo *li = vf->info[(int)vf->lineType] ;
+  I64 j, n = oneLen(vf) ;
+  if (!n) return 0 ;
+  double x, sum = 0, min = 0, max = 0 ;
+  OneType t = li->fieldType[li->listField] ;
+  I64 *il = (t == oneINT_LIST) ? oneIntList(vf) : 0 ;
+  double *rl = (t == oneREAL_LIST) ? oneRealList(vf) : 0 ;
+  U8 *cl = (!il && !rl) ? (U8*) oneString(vf) : 0 ; /* STRING or DNA, by byte value */
+  for (j = 0 ; j < n ; ++j)
+    { x = il ? il[j] : rl ? rl[j] : cl[j] ;
+      sum += x ;
+      if (!j || x < min) min = x ;
+      if (!j || x > max) max = x ;
+    }
+  switch (attr)
+    {
+    case A_SUM: return sum ;
+    case A_MEAN: return sum / n ;
+    case A_MIN: return min ;
+    default: return max ;
+    }
+}
+
+static int filterLine (Filter *f, FilterState *st, OneFile *vf) /* after reading a line */
+{
+  int i, T = vf->lineType ;
+  if (st->count[T]++) return -1 ; /* only the first T line gives values */
+  bool isNew = false ;
+  for (i = 0 ; i < f->nTerm ; ++i)
+    if (f->term[i].type == T && f->term[i].attr != A_COUNT && !f->term[i].isList)
+      { int a = f->term[i].attr ;
+	if (a == A_LEN) st->val[i] = oneLen(vf) ;
+	else
+	  switch (vf->info[T]->fieldType[a])
+	    {
+	    case oneINT: st->val[i] = oneInt(vf,a) ; break ;
+	    case oneREAL: st->val[i] = oneReal(vf,a) ; break ;
+	    default: st->val[i] = (U8) oneChar(vf,a) ; break ;
+	    }
+	st->isKnown[i] = isNew = true ;
+      }
+  int r = isNew ? filterEval (f, st) : -1 ;
+  if (r >= 0) return r ;
+  isNew = false ;
+  for (i = 0 ; i < f->nTerm ; ++i) /* now the terms that need the list decoded */
+    if (f->term[i].type == T && f->term[i].isList)
+      { st->val[i] = filterListStat (vf, f->term[i].attr) ;
+	st->isKnown[i] = isNew = true ;
+      }
+  return isNew ? filterEval (f, st) : -1 ;
+}
+
+static int filterEnd (Filter *f, FilterState *st) /* at the end of the object */
+{
+  int i ;
+  for (i = 0 ; i < f->nTerm ; ++i)
+    if (!st->isKnown[i])
+      { st->val[i] = (f->term[i].attr == A_COUNT) ? st->count[(int)f->term[i].type] : 0 ;
+	st->isKnown[i] = true ;
+      }
+  return filterEval (f, st) ;
+}
+
+typedef struct {
+  Filter   *f ;
+  OneFile  *vf ;
+  I64       i0, iN ;		/* objects i0 to iN-1, counting from 1 as for oneGoto() */
+  U8       *isPass ;
+} FilterJob ;
+
+static void *filterThread (void *arg)
+{
+  FilterJob *job = (FilterJob*) arg ;
+  Filter *f = job->f ;
+  OneFile *vf = job->vf ;
+  char T = f->objType ;
+  OneInfo *li = vf->info[(int)T] ;
+  FilterState *st = filterStateCreate (f) ;
+  I64 i ;
+  char *mask = new0 (f->nTerm + 129, char), *m = mask ;
+  int   j ;			/* only read object lines, which end objects, and those in terms */
+  for (j = 'A' ; j <= 'z' ; ++j)
+    if (vf->info[j] && vf->info[j]->isObject) *m++ = j ;
+  for (i = 0 ; i < f->nTerm ; ++i) *m++ = f->term[i].type ;
+  oneSetLineTypeMask (vf, mask) ;
+  for (i = job->i0 ; i < job->iN ; ++i)
+    { if (vf->lineType != T || li->accum.count != i) /* not already at object i */
+	if (!oneGoto (vf, T, i) || !oneReadLine (vf))
+	  die ("can't read object %c %lld", T, i) ;
+      memset (st->isKnown, 0, f->nTerm*sizeof(bool)) ;
+      memset (st->count, 0, sizeof(st->count)) ;
+      int r = filterLine (f, st, vf) ;
+      while (r < 0)
+	if (!oneReadLine (vf) || vf->lineType == T || !li->contains[(int)vf->lineType])
+	  r = filterEnd (f, st) ;
+	else
+	  r = filterLine (f, st, vf) ;
+      job->isPass[i] = r ;
+    }
+  oneSetLineTypeMask (vf, 0) ;
+  free (mask) ;
+  filterStateDestroy (st) ;
+  return 0 ;
+}
+
+/* evaluates the filter on every object, using nThreads readers, and returns the objects
+   that pass as an index list for the output code, starting with the lines before them */
+
+static IndexList *filterObjects (Filter *f, OneFile *vf, int nThreads, bool isVerbose)
+{
+  char T = f->objType ;
+  I64 i, n = vf->info[(int)T]->given.count, nPass = 0 ;
+  U8 *isPass = new0 (n+1, U8) ;
+  FilterJob *job = new0 (nThreads, FilterJob) ;
+  pthread_t *threads = new (nThreads, pthread_t) ;
+  for (i = 0 ; i < nThreads ; ++i)
+    { job[i].f = f ; job[i].vf = vf + i ; job[i].isPass = isPass ;
+      job[i].i0 = 1 + (n * i) / nThreads ;
+      job[i].iN = 1 + (n * (i+1)) / nThreads ;
+    }
+  if (nThreads == 1)
+    filterThread (job) ;
+  else
+    { for (i = 0 ; i < nThreads ; ++i) pthread_create (&threads[i], 0, filterThread, &job[i]) ;
+      for (i = 0 ; i < nThreads ; ++i) pthread_join (threads[i], 0) ;
+    }
+
+  IndexList *ol, *ol0 = ol = new0 (1, IndexList) ; /* 0-1 gives the lines before objects */
+  ol->i0 = 0 ; ol->iN = 1 ;
+  for (i = 1 ; i <= n ; ++i)
+    if (isPass[i])
+      { ++nPass ;
+	if (ol->iN == i && ol->i0) ++ol->iN ; /* extend the current run */
+	else
+	  { ol->next = new0 (1, IndexList) ; ol = ol->next ; ol->i0 = i ; ol->iN = i+1 ; }
+      }
+  if (isVerbose)
+    fprintf (stderr, "filter passed %lld of %lld %c objects\n", nPass, n, T) ;
+  free (isPass) ; free (job) ; free (threads) ;
+  return ol0 ;
+}
+
+/*********** main ***********/
+
 int main (int argc, char **argv)
 {
   I64 i ;
@@ -73,6 +482,8 @@ int main (int argc, char **argv)
     isBinary = false, isVerbose = false ;
   char  indexType = 0 ;
   IndexList *objList = 0 ;
+  char *filterText = 0 ;
+  int   nThreads = 1 ;
   
   timeUpdate (0) ;
 
@@ -89,8 +500,13 @@ int main (int argc, char **argv)
       fprintf (stderr, "  -b --binary                   write in binary (default is ascii)\n") ;
       fprintf (stderr, "  -o --output <filename>        output file name (default stdout)\n") ;
       fprintf (stderr, "  -i --index T x[-y](,x[-y])*   write specified objects/groups of type T\n") ;
+      fprintf (stderr, "  -f --filter <expression>      only write objects for which the expression is true\n") ;
+      fprintf (stderr, "  -T --threads <n>              number of threads to evaluate the filter [1]\n") ;
       fprintf (stderr, "  -v --verbose                  write commentary including timing\n") ;
       fprintf (stderr, "index only works for binary files; '-i A 0-10' outputs first 10 objects of type A\n") ;
+      fprintf (stderr, "filter only works for binary files; terms T.x are from the first T line in the object\n") ;
+      fprintf (stderr, "  where x is a field number, or len, count, sum, mean, min, max of the list\n") ;
+      fprintf (stderr, "  operators are || && ! < <= > >= == != + - * / and ( ), e.g. 'S.len > 1000 && Q.mean >= 53'\n") ;
       exit (0) ;
     }
   
@@ -117,6 +533,12 @@ int main (int argc, char **argv)
       { outFileName = argv[1] ; argc -= 2 ; argv += 2 ; }
     else if ((!strcmp (*argv, "-i") || !strcmp (*argv, "--index")) && argc >= 3)
       { indexType = *argv[1] ; objList = parseIndexList (argv[2]) ; argc -= 3 ; argv += 3 ; }
+    else if ((!strcmp (*argv, "-f") || !strcmp (*argv, "--filter")) && argc >= 2)
+      { filterText = argv[1] ; argc -= 2 ; argv += 2 ; }
+    else if ((!strcmp (*argv, "-T") || !strcmp (*argv, "--threads")) && argc >= 2)
+      { nThreads = atoi (argv[1]) ; argc -= 2 ; argv += 2 ;
+	if (nThreads < 1) die ("number of threads %d must be positive", nThreads) ;
+      }
     else die ("unknown option %s - run without arguments to see options", *argv) ;
 
   if (isBinary) isNoHeader = false ;
@@ -124,11 +546,14 @@ int main (int argc, char **argv)
     
   if (argc != 1)
     die ("need a single data one-code file as argument") ;
+  if (filterText && objList)
+    die ("can't combine -i and -f") ;
+  if (!filterText) nThreads = 1 ;
 
   OneSchema *vs = 0 ;
   if (schemaFileName && !(vs = oneSchemaCreateFromFile (schemaFileName)))
     die ("failed to read schema file %s", schemaFileName) ;
-  OneFile *vfIn = oneFileOpenRead (argv[0], vs, fileType, 1) ; /* reads the header */
+  OneFile *vfIn = oneFileOpenRead (argv[0], vs, fileType, nThreads) ; /* reads the header */
   if (!vfIn) die ("failed to open one file %s", argv[0]) ;
 
   if (objList)
@@ -140,6 +565,16 @@ int main (int argc, char **argv)
 	die ("no index for line type %c", indexType) ;
     }
 
+  Filter *filter = 0 ;
+  if (filterText)
+    { if (!vfIn->isBinary)
+	die ("%s is ascii - you can only filter objects in binary files", argv[0]) ;
+      filter = filterCreate (vfIn, filterText) ;
+      indexType = filter->objType ;
+      if (!vfIn->info[(int)indexType]->index)
+	die ("no index for line type %c", indexType) ;
+    }
+
   if (isWriteSchema)
     { oneFileWriteSchema (vfIn, outFileName) ; }
   else
@@ -161,6 +596,8 @@ int main (int argc, char **argv)
       if (!isHeaderOnly)
 	{ oneAddProvenance (vfOut, "ONEview", "0.0", command) ;
       
+	  if (filter) objList = filterObjects (filter, vfIn, nThreads, isVerbose) ;
+
 	  static size_t fieldSize[128] ;
 	  for (i = 0 ; i < 128 ; ++i)
 	    if (vfIn->info[i]) fieldSize[i] = vfIn->info[i]->nField*sizeof(OneField) ;
@@ -198,6 +635,7 @@ int main (int argc, char **argv)
       
   oneFileClose (vfIn) ;
   if (vs) oneSchemaDestroy (vs) ;
+  if (filter) filterDestroy (filter) ;
   
   free (command) ;
   if (isVerbose) timeTotal (stderr) ;
@@ -1074,8 +1074,36 @@ static void readStringList(OneFile *vf, char t, I64 len)
 
 bool addProvenance(OneFile *vf, OneProvenance *from, int n) ; // need forward declaration
 
+bool oneSetLineTypeMask (OneFile *vf, const char *lineTypes)
+{ int i ;
+
+  if (vf->isWrite) return false ;
+  if (!lineTypes) { vf->isMask = false ; return true ; }
+  for (i = 0 ; lineTypes[i] ; ++i)
+    if (lineTypes[i] < 0 || !vf->info[(int) lineTypes[i]])
+      { snprintf (errorString, 1024, "unknown line type %c in line type mask", lineTypes[i]) ;
+	return false ;
+      }
+  memset (vf->lineMask, 0, 128) ;
+  for (i = 0 ; lineTypes[i] ; ++i) vf->lineMask[(int) lineTypes[i]] = true ;
+  vf->lineMask['/'] = true ;       // comments of wanted lines are read with them
+  vf->isMask = true ;
+  return true ;
+}
+
+static void skipBytes (OneFile *vf, I64 n) // seek past long lists, so they are not read
+{ if (n <= 0) return ;
+  if (n > (1 << 16) && !fseek (vf->f, n, SEEK_CUR)) return ; // fseek() drops the stdio buffer
+  while (n > 0)
+    { I64 k = (n < vf->codecBufSize) ? n : vf->codecBufSize ;
+      if ((I64) fread (vf->codecBuf, 1, k, vf->f) != k)
+	die ("ONE read error: failed to skip list size %lld", n) ;
+      n -= k ;
+    }
+}
+
 char oneReadLine (OneFile *vf)
-{ bool      isAscii;
+{ bool      isAscii, isSkip;
   U8        x;
   char      t;
   OneInfo  *li;
@@ -1083,6 +1111,7 @@ char oneReadLine (OneFile *vf)
   assert (!vf->isWrite) ;
   assert (!vf->isFinal) ;
 
+ nextLine:                         // return here after a line of a type not in the mask
   vf->linePos = 0;                 // must come before first vfGetc()
   x = vfGetc (vf);                 // read first char
   if (feof (vf->f) || x == '\n')   // blank line (x=='\n') is end of records marker before footer
@@ -1113,6 +1142,8 @@ char oneReadLine (OneFile *vf)
     *(char*)(vf->info['/']->buffer) = 0 ;
 
   vf->nBits = 0 ;        // will use for any compressed data read in
+  vf->isIntListCompact = false ;
+  isSkip = vf->isMask && !vf->lineMask[(int) t] ;
   
   if (isAscii)           // read field by field according to ascii spec
     { int     i, j;
@@ -1164,6 +1195,7 @@ char oneReadLine (OneFile *vf)
             break;
 	  }
       readFlush (vf);
+      if (isSkip) goto nextLine ;
     }
 
   else        // binary - block read fields and list, potentially compressed
@@ -1194,20 +1226,27 @@ char oneReadLine (OneFile *vf)
               else if (x & 0x1)    				  // list is compressed
                 { vf->nBits = ltfRead (vf->f) ;
 		  size_t bytes = (vf->nBits+7) >> 3 ;
-		  if (bytes > (size_t) vf->codecBufSize)
+		  if (isSkip)
+		    { skipBytes (vf, bytes) ; vf->nBits = 0 ; }
+		  else if (bytes > (size_t) vf->codecBufSize)
 		    { if (vf->codecBuf) free (vf->codecBuf) ;
 		      vf->codecBufSize = bytes + 1 ;
 		      vf->codecBuf = new (vf->codecBufSize, void) ;
 		    }
-                  if (fread (vf->codecBuf, bytes, 1, vf->f) != 1)
+                  if (!isSkip && fread (vf->codecBuf, bytes, 1, vf->f) != 1)
                     die ("ONE read error: fail to read compressed list");
                 }
               else if (li->fieldType[li->listField] == oneINT_LIST)
                 { I64 listSize  = (listLen-1) * vf->intListBytes ;
-                  if ((I64) fread (&(((I64*)li->buffer)[1]), 1, listSize, vf->f) != listSize)
+		  if (isSkip)
+		    skipBytes (vf, listSize) ;
+                  else if ((I64) fread (&(((I64*)li->buffer)[1]), 1, listSize, vf->f) != listSize)
                     die ("ONE read error: failed to read list size %lld", listSize);
-		  decompactIntList (vf, listLen, li->buffer, vf->intListBytes);
+		  else
+		    vf->isIntListCompact = true ; // decompacted by _oneList() if it is wanted
                 }
+	      else if (isSkip)
+		skipBytes (vf, listLen * li->listEltSize) ;
 	      else
                 { I64 listSize  = listLen * li->listEltSize ;
                   if ((I64) fread (li->buffer, 1, listSize, vf->f) != listSize)
@@ -1215,7 +1254,7 @@ char oneReadLine (OneFile *vf)
                 }
             }
 
-          if (li->fieldType[li->listField] == oneSTRING)
+          if (li->fieldType[li->listField] == oneSTRING && !isSkip)
             ((char *) li->buffer)[listLen] = '\0'; // 0 terminate
         }
 
@@ -1228,12 +1267,16 @@ char oneReadLine (OneFile *vf)
 	if (peek == '/') // a comment
 	  { OneField keepField0 = vf->field[0] ;
 	    I64 keepNbits = vf->nBits ; // will be reset in readLine
+	    bool keepCompact = vf->isIntListCompact ;
 	    oneReadLine (vf) ; // read comment line into vf->info['/']->buffer
 	    vf->lineType = t ;
 	    vf->field[0] = keepField0 ;
 	    vf->nBits = keepNbits ;
+	    vf->isIntListCompact = keepCompact ;
 	  }
       }
+
+      if (isSkip) goto nextLine ;
     }
 
   return t;
@@ -1261,6 +1304,10 @@ void *_oneList (OneFile *vf)
 	vcDecode (li->listCodec, vf->nBits, vf->codecBuf, li->buffer) ;
       vf->nBits = 0 ; // so we don't do it again
     }
+  else if (vf->isIntListCompact)
+    { decompactIntList (vf, oneLen(vf), li->buffer, vf->intListBytes) ;
+      vf->isIntListCompact = false ;
+    }
   
   return li->buffer ;
 }
@@ -2668,22 +2715,15 @@ static void oneWriteFooter (OneFile *vf)
   //   accumulating counts/statistics for the file and merge thread stats into those for
   //   the master file (if a parallel OneFile).
 
-void oneFinalizeCounts(OneFile *vf)
+  // Merges the counts/statistics and indices of the slave threads of a parallel OneFile into
+  //   the master.  If isFinal, objects still open at the end of the last thread are closed,
+  //   else they are carried back into the master, to be continued by the next round of lines.
+
+static void mergeThreadCounts (OneFile *vf, bool isFinal)
 { int      ii, j, k ;
   OneInfo *li, *lk;
 
-  if (vf->share < 0)
-    die ("ONE write error: cannot call oneFileClose on a slave OneFile");
-
-  vf->isFinal = true; // needed to prevent infinite recursion
-
-  if (vf->share == 0)
-    { while (vf->objectFrame)
-	endObject (vf, vf->openObjects[vf->objectFrame]) ; // terminate open objects
-      return; 
-    }
-
-  int nthreads = vf->share; // if we get here then nthreads > 1
+  int nthreads = vf->share;
   
   // first we need to complete any objects left open at the end of files and update max count/total
   OneFile *vk, *vk1 ;
@@ -2713,7 +2753,7 @@ void oneFinalizeCounts(OneFile *vf)
 	    }
 	  --vk1->objectFrame ;
 	}
-      if (k == nthreads-1) // close any remaining open objects at the end of the final file
+      if (isFinal && k == nthreads-1) // close any remaining open objects at the end of the final file
 	while (vk->objectFrame)
 	  endObject (vk, vk->openObjects[vk->objectFrame]) ;
       
@@ -2759,6 +2799,115 @@ void oneFinalizeCounts(OneFile *vf)
 	    }
 	}
     }
+
+  if (!isFinal) // carry objects open at the end of the last thread back into the master
+    { vk = &vf[nthreads-1] ;
+      for (j = 1 ; j <= vk->objectFrame ; ++j)
+	{ lk = vk->openObjects[j] ;
+	  int i ;
+	  for (i = 'A' ; i <= 'z' ; ++i) if (vk->info[i] == lk) break ;
+	  if (i <= 'z') li = vf->info[i] ; else die ("failed to find li") ;
+	  for (s = li->stats, s1 = lk->stats ; s->type ; ++s, ++s1) // restate start in master coords
+	    { s->count = vf->info[(int)s->type]->accum.count
+		- vk->info[(int)s->type]->accum.count + s1->count ;
+	      if (s->isList)
+		s->total = vf->info[(int)s->type]->accum.total
+		  - vk->info[(int)s->type]->accum.total + s1->total ;
+	    }
+	  vf->openObjects[++vf->objectFrame] = li ;
+	}
+      vk->objectFrame = 0 ;
+    }
+}
+
+  // After all input has been read, or all data has been written, this routine will finish
+  //   accumulating counts/statistics for the file and merge thread stats into those for
+  //   the master file (if a parallel OneFile).
+
+void oneFinalizeCounts(OneFile *vf)
+{
+  if (vf->share < 0)
+    die ("ONE write error: cannot call oneFileClose on a slave OneFile");
+
+  vf->isFinal = true; // needed to prevent infinite recursion
+
+  if (vf->share == 0)
+    { while (vf->objectFrame)
+	endObject (vf, vf->openObjects[vf->objectFrame]) ; // terminate open objects
+      return; 
+    }
+
+  mergeThreadCounts (vf, true) ; // if we get here then nthreads > 1
+}
+
+static void catThreadFiles (OneFile *vf) // appends the slave files to vf->f and rewinds them
+{ int   i ;
+  I64   size, n ;
+  char *buf = new (10000000, char);
+
+  for (i = 1; i < vf->share; i++)
+    { size = ftello (vf[i].f) ; // NB slave files are reused, so may extend beyond this
+      if (fseek (vf[i].f, 0L, SEEK_SET) != 0)
+	die ("ONEfile error: failed to rewind parallel file %d", i) ;
+      while (size > 0)
+	{ n = size < 10000000 ? size : 10000000 ;
+	  if ((I64) fread (buf, 1, n, vf[i].f) != n)
+	    die ("ONE write error: failed to read back parallel file %d", i) ;
+	  if ((I64) fwrite (buf, 1, n, vf->f) != n)
+	    die ("ONE write error: while cat'ing thread bits (oneFileClose)");
+	  size -= n ;
+	}
+      if (fseek (vf[i].f, 0L, SEEK_SET) != 0)
+	die ("ONEfile error: failed to rewind parallel file %d", i) ;
+    }
+  free (buf) ;
+}
+
+  // Lines written so far by the slave threads are appended to the master file, in thread order,
+  //   and the slaves are reset to write the next round.  This lets an ordered stream be written
+  //   in parallel, by giving each thread successive batches and merging after each round.
+
+void oneMergeThreads (OneFile *vf)
+{ int      i, ii ;
+  OneInfo *li ;
+  OneStat *s ;
+
+  if (vf->share < 0)
+    die ("ONE write error: cannot call oneMergeThreads on a slave OneFile");
+  if (!vf->isWrite || vf->isFinal || vf->share == 0) return ;
+
+  if (!vf->isHeaderOut && (vf->isBinary || !vf->isNoAsciiHeader))
+    { writeHeader (vf) ;
+      if (vf->isBinary) // as in oneWriteLine(), so that index[0] is the start of the data
+	{ fputc ('\n', vf->f) ;
+	  vf->byte = ftello (vf->f) ;
+	  vf->isLastLineBinary = true ;
+	  for (i = 'A' ; i <= 'z' ; i++)
+	    if (vf->info[i] && vf->info[i]->index)
+	      vf->info[i]->index[0] = vf->byte ;
+	}
+    }
+
+  mergeThreadCounts (vf, false) ;
+  catThreadFiles (vf) ;
+  if (vf->isBinary) vf->byte = ftello (vf->f) ;
+
+  for (i = 1 ; i < vf->share ; ++i) // reset the slaves as if newly opened
+    { OneFile *v = &vf[i] ;
+      for (ii = 0 ; ii < v->nDefn ; ++ii)
+	{ if (v->defnOrder[ii] & 0x80) continue ; // skip 'G' lines
+	  li = v->info[v->defnOrder[ii]] ;
+	  li->accum.count = li->accum.max = li->accum.total = 0 ;
+	  li->isFirst = true ;
+	  li->isClosed = false ;
+	  if (li->stats)
+	    for (s = li->stats ; s->type ; ++s)
+	      s->count = s->count0 = s->maxCount = s->total = s->total0 = s->maxTotal = 0 ;
+	}
+      vf->line += v->line ; v->line = 0 ;
+      v->byte = 0 ;
+      v->isLastLineBinary = v->isBinary ;
+    }
 }
 
 //
@@ -2771,18 +2920,7 @@ static void oneFinalize (OneFile *vf)
   if (!vf->isHeaderOut && (vf->isBinary || !vf->isNoAsciiHeader)) writeHeader (vf) ;
       
   if (vf->share > 0)
-    { int  i, nread ;
-      char *buf;
-      buf = new (10000000, char);
-      for (i = 1; i < vf->share; i++)
-	{ if (fseek (vf[i].f, 0L, SEEK_SET) != 0)
-	    die ("ONEfile error: failed to rewind parallel file %d", i) ;
-	  while (!feof(vf[i].f) && (nread = fread (buf,1,10000000,vf[i].f)) > 0)
-	    if ((int) fwrite(buf,1,nread,vf->f) != nread)
-	      die ("ONE write error: while cat'ing thread bits (oneFileClose)");
-	}
-      free(buf);
-    }
+    catThreadFiles (vf) ;
 
   if (vf->isBinary || vf->line)
     fputc ('\n', vf->f) ; // terminate last line - end of data marker if binary
@@ -184,6 +184,9 @@ typedef struct
     char  *codecBuf;
     I64    nBits;                  // number of bits of list currently in codecBuf
     I64    intListBytes;           // number of bytes per integer in the compacted INT_LIST
+    bool   isIntListCompact;       // INT_LIST in buffer still compacted - _oneList() expands it
+    bool   isMask;                 // if set, oneReadLine() skips line types not in lineMask
+    bool   lineMask[128];
     I64    linePos;                // current line position
     OneHeaderText *headerText;     // arbitrary descriptive text that goes with the header
     OneInfo *openObjects[128];     // stack of infos for open objects
@@ -287,6 +290,13 @@ char oneReadLine (OneFile *of) ;
   //   if at the end of the data section.  The content macros immediately below are
   //   used to access the information of the line most recently read.
 
+bool oneSetLineTypeMask (OneFile *of, const char *lineTypes) ;
+
+  // Restrict oneReadLine() to the line types in the string lineTypes, e.g. "SI"; 0 removes
+  //   the restriction.  Binary lines of other types are passed by seeking over their lists,
+  //   which are neither read nor decoded, though their counts are still kept up to date.
+  //   Returns false for an unknown line type.  Set it on each OneFile of a threaded read.
+
 void   *_oneList (OneFile *of) ;                // lazy codec decompression if required
 void   *_oneCompressedList (OneFile *of) ;      // lazy codec compression if required
 
@@ -385,6 +395,12 @@ void oneWriteComment (OneFile *of, char *format, ...); // can not include newlin
 
   // Adds a comment to the current line. Extends line in ascii, adds special line type in binary.
 
+void oneMergeThreads (OneFile *of);
+
+  // For a file opened for writing with nthreads > 1, appends all lines written so far by the
+  //   slaves (of+1, of+2, ...) to the master in thread order, and resets the slaves. Call when
+  //   no thread is writing. Lets threads write successive batches of an ordered stream in rounds.
+
 // CLOSING FILES (FOR BOTH READ & WRITE):
 
 void oneFileClose (OneFile *of);
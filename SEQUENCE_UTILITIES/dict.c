@@ -27,38 +27,89 @@
 
 #include "dict.h"
 
-#include "array.h"
+/* Open addressing over slots in groups of 8, probing group by group.  Next to each slot is
+   a one byte tag from the hash, so a probe tests the 8 tags of a group with a few word
+   operations, and only compares strings where a tag matches.  Name text is packed into
+   large arena blocks rather than allocated one by one.  dictFind() keeps no state, so
+   lookups can run in parallel while the dictionary is not being added to.
+*/
+
+#define GROUP 8
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+#define ARENA_BLOCK (1 << 20)
 
 /****************************************/
 
-static void* remap (void *old, U64 oldSize, U64 newSize)
+static inline U64 hashString (char *cp)
 {
-  void* new = mycalloc (newSize, 1) ;
-  memcpy (new, old, oldSize) ;
-  free (old) ;
-  return new ;
+  U64 x = 0xcbf29ce484222325ULL ; // FNV-1a, then the murmur3 finaliser to mix the bits
+  while (*cp) x = (x ^ (U8)*cp++) * 0x100000001b3ULL ;
+  x ^= x >> 33 ; x *= 0xff51afd7ed558ccdULL ;
+  x ^= x >> 33 ; x *= 0xc4ceb9fe1a85ec53ULL ;
+  x ^= x >> 33 ;
+  return x ;
 }
 
-/****************************************/
+static inline U64 zeroBytes (U64 x) /* top bit set in each zero byte of x */
+{ return (x - ONES) & ~x & HIGHS ; } // can also flag a byte above a zero byte - callers check
 
-static U64 hashString (char *cp, U64 n, bool isDiff)
-{
-  U64 i ;
-  U64 j, x = 0 ;
-  U64 rotate = isDiff ? 21 : 13 ;
-  U64 leftover = 8 * sizeof(U64) - rotate ;
+static inline U8 hashTag (U64 h) { return 0x80 | (h >> 57) ; } /* never 0 = empty */
 
-  while (*cp)
-    x = (*cp++) ^ ((x >> leftover) | (x << rotate)) ;
+/* dictProbe() returns the index (1-based) of s if present, else 0 and the slot for it */
 
-  for (j = x, i = n ; i < sizeof(U64) ; i += n)
-    j ^= (x >> i) ;
-  j &= (1 << n) - 1 ;
+static inline U64 dictProbe (DICT *dict, char *s, U64 h, U64 *slot)
+{
+  U64 mask = dict->size - 1 ;
+  U64 x = h & mask & ~(U64)(GROUP-1) ;
+  U8  tag = hashTag (h) ;
+  U64 tagWord = ONES * tag ;
+  while (true)
+    { U64 w, m, j, i ;
+      memcpy (&w, dict->tags + x, GROUP) ;
+      for (m = zeroBytes (w ^ tagWord) ; m ; m &= m - 1)
+	{ j = x + (__builtin_ctzll (m) >> 3) ; // little-endian: lowest bits are first slot
+	  if (dict->tags[j] == tag && !strcmp (s, dict->names[i = dict->table[j]]))
+	    return i ;
+	}
+      if ((m = zeroBytes (w))) // the lowest flag is always a true zero, i.e. empty slot
+	{ if (slot) *slot = x + (__builtin_ctzll (m) >> 3) ;
+	  return 0 ;
+	}
+      x = (x + GROUP) & mask ;
+    }
+}
 
-  if (isDiff)
-    j |= 1 ;
+static inline void dictPlace (DICT *dict, U64 h, U64 i) /* for rehashing - i is not present */
+{
+  U64 mask = dict->size - 1 ;
+  U64 x = h & mask & ~(U64)(GROUP-1), w, m ;
+  while (true)
+    { memcpy (&w, dict->tags + x, GROUP) ;
+      if ((m = zeroBytes (w)))
+	{ x += __builtin_ctzll (m) >> 3 ;
+	  dict->tags[x] = hashTag (h) ; dict->table[x] = i ;
+	  return ;
+	}
+      x = (x + GROUP) & mask ;
+    }
+}
 
-  return j ;
+static char *arenaCopy (DICT *dict, char *s, U64 len) /* len includes the terminating 0 */
+{
+  if (len > dict->arenaLeft)
+    { U64 size = len + sizeof(char*) ;
+      if (size < ARENA_BLOCK) size = ARENA_BLOCK ;
+      char *block = new (size, char) ;
+      *(char**)block = dict->block ; // link to the previous block, for dictDestroy()
+      dict->block = block ;
+      dict->arena = block + sizeof(char*) ;
+      dict->arenaLeft = size - sizeof(char*) ;
+    }
+  char *t = dict->arena ;
+  memcpy (t, s, len) ;
+  dict->arena += len ; dict->arenaLeft -= len ;
+  return t ;
 }
 
 /*****************************/
@@ -68,8 +119,9 @@ DICT *dictCreate (U64 size)
   DICT *dict = (DICT*) mycalloc (1, sizeof(DICT)) ;
 
   for (dict->dim = 10, dict->size = 1024 ; dict->size < size ; ++dict->dim, dict->size *= 2) ;
-  dict->table = (U64*) mycalloc (dict->size, sizeof(U64)) ;
-  dict->names = (char**) mycalloc (dict->size/2, sizeof(char*)) ;
+  dict->table = new (dict->size, U64) ;
+  dict->tags = new0 (dict->size, U8) ;
+  dict->names = new0 (dict->size/2 + 1, char*) ;
   return dict ; 
 }
 
@@ -77,21 +129,30 @@ DICT *dictCreate (U64 size)
 
 void dictDestroy (DICT *dict)
 {
-  U64 i ;
-  for (i = 1 ; i <= dict->max ; ++i) free (dict->names[i]) ;
+  while (dict->block)
+    { char *prev = *(char**)dict->block ;
+      free (dict->block) ;
+      dict->block = prev ;
+    }
   free (dict->names) ;
   free (dict->table) ;
+  free (dict->tags) ;
   free (dict) ;
 }
 
 /*****************************/
 
+/* The file starts with a version tag, then holds the names in index order, so dictRead()
+   rebuilds the table with dictAdd().  Files from before the tag start with the table dim,
+   and are rejected.  Change the tag if the format changes again. */
+
+static char dictFileTag[8] = "DICT\0v2\n" ;
+
 bool dictWrite (DICT *dict, FILE *f)
 {
+  if (fwrite (dictFileTag,1,8,f) != 8) return false ;
   if (fwrite (&dict->dim,sizeof(U64),1,f) != 1) return false ;
   if (fwrite (&dict->max,sizeof(U64),1,f) != 1) return false ;
-  if (fwrite (dict->table,sizeof(U64),dict->size,f) != dict->size) return false ;
-  if (fwrite (dict->names,sizeof(char*),dict->max+1,f) != dict->max+1) return false ;
   U64 i ;
   for (i = 1 ; i <= dict->max ; ++i)
     { U64 len = strlen(dict->names[i]) ;
@@ -103,91 +164,94 @@ bool dictWrite (DICT *dict, FILE *f)
   
 DICT *dictRead (FILE *f)
 {
-  U64 dim ; if (fread (&dim,sizeof(U64),1,f) != 1) return 0 ;
-  DICT *dict = dictCreate (1 << dim) ;
-  if (fread (&dict->max,sizeof(U64),1,f) != 1) return 0 ;
-  if (fread (dict->table,sizeof(U64),dict->size,f) != dict->size) return 0 ;
-  if (fread (dict->names,sizeof(char*),dict->max+1,f) != dict->max+1) return 0 ;
-  U64 i ;
-  for (i = 1 ; i <= dict->max ; ++i)
-    { U64 len ;
-      if (fread (&len,sizeof(U64),1,f) != 1) return 0 ;
-      dict->names[i] = new0 (len+1, char) ;
-      if (fread (dict->names[i],1,len,f) != len) return 0 ;
+  U64 dim, max ;
+  char tag[8] ;
+  if (fread (tag,1,8,f) != 8 || memcmp (tag, dictFileTag, 8)) return 0 ;
+  if (fread (&dim,sizeof(U64),1,f) != 1 || dim > 62) return 0 ;
+  if (fread (&max,sizeof(U64),1,f) != 1) return 0 ;
+  DICT *dict = dictCreate ((U64)1 << dim) ;
+  char *s = 0 ;
+  U64 i, len, sMax = 0 ;
+  for (i = 1 ; i <= max ; ++i)
+    { if (fread (&len,sizeof(U64),1,f) != 1) break ;
+      if (len >= sMax) { free (s) ; sMax = len + 1024 ; s = new (sMax, char) ; }
+      if (fread (s,1,len,f) != len) break ;
+      s[len] = 0 ;
+      dictAdd (dict, s, 0) ;
     }
+  free (s) ;
+  if (i <= max) { dictDestroy (dict) ; return 0 ; }
   return dict ;
 }
 
 /*****************************/
 
-static U64 newPos ;		/* communication between dictFind() and dictAdd() */
-
 bool dictFind (DICT *dict, char *s, U64 *ip)
 {
-  U64 i, x, d ;
+  U64 i ;
 
-  if (!dict) die ("dictAdd received null dict\n") ;
-  if (!s) die ("dictAdd received null string\n") ;
+  if (!dict) die ("dictFind received null dict\n") ;
+  if (!s) die ("dictFind received null string\n") ;
 
-  x = hashString (s, dict->dim, 0) ;
-  if (!(i = dict->table[x]))
-    { newPos = x ; 
-      return false ; 
-    }
-  else if (!strcmp (s, dict->names[i]))
-    { if (ip) *ip = i-1 ; 
-      return true ; 
-    }
-  else
-    { d = hashString (s, dict->dim, 1) ;
-      while (1)
-	{ x = (x + d) & ((1 << dict->dim) - 1) ;
-	  if (!(i = dict->table[x]))
-	    { newPos = x ; 
-	      return false ; 
-	    }
-	  else if (!strcmp (s, dict->names[i]))
-	    { if (ip) *ip = i-1 ; 
-	      return true ; 
-	    }
+  if (!(i = dictProbe (dict, s, hashString (s), 0))) return false ;
+  if (ip) *ip = i-1 ;
+  return true ;
+}
+
+/*****************************/
+
+#define BATCH 16
+
+U64 dictFindBatch (DICT *dict, U64 n, char **s, I64 *index)
+{
+  U64 h[BATCH], i, j, nFound = 0 ;
+
+  if (!dict) die ("dictFindBatch received null dict\n") ;
+
+  for (i = 0 ; i < n ; i += BATCH)
+    { U64 nb = (n - i < BATCH) ? n - i : BATCH ;
+      for (j = 0 ; j < nb ; ++j) // hash a batch and prefetch where each will probe first
+	{ U64 x = (h[j] = hashString (s[i+j])) & (dict->size - 1) & ~(U64)(GROUP-1) ;
+	  __builtin_prefetch (dict->tags + x) ;
+	  __builtin_prefetch (dict->table + x) ;
+	}
+      for (j = 0 ; j < nb ; ++j)
+	{ U64 k = dictProbe (dict, s[i+j], h[j], 0) ;
+	  index[i+j] = (I64)k - 1 ;
+	  if (k) ++nFound ;
 	}
     }
+  return nFound ;
 }
 
 /*****************************/
 
 bool dictAdd (DICT *dict, char *s, U64 *ip)
 {
-  U64 i, x ;
+  U64 i, slot = 0, h ;
 
-  if (dictFind (dict, s, ip)) return false ;
+  if (!dict) die ("dictAdd received null dict\n") ;
+  if (!s) die ("dictAdd received null string\n") ;
+
+  h = hashString (s) ;
+  if ((i = dictProbe (dict, s, h, &slot)))
+    { if (ip) *ip = i-1 ;
+      return false ;
+    }
 
   i = ++dict->max ;
-  dict->table[newPos] = i ;
-  dict->names[i] = (char*) myalloc (strlen(s) + 1) ;
-  strcpy (dict->names[i], s) ;
+  dict->names[i] = arenaCopy (dict, s, strlen(s) + 1) ;
+  dict->tags[slot] = hashTag (h) ;
+  dict->table[slot] = i ;
   if (ip) *ip = i-1 ;
 
-  if (dict->max > 0.3 * dict->size) /* double table size and remap */
-    { U64 *newTable ;
-      ++dict->dim ; dict->size *= 2 ;
-      dict->names = (char**) remap (dict->names, (dict->max+1)*sizeof(char*), (dict->size/2)*sizeof(char*)) ;
-      newTable = (U64*) mycalloc (dict->size, sizeof(U64)) ;
+  if (dict->max >= dict->size/2) /* double table size and rehash */
+    { ++dict->dim ; dict->size *= 2 ;
+      dict->names = newResize (dict->names, dict->max+1, dict->size/2 + 1, char*) ;
+      free (dict->table) ; dict->table = new (dict->size, U64) ;
+      free (dict->tags) ; dict->tags = new0 (dict->size, U8) ;
       for (i = 1 ; i <= dict->max ; ++i)
-	{ s = dict->names[i] ;
-	  x = hashString (s, dict->dim, 0) ;
-	  if (!newTable[x])
-	    newTable[x] = i ;
-	  else
-	    { U64 d = hashString (s, dict->dim, 1) ;
-	      while (1)
-		{ x = (x + d) & ((1 << dict->dim) - 1) ;
-		  if (!newTable[x])
-		    { newTable[x] = i ; break ; }
-		}
-	    }
-	}
-      free (dict->table) ; dict->table = newTable ;
+	dictPlace (dict, hashString (dict->names[i]), i) ;
     }
 
   return true ;
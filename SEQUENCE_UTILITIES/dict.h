@@ -18,19 +18,27 @@
 #include "utils.h"
 
 typedef struct {
-  char* *names ;
-  U64 *table ;
+  char* *names ;		/* names[1..max], pointing into arena blocks */
+  U64 *table ;			/* index+1 of the name in each slot */
+  U8  *tags ;			/* per slot: 0 if empty, else 0x80 | top 7 bits of the hash */
   U64 max ;			/* current number of entries */
   U64 dim ;
   U64 size ;			/* 2^dim = size of tables */
+  char *block ;			/* current block of name text, starts with link to previous */
+  char *arena ;			/* free space in block */
+  U64 arenaLeft ;
 } DICT ;
 
 DICT *dictCreate (U64 size) ;
 void dictDestroy (DICT *dict) ;
 bool dictWrite (DICT *dict, FILE *f) ; /* return success or failure */
-DICT *dictRead (FILE *f) ;	       /* return 0 on failure */
+DICT *dictRead (FILE *f) ;	       /* return 0 on failure, including files of an older format */
 bool dictAdd (DICT *dict, char* string, U64 *index) ; /* return TRUE if added, always fill index */
 bool dictFind (DICT *dict, char *string, U64 *index) ; /* return TRUE if found */
+U64  dictFindBatch (DICT *dict, U64 n, char **strings, I64 *index) ;
+	/* looks up n strings, prefetching ahead; index[i] is -1 if not found; returns number found */
+	/* dictFind() and dictFindBatch() can run in many threads at once, if no dictAdd() is
+	   running at the same time */
 char* dictName (DICT *dict, U64 i) ;
 
 #define dictMax(dict)  ((dict)->max)
@@ -28,6 +28,7 @@
 
 #include "hash.h"
 #include "array.h"
+#include <pthread.h>
 
 /* Originally grabbed from Steve Omohundro's sather code by Richard Durbin.
 
@@ -40,6 +41,14 @@
    be used as array indices, i.e. similar to DICT package, generating extra indirection 
    if true type is an integer, but flexible.
    Empty and removed keys are now INT_MAX and INT_MAX-1 for integers and floats.
+
+   There is also a concurrent mode.  The keys are split by a second hash into stripes,
+   each an ordinary table with its own lock for adding.  Finds take no lock: an add writes
+   the value before the key, and a stripe that grows builds a new table and then publishes
+   it, keeping the old one for readers that may still be in it.  So doubling only ever
+   moves one stripe, while adds and finds carry on in the others.  The old tables together
+   are smaller than the current one; hashCompact() frees them when no other thread is
+   using the Hash, as do hashClear() and hashDestroy().
 */
 
 typedef struct {
@@ -52,23 +61,46 @@ typedef struct {
   Array freeList ;     		/* list of removed integers that can be reused */
   int nFree ;			/* number in free list */
   int iter ;			/* used in iterator */
+  struct HashStripeStruct *stripes ; /* if concurrent, then keys and values are not used */
+  int iterStripe ;
 } TrueHash ;
 
+typedef struct HashTableStruct {
+  I64      mask ;
+  HashKey *keys ;
+  int     *values ;
+  struct HashTableStruct *retired ; /* tables replaced by doubling, freed by hashCompact() */
+} HashTable ;
+
+typedef struct HashStripeStruct {
+  pthread_mutex_t lock ;	/* held while adding */
+  HashTable *table ;		/* current table, readable without the lock */
+  int        nbits, guard ;
+} HashStripe ;
+
+#define STRIPE_BITS 6
+
 static const int IS5 = (sizeof(I64)*8)/5 ;
 static const int IS7 = (sizeof(I64)*8)/7 ;
 
-static inline I64 hashFunc (TrueHash *h, HashKey hk)
+static inline I64 hashMaskFunc (I64 mask, HashKey hk)
 { int z = IS5 ; I64 x = hk.i, hash ;
   for (hash = x, x >>= 5 ; z-- ; x >>= 5) hash ^= x ;
-  return hash & h->mask ;
+  return hash & mask ;
 }
 
-static inline I64 deltaFunc (TrueHash *h, HashKey hk)
+static inline I64 deltaMaskFunc (I64 mask, HashKey hk)
 { int z = IS7 ; I64 x = hk.i, delta ;
   for (delta = x, x >>= 7 ; z-- ; x >>= 7) delta ^= x ;
-  return (delta & h->mask) | 0x01 ;  /* delta odd is prime relative to  2^m */
+  return (delta & mask) | 0x01 ;  /* delta odd is prime relative to  2^m */
 }
 
+static inline I64 hashFunc (TrueHash *h, HashKey hk) { return hashMaskFunc (h->mask, hk) ; }
+static inline I64 deltaFunc (TrueHash *h, HashKey hk) { return deltaMaskFunc (h->mask, hk) ; }
+
+static inline int stripeFunc (HashKey hk) /* top bits of a multiplicative hash */
+{ return (int) (((U64)hk.i * 0x9e3779b97f4a7c15ULL) >> (64 - STRIPE_BITS)) ; }
+
 #define HASH_FUNC(_key) { register int z = IS5, x = _key.i ; \
 		          for (hash = x, x >>= 5 ; z-- ; x >>= 5) hash ^= x ; \
 			  hash &= h->mask ;				\
@@ -112,20 +144,94 @@ Hash hashCreate (int n)
   return (Hash) h ;
 }
 
+static HashTable *tableCreate (int nbits) /* calloc() not new0(), whose counts are not thread safe */
+{
+  HashTable *t = (HashTable*) calloc (1, sizeof(HashTable)) ;
+  if (t) t->keys = (HashKey*) calloc ((I64)1 << nbits, sizeof(HashKey)) ;
+  if (t && t->keys) t->values = (int*) calloc ((I64)1 << nbits, sizeof(int)) ;
+  if (!t || !t->values) die ("out of memory growing concurrent hash to 2^%d", nbits) ;
+  t->mask = ((I64)1 << nbits) - 1 ;
+  return t ;
+}
+
+static void tableDestroy (HashTable *t)
+{
+  while (t)
+    { HashTable *next = t->retired ;
+      free (t->keys) ; free (t->values) ; free (t) ;
+      t = next ;
+    }
+}
+
+Hash hashCreateConcurrent (int n)
+{
+  TrueHash *h = (TrueHash*) hashCreate (64) ;
+  int i, nbits = 1 ;
+
+  newFree (h->keys, 1 << h->nbits, HashKey) ; h->keys = 0 ; // these are in the stripes
+  newFree (h->values, 1 << h->nbits, int) ; h->values = 0 ;
+  n >>= STRIPE_BITS ;		/* expected number per stripe */
+  if (n < 64) n = 64 ;
+  --n ;
+  while (n >>= 1) ++nbits ;	/* twice as big as needed, as in hashCreate() */
+  h->stripes = new0 (1 << STRIPE_BITS, HashStripe) ;
+  for (i = 0 ; i < (1 << STRIPE_BITS) ; ++i)
+    { HashStripe *s = &h->stripes[i] ;
+      pthread_mutex_init (&s->lock, 0) ;
+      s->nbits = nbits ;
+      s->table = tableCreate (nbits) ;
+      s->guard = 1 << (nbits - 1) ;
+    }
+  return (Hash) h ;
+}
+
 void hashDestroy (Hash hx)
 {
   TrueHash *h = (TrueHash*) hx ;
-  newFree (h->keys, 1 << h->nbits, HashKey) ;
-  newFree (h->values, 1 << h->nbits, int) ;
+  if (h->stripes)
+    { int i ;
+      for (i = 0 ; i < (1 << STRIPE_BITS) ; ++i)
+	{ HashStripe *s = &h->stripes[i] ;
+	  tableDestroy (s->table) ; // and those it retired
+	  pthread_mutex_destroy (&s->lock) ;
+	}
+      free (h->stripes) ;
+    }
+  else
+    { newFree (h->keys, 1 << h->nbits, HashKey) ;
+      newFree (h->values, 1 << h->nbits, int) ;
+    }
   arrayDestroy (h->freeList) ;
   newFree (h, 1, TrueHash) ;
   ++nDestroyed ;
 }
 
+void hashCompact (Hash hx)
+{
+  TrueHash *h = (TrueHash*) hx ;
+  int i ;
+  if (!h->stripes) return ;
+  for (i = 0 ; i < (1 << STRIPE_BITS) ; ++i)
+    { HashTable *t = h->stripes[i].table ;
+      tableDestroy (t->retired) ;
+      t->retired = 0 ;
+    }
+}
+
 void hashClear (Hash hx)
 { 
   TrueHash *h = (TrueHash*) hx ;
   h->n = 0 ;
+  if (h->stripes)
+    { int i ;
+      hashCompact (hx) ;
+      for (i = 0 ; i < (1 << STRIPE_BITS) ; ++i)
+	{ HashStripe *s = &h->stripes[i] ;
+	  memset (s->table->keys, 0, sizeof(I64)*(s->table->mask+1)) ;
+	  s->guard = 1 << (s->nbits - 1) ;
+	}
+      return ;
+    }
   memset (h->keys, 0, sizeof(I64)*(1 << h->nbits)) ;
   h->guard = (1 << (h->nbits - 1)) ;
   h->freeList = arrayReCreate (h->freeList, 32, int) ;
@@ -175,6 +281,71 @@ static void hashDouble (TrueHash *h)
   newFree (oldValues, oldsize, int) ;
 }
 
+/************************ concurrent versions ***********************/
+
+static void stripeDouble (HashStripe *s) /* called with s->lock held */
+{
+  HashTable *old = s->table, *t = tableCreate (++s->nbits) ;
+  I64 i, hash, delta ;
+
+  s->guard = 1 << (s->nbits - 1) ;
+  for (i = 0 ; i <= old->mask ; ++i)
+    if (old->keys[i].i)
+      { hash = hashMaskFunc (t->mask, old->keys[i]) ; delta = 0 ;
+	while (t->keys[hash].i)
+	  { if (!delta) delta = deltaMaskFunc (t->mask, old->keys[i]) ;
+	    hash = (hash + delta) & t->mask ;
+	  }
+	t->keys[hash] = old->keys[i] ;
+	t->values[hash] = old->values[i] ;
+	--s->guard ;
+      }
+  t->retired = old ;		/* readers may still be in old, so keep it */
+  __atomic_store_n (&s->table, t, __ATOMIC_RELEASE) ; // publish only when complete
+}
+
+static bool hashFindConcurrent (TrueHash *h, HashKey k, int *index)
+{
+  HashStripe *s = &h->stripes[stripeFunc (k)] ;
+  HashTable  *t = __atomic_load_n (&s->table, __ATOMIC_ACQUIRE) ;
+  I64 hash = hashMaskFunc (t->mask, k), delta = 0, x ;
+
+  while ((x = __atomic_load_n (&t->keys[hash].i, __ATOMIC_ACQUIRE)))
+    if (x == k.i)
+      { if (index) *index = t->values[hash] - 1 ; // value was written before the key
+	return true ;
+      }
+    else
+      { if (!delta) delta = deltaMaskFunc (t->mask, k) ;
+	hash = (hash + delta) & t->mask ;
+      }
+  return false ;
+}
+
+static bool hashAddConcurrent (TrueHash *h, HashKey k, int *index)
+{
+  HashStripe *s = &h->stripes[stripeFunc (k)] ;
+  bool isAdded = false ;
+
+  pthread_mutex_lock (&s->lock) ;
+  if (!s->guard) stripeDouble (s) ;
+  HashTable *t = s->table ;
+  I64 hash = hashMaskFunc (t->mask, k), delta = 0 ;
+  while (t->keys[hash].i && t->keys[hash].i != k.i)
+    { if (!delta) delta = deltaMaskFunc (t->mask, k) ;
+      hash = (hash + delta) & t->mask ;
+    }
+  if (!t->keys[hash].i)
+    { t->values[hash] = __atomic_add_fetch (&h->n, 1, __ATOMIC_RELAXED) ;
+      __atomic_store_n (&t->keys[hash].i, k.i, __ATOMIC_RELEASE) ;
+      --s->guard ;
+      isAdded = true ;
+    }
+  if (index) *index = t->values[hash] - 1 ;
+  pthread_mutex_unlock (&s->lock) ;
+  return isAdded ;
+}
+
 /************************ Searches  ************************************/
 
 bool hashFind (Hash hx, HashKey k, int *index)
@@ -183,6 +354,7 @@ bool hashFind (Hash hx, HashKey k, int *index)
   TrueHash *h = (TrueHash*) hx ;
   I64 hash, delta = 0 ;
 
+  if (h->stripes) return hashFindConcurrent (h, k, index) ;
   hash = hashFunc (h,k) ;
   while (true)
     if (h->keys[hash].i == k.i)
@@ -209,6 +381,7 @@ bool hashAdd (Hash hx, HashKey k, int *index)
   TrueHash *h = (TrueHash*) hx ;
   I64 hash, delta = 0 ;
 
+  if (h->stripes) return hashAddConcurrent (h, k, index) ;
   if (!h->guard)
     hashDouble (h) ;
 
@@ -244,6 +417,8 @@ bool hashRemove (Hash hx, HashKey k)
   TrueHash *h = (TrueHash*) hx ;
   I64 hash, delta = 0 ;
 
+  if (h->stripes) die ("hashRemove() is not supported for a concurrent Hash") ;
+
   hash = hashFunc (h,k) ;
   while (true)
     if (h->keys[hash].i == k.i)
@@ -270,6 +445,7 @@ void hashInitIterator (Hash hx)
   TrueHash *h = (TrueHash*) hx ;
 
   h->iter = -1 ;
+  h->iterStripe = 0 ;
 }
 
 bool hashNextKeyValue (Hash hx, HashKey *kp, int *ip)
@@ -277,6 +453,19 @@ bool hashNextKeyValue (Hash hx, HashKey *kp, int *ip)
   TrueHash *h = (TrueHash*) hx ;
   int size = 1 << h->nbits ;
 
+  if (h->stripes)
+    { for ( ; h->iterStripe < (1 << STRIPE_BITS) ; ++h->iterStripe, h->iter = -1)
+	{ HashTable *t = h->stripes[h->iterStripe].table ;
+	  while (++h->iter <= t->mask)
+	    if (t->keys[h->iter].i)
+	      { kp->i = t->keys[h->iter].i ;
+		if (ip) *ip = t->values[h->iter] - 1 ;
+		return true ;
+	      }
+	}
+      return false ;
+    }
+
   while (++h->iter < size)
     if (h->keys[h->iter].i && h->keys[h->iter].i != REMOVED.i)
       { kp->i = h->keys[h->iter].i ;
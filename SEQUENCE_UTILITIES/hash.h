@@ -51,6 +51,12 @@ static inline HashKey hashPtr (const void *x)
 	{ HashKey hk ; hk.p = x ; return hk ; }
 
 Hash hashCreate (int n) ;
+Hash hashCreateConcurrent (int n) ;
+	/* hashAdd() and hashFind() can then be called from many threads at once: finds take no
+	   lock, adds lock one of many stripes, each of which grows separately.  Indices are still
+	   0,1,2... in order of adding.  hashRemove() is not allowed, and hashClear(), hashCompact()
+	   and the iterator must not run at the same time as anything else. */
+void hashCompact (Hash h) ;	/* frees tables a concurrent Hash keeps for readers while growing */
 void hashDestroy (Hash h) ;
 void hashClear (Hash h) ;
 bool hashAdd  (Hash h, HashKey k, int *index) ; /* return true if added, fill index if non-zero */
@@ -14,7 +14,7 @@
 #include "ONElib.h"
 
 static char *hocoSchemaText ;
-static void hoco (char *seq, U64 *seqLen, U64 **runLengths) ;
+static U64  hoco (char *seq, U64 seqLen, U64 *runLengths) ;
 static void writeHoco (SeqIO *siOut, U64 seqLen, U64 runLen, U64 *runLengths) ;
 static void convertUnHoco (SeqIO *siIn, SeqIO *siOut) ;
 
@@ -23,6 +23,8 @@ static void scaffoldBreak (SeqIO *siOut, char *id, char *desc, U64 seqLen, char
 			   int scaffThresh) ; 
 static void scaffoldJoin (char *fileName, SeqIO *siOut, bool isVerbose) ; 
 
+static void convertThreaded (SeqIO *siIn, SeqIO *siOut, bool isHoco) ;
+
 int main (int argc, char *argv[])
 {
   storeCommandLine (argc, argv) ;
@@ -31,7 +33,7 @@ int main (int argc, char *argv[])
   timeUpdate (stdout) ;
 
   if (!argc || !strcmp(*argv,"-h") || !strcmp(*argv,"--help"))
-    { fprintf (stderr, "Usage: seqconvert [-fa|fq|b|1] [-t] [-Q T] [-H|U] [-K|J] [-KT T] [-z] [-S] [-R cramRefFile] [-o outfile] [infile]\n") ;
+    { fprintf (stderr, "Usage: seqconvert [-fa|fq|b|1] [-t] [-Q T] [-H|U] [-K|J] [-KT T] [-T n] [-TI n] [-TO n] [-z] [-S] [-R cramRefFile] [-o outfile] [infile]\n") ;
       fprintf (stderr, "   autodetects input file type: fasta/q (.gz), binary, ONEcode, BAM/SAM\n") ;
       fprintf (stderr, "   .gz ending outfile name implies gzip compression\n") ;
       fprintf (stderr, "   -fa : output as fasta, -fq as fastq, -b as binary, -1 as ONEcode\n") ;
@@ -44,6 +46,9 @@ int main (int argc, char *argv[])
       fprintf (stderr, "   -K  : scaffold break sequences at >KT N's - stores breaks if ONEcode\n") ;
       fprintf (stderr, "   -J  : scaffold rejoin - only works on ONEcode input\n") ;
       fprintf (stderr, "   -KT : sets the threshold for scaffold breaking [20]\n") ;
+      fprintf (stderr, "   -T  : number of threads both to decompress the input and to write ONEcode [0]\n") ;
+      fprintf (stderr, "   -TI : number of threads to decompress the input, overriding -T\n") ;
+      fprintf (stderr, "   -TO : number of threads to write ONEcode, overriding -T\n") ;
       fprintf (stderr, "   -R refFileName : fasta reference file for cram\n") ;
       fprintf (stderr, "   NB gzip is not compatible with binary\n") ;
       fprintf (stderr, "   if no infile then use stdin\n") ;
@@ -63,6 +68,7 @@ int main (int argc, char *argv[])
   char *outFileName = "-z" ;
   int qualThresh = 30 ;
   int scaffThresh = 20 ;
+  int nThreads = 0, nInThreads = -1, nOutThreads = -1 ;
   
   while (argc)
     { if (!strcmp (*argv, "-fa")) type = FASTA ;
@@ -79,6 +85,12 @@ int main (int argc, char *argv[])
       else if (!strcmp (*argv, "-J")) isJoin = true ;
       else if (!strcmp (*argv, "-KT") && argc > 1)
 	{ --argc ; ++argv ; scaffThresh = atoi (*argv) ; }
+      else if (!strcmp (*argv, "-T") && argc > 1)
+	{ --argc ; ++argv ; nThreads = atoi (*argv) ; }
+      else if (!strcmp (*argv, "-TI") && argc > 1)
+	{ --argc ; ++argv ; nInThreads = atoi (*argv) ; }
+      else if (!strcmp (*argv, "-TO") && argc > 1)
+	{ --argc ; ++argv ; nOutThreads = atoi (*argv) ; }
       else if (!strcmp (*argv, "-o") && argc > 1)
 	{ --argc ; ++argv ; outFileName = *argv ; }
       else if (!strcmp (*argv, "-S")) isVerbose = false ;
@@ -89,14 +101,18 @@ int main (int argc, char *argv[])
       --argc ; ++argv ;
     }
 
+  if (nInThreads < 0) nInThreads = nThreads ;
+  if (nOutThreads < 0) nOutThreads = nThreads ;
+
   if (isHoco && isScaffold) die ("sorry, can't do both scaffold and hoco for now") ;
 
   SeqIO *siOut ;
   if (!strcmp(outFileName, "-z") && !isGzip) outFileName = "-" ; /* remove 'z' */
   if (type == ONE && isHoco)
     { OneSchema *schema = oneSchemaCreateFromText (hocoSchemaText) ;
-      OneFile *vf = oneFileOpenWriteNew (outFileName, schema, "seq", true, 1) ;
+      OneFile *vf = oneFileOpenWriteNew (outFileName, schema, "seq", true, nOutThreads > 1 ? nOutThreads : 1) ;
       oneSchemaDestroy (schema) ;
+      if (!vf) die ("didn't open %s", outFileName) ;
       siOut = seqIOadoptOneFile (vf, 0, qualThresh) ;
     }
   else if (type == ONE && isScaffold)
@@ -108,7 +124,7 @@ int main (int argc, char *argv[])
       if (!siOut) die ("didn't adopt %s", outFileName) ;
     }
   else
-    siOut = seqIOopenWrite (outFileName, type, 0, qualThresh) ;
+    siOut = seqIOopenWriteThreaded (outFileName, type, 0, qualThresh, nOutThreads) ;
   if (!siOut) die ("failed to open output file %s", outFileName) ;
 
   if (isJoin)
@@ -117,7 +133,7 @@ int main (int argc, char *argv[])
     }
   
   bool isQual = ((siOut->type == BINARY && qualThresh > 0) || siOut->type == FASTQ || siOut->type == ONE) && !isHoco && !isUnHoco ;
-  SeqIO *siIn = seqIOopenRead (inFileName, 0, isQual) ;
+  SeqIO *siIn = seqIOopenReadThreaded (inFileName, 0, isQual, nInThreads) ;
   if (!siIn) die ("failed to open input file %s", inFileName) ;
   if (isUnHoco && siIn->type != ONE) die ("can only Unhoco ONEcode files") ;
   if (isJoin && siIn->type != ONE) die ("can only reJoin ONEcode files") ;
@@ -128,9 +144,11 @@ int main (int argc, char *argv[])
       fprintf (stderr, "\n") ;
     }
 
-  U64 *runLengths ; // needed for hoco - need to declare here outside seqio loop
+  U64 *runLengths = 0, runMax = 0 ; // needed for hoco - declare here outside seqio loop
   if (isUnHoco)
     convertUnHoco (siIn, siOut) ;
+  else if (siOut->nThreads > 1)
+    convertThreaded (siIn, siOut, isHoco) ;
   else
     while (seqIOread (siIn))
       { U64 seqLen = siIn->seqLen ;
@@ -142,7 +160,12 @@ int main (int argc, char *argv[])
 			 siIn->isQual ? sqioQual(siIn) : 0,
 			 scaffThresh) ;
 	else
-	  { if (isHoco) hoco (sqioSeq(siIn), &seqLen, (siOut->type == ONE) ? &runLengths : 0) ;
+	  { if (isHoco && siOut->type == ONE && seqLen > runMax)
+	      { if (runMax) free (runLengths) ;
+		runMax = seqLen + 1024 ;
+		runLengths = new (runMax, U64) ;
+	      }
+	    if (isHoco) seqLen = hoco (sqioSeq(siIn), seqLen, (siOut->type == ONE) ? runLengths : 0) ;
 	    seqIOwrite (siOut,
 			siIn->idLen ? sqioId(siIn) : 0,
 			siIn->descLen ? sqioDesc(siIn) : 0,
@@ -158,6 +181,7 @@ int main (int argc, char *argv[])
     }
 
   seqIOclose (siIn) ;
+  if (runMax) free (runLengths) ;
   
  cleanup:
   seqIOclose (siOut) ;
@@ -166,30 +190,39 @@ int main (int argc, char *argv[])
 
 /****************/
 
-static void hoco (char *seq, U64 *seqLen, U64 **runLengths)
+/* hoco works a word at a time: XOR of 8 bytes with the same 8 shifted by one gives a
+   nonzero byte at each run boundary, so words inside a run are skipped with one test.
+   Compression is in place, since we write at or behind where we read.  runLengths, if
+   given, needs seqLen entries and gets the cumulative end of each run, as in the H line.
+*/
+
+#define HI_BITS 0x8080808080808080ULL
+#define LO_BITS 0x7f7f7f7f7f7f7f7fULL
+
+static U64 hoco (char *seq, U64 seqLen, U64 *runLengths)
 {
-  static size_t runLengthSize = 0 ;
-  char *s = seq, *t = seq ;
-  U64  tot = *seqLen ; 
-  if (runLengths)
-    { if (runLengthSize < *seqLen)
-	{ if (runLengthSize) free (*runLengths) ;
-	  runLengthSize = *seqLen + 1024 ;
-	  *runLengths = new (runLengthSize, U64) ;
+  if (!seqLen) return 0 ;
+  char *t = seq ;  // last base written
+  U64  *r = runLengths ;
+  U64   i = 1, x, y ;
+  for ( ; i + 8 <= seqLen ; i += 8)
+    { memcpy (&x, seq+i, 8) ; memcpy (&y, seq+i-1, 8) ;
+      x ^= y ;
+      U64 m = (((x & LO_BITS) + LO_BITS) | x) & HI_BITS ; // top bit of each nonzero byte
+      while (m) // little-endian, so lowest set bit is the first boundary
+	{ U64 pos = i + (__builtin_ctzll (m) >> 3) ;
+	  *++t = seq[pos] ;
+	  if (r) *r++ = pos ;
+	  m &= m - 1 ;
 	}
-      U64 *r = *runLengths ;
-      *t = *s++ ; --tot ; *r = 1 ;
-      while (tot--)
-	if (*s == *t) { ++s ; ++*r ; }
-	else { *++t = *s++ ; r[1] = 1 + *r ; ++r ; }
-    }
-  else // duplicate code to avoid extra tests inside the loop
-    { *t = *s++ ; --tot ;
-      while (tot--)
-	if (*s == *t) ++s ; 
-	else *++t = *s++ ;
     }
-  *seqLen = (t - seq) + 1 ;
+  for ( ; i < seqLen ; ++i)
+    if (seq[i] != *t)
+      { *++t = seq[i] ;
+	if (r) *r++ = i ;
+      }
+  if (r) *r = seqLen ;
+  return (t - seq) + 1 ;
 }
 
 static char *hocoSchemaText =
@@ -233,6 +266,10 @@ static inline void bufferDestroy (Buffer *b)
 
 /*******************************************/
 
+/* unhoco writes each run as 8 copies of its base, then moves on by the run length,
+   so sbuf needs 8 bytes of slack - longer runs fall back to memset().
+*/
+
 static void convertUnHoco (SeqIO *siIn, SeqIO *siOut)
 {
   OneFile *vf = (OneFile*) siIn->handle ;
@@ -250,13 +287,14 @@ static void convertUnHoco (SeqIO *siIn, SeqIO *siOut)
       if (vf->lineType == 'H')
 	{ assert (oneLen(vf) == tlen) ;
 	  slen = oneInt(vf,0) ;
-	  bufferCheckSize (sbuf, slen) ;
-	  I64 *r = oneIntList(vf) ;
-	  I64 n = *r ;
+	  bufferCheckSize (sbuf, slen + 8) ;
+	  I64 *r = oneIntList(vf), *rEnd = r + tlen, last = 0 ;
 	  char *s = sbuf->buf, *t = tbuf->buf ;
-	  while (tlen--)
-	    { while (n--) *s++ = *t ;
-	      n = r[1] - *r ; ++r ; ++t ;
+	  for ( ; r < rEnd ; last = *r++, ++t)
+	    { I64 n = *r - last ;
+	      if (n <= 8) { U64 x = 0x0101010101010101ULL * (U8)*t ; memcpy (s, &x, 8) ; }
+	      else memset (s, *t, n) ;
+	      s += n ;
 	    }
 	  while (oneReadLine (vf) && vf->lineType != 'S')
 	    if (vf->lineType == 'I') storeIdLine (siIn, vf) ;
@@ -399,3 +437,103 @@ static void scaffoldJoin (char *inFileName, SeqIO *siOut, bool isVerbose)
 
 /****************/
 
+
+/******** parallel conversion to ONEcode *********/
+
+/* The input is read in rounds of one batch per thread.  Each thread writes its batch to its
+   own slave OneFile, then seqIOmergeThreads() appends them in order.  The next round is read
+   while the current one is being written.
+*/
+
+#include <pthread.h>
+
+#define BATCH_SIZE (1 << 24)
+
+typedef struct { U64 idLen, descLen, seqLen ; } BatchRec ; /* followed by id\0desc\0seq[qual] */
+
+typedef struct {
+  SeqIO *si ;			/* the writer for this thread */
+  U64    n, size, max ;		/* number of records, bytes used and allocated in data */
+  char  *data ;
+  bool   isQual, isHoco ;
+  U64   *runLengths, runMax ;	/* for hoco, allocated by the thread */
+} Batch ;
+
+static bool batchRead (SeqIO *siIn, Batch *b) /* false if no more input */
+{
+  b->n = b->size = 0 ;
+  while (b->size < BATCH_SIZE && seqIOread (siIn))
+    { U64 len = sizeof(BatchRec) + siIn->idLen + siIn->descLen + 2 + siIn->seqLen * (b->isQual ? 2 : 1) ;
+      len = (len + 7) & ~(U64)7 ; /* keep the BatchRec aligned */
+      if (b->size + len > b->max)
+	{ b->max = 2*(b->size + len) ;
+	  b->data = newResize (b->data, b->size, b->max, char) ;
+	}
+      BatchRec *r = (BatchRec*) (b->data + b->size) ;
+      r->idLen = siIn->idLen ; r->descLen = siIn->descLen ; r->seqLen = siIn->seqLen ;
+      char *s = (char*) (r+1) ;
+      memcpy (s, sqioId(siIn), r->idLen) ; s += r->idLen ; *s++ = 0 ;
+      memcpy (s, sqioDesc(siIn), r->descLen) ; s += r->descLen ; *s++ = 0 ;
+      memcpy (s, sqioSeq(siIn), r->seqLen) ; s += r->seqLen ;
+      if (b->isQual) memcpy (s, sqioQual(siIn), r->seqLen) ;
+      b->size += len ; ++b->n ;
+    }
+  return b->n > 0 ;
+}
+
+static void *batchWrite (void *arg)
+{
+  Batch *b = (Batch*) arg ;
+  char  *p = b->data ;
+  U64    i ;
+  for (i = 0 ; i < b->n ; ++i)
+    { BatchRec *r = (BatchRec*) p ;
+      char *id = (char*) (r+1), *desc = id + r->idLen + 1, *seq = desc + r->descLen + 1 ;
+      if (b->isHoco)
+	{ bool isOne = (b->si->type == ONE) ;
+	  if (isOne && r->seqLen > b->runMax)
+	    { free (b->runLengths) ; // malloc not new(), which is not thread safe
+	      b->runMax = r->seqLen + 1024 ;
+	      b->runLengths = (U64*) malloc (b->runMax * sizeof(U64)) ;
+	    }
+	  U64 len = hoco (seq, r->seqLen, isOne ? b->runLengths : 0) ;
+	  seqIOwrite (b->si, r->idLen ? id : 0, r->descLen ? desc : 0, len, seq, 0) ;
+	  if (isOne) writeHoco (b->si, r->seqLen, len, b->runLengths) ;
+	}
+      else
+	seqIOwrite (b->si, r->idLen ? id : 0, r->descLen ? desc : 0, r->seqLen, seq,
+		    b->isQual ? seq + r->seqLen : 0) ;
+      p += (sizeof(BatchRec) + r->idLen + r->descLen + 2 + r->seqLen * (b->isQual ? 2 : 1) + 7) & ~(U64)7 ;
+    }
+  return 0 ;
+}
+
+static void convertThreaded (SeqIO *siIn, SeqIO *siOut, bool isHoco)
+{
+  int        i, nThreads = siOut->nThreads ;
+  Batch     *batch = new0 (2*nThreads, Batch), *next = batch + nThreads ;
+  pthread_t *threads = new (nThreads, pthread_t) ;
+
+  for (i = 0 ; i < 2*nThreads ; ++i)
+    { batch[i].si = seqIOthread (siOut, i % nThreads) ;
+      batch[i].isQual = siIn->isQual ; batch[i].isHoco = isHoco ;
+    }
+  Batch *curr = batch ;
+  bool isMore = true ;
+  for (i = 0 ; i < nThreads && isMore ; ++i) isMore = batchRead (siIn, &curr[i]) ;
+  while (curr[0].n)
+    { for (i = 0 ; i < nThreads ; ++i)
+	pthread_create (&threads[i], 0, batchWrite, &curr[i]) ;
+      for (i = 0 ; i < nThreads ; ++i) next[i].n = 0 ;
+      for (i = 0 ; i < nThreads && isMore ; ++i) isMore = batchRead (siIn, &next[i]) ;
+      for (i = 0 ; i < nThreads ; ++i)
+	pthread_join (threads[i], 0) ;
+      seqIOmergeThreads (siOut) ;
+      Batch *t = curr ; curr = next ; next = t ;
+    }
+
+  for (i = 0 ; i < 2*nThreads ; ++i) { free (batch[i].data) ; free (batch[i].runLengths) ; }
+  free (batch) ; free (threads) ;
+}
+
+/****************/
@@ -15,6 +15,7 @@
 #include "dict.h"
 #include "seqio.h"
 #include "ONElib.h"
+#include <sys/stat.h>
 
 #define VERSION "1.0"
 
@@ -34,6 +35,14 @@ int fragOrder (const void *a, const void *b)
 }
 
 DICT *dict ;
+Array textFrags, countFrags, kStart ; // kStart is the start of each k in textFrags
+U64   kt = 0, kc = 0 ;		      // numbers of text and count frags written
+
+static char *idxSchemaText =
+  "1 3 def 1 0  schema for seqextract identifier index\n"
+  ".\n"
+  "P 3 idx IDENTIFIER INDEX\n"
+  "O I 2 3 INT 6 STRING     object number (1-based) in the sequence file, identifier\n" ;
 
 void usage (void)
 {
@@ -42,6 +51,8 @@ void usage (void)
   fprintf (stderr, "    -fa                       output FASTA file\n") ;
   fprintf (stderr, "    -1                        output ONEcode file\n") ;
   fprintf (stderr, "    -I                        output identifiers - only aplies to ONEcode\n") ;
+  fprintf (stderr, "    -T nthreads               threads to decompress the input [0]\n") ;
+  fprintf (stderr, "    -X                        for binary ONEcode use index <seqfile>.1idx for ids, making if needed\n") ;
   fprintf (stderr, "    -o outfilename            output file [-] : autorecognizes .1*, .fa, .fa.gz\n") ;
   fprintf (stderr, "    -f id[:start-[end]]    fragment to extract - can do many of these\n") ;
   fprintf (stderr, "    -F fragfile               file of fragments to extract\n") ;
@@ -53,6 +64,7 @@ void usage (void)
   fprintf (stderr, "  start and end use 0-based coords with open end (so length = end-start)\n") ;
   fprintf (stderr, "    if no end then go to end of seq, so :0- for whole sequence\n") ;
   fprintf (stderr, "  count is 1-based (since 0 is before the first object)\n") ;
+  fprintf (stderr, "  binary ONEcode input is read only where needed, using its object index\n") ;
   
   exit (1) ;
 }
@@ -109,13 +121,13 @@ void parseFile (char *fileName, Array frags, bool isCount)
 void writeFrag (SeqIO *siIn, SeqIO *siOut, Frag *f, U64 count)
 {
   static char idBuf[1024] ;
-  char *seq = sqioSeq(siIn) ;
   if (!f->end) f->end = siIn->seqLen ;
-  if (f->isRC)
+  U64 len = f->end - f->start ;
+  char *seq = sqioSeq(siIn) + f->start ;
+  if (f->isRC) // only reverse complement the fragment
     { I64 t = f->start ; f->start = siIn->seqLen - f->end ; f->end = siIn->seqLen - t ;
-      seq = seqRevComp (seq, siIn->seqLen) ;
+      seq = seqRevComp (seq, len) ;
     }      
-  seq += f->start ;
   if (count)
     { if (siIn->idLen)
 	{ if (snprintf (idBuf, 1024, "%s:%llu-%llu", sqioId(siIn), f->start,f->end) >= 1023)
@@ -123,11 +135,104 @@ void writeFrag (SeqIO *siIn, SeqIO *siOut, Frag *f, U64 count)
 	}
       else sprintf (idBuf, "%llu:%llu-%llu", count, f->start, f->end) ;
       if (f->isRC) strcat (idBuf, "R") ;
-      seqIOwrite (siOut, idBuf, 0, f->end - f->start, seq, 0) ;
+      seqIOwrite (siOut, idBuf, 0, len, seq, 0) ;
     }
   else
-    seqIOwrite (siOut, 0, 0, f->end - f->start, seq, 0) ;
-  if (f->isRC) free (seq - f->start) ;
+    seqIOwrite (siOut, 0, 0, len, seq, 0) ;
+  if (f->isRC) free (seq) ;
+}
+
+void writeFrags (SeqIO *siIn, SeqIO *siOut, U64 count, bool isWriteIdentifiers)
+{ // writes all fragments from the current sequence, which is number count in the file
+  U64 i, k ;
+  while (kc < arrayMax (countFrags) && arrp(countFrags,kc,Frag)->k == count)
+    writeFrag (siIn, siOut, arrp(countFrags,kc++,Frag), isWriteIdentifiers ? count : 0) ;
+  if (siIn->idLen && dictFind (dict, sqioId(siIn), &k))
+    for (i = arr(kStart,k,I64) ; i < arrayMax(textFrags) && arrp(textFrags,i,Frag)->k == k ; ++i)
+      { writeFrag (siIn, siOut, arrp(textFrags,i,Frag), count) ; ++kt ; }
+}
+
+/* For binary ONEcode we find the object number of each requested id, either by reading
+   just the I lines of the sequence file, or from a ONEcode index of the ids.
+*/
+
+void idScan (OneFile *vf, Array kCount, char *indexFileName, char *seqFileName)
+{
+  OneFile *vfIdx = 0 ;
+  if (indexFileName)
+    { OneSchema *schema = oneSchemaCreateFromText (idxSchemaText) ;
+      vfIdx = oneFileOpenWriteNew (indexFileName, schema, "idx", true, 1) ;
+      oneSchemaDestroy (schema) ;
+      if (!vfIdx) die ("failed to open index file %s", indexFileName) ;
+      oneAddProvenance (vfIdx, "seqextract", VERSION, getCommandLine()) ;
+      oneAddReference (vfIdx, seqFileName, 0) ;
+    }
+  if (!oneGoto (vf, 'S', 1)) die ("failed to go to the first sequence in %s", seqFileName) ;
+  U64 count = 0, k ;
+  while (oneReadLine (vf))
+    if (vf->lineType == 'S') ++count ; // sequence lists are not decoded unless we ask
+    else if (vf->lineType == 'I')
+      { if (dictFind (dict, oneString(vf), &k) && !array(kCount,k,U64))
+	  arr(kCount,k,U64) = count ;
+	if (vfIdx)
+	  { oneInt(vfIdx,0) = count ;
+	    oneWriteLine (vfIdx, 'I', oneLen(vf), oneString(vf)) ;
+	  }
+      }
+  if (vfIdx) oneFileClose (vfIdx) ;
+}
+
+bool idIndexRead (char *indexFileName, char *seqFileName, Array kCount)
+{
+  struct stat sIdx, sSeq ; // the index must be newer than the sequence file
+  if (stat (indexFileName, &sIdx) || stat (seqFileName, &sSeq) || sIdx.st_mtime < sSeq.st_mtime)
+    return false ;
+  OneFile *vf = oneFileOpenRead (indexFileName, 0, "idx", 1) ;
+  if (!vf) return false ;
+  U64 k ;
+  while (oneReadLine (vf))
+    if (vf->lineType == 'I' && dictFind (dict, oneString(vf), &k) && !array(kCount,k,U64))
+      arr(kCount,k,U64) = oneInt(vf,0) ;
+  oneFileClose (vf) ;
+  return true ;
+}
+
+void extractIndexed (SeqIO *siIn, SeqIO *siOut, bool isWriteIdentifiers, char *indexFileName,
+		     char *seqFileName)
+{
+  U64 i ;
+  Frag *f ;
+  Array need = arrayCreate (arrayMax(countFrags) + arrayMax(textFrags), Frag) ;
+  for (i = 0 ; i < arrayMax(countFrags) ; ++i)
+    if ((f = arrp(countFrags,i,Frag))->k <= siIn->nSeq)
+      array(need,arrayMax(need),Frag) = *f ;
+  if (arrayMax(textFrags))
+    { Array kCount = arrayCreate (dictMax(dict), U64) ; // object number for each id, 0 if missing
+      if (!indexFileName || !idIndexRead (indexFileName, seqFileName, kCount))
+	idScan ((OneFile*)siIn->handle, kCount, indexFileName, seqFileName) ;
+      for (i = 0 ; i < arrayMax(textFrags) ; ++i)
+	{ f = arrp(textFrags,i,Frag) ;
+	  if (f->k < arrayMax(kCount) && arr(kCount,f->k,U64))
+	    { Frag *g = arrayp(need,arrayMax(need),Frag) ;
+	      *g = *f ; g->k = arr(kCount,f->k,U64) ;
+	    }
+	}
+      arrayDestroy (kCount) ;
+    }
+  arraySort (need, fragOrder) ; // so we move forwards through the file
+
+  for (i = 0 ; i < arrayMax(need) ; )
+    { U64 count = arrp(need,i,Frag)->k ;
+      U64 start = arrp(need,i,Frag)->start, end = 0 ; // unpack the union of the fragments
+      bool isToEnd = false ;
+      for ( ; i < arrayMax(need) && (f = arrp(need,i,Frag))->k == count ; ++i)
+	if (!f->end) isToEnd = true ; else if (f->end > end) end = f->end ;
+      if (isToEnd) end = 0 ;
+      if (!seqIOgoto (siIn, count-1) || !seqIOreadRange (siIn, start, end))
+	die ("failed to read sequence %llu", count) ;
+      writeFrags (siIn, siOut, count, isWriteIdentifiers) ;
+    }
+  arrayDestroy (need) ;
 }
 
 int main (int argc, char *argv[])
@@ -137,17 +242,21 @@ int main (int argc, char *argv[])
 
   if (sizeof (I64) != sizeof (long long)) die ("I64 size mismatch") ;
 
-  Array textFrags = arrayCreate (256, Frag) ;
-  Array countFrags = arrayCreate (256, Frag) ;
+  textFrags = arrayCreate (256, Frag) ;
+  countFrags = arrayCreate (256, Frag) ;
   dict = dictCreate (256) ;
   SeqIOtype outType = FASTA ;
   char* outFileName = "-" ;
   bool isWriteIdentifiers = false ;
+  int nThreads = 0 ;
+  bool isIndex = false ;
   
   while (argc > 1)
     if (!strcmp (*argv, "-1")) { outType = ONE ; --argc ; ++argv ; }
     else if (!strcmp (*argv, "-I")) { isWriteIdentifiers = true ; --argc ; ++argv ; }
     else if (!strcmp (*argv, "-fa")) { outType = FASTA ; --argc ; ++argv ; }
+    else if (!strcmp (*argv, "-X")) { isIndex = true ; --argc ; ++argv ; }
+    else if (!strcmp (*argv, "-T")) { nThreads = atoi (argv[1]) ; argc -= 2 ; argv += 2 ; }
     else if (!strcmp (*argv, "-o")) { outFileName = argv[1] ; argc -= 2 ; argv += 2 ; }
     else if (!strcmp (*argv, "-f"))
       { parseText (argv[1], arrayp(textFrags,arrayMax(textFrags),Frag)) ;
@@ -164,14 +273,14 @@ int main (int argc, char *argv[])
 
   arraySort (textFrags, fragOrder) ;
   arraySort (countFrags, fragOrder) ;
-  Array kStart = arrayCreate (256, I64) ; // build an index of the start of k in textFrags
+  kStart = arrayCreate (256, I64) ; // build an index of the start of k in textFrags
   array(kStart, 0, I64) = 0 ; // must start like this
   U64 i ;
   for (i = 1 ; i < arrayMax(textFrags) ; ++i)
     if (arrp(textFrags,i,Frag)->k > arrp(textFrags,i-1,Frag)->k) // should be +1
       array(kStart, arrayMax(kStart), I64) = i ;
 
-  SeqIO *siIn = seqIOopenRead (*argv, dna2textConv, 0) ;
+  SeqIO *siIn = seqIOopenReadThreaded (*argv, dna2textConv, 0, nThreads) ;
   if (!siIn) die ("failed to open input sequence file %s", *argv) ;
   SeqIO *siOut = seqIOopenWrite (outFileName, outType, dna2textConv, 0) ;
   if (!siOut) die ("failed to open output file %s", outFileName) ;
@@ -181,16 +290,21 @@ int main (int argc, char *argv[])
     }
   else
     isWriteIdentifiers = true ;
-  U64 count = 0, kt = 0, kc = 0 ;
-  U64 k ;
-  while (seqIOread (siIn))
-    { ++count ;
-      while (kc < arrayMax (countFrags) && arrp(countFrags,kc,Frag)->k == count)
-	writeFrag (siIn, siOut, arrp(countFrags,kc++,Frag), isWriteIdentifiers ? count : 0) ;
-      if (siIn->idLen && dictFind (dict, sqioId(siIn), &k))
-	for (i = arr(kStart,k,I64) ; i < arrayMax(textFrags) && arrp(textFrags,i,Frag)->k == k ; ++i)
-	  { writeFrag (siIn, siOut, arrp(textFrags,i,Frag), count) ; ++kt ; }
-      if (kt == arrayMax (textFrags) && kc == arrayMax (countFrags)) break ;
+  if (siIn->type == ONE && ((OneFile*)siIn->handle)->isBinary)
+    { char *indexFileName = 0 ;
+      if (isIndex)
+	{ indexFileName = new (strlen(*argv) + 6, char) ;
+	  strcpy (indexFileName, *argv) ; strcat (indexFileName, ".1idx") ;
+	}
+      extractIndexed (siIn, siOut, isWriteIdentifiers, indexFileName, *argv) ;
+      if (indexFileName) free (indexFileName) ;
+    }
+  else
+    { U64 count = 0 ;
+      while (seqIOread (siIn))
+	{ writeFrags (siIn, siOut, ++count, isWriteIdentifiers) ;
+	  if (kt == arrayMax (textFrags) && kc == arrayMax (countFrags)) break ;
+	}
     }
   seqIOclose (siIn) ;
   seqIOclose (siOut) ;
@@ -12,6 +12,7 @@
  */
 
 #include "seqio.h"
+#include "vzi.h"
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -28,17 +29,274 @@ void bamFileClose (SeqIO *si) ;
 // global
 char* seqIOtypeName[] = { "unknown", "fasta", "fastq", "binary", "onecode", "bam" } ;
 
+static SeqPack *seqPackCreateConvert (int *convert) ;
+static void seqPackFill (SeqPack *sp) ;
+
+/********** threaded input pipeline for seqIOopenReadThreaded() ***********/
+
+/* Worker threads fill a ring of slots with decompressed data, which seqRead() hands
+   on to the parser in order.  For BGZF input (bgzip, samtools etc.) each worker reads
+   a run of whole blocks under the input lock then inflates them independently, so
+   decompression scales with threads.  Other input (plain gzip or uncompressed) can
+   only be inflated serially, so one worker runs gzread() ahead of the parser.
+*/
+
+#include <pthread.h>
+
+#define SLOT_SIZE (1 << 22)	/* target decompressed bytes per slot */
+
+/* NB worker threads use malloc() not new(), because the latter updates unlocked global counts */
+
+typedef struct {
+  char  *in, *out ;		/* compressed blocks (BGZF only) and decompressed data */
+  U64    inSize, inMax, outSize, outMax, outAlloc, outUsed ;
+  bool   isDone ;
+} ReadSlot ;
+
+typedef struct {
+  gzFile     gzf ;		/* non-BGZF input */
+  FILE      *f ;		/* BGZF input */
+  int        nThreads, nSlots ;
+  pthread_t *threads ;
+  ReadSlot  *slots ;
+  U64        nFill, nUse ;	/* number of slots claimed by workers, consumed by parser */
+  ReadSlot  *current ;		/* slot being consumed, if any */
+  bool       isEOF, isStop ;
+  pthread_mutex_t inLock ;	/* held while reading input, so slots are claimed in order */
+  pthread_mutex_t lock ;	/* protects the slot counters and flags */
+  pthread_cond_t  filled, freed ;
+} Reader ;
+
+static bool isBGZFheader (U8 *h) /* needs 16 bytes: gzip FEXTRA header with BC subfield first */
+{ return h[0] == 31 && h[1] == 139 && h[2] == 8 && (h[3] & 4) &&
+    h[10] == 6 && h[11] == 0 && h[12] == 'B' && h[13] == 'C' && h[14] == 2 && h[15] == 0 ;
+}
+
+static bool bgzfReadBlocks (Reader *r, ReadSlot *slot) /* under inLock; false at EOF */
+{
+  slot->inSize = slot->outMax = 0 ;
+  while (slot->outMax < SLOT_SIZE)
+    { U8 h[18] ;
+      size_t n = fread (h, 1, 18, r->f) ;
+      if (!n) return slot->inSize > 0 ;
+      if (n < 18 || !isBGZFheader (h)) die ("bad BGZF block header") ;
+      U64 bsize = (h[16] | (h[17] << 8)) + 1 ;
+      if (slot->inSize + bsize > slot->inMax)
+	{ slot->inMax = 2*(slot->inSize + bsize) ;
+	  if (!(slot->in = realloc (slot->in, slot->inMax))) die ("failed to allocate BGZF input") ;
+	}
+      U8 *block = (U8*) slot->in + slot->inSize ;
+      memcpy (block, h, 18) ;
+      if (fread (block + 18, 1, bsize - 18, r->f) != bsize - 18) die ("truncated BGZF block") ;
+      slot->inSize += bsize ;
+      U8 *t = block + bsize - 4 ;  /* ISIZE */
+      slot->outMax += t[0] | (t[1] << 8) | (t[2] << 16) | ((U32)t[3] << 24) ;
+    }
+  return true ;
+}
+
+static void bgzfInflate (ReadSlot *slot, z_stream *z) /* outside any lock */
+{
+  if (slot->outMax > slot->outAlloc)
+    { free (slot->out) ; slot->outAlloc = slot->outMax ;
+      if (!(slot->out = malloc (slot->outAlloc))) die ("failed to allocate BGZF output") ;
+    }
+  slot->outSize = 0 ;
+  U8 *block = (U8*) slot->in, *end = block + slot->inSize ;
+  while (block < end)
+    { int xlen = block[10] | (block[11] << 8) ;
+      U64 bsize = (block[16] | (block[17] << 8)) + 1 ;
+      U8 *t = block + bsize - 8 ;
+      U32 crc = t[0] | (t[1] << 8) | (t[2] << 16) | ((U32)t[3] << 24) ;
+      U32 isize = t[4] | (t[5] << 8) | (t[6] << 16) | ((U32)t[7] << 24) ;
+      inflateReset (z) ;
+      z->next_in = block + 12 + xlen ; z->avail_in = bsize - 20 - xlen ;
+      z->next_out = (U8*) slot->out + slot->outSize ; z->avail_out = isize ;
+      if (inflate (z, Z_FINISH) != Z_STREAM_END || z->avail_out)
+	die ("failed to inflate BGZF block") ;
+      if (crc32 (0, (U8*) slot->out + slot->outSize, isize) != crc)
+	die ("BGZF block CRC mismatch") ;
+      slot->outSize += isize ;
+      block += bsize ;
+    }
+}
+
+static void *readerThread (void *arg)
+{
+  Reader *r = (Reader*) arg ;
+  z_stream z ;
+  if (r->f)
+    { memset (&z, 0, sizeof(z_stream)) ;
+      if (inflateInit2 (&z, -15) != Z_OK) die ("inflateInit2 failed") ;
+    }
+  while (true)
+    { pthread_mutex_lock (&r->inLock) ;
+      pthread_mutex_lock (&r->lock) ;
+      while (!r->isStop && !r->isEOF && r->nFill - r->nUse >= r->nSlots)
+	pthread_cond_wait (&r->freed, &r->lock) ;
+      if (r->isStop || r->isEOF)
+	{ pthread_mutex_unlock (&r->lock) ; pthread_mutex_unlock (&r->inLock) ; break ; }
+      ReadSlot *slot = &r->slots[r->nFill++ % r->nSlots] ;
+      pthread_mutex_unlock (&r->lock) ;
+
+      bool isMore ;
+      if (r->f)
+	isMore = bgzfReadBlocks (r, slot) ;
+      else
+	{ int n = gzread (r->gzf, slot->out, SLOT_SIZE) ;
+	  if (n < 0) die ("gzread failed") ;
+	  slot->outSize = n ;
+	  isMore = (n > 0) ;
+	}
+      if (!isMore)
+	{ pthread_mutex_lock (&r->lock) ; r->isEOF = true ; pthread_mutex_unlock (&r->lock) ; }
+      pthread_mutex_unlock (&r->inLock) ;
+
+      if (r->f)
+	{ if (isMore) bgzfInflate (slot, &z) ; else slot->outSize = 0 ; }
+
+      pthread_mutex_lock (&r->lock) ;
+      slot->isDone = true ;
+      pthread_cond_broadcast (&r->filled) ;
+      pthread_mutex_unlock (&r->lock) ;
+    }
+  if (r->f) inflateEnd (&z) ;
+  pthread_mutex_lock (&r->lock) ;
+  pthread_cond_broadcast (&r->filled) ;
+  pthread_mutex_unlock (&r->lock) ;
+  return 0 ;
+}
+
+static Reader *readerCreate (char *filename, int nThreads)
+{
+  FILE *f = fopen (filename, "r") ;
+  if (!f) return 0 ;
+  U8 h[16] ;
+  bool isBGZF = (fread (h, 1, 16, f) == 16 && isBGZFheader (h)) ;
+  Reader *r = new0 (1, Reader) ;
+  if (isBGZF)
+    { rewind (f) ; r->f = f ; r->nThreads = nThreads ; }
+  else
+    { fclose (f) ;
+      if (!(r->gzf = gzopen (filename, "r"))) { free (r) ; return 0 ; }
+      gzbuffer (r->gzf, 1 << 20) ;
+      r->nThreads = 1 ;		/* gzip stream can only be inflated serially */
+    }
+  r->nSlots = 2*r->nThreads + 2 ;
+  r->slots = new0 (r->nSlots, ReadSlot) ;
+  if (!isBGZF)
+    { int i ;
+      for (i = 0 ; i < r->nSlots ; ++i) r->slots[i].out = new (SLOT_SIZE, char) ;
+    }
+  pthread_mutex_init (&r->inLock, 0) ;
+  pthread_mutex_init (&r->lock, 0) ;
+  pthread_cond_init (&r->filled, 0) ;
+  pthread_cond_init (&r->freed, 0) ;
+  r->threads = new (r->nThreads, pthread_t) ;
+  int i ;
+  for (i = 0 ; i < r->nThreads ; ++i)
+    pthread_create (&r->threads[i], 0, readerThread, r) ;
+  return r ;
+}
+
+static void readerDestroy (Reader *r)
+{
+  pthread_mutex_lock (&r->lock) ;
+  r->isStop = true ;
+  pthread_cond_broadcast (&r->freed) ;
+  pthread_mutex_unlock (&r->lock) ;
+  int i ;
+  for (i = 0 ; i < r->nThreads ; ++i) pthread_join (r->threads[i], 0) ;
+  for (i = 0 ; i < r->nSlots ; ++i)
+    { free (r->slots[i].in) ; free (r->slots[i].out) ; }
+  free (r->slots) ; free (r->threads) ;
+  pthread_mutex_destroy (&r->inLock) ;
+  pthread_mutex_destroy (&r->lock) ;
+  pthread_cond_destroy (&r->filled) ;
+  pthread_cond_destroy (&r->freed) ;
+  if (r->f) fclose (r->f) ;
+  if (r->gzf) gzclose (r->gzf) ;
+  free (r) ;
+}
+
+static U64 readerRead (Reader *r, char *buf, U64 n)
+{
+  U64 nRead = 0 ;
+  while (nRead < n)
+    { if (!r->current)
+	{ ReadSlot *slot = &r->slots[r->nUse % r->nSlots] ;
+	  pthread_mutex_lock (&r->lock) ;
+	  while (!(r->nUse < r->nFill && slot->isDone) && !(r->isEOF && r->nUse >= r->nFill))
+	    pthread_cond_wait (&r->filled, &r->lock) ;
+	  bool isEnd = (r->nUse >= r->nFill) ;
+	  pthread_mutex_unlock (&r->lock) ;
+	  if (isEnd) break ;
+	  r->current = slot ; slot->outUsed = 0 ;
+	}
+      ReadSlot *slot = r->current ;
+      U64 k = slot->outSize - slot->outUsed ;
+      if (k > n - nRead) k = n - nRead ;
+      if (k) memcpy (buf + nRead, slot->out + slot->outUsed, k) ;
+      slot->outUsed += k ; nRead += k ;
+      if (slot->outUsed == slot->outSize)
+	{ pthread_mutex_lock (&r->lock) ;
+	  slot->isDone = false ; ++r->nUse ; r->current = 0 ;
+	  pthread_cond_broadcast (&r->freed) ;
+	  pthread_mutex_unlock (&r->lock) ;
+	}
+    }
+  return nRead ;
+}
+
+static U64 seqRead (SeqIO *si, char *buf, U64 n)
+{ if (si->vzi) return vziRead ((Vzi*) si->vzi, buf, n) ;
+  else if (si->reader) return readerRead ((Reader*) si->reader, buf, n) ;
+  else return gzread (si->gzf, buf, n) ;
+}
+
+static void seqInputClose (SeqIO *si)
+{ if (si->gzf) { gzclose (si->gzf) ; si->gzf = 0 ; }
+  if (si->reader) { readerDestroy ((Reader*) si->reader) ; si->reader = 0 ; }
+  if (si->vzi) { vziClose ((Vzi*) si->vzi) ; si->vzi = 0 ; }
+}
+
+/********** opening and closing ***********/
+
+#ifdef ONEIO
+static void oneReadSetup (SeqIO *si, OneFile *vf)
+{
+  si->type = ONE ; // important that this is after successful open
+  si->handle = vf ;
+  si->seqPack = seqPackCreateConvert (si->convert) ; // to unpack binary DNA directly
+  if (vf->info['S']->given.count)
+    { si->nSeq = vf->info['S']->given.count ;
+      si->totSeqLen = vf->info['S']->given.total ;
+      si->maxSeqLen = vf->info['S']->given.max ;
+      si->seqBuf = new0 (si->maxSeqLen+1,char) ;
+    }
+  if (si->isQual && vf->info['Q'] && vf->info['Q']->given.count)
+    si->qualBuf = new0 (si->maxSeqLen+1,char) ;
+  else
+    si->isQual = false ;
+}
+#endif
+
 SeqIO *seqIOopenRead (char *filename, int* convert, bool isQual)
+{ return seqIOopenReadThreaded (filename, convert, isQual, 0) ; }
+
+SeqIO *seqIOopenReadThreaded (char *filename, int* convert, bool isQual, int nThreads)
 {
   SeqIO *si = new0 (1, SeqIO) ;
   if (!strcmp (filename, "-")) si->gzf = gzdopen (fileno (stdin), "r") ;
+  else if ((si->vzi = vziOpen (filename, nThreads))) ; /* VGPzip: independent indexed blocks */
+  else if (nThreads > 0) si->reader = readerCreate (filename, nThreads) ;
   else si->gzf = gzopen (filename, "r") ;
-  if (!si->gzf) { free(si) ; return 0 ; }
+  if (!si->gzf && !si->reader && !si->vzi) { free(si) ; return 0 ; }
   si->bufSize = 1<<24 ; // 16 MB
   si->b = si->buf = new (si->bufSize, char) ;
   si->convert = convert ;
   si->isQual = isQual ;
-  si->nb = gzread (si->gzf, si->buf, si->bufSize) ;
+  si->nb = seqRead (si, si->buf, si->bufSize) ;
   if (!si->nb)
     { fprintf (stderr, "sequence file %s unreadable or empty\n", filename) ;
       seqIOclose (si) ;
@@ -58,7 +316,7 @@ SeqIO *seqIOopenRead (char *filename, int* convert, bool isQual)
 	    (si->buf[1] == 'R' && si->buf[2] == 'G') ||
 	    (si->buf[1] == 'P' && si->buf[2] == 'G') ||
 	    (si->buf[1] == 'C' && si->buf[2] == 'O'))) // then almost certainly a SAM file
-	{ gzclose (si->gzf) ; si->gzf = 0 ;
+	{ seqInputClose (si) ;
 	  if (!bamFileOpenRead (filename, si))
 	    { fprintf (stderr, "failed to open file %s as SAM/BAM/CRAM\n", filename) ;
 	      seqIOclose (si) ;
@@ -95,38 +353,38 @@ SeqIO *seqIOopenRead (char *filename, int* convert, bool isQual)
 	  { maxBufSize = ((maxBufSize >> 20) + 1) << 20 ; /* so a clean number of megabytes */
 	    char *newBuf = new (maxBufSize, char) ; memcpy (newBuf, si->b, si->nb) ;
 	    si->b = si->buf = newBuf ; si->bufSize = maxBufSize ;
-	    si->nb += gzread (si->gzf, si->b + si->nb, si->bufSize - si->nb) ;
+	    si->nb += seqRead (si, si->b + si->nb, si->bufSize - si->nb) ;
 	  }
       }
     }
 #ifdef ONEIO
   else if (*si->buf == '1')
-    { gzclose (si->gzf) ; si->gzf = 0 ;
-      OneFile *vf = oneFileOpenRead (filename, 0, "seq", 1) ;
+    { seqInputClose (si) ;
+      OneFile *vf = oneFileOpenRead (filename, 0, "seq", nThreads > 1 ? nThreads : 1) ;
       if (!vf)
 	{ fprintf (stderr, "failed to open ONE seq file %s\n", filename) ;
 	  seqIOclose (si) ;
 	  return 0 ;
 	}
-      si->type = ONE ; // important that this is after successful open
-      si->handle = vf ;
-      if (vf->info['S']->given.count)
-	{ si->nSeq = vf->info['S']->given.count ;
-	  si->totSeqLen = vf->info['S']->given.total ;
-	  si->maxSeqLen = vf->info['S']->given.max ;
-	  si->seqBuf = new0 (si->maxSeqLen+1,char) ;
+      oneReadSetup (si, vf) ;
+      if (nThreads > 1 && vf->isBinary) /* thread readers, to position with seqIOgoto() */
+	{ SeqIO *st = new0 (nThreads, SeqIO) ;
+	  int i ;
+	  for (i = 1 ; i < nThreads ; ++i)
+	    { st[i].convert = si->convert ; st[i].isQual = isQual ;
+	      st[i].bufSize = 1 << 16 ;
+	      st[i].buf = new (st[i].bufSize, char) ;
+	      oneReadSetup (&st[i], vf + i) ;
+	    }
+	  si->threads = st ; si->nThreads = nThreads ;
 	}
-      if (si->isQual && vf->info['Q'] && vf->info['Q']->given.count)
-	si->qualBuf = new0 (si->maxSeqLen+1,char) ;
-      else
-	si->isQual = false ;
       while (oneReadLine (vf) && vf->lineType != 'S') ; // move up to first sequence line
       si->seqStart = 0 ;
     }
 #endif
 #ifdef BAMIO
   else
-    { gzclose (si->gzf) ; si->gzf = 0 ;
+    { seqInputClose (si) ;
       if (!bamFileOpenRead (filename, si))
 	{ fprintf (stderr, "failed to open file %s as SAM/BAM/CRAM\n", filename) ;
 	  seqIOclose (si) ;
@@ -146,7 +404,8 @@ SeqIO *seqIOopenRead (char *filename, int* convert, bool isQual)
 
 void seqIOclose (SeqIO *si)
 { if (si->isWrite)
-    { if (si->type <= BINARY)
+    { if (si->nThreads > 1) seqIOmergeThreads (si) ;
+      if (si->type <= BINARY)
 	seqIOflush (si) ;
       if (si->type == BINARY)	/* write header */
 	{ if (lseek (si->fd, 0, SEEK_SET)) die ("failed to seek to start of binary file") ;
@@ -162,10 +421,20 @@ void seqIOclose (SeqIO *si)
 	  seqIOflush (si) ;
 	}
     }
+  if (si->threads)
+    { int i ;
+      for (i = 1 ; i < si->nThreads ; ++i)
+	{ SeqIO *st = (SeqIO*)si->threads + i ;
+	  free (st->buf) ; free (st->seqBuf) ; free (st->qualBuf) ;
+	  if (st->seqPack) seqPackDestroy (st->seqPack) ;
+	}
+      free (si->threads) ;
+    }
   free (si->buf) ;
+  if (si->seqPack) seqPackDestroy (si->seqPack) ;
   if (si->seqBuf) free (si->seqBuf) ;
   if (si->qualBuf) free (si->qualBuf) ;
-  if (si->gzf) gzclose (si->gzf) ;
+  seqInputClose (si) ;
   if (si->fd) close (si->fd) ;
 #ifdef ONEIO
   if (si->type == ONE)
@@ -178,6 +447,18 @@ void seqIOclose (SeqIO *si)
   free (si) ;
 }
 
+bool seqIOgoto (SeqIO *si, U64 i)
+{
+#ifdef ONEIO
+  if (si->type == ONE)
+    { OneFile *vf = (OneFile*) si->handle ;
+      if (i >= si->nSeq || !oneGoto (vf, 'S', i+1)) return false ;
+      return oneReadLine (vf) && vf->lineType == 'S' ;
+    }
+#endif
+  return false ;
+}
+
 /********** local routines for seqIOread() ***********/
  
 static void bufRefill (SeqIO *si)
@@ -186,7 +467,7 @@ static void bufRefill (SeqIO *si)
   si->idStart -= si->recStart ; si->descStart -= si->recStart ; /* adjust all the offsets */
   si->seqStart -= si->recStart ; si->qualStart -= si->recStart ;
   si->recStart = 0 ;
-  si->nb = gzread (si->gzf, si->b, si->buf + si->bufSize - si->b) ;
+  si->nb = seqRead (si, si->b, si->buf + si->bufSize - si->b) ;
 }
 
 static void bufDouble (SeqIO *si)
@@ -195,7 +476,7 @@ static void bufDouble (SeqIO *si)
   memcpy (newbuf, si->buf, si->bufSize) ;
   si->b = newbuf + si->bufSize ; si->nb = si->bufSize ; /* rely on being at end of old buf */
   free (si->buf) ; si->buf = newbuf ;
-  si->nb = gzread (si->gzf, si->b, si->bufSize) ;
+  si->nb = seqRead (si, si->b, si->bufSize) ;
   si->bufSize *= 2 ;
 }
 
@@ -218,7 +499,7 @@ static void bufHardRefill (SeqIO *si, U64 n) /* like bufRefill() but for bufConf
   si->b -= si->recStart ;		/* will be position after move */
   memmove (si->buf, si->buf + si->recStart, si->b - si->buf) ;
   si->recStart = 0 ; si->b = si->buf ;
-  si->nb += gzread (si->gzf, si->b + si->nb, si->bufSize - si->nb) ;
+  si->nb += seqRead (si, si->b + si->nb, si->bufSize - si->nb) ;
   if (si->nb < n) die ("incomplete sequence record %llu", si->line) ;
 }
 
@@ -226,50 +507,63 @@ static void bufHardRefill (SeqIO *si, U64 n) /* like bufRefill() but for bufConf
 
 #include <ctype.h>
 
-bool seqIOread (SeqIO *si)
-{
 #ifdef ONEIO
-  if (si->type == ONE)
-    { OneFile *vf = (OneFile*) si->handle ;
-      if (vf->lineType != 'S') return false ; // at end of file
-      si->seqLen = oneLen(vf) ; // otherwise we are at an 'S' line
-      if (si->seqLen > si->maxSeqLen)
-	{ if (si->maxSeqLen) { free (si->seqBuf) ; if (si->isQual) free (si->qualBuf) ; }
-	  si->maxSeqLen = si->seqLen ;
-	  si->seqBuf = new0 (si->maxSeqLen+1, char) ;
-	  if (si->isQual) si->qualBuf = new0 (si->maxSeqLen+1, char) ;
+static bool oneSeqRead (SeqIO *si, U64 start, U64 end) // only [start,end) of the sequence
+{
+  OneFile *vf = (OneFile*) si->handle ;
+  if (vf->lineType != 'S') return false ; // at end of file
+  si->seqLen = oneLen(vf) ; // otherwise we are at an 'S' line
+  if (end > si->seqLen || !end) end = si->seqLen ;
+  if (start > end) start = end ;
+  if (si->seqLen > si->maxSeqLen)
+    { if (si->maxSeqLen) { free (si->seqBuf) ; if (si->isQual) free (si->qualBuf) ; }
+      si->maxSeqLen = si->seqLen ;
+      si->seqBuf = new0 (si->maxSeqLen+1, char) ;
+      if (si->isQual) si->qualBuf = new0 (si->maxSeqLen+1, char) ;
+    }
+  if (si->is2bit) // copy the packed data, which the next oneReadLine() overwrites
+    { if (si->seqLen) memcpy (si->seqBuf, oneDNA2bit(vf), (si->seqLen+3) >> 2) ; }
+  else if (vf->nBits) // still 2-bit packed: unpack and convert 4 bases per table lookup
+    seqUnpack (si->seqPack, oneDNA2bit(vf), si->seqBuf + start, start, end - start) ;
+  else if (si->convert)
+    { char *s = si->seqBuf, *e = s + si->seqLen, *sv = oneString(vf) ;
+      while (s < e) *s++ = si->convert[(int)*sv++] ;
+    }
+  else
+    memcpy (si->seqBuf, oneString(vf), si->seqLen) ;
+  si->idLen = 0 ; si->idStart = 0 ;
+  si->descLen = 0 ; si->descStart = 0 ;
+  *si->buf = 0 ;
+  while (oneReadLine (vf) && vf->lineType != 'S') // lists are only decoded if we ask
+    { if (vf->lineType == 'Q' && si->isQual)
+	{ char *q = si->qualBuf, *qv = oneString(vf) ;
+	  U64 i, n = si->seqLen ;
+	  for (i = 0 ; i < n ; ++i) q[i] = qv[i] - 33 ; // simple loop so compiler vectorizes
 	}
-      if (si->convert)
-	{ char *s = si->seqBuf, *e = s + si->seqLen, *sv = oneString(vf) ;
-	  while (s < e) *s++ = si->convert[(int)*sv++] ;
+      if (vf->lineType == 'I' && !si->isSkipId)
+	{ char *desc = oneReadComment (vf) ;
+	  si->idLen = oneLen(vf) ;
+	  if (desc) si->descLen = strlen(desc) ; else si->descLen = 0 ;
+	  while (si->idLen + si->descLen + 2 > si->bufSize) bufDouble (si) ;
+	  si->idStart = 0 ; strcpy (si->buf, oneString(vf)) ;
+	  si->descStart = si->idLen+1 ;
+	  if (desc) strcpy (si->buf+si->descStart, desc) ; else si->buf[si->descStart] = 0 ;
 	}
-      else
-	memcpy (si->seqBuf, oneString(vf), si->seqLen) ;
-      si->idLen = 0 ; si->idStart = 0 ;
-      si->descLen = 0 ; si->descStart = 0 ;
-      *si->buf = 0 ;
-      while (oneReadLine (vf) && vf->lineType != 'S')
-	{ if (vf->lineType == 'Q' && si->isQual)
-	    { char *q = si->qualBuf, *e = q + si->seqLen, *qv = oneString(vf) ;
-	      while (q < e) *q++ = *qv++ - 33 ;
-	    }
-	  if (vf->lineType == 'I')
-	    { char *desc = oneReadComment (vf) ;
-	      si->idLen = oneLen(vf) ;
-	      if (desc) si->descLen = strlen(desc) ; else si->descLen = 0 ;
-	      while (si->idLen + si->descLen + 2 > si->bufSize) bufDouble (si) ;
-	      si->idStart = 0 ; strcpy (si->buf, oneString(vf)) ;
-	      si->descStart = si->idLen+1 ;
-	      if (desc) strcpy (si->buf+si->descStart, desc) ; else si->buf[si->descStart] = 0 ;
-	    }
-	  if (vf->lineType == 'N')
-	    { int n = oneInt(vf,2) ;
-	      char base = si->convert ? si->convert[(int)oneChar(vf,1)] : oneChar(vf,1) ;
-	      while (n--) si->seqBuf[oneInt(vf,0)+n] = base ;
-	    }
+      if (vf->lineType == 'N' && !si->is2bit)
+	{ int n = oneInt(vf,2) ;
+	  char base = si->convert ? si->convert[(int)oneChar(vf,1)] : oneChar(vf,1) ;
+	  U64 pos = oneInt(vf,0) ;
+	  while (n--) if (pos+n >= start && pos+n < end) si->seqBuf[pos+n] = base ;
 	}
-      return true ;
     }
+  return true ;
+}
+#endif
+
+bool seqIOread (SeqIO *si)
+{
+#ifdef ONEIO
+  if (si->type == ONE) return oneSeqRead (si, 0, 0) ;
 #endif
 #ifdef BAMIO
   if (si->type == BAM) return bamRead (si) ;
@@ -353,9 +647,38 @@ bool seqIOread (SeqIO *si)
   return true ;
 }
 
+bool seqIOreadRange (SeqIO *si, U64 start, U64 end)
+{
+#ifdef ONEIO
+  if (si->type == ONE) return oneSeqRead (si, start, end) ;
+#endif
+  return seqIOread (si) ;
+}
+
 /*********************** open for writing ***********************/
 
 SeqIO *seqIOopenWrite (char *filename, SeqIOtype type, int* convert, int qualThresh)
+{ return seqIOopenWriteThreaded (filename, type, convert, qualThresh, 1) ; }
+
+#ifdef ONEIO
+static void oneWriteThreadsSetup (SeqIO *si) /* a SeqIO for each slave OneFile, with its own counts */
+{
+  OneFile *vf = (OneFile*) si->handle ;
+  int i, nThreads = vf->share ; // share is the number of threads in the master
+  if (nThreads <= 1) return ;
+  SeqIO *st = new0 (nThreads, SeqIO) ;
+  for (i = 1 ; i < nThreads ; ++i)
+    { st[i].type = ONE ; st[i].isWrite = true ;
+      st[i].convert = si->convert ;
+      st[i].isQual = si->isQual ; st[i].qualThresh = si->qualThresh ;
+      st[i].handle = vf + i ;
+    }
+  si->threads = st ; si->nThreads = nThreads ;
+}
+#endif
+
+SeqIO *seqIOopenWriteThreaded (char *filename, SeqIOtype type, int* convert, int qualThresh,
+			       int nThreads)
 {
   SeqIO *si = new0 (1, SeqIO) ;
 
@@ -392,13 +715,15 @@ SeqIO *seqIOopenWrite (char *filename, SeqIOtype type, int* convert, int qualThr
     { OneSchema *schema = oneSchemaCreateFromText (seqioSchemaText) ;
       char *oneType = "seq" ;
       //      if (*ext == '1') ++ext ; oneType = ext ; // don't think I want this
-      OneFile *vf = oneFileOpenWriteNew (filename, schema, oneType, true, 1) ;
+      if (nThreads < 1) nThreads = 1 ;
+      OneFile *vf = oneFileOpenWriteNew (filename, schema, oneType, true, nThreads) ;
       oneSchemaDestroy (schema) ;
       if (!vf) { free (si) ; return 0 ; }
       si->handle = vf ;
       char *commandLine = getCommandLine() ;
       if (!commandLine) commandLine = "-" ;
       oneAddProvenance (vf, "seqio", "1.0", commandLine) ;
+      oneWriteThreadsSetup (si) ;
       return si ;
     }
 #else
@@ -461,10 +786,36 @@ SeqIO *seqIOadoptOneFile (void *handle, int* convert, int qualThresh)
   si->qualThresh = qualThresh ;
   si->type = ONE ;
   si->handle = handle ;
+  oneWriteThreadsSetup (si) ; // if the handle was opened with threads
   return si ;
 #endif
 }
 
+SeqIO *seqIOthread (SeqIO *si, int i)
+{
+  if (!i) return si ;
+  if (i < 0 || i >= si->nThreads) die ("seqIOthread %d out of range", i) ;
+  return (SeqIO*)si->threads + i ;
+}
+
+void seqIOmergeThreads (SeqIO *si)
+{
+  int i ;
+  for (i = 1 ; i < si->nThreads ; ++i)
+    { SeqIO *st = (SeqIO*)si->threads + i ;
+      si->nSeq += st->nSeq ; st->nSeq = 0 ;
+      si->totIdLen += st->totIdLen ; st->totIdLen = 0 ;
+      si->totDescLen += st->totDescLen ; st->totDescLen = 0 ;
+      si->totSeqLen += st->totSeqLen ; st->totSeqLen = 0 ;
+      if (st->maxIdLen > si->maxIdLen) si->maxIdLen = st->maxIdLen ;
+      if (st->maxDescLen > si->maxDescLen) si->maxDescLen = st->maxDescLen ;
+      if (st->maxSeqLen > si->maxSeqLen) si->maxSeqLen = st->maxSeqLen ;
+    }
+#ifdef ONEIO
+  if (si->nThreads > 1) oneMergeThreads ((OneFile*)si->handle) ;
+#endif
+}
+
 void seqIOflush (SeqIO *si)	/* writes buffer to file and resets to 0 */
 {
   if (!si->isWrite) return ;
@@ -505,14 +856,14 @@ void seqIOwrite (SeqIO *si, char *id, char *desc, U64 seqLen, char *seq, char *q
 #ifdef ONEIO
   if (si->type == ONE)
     { OneFile *vf = (OneFile*)(si->handle) ;
-      static U64 bufLen = 0 ;
-      static char *buf = 0 ;
       I64 i ;
-      if (seqLen > bufLen)
-	{ if (buf) free (buf) ;
-	  bufLen = seqLen ;
-	  buf = new(bufLen+1,char) ;
+      if (seqLen >= si->bufSize) /* NB malloc() not new() because may be in a thread */
+	{ free (si->buf) ;
+	  si->bufSize = seqLen + 1 ;
+	  si->buf = malloc (si->bufSize) ;
+	  if (!si->buf) die ("failed to allocate %llu bytes in seqIOwrite", si->bufSize) ;
 	}
+      char *buf = si->buf ;
       if (si->convert)
 	{ for (i = 0 ; i < seqLen ; ++i) buf[i] = si->convert[(int)(seq[i])] ;
 	  seq = buf ;
@@ -622,6 +973,25 @@ SeqPack *seqPackCreate (char unpackA)
       die ("seqPackCreate: unrecognised unpackA character %d = %c - must be one of a, A, 0, 1",
 	   unpackA, unpackA) ;
     }
+  seqPackFill (sp) ;
+  return sp ;
+}
+
+static SeqPack *seqPackCreateConvert (int *convert) /* unpacks 2-bit acgt through convert[] */
+{
+  SeqPack *sp = new (1, SeqPack) ;
+  int i ;
+  for (i = 0 ; i < 4 ; ++i)
+    { sp->unconv[i] = convert ? convert[(int)"acgt"[i]] : "acgt"[i] ;
+      sp->unconvC[i] = convert ? convert[(int)"tgca"[i]] : "tgca"[i] ;
+    }
+  sp->unconv[4] = sp->unconvC[4] = 0 ;
+  seqPackFill (sp) ;
+  return sp ;
+}
+
+static void seqPackFill (SeqPack *sp) /* builds byteExpand[] tables from unconv[] */
+{
   int i, j ;
   for (i = 0 ; i < 256 ; ++i)
     { U8 u ;
@@ -630,7 +1000,6 @@ SeqPack *seqPackCreate (char unpackA)
       s = (char*)&sp->byteExpandC[i] ;
       u = i ; for (j = 4 ; j-- ; ) { s[j] = sp->unconvC[u & 0x03] ; u >>= 2 ; }
     }
-  return sp ;
 }
 
 static U8 pack[] = {    // sends N (indeed any non-CGT) to A, except 0,1,2,3 are maintained
@@ -67,16 +67,22 @@ typedef struct {
   U64   idStart, descStart, seqStart, qualStart ;
   bool  isQual ;       		/* if set then convert qualities by subtracting 33 (FASTQ) */
   int   qualThresh ;		/* used for binary representation of qualities */
+  bool  isSkipId ;		/* ONE input: ignore ids and descriptions - set before seqIOread() */
+  bool  is2bit ;		/* ONE input: sequence is 2-bit packed, 4 per byte, N's as a */
   /* below here private */
   U64   bufSize ;
   U64   nb ;			/* nb is how many characters left to read in the buffer */
   U64   line, recStart ;	/* recStart is the offset for the current record */
   int   fd ;			/* file descriptor, if gzf is not set */
   gzFile gzf ;
+  void *reader ;			/* threaded input pipeline, if set instead of gzf */
+  void *vzi ;			/* indexed VGPzip input, if set instead of gzf */
   char *buf, *b ;		/* b is current pointer in buf */
   int  *convert ;
   char *seqBuf, *qualBuf ;	/* used in modes BINARY, VGP, BAM */
   void *handle;			/* used for ONEseq, BAM */
+  int   nThreads ;		/* for parallel ONEseq reading and writing */
+  void *threads ;		/* SeqIO for each slave OneFile */
   SeqPack  *seqPack ;
   QualPack *qualPack ;
 } SeqIO ;
@@ -87,16 +93,29 @@ typedef struct {
 /* Add 0 terminators to ids.  Convert sequences in place if convert != 0, and quals if isQual. */
 
 SeqIO  *seqIOopenRead (char *filename, int* convert, bool isQual) ; /* can use "-" for stdin */
+SeqIO  *seqIOopenReadThreaded (char *filename, int* convert, bool isQual, int nThreads) ;
+	/* decompresses input in nThreads background threads; BGZF files inflate in parallel */
+	/* for binary ONE input instead gives nThreads readers: see seqIOthread(), seqIOgoto() */
+bool    seqIOgoto (SeqIO *si, U64 i) ; /* ONE input only: next seqIOread() gives sequence i */
 bool    seqIOread (SeqIO *si) ;
+bool    seqIOreadRange (SeqIO *si, U64 start, U64 end) ;
+	/* as seqIOread(), but for ONE input only [start,end) of sqioSeq() is valid; end 0 for all */
 #define sqioId(si)   ((si)->buf+(si)->idStart)
 #define sqioDesc(si) ((si)->buf+(si)->descStart)
 #define sqioSeq(si)  ((si)->type >= BINARY ? (si)->seqBuf : (si)->buf+(si)->seqStart)
 #define sqioQual(si) ((si)->type >= BINARY ? (si)->qualBuf : (si)->buf+(si)->qualStart)
+#define sqioSeq2bit(si) ((U8*)(si)->seqBuf) /* if is2bit, little-endian as in seqPack() */
 
 void    seqIOreferenceFileName (char *refFileName) ; /* resets this (globally) for CRAM */
 
 SeqIO  *seqIOopenWrite (char *filename, SeqIOtype type, int* convert, int qualThresh) ;
 void    seqIOwrite (SeqIO *si, char *id, char *desc, U64 seqLen, char *seq, char *qual) ;
+SeqIO  *seqIOopenWriteThreaded (char *filename, SeqIOtype type, int* convert, int qualThresh,
+				int nThreads) ;
+	/* for ONEseq output, seqIOthread(si,i) is the writer for thread i, 0 <= i < nThreads */
+	/* thread i writes its batch of each round, then seqIOmergeThreads() keeps the order */
+SeqIO  *seqIOthread (SeqIO *si, int i) ; /* also the reader for thread i if opened threaded */
+void    seqIOmergeThreads (SeqIO *si) ; /* call between rounds when no thread is writing */
 void    seqIOflush (SeqIO *si) ;	/* NB writes are buffered, so need this to ensure in file */
 
 void    seqIOclose (SeqIO *si) ;	/* will flush file opened for writing */
@@ -114,6 +133,7 @@ static char *seqioSchemaText =
   "D N 3 3 INT 4 CHAR 3 INT  non-acgt base: pos (0-indexed), base, number\n" ;
 
 SeqIO *seqIOadoptOneFile (void *handle, int* convert, int qualThresh) ;
+	/* if handle was opened for writing with nthreads > 1 then seqIOthread() works as above */
 
 /* utility */
 
@@ -16,6 +16,7 @@
 #include <stdbool.h>
 #include <ctype.h>
 #include <math.h>
+#include <pthread.h>
 
 static int lengthBins = 20 ;
 
@@ -27,94 +28,225 @@ void usage (void)
   fprintf (stderr, "    -b : show base counts\n") ;
   fprintf (stderr, "    -q : show quality counts\n") ;
   fprintf (stderr, "    -t : show time and memory used\n") ;
-  fprintf (stderr, "    -l : show length distribution in up to %d quadratic bins\n", lengthBins) ;
+  fprintf (stderr, "    -l : show N50 and length distribution in up to %d quadratic bins\n", lengthBins) ;
+  fprintf (stderr, "    -g <genome size> : also show NG50 with -l\n") ;
   fprintf (stderr, "    -e : show name length [desc] per entry\n") ;
+  fprintf (stderr, "    -T <n> : use n threads - to read binary 1code, else to decompress the input [0]\n") ;
   exit (0) ;
 }
 
+/* Each thread accumulates its own Stats, which are merged at the end.  Byte counts use
+   4 interleaved tables so that consecutive increments do not wait on each other.  Lengths
+   are kept exactly, so that N50 is exact: short ones as counts, long ones as a list.
+*/
+
+#define LONG_LEN (1 << 20)
+
+typedef struct {
+  U64   nSeq, totLen, lenMin, lenMax ;
+  U64  *baseCount, *qualCount ;	/* 4*256 each, if requested */
+  Array lenCount ;		/* U64 number of sequences of each length < LONG_LEN */
+  Array longLen ;		/* U64 lengths >= LONG_LEN */
+} Stats ;
+
+/* maxLen and maxLong, if known, size the arrays so that they never grow: stats filled in
+   threads rely on this, since growing an Array updates unlocked globals in array.c */
+
+static void statsInit (Stats *st, bool isBase, bool isQual, U64 maxLen, U64 maxLong)
+{
+  memset (st, 0, sizeof(Stats)) ;
+  if (isBase) st->baseCount = new0 (4*256, U64) ;
+  if (isQual) st->qualCount = new0 (4*256, U64) ;
+  if (maxLen >= LONG_LEN) maxLen = LONG_LEN-1 ;
+  st->lenCount = arrayCreate (maxLen+1, U64) ;
+  st->longLen = arrayCreate (maxLong, U64) ;
+}
+
+static inline void countBytes (U64 *c, U8 *s, U64 len)
+{
+  U64 *c1 = c + 256, *c2 = c + 512, *c3 = c + 768 ;
+  U8  *e = s + (len & ~(U64)3) ;
+  while (s < e)
+    { ++c[s[0]] ; ++c1[s[1]] ; ++c2[s[2]] ; ++c3[s[3]] ; s += 4 ; }
+  switch (len & 3) // note fall through
+    {
+    case 3: ++c[s[2]] ;
+    case 2: ++c[s[1]] ;
+    case 1: ++c[s[0]] ;
+    }
+}
+
+static void statsAdd (Stats *st, SeqIO *si)
+{
+  U64 len = si->seqLen ;
+  if (!st->nSeq++ || len < st->lenMin) st->lenMin = len ; /* 0 is a real length */
+  st->totLen += len ;
+  if (len > st->lenMax) st->lenMax = len ;
+  if (len < LONG_LEN) ++array(st->lenCount, len, U64) ;
+  else array(st->longLen, arrayMax(st->longLen), U64) = len ;
+  if (st->baseCount) countBytes (st->baseCount, (U8*)sqioSeq(si), len) ;
+  if (st->qualCount && si->isQual) countBytes (st->qualCount, (U8*)sqioQual(si), len) ;
+}
+
+static void statsMerge (Stats *st, Stats *s1) /* adds s1 into st and frees s1's memory */
+{
+  U64 i ;
+  if (s1->nSeq && (!st->nSeq || s1->lenMin < st->lenMin)) st->lenMin = s1->lenMin ;
+  st->nSeq += s1->nSeq ;
+  st->totLen += s1->totLen ;
+  if (s1->lenMax > st->lenMax) st->lenMax = s1->lenMax ;
+  for (i = 0 ; i < arrayMax(s1->lenCount) ; ++i)
+    if (arr(s1->lenCount, i, U64)) array(st->lenCount, i, U64) += arr(s1->lenCount, i, U64) ;
+  for (i = 0 ; i < arrayMax(s1->longLen) ; ++i)
+    array(st->longLen, arrayMax(st->longLen), U64) = arr(s1->longLen, i, U64) ;
+  for (i = 0 ; i < 4*256 ; ++i)
+    { if (st->baseCount) st->baseCount[i] += s1->baseCount[i] ;
+      if (st->qualCount) st->qualCount[i] += s1->qualCount[i] ;
+    }
+  if (s1->baseCount) free (s1->baseCount) ;
+  if (s1->qualCount) free (s1->qualCount) ;
+  arrayDestroy (s1->lenCount) ; arrayDestroy (s1->longLen) ;
+}
+
+static int U64order (const void *a, const void *b)
+{ U64 x = *(U64*)a, y = *(U64*)b ; return (x < y) ? 1 : (x > y) ? -1 : 0 ; } /* decreasing */
+
+static U64 statsNx (Stats *st, U64 target) /* length L such that seqs >= L total >= target */
+{
+  U64 i, sum = 0 ;
+  for (i = 0 ; i < arrayMax(st->longLen) ; ++i) /* sorted by caller */
+    if ((sum += arr(st->longLen, i, U64)) >= target) return arr(st->longLen, i, U64) ;
+  for (i = arrayMax(st->lenCount) ; i-- ; )
+    if ((sum += i * arr(st->lenCount, i, U64)) >= target) return i ;
+  return 0 ;
+}
+
+typedef struct {
+  SeqIO *si ;
+  U64    start, end ;
+  Stats  stats ;
+} ThreadArg ;
+
+static void *statsThread (void *arg)
+{
+  ThreadArg *ta = (ThreadArg*) arg ;
+  U64 i ;
+  if (ta->start < ta->end && !seqIOgoto (ta->si, ta->start))
+    die ("failed to go to sequence %llu", ta->start) ;
+  for (i = ta->start ; i < ta->end && seqIOread (ta->si) ; ++i)
+    statsAdd (&ta->stats, ta->si) ;
+  return 0 ;
+}
+
 int main (int argc, char *argv[])
 {
   --argc ; ++argv ;
-  U64   *totBase = 0, *totQual = 0 ;
+  bool  isBase = false, isQual = false, isLength = false ;
   bool  isTime = false ;
   bool  isEntry = false ;
-  Array lengthCount = 0, lengthSum = 0 ;
+  int   nThreads = 0 ;
+  U64   genomeSize = 0 ;
 
   if (!argc) usage () ;
 
   while (argc && **argv == '-' && strcmp (*argv, "-"))
-    if (!strcmp (*argv, "-b")) { totBase = new0 (256, U64) ; --argc ; ++argv ; }
-    else if (!strcmp (*argv, "-q")) { totQual = new0 (256, U64) ; --argc ; ++argv ; }
+    if (!strcmp (*argv, "-b")) { isBase = true ; --argc ; ++argv ; }
+    else if (!strcmp (*argv, "-q")) { isQual = true ; --argc ; ++argv ; }
     else if (!strcmp (*argv, "-t")) { isTime = true ; --argc ; ++argv ; }
     else if (!strcmp (*argv, "-e")) { isEntry = true ; --argc ; ++argv ; }
-    else if (!strcmp (*argv, "-l"))
-      { lengthCount = arrayCreate (10000, int) ;
-	lengthSum = arrayCreate (10000, U64) ;
-	--argc ; ++argv ;
-      }
+    else if (!strcmp (*argv, "-T") && argc > 1) { nThreads = atoi (argv[1]) ; argc -= 2 ; argv += 2 ; }
+    else if (!strcmp (*argv, "-g") && argc > 1) { genomeSize = atoll (argv[1]) ; argc -= 2 ; argv += 2 ; }
+    else if (!strcmp (*argv, "-l")) { isLength = true ; --argc ; ++argv ; }
     else usage () ;
-  
+
   if (isTime) timeUpdate (stdout) ;
-  
-  SeqIO *si = seqIOopenRead (*argv, 0, true) ;
+
+  SeqIO *si = seqIOopenReadThreaded (*argv, 0, isQual, nThreads) ;
   if (!si) die ("failed to open sequence file %s\n", *argv) ;
+  si->isSkipId = !isEntry ;
 
-  U64 lenMin = 0, lenMax = 0, totLen = 0 ;
+  Stats stats ;
   int i ;
-  while (seqIOread (si))
-    { char *s = sqioSeq(si), *e = s + si->seqLen ;
-      if (totBase) while (s < e) ++totBase[(int)*s++] ;
-      totLen += si->seqLen ;
-      if (si->seqLen > lenMax) lenMax = si->seqLen ;
-      if (!lenMin || si->seqLen < lenMin) lenMin = si->seqLen ;
-      if (lengthCount)
-	{ i = 10.*sqrt((double)si->seqLen) ;
-	  ++array(lengthCount, i, int) ; array(lengthSum, i, U64) += si->seqLen ;
-	}
-      if (totQual && si->isQual)
-	{ char *q = sqioQual(si), *e = q + si->seqLen ;
-	  while (q < e) ++totQual[(int)*q++] ;
+  if (si->nThreads > 1 && !isEntry && si->maxSeqLen) /* partition ONE input by sequence index */
+    { pthread_t *threads = new (si->nThreads, pthread_t) ;
+      ThreadArg *ta = new0 (si->nThreads, ThreadArg) ;
+      for (i = 0 ; i < si->nThreads ; ++i)
+	{ ta[i].si = seqIOthread (si, i) ;
+	  ta[i].si->isSkipId = true ;
+	  ta[i].start = (si->nSeq * i) / si->nThreads ;
+	  ta[i].end = (si->nSeq * (i+1)) / si->nThreads ;
+	  statsInit (&ta[i].stats, isBase, isQual, si->maxSeqLen, si->totSeqLen / LONG_LEN + 1) ;
+	  pthread_create (&threads[i], 0, statsThread, &ta[i]) ;
 	}
-      if (isEntry)
-	{ printf ("%s\t%lld", sqioId(si), (long long)si->seqLen) ;
-	  if (si->descLen) printf ("\t%s\n", sqioDesc(si)) ; else putchar ('\n') ;
+      for (i = 0 ; i < si->nThreads ; ++i) pthread_join (threads[i], 0) ;
+      stats = ta[0].stats ;
+      for (i = 1 ; i < si->nThreads ; ++i) statsMerge (&stats, &ta[i].stats) ;
+      free (threads) ; free (ta) ;
+    }
+  else
+    { statsInit (&stats, isBase, isQual, 1023, 64) ;
+      while (seqIOread (si))
+	{ statsAdd (&stats, si) ;
+	  if (isEntry)
+	    { printf ("%s\t%lld", sqioId(si), (long long)si->seqLen) ;
+	      if (si->descLen) printf ("\t%s\n", sqioDesc(si)) ; else putchar ('\n') ;
+	    }
 	}
     }
   if (isEntry) exit (0) ;
+
+  U64 totLen = stats.totLen ;
   printf ("%s file, %llu sequences >= 0, %llu total, %.2f average, %llu min, %llu max\n",
-	  seqIOtypeName[si->type], si->nSeq, totLen, totLen / (double) si->nSeq, lenMin, lenMax) ;
-  if (totBase)
+	  seqIOtypeName[si->type], stats.nSeq, totLen, totLen / (double) stats.nSeq,
+	  stats.lenMin, stats.lenMax) ;
+  if (stats.baseCount)
     { printf ("bases\n") ;
       for (i = 0 ; i < 256 ; ++i)
-	if (totBase[i])
-	  { if (isprint(i))
-	      printf ("  %c %llu %4.1f %%\n", i, totBase[i], totBase[i]*100.0/totLen) ;
-	    else
-	      printf ("  unprint-%d %llu %4.1f %%\n", i, totBase[i], totBase[i]*100.0/totLen) ;
-	  }
-      free (totBase) ;
+	{ U64 n = stats.baseCount[i] + stats.baseCount[256+i]
+	    + stats.baseCount[512+i] + stats.baseCount[768+i] ;
+	  if (n)
+	    { if (isprint(i))
+		printf ("  %c %llu %4.1f %%\n", i, n, n*100.0/totLen) ;
+	      else
+		printf ("  unprint-%d %llu %4.1f %%\n", i, n, n*100.0/totLen) ;
+	    }
+	}
+      free (stats.baseCount) ;
     }
 
-  if (totQual && si->isQual)
+  if (stats.qualCount && si->isQual)
     { printf ("qualities\n") ;
       U64 sum = 0 ;
       for (i = 0 ; i < 256 ; ++i)
-	{ sum += totQual[i] ;
-	  if (totQual[i]) printf (" %3d %llu %4.1f %% %5.1f %%\n",
-				  i, totQual[i], totQual[i]*100.0/totLen, sum*100.0/totLen) ;
+	{ U64 n = stats.qualCount[i] + stats.qualCount[256+i]
+	    + stats.qualCount[512+i] + stats.qualCount[768+i] ;
+	  sum += n ;
+	  if (n) printf (" %3d %llu %4.1f %% %5.1f %%\n",
+			 i, n, n*100.0/totLen, sum*100.0/totLen) ;
 	}
-      free (totQual) ;
     }
+  if (stats.qualCount) free (stats.qualCount) ;
 
-  if (lengthSum)
-    { if (lenMin < lenMax)
-	{ U64 tot50 = 0 ;
-	  for (i = 0 ; i < arrayMax(lengthSum) && tot50 < 0.5*totLen ; ++i) 
-	    tot50 += arr(lengthSum, i, U64) ;
-	  printf ("approximate N50 %ld\n", ((long)i*(long)(i+1))/100) ;
+  if (isLength)
+    { if (stats.lenMin < stats.lenMax)
+	{ arraySort (stats.longLen, U64order) ;
+	  printf ("N50 %llu\n", statsNx (&stats, (totLen+1)/2)) ;
+	  if (genomeSize)
+	    { U64 ng50 = statsNx (&stats, (genomeSize+1)/2) ;
+	      if (ng50) printf ("NG50 %llu\n", ng50) ;
+	      else printf ("NG50 undefined: total length less than half genome size\n") ;
+	    }
+	  Array lengthCount = arrayCreate (10000, int) ; /* quadratic bins from exact lengths */
+	  U64 j ;
+	  for (j = 0 ; j < arrayMax(stats.lenCount) ; ++j)
+	    if (arr(stats.lenCount, j, U64))
+	      array(lengthCount, (int)(10.*sqrt((double)j)), int) += arr(stats.lenCount, j, U64) ;
+	  for (j = 0 ; j < arrayMax(stats.longLen) ; ++j)
+	    ++array(lengthCount, (int)(10.*sqrt((double)arr(stats.longLen, j, U64))), int) ;
 	  printf ("length distribution (quadratic bins)\n") ;
 	  int s = 0 ;
 	  int d = arrayMax(lengthCount) / 20 ;
+	  if (!d) d = 1 ;
 	  for (i = 0 ; i < arrayMax(lengthCount) ; ++i)
 	    { s += arr(lengthCount, i, int) ;
 	      if (s && !((arrayMax(lengthCount)-1-i) % d))
@@ -122,10 +254,11 @@ int main (int argc, char *argv[])
 		  s = 0 ;
 		}
 	    }
+	  arrayDestroy (lengthCount) ;
 	}
-      arrayDestroy (lengthCount) ; arrayDestroy (lengthSum) ;
     }
-  
+  arrayDestroy (stats.lenCount) ; arrayDestroy (stats.longLen) ;
+
   if (isTime) timeTotal (stdout) ;
   seqIOclose (si) ;
 }
@@ -0,0 +1,138 @@
+/*  File: utiltest.c
+ *-------------------------------------------------------------------
+ * Description: checks of the dict and concurrent hash packages - run by "make test"
+ *   Usage: utiltest [nNames [nThreads]]
+ *-------------------------------------------------------------------
+ */
+
+#include "utils.h"
+#include "dict.h"
+#include "hash.h"
+#include <pthread.h>
+
+static int nFail = 0 ;
+
+static void check (bool ok, char *what)
+{ if (!ok) { fprintf (stderr, "utiltest failed: %s\n", what) ; ++nFail ; } }
+
+/* names 0..n-1 are added; names n..2n-1 are looked up but never added */
+
+static char *testName (U64 i)
+{ static char buf[32] ;
+  sprintf (buf, "seq%llu_%llx", i, (i * 0x9e3779b97f4a7c15ULL) >> 40) ;
+  return buf ;
+}
+
+static void dictTest (U64 n)
+{
+  DICT *dict = dictCreate (16) ;	/* small, so that the table grows */
+  U64   i, k ;
+
+  for (i = 0 ; i < n ; ++i)
+    check (dictAdd (dict, testName (i), &k) && k == i, "dictAdd gives the next index") ;
+  check (!dictAdd (dict, testName (7), &k) && k == 7, "dictAdd of a present name") ;
+  check (dictMax (dict) == n, "dictMax") ;
+
+  char **s = new (2*n, char*) ;
+  for (i = 0 ; i < 2*n ; ++i) s[i] = strdup (testName (i)) ;
+  I64  *index = new (2*n, I64) ;
+  U64   nFound = dictFindBatch (dict, 2*n, s, index) ;
+  check (nFound == n, "dictFindBatch finds the names that were added") ;
+  for (i = 0 ; i < 2*n ; ++i)
+    { bool isFound = dictFind (dict, s[i], &k) ;
+      check (isFound == (index[i] >= 0), "dictFindBatch and dictFind agree on presence") ;
+      if (isFound) check ((I64) k == index[i] && k == i, "dictFindBatch and dictFind agree on index") ;
+    }
+
+  FILE *f = tmpfile () ;
+  check (dictWrite (dict, f), "dictWrite") ;
+  rewind (f) ;
+  DICT *d2 = dictRead (f) ;
+  check (d2 && dictMax (d2) == n, "dictRead") ;
+  for (i = 0 ; d2 && i < n ; ++i)
+    check (!strcmp (dictName (d2, i), s[i]) && dictFind (d2, s[i], &k) && k == i, "dictRead names") ;
+  if (d2) dictDestroy (d2) ;
+  fclose (f) ;
+
+  f = tmpfile () ;		/* the old format started straight away with dim then max */
+  fwrite (&dict->dim, sizeof(U64), 1, f) ; fwrite (&dict->max, sizeof(U64), 1, f) ;
+  rewind (f) ;
+  check (!dictRead (f), "dictRead rejects a file without the version tag") ;
+  fclose (f) ;
+
+  for (i = 0 ; i < 2*n ; ++i) free (s[i]) ;
+  free (s) ; free (index) ;
+  dictDestroy (dict) ;
+}
+
+/* every thread adds all n keys, each starting at a different place, so that adds of the same
+   key race, and finds each key straight after adding it; afterwards all threads must agree
+   on the index of each key, and the indices must be exactly 0..n-1 */
+
+typedef struct {
+  Hash h ;
+  int  n, start ;
+  int *index ;			/* index[k] as returned to this thread */
+  int  nBad ;			/* finds that failed or disagreed with the add */
+} HashJob ;
+
+static void *hashThread (void *arg)
+{
+  HashJob *job = (HashJob*) arg ;
+  int i, j ;
+  for (i = 0 ; i < job->n ; ++i)
+    { int k = (job->start + i) % job->n ;
+      hashAdd (job->h, hashInt (k), &job->index[k]) ;
+      if (!hashFind (job->h, hashInt (k), &j) || j != job->index[k]) ++job->nBad ;
+    }
+  return 0 ;
+}
+
+static void hashTest (int n, int nThreads)
+{
+  Hash       h = hashCreateConcurrent (64) ; /* small, so that the stripes grow */
+  HashJob   *job = new0 (nThreads, HashJob) ;
+  pthread_t *threads = new (nThreads, pthread_t) ;
+  int        i, t, k ;
+
+  for (t = 0 ; t < nThreads ; ++t)
+    { job[t].h = h ; job[t].n = n ; job[t].start = (int) (((I64) n * t) / nThreads) ;
+      job[t].index = new (n, int) ;
+      pthread_create (&threads[t], 0, hashThread, &job[t]) ;
+    }
+  for (t = 0 ; t < nThreads ; ++t) pthread_join (threads[t], 0) ;
+
+  check (hashCount (h) == n, "hashCount after concurrent adds") ;
+  char *isSeen = new0 (n, char) ;
+  for (t = 0 ; t < nThreads ; ++t)
+    check (!job[t].nBad, "concurrent hashFind of a key just added") ;
+  for (k = 0 ; k < n ; ++k)
+    { i = job[0].index[k] ;
+      for (t = 1 ; t < nThreads ; ++t)
+	check (job[t].index[k] == i, "threads agree on the index of a key") ;
+      check (i >= 0 && i < n && !isSeen[i], "indices are 0..n-1, each once") ;
+      if (i >= 0 && i < n) isSeen[i] = 1 ;
+    }
+
+  hashCompact (h) ;
+  for (k = 0 ; k < n ; ++k)
+    check (hashFind (h, hashInt (k), &i) && i == job[0].index[k], "hashFind after hashCompact") ;
+  check (!hashFind (h, hashInt (n), 0), "hashFind of an absent key") ;
+
+  for (t = 0 ; t < nThreads ; ++t) free (job[t].index) ;
+  free (job) ; free (threads) ; free (isSeen) ;
+  hashDestroy (h) ;
+}
+
+int main (int argc, char **argv)
+{
+  U64 n = (argc > 1) ? atoll (argv[1]) : 100000 ;
+  int nThreads = (argc > 2) ? atoi (argv[2]) : 4 ;
+
+  dictTest (n) ;
+  hashTest ((int) n, nThreads) ;
+
+  if (nFail) { fprintf (stderr, "utiltest: %d checks failed\n", nFail) ; exit (1) ; }
+  printf ("utiltest: dict and hash checks passed with %llu names, %d threads\n", n, nThreads) ;
+  return 0 ;
+}
@@ -0,0 +1,229 @@
+/*  File: vzi.c
+ *-------------------------------------------------------------------
+ * Description: random access reader for VGPzip files
+ *   VGPzip writes each 10MB of input as an independent gzip member, and the .vzi index is
+ *   the number of blocks followed by the compressed end offset of each block, all int64.
+ *   Uncompressed block sizes come from the gzip ISIZE trailers.  Worker threads claim
+ *   blocks in order and inflate them into a ring of slots at most nSlots ahead of the
+ *   reader; a seek just moves the reader and the claim point.
+ * Exported functions: see vzi.h
+ *-------------------------------------------------------------------
+ */
+
+#include "vzi.h"
+#include <zlib.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+typedef struct {
+  I64   block ;			/* block held or being inflated, -1 if none */
+  bool  isReady, isBusy ;
+  U8   *in ;			/* compressed block */
+  char *out ;			/* uncompressed block */
+} VziSlot ;
+
+struct VziStruct {
+  int        fd ;
+  I64        nBlocks ;
+  I64       *zoff ;		/* compressed start of block i, zoff[nBlocks] = file size */
+  U64       *uoff ;		/* uncompressed start of block i, uoff[nBlocks] = total */
+  int        nThreads, nSlots ;
+  pthread_t *threads ;
+  VziSlot   *slots ;
+  I64        nextClaim ;	/* next block for a worker to inflate */
+  I64        readBlock ;	/* block the reader is in */
+  U64        readPos ;		/* offset within readBlock */
+  bool       isStop ;
+  z_stream   z ;		/* for the reader if nThreads == 0 */
+  pthread_mutex_t lock ;
+  pthread_cond_t  filled, freed ;
+} ;
+
+static void blockInflate (Vzi *v, I64 b, VziSlot *s, z_stream *z) /* outside any lock */
+{
+  U64 inSize = v->zoff[b+1] - v->zoff[b], outSize = v->uoff[b+1] - v->uoff[b] ;
+  if (pread (v->fd, s->in, inSize, v->zoff[b]) != (ssize_t) inSize)
+    die ("failed to read VGPzip block %lld", b) ;
+  inflateReset (z) ;
+  z->next_in = s->in ; z->avail_in = inSize ;
+  z->next_out = (U8*) s->out ; z->avail_out = outSize ;
+  if (inflate (z, Z_FINISH) != Z_STREAM_END || z->avail_out)
+    die ("failed to inflate VGPzip block %lld", b) ;
+}
+
+static void *vziThread (void *arg)
+{
+  Vzi *v = (Vzi*) arg ;
+  z_stream z ;
+  memset (&z, 0, sizeof(z_stream)) ;
+  if (inflateInit2 (&z, 16+MAX_WBITS) != Z_OK) die ("inflateInit2 failed") ;
+
+  pthread_mutex_lock (&v->lock) ;
+  while (true)
+    { VziSlot *s = 0 ;
+      while (!v->isStop)
+	{ if (v->nextClaim < v->nBlocks && v->nextClaim < v->readBlock + v->nSlots)
+	    { s = &v->slots[v->nextClaim % v->nSlots] ;
+	      if (s->block == v->nextClaim && (s->isReady || s->isBusy)) /* still valid after seek */
+		{ ++v->nextClaim ; continue ; }
+	      if (!s->isBusy) break ; /* else wait for a stale inflate from before a seek */
+	    }
+	  pthread_cond_wait (&v->freed, &v->lock) ;
+	}
+      if (v->isStop) break ;
+      I64 b = v->nextClaim++ ;
+      s->block = b ; s->isReady = false ; s->isBusy = true ;
+      pthread_mutex_unlock (&v->lock) ;
+
+      blockInflate (v, b, s, &z) ;
+
+      pthread_mutex_lock (&v->lock) ;
+      s->isReady = true ; s->isBusy = false ;
+      pthread_cond_broadcast (&v->filled) ;
+      pthread_cond_broadcast (&v->freed) ; /* a claim may be waiting for this slot */
+    }
+  pthread_mutex_unlock (&v->lock) ;
+  inflateEnd (&z) ;
+  return 0 ;
+}
+
+Vzi *vziOpen (char *filename, int nThreads)
+{
+  int len = strlen (filename) ;
+  if (len < 4 || strcmp (filename + len - 3, ".gz")) return 0 ;
+  char *indexName = new (len + 2, char) ;
+  strcpy (indexName, filename) ; strcpy (indexName + len - 3, ".vzi") ;
+  int fd = open (indexName, O_RDONLY) ;
+  free (indexName) ;
+  if (fd < 0) return 0 ;
+
+  Vzi *v = new0 (1, Vzi) ;
+  v->fd = -1 ;
+  if (read (fd, &v->nBlocks, sizeof(I64)) != sizeof(I64) || v->nBlocks < 1)
+    { close (fd) ; vziClose (v) ; return 0 ; }
+  v->zoff = new (v->nBlocks+1, I64) ;
+  v->zoff[0] = 0 ;
+  bool isOK = (read (fd, v->zoff+1, v->nBlocks*sizeof(I64)) == (ssize_t)(v->nBlocks*sizeof(I64))) ;
+  close (fd) ;
+  struct stat st ;
+  if (!isOK || (v->fd = open (filename, O_RDONLY)) < 0 || fstat (v->fd, &st)
+      || v->zoff[v->nBlocks] != st.st_size)
+    { warn ("ignoring VGPzip index for %s - it does not match the file", filename) ;
+      vziClose (v) ; return 0 ;
+    }
+
+  v->uoff = new (v->nBlocks+1, U64) ;	/* block sizes from the gzip ISIZE trailers */
+  v->uoff[0] = 0 ;
+  U64 maxIn = 0, maxOut = 0 ;
+  I64 b ;
+  for (b = 0 ; b < v->nBlocks ; ++b)
+    { U8 t[4] ;
+      U64 inSize = v->zoff[b+1] - v->zoff[b] ;
+      if (inSize < 18 || pread (v->fd, t, 4, v->zoff[b+1] - 4) != 4)
+	{ warn ("ignoring VGPzip index for %s - bad block %lld", filename, b) ;
+	  vziClose (v) ; return 0 ;
+	}
+      U64 outSize = t[0] | (t[1] << 8) | (t[2] << 16) | ((U32)t[3] << 24) ;
+      v->uoff[b+1] = v->uoff[b] + outSize ;
+      if (inSize > maxIn) maxIn = inSize ;
+      if (outSize > maxOut) maxOut = outSize ;
+    }
+
+  v->nThreads = nThreads ;
+  v->nSlots = nThreads ? 2*nThreads : 1 ;
+  if (v->nSlots > v->nBlocks) v->nSlots = v->nBlocks ;
+  v->slots = new0 (v->nSlots, VziSlot) ;
+  int i ;
+  for (i = 0 ; i < v->nSlots ; ++i)
+    { v->slots[i].block = -1 ;
+      v->slots[i].in = new (maxIn, U8) ;
+      v->slots[i].out = new (maxOut, char) ;
+    }
+  pthread_mutex_init (&v->lock, 0) ;
+  pthread_cond_init (&v->filled, 0) ;
+  pthread_cond_init (&v->freed, 0) ;
+  if (nThreads)
+    { v->threads = new (nThreads, pthread_t) ;
+      for (i = 0 ; i < nThreads ; ++i)
+	pthread_create (&v->threads[i], 0, vziThread, v) ;
+    }
+  else if (inflateInit2 (&v->z, 16+MAX_WBITS) != Z_OK)
+    die ("inflateInit2 failed") ;
+  return v ;
+}
+
+U64 vziSize (Vzi *v) { return v->uoff[v->nBlocks] ; }
+
+bool vziSeek (Vzi *v, U64 offset)
+{
+  if (offset > v->uoff[v->nBlocks]) return false ;
+  I64 b0 = 0, b1 = v->nBlocks ;	/* find b with uoff[b] <= offset < uoff[b+1] */
+  while (b1 > b0 + 1)
+    { I64 b = (b0 + b1) / 2 ;
+      if (v->uoff[b] <= offset) b0 = b ; else b1 = b ;
+    }
+  if (offset == v->uoff[v->nBlocks]) b0 = v->nBlocks ;
+  pthread_mutex_lock (&v->lock) ;
+  if (b0 < v->readBlock || b0 > v->nextClaim) v->nextClaim = b0 ; /* else blocks are claimed */
+  v->readBlock = b0 ;
+  v->readPos = offset - v->uoff[b0] ;
+  pthread_cond_broadcast (&v->freed) ;
+  pthread_mutex_unlock (&v->lock) ;
+  return true ;
+}
+
+U64 vziRead (Vzi *v, void *buf, U64 n)
+{
+  U64 nRead = 0 ;
+  while (nRead < n && v->readBlock < v->nBlocks)
+    { VziSlot *s = &v->slots[v->readBlock % v->nSlots] ;
+      if (!v->nThreads)
+	{ if (s->block != v->readBlock)
+	    { blockInflate (v, v->readBlock, s, &v->z) ; s->block = v->readBlock ; }
+	}
+      else
+	{ pthread_mutex_lock (&v->lock) ;
+	  while (!(s->block == v->readBlock && s->isReady))
+	    pthread_cond_wait (&v->filled, &v->lock) ;
+	  pthread_mutex_unlock (&v->lock) ;
+	}
+      U64 size = v->uoff[v->readBlock+1] - v->uoff[v->readBlock] ;
+      U64 k = size - v->readPos ;
+      if (k > n - nRead) k = n - nRead ;
+      memcpy ((char*) buf + nRead, s->out + v->readPos, k) ;
+      nRead += k ; v->readPos += k ;
+      if (v->readPos == size)
+	{ pthread_mutex_lock (&v->lock) ;
+	  ++v->readBlock ; v->readPos = 0 ;
+	  pthread_cond_broadcast (&v->freed) ;
+	  pthread_mutex_unlock (&v->lock) ;
+	}
+    }
+  return nRead ;
+}
+
+void vziClose (Vzi *v)
+{
+  int i ;
+  if (v->slots)
+    { pthread_mutex_lock (&v->lock) ;
+      v->isStop = true ;
+      pthread_cond_broadcast (&v->freed) ;
+      pthread_mutex_unlock (&v->lock) ;
+      for (i = 0 ; i < v->nThreads ; ++i) pthread_join (v->threads[i], 0) ;
+      if (v->nThreads) free (v->threads) ; else inflateEnd (&v->z) ;
+      for (i = 0 ; i < v->nSlots ; ++i) { free (v->slots[i].in) ; free (v->slots[i].out) ; }
+      free (v->slots) ;
+      pthread_mutex_destroy (&v->lock) ;
+      pthread_cond_destroy (&v->filled) ;
+      pthread_cond_destroy (&v->freed) ;
+    }
+  if (v->fd >= 0) close (v->fd) ;
+  if (v->zoff) free (v->zoff) ;
+  if (v->uoff) free (v->uoff) ;
+  free (v) ;
+}
+
+/****************** end of file *****************/
@@ -0,0 +1,26 @@
+/*  File: vzi.h
+ *-------------------------------------------------------------------
+ * Description: random access reader for VGPzip files, i.e. gzip files made of independent
+ *   blocks with a .vzi index of compressed block end offsets: x.gz is indexed by x.vzi
+ * Exported functions: see below
+ *-------------------------------------------------------------------
+ */
+
+#ifndef VZI_DEFINED
+#define VZI_DEFINED
+
+#include "utils.h"
+
+typedef struct VziStruct Vzi ;
+
+Vzi  *vziOpen (char *filename, int nThreads) ;
+	/* returns 0 if filename does not end .gz or there is no valid matching .vzi index */
+	/* nThreads workers inflate blocks ahead of the reader; 0 inflates in vziRead() */
+U64   vziSize (Vzi *v) ;		 /* total uncompressed size */
+bool  vziSeek (Vzi *v, U64 offset) ;	 /* to uncompressed offset; false if beyond the end */
+U64   vziRead (Vzi *v, void *buf, U64 n) ; /* returns number of bytes read, 0 at end */
+void  vziClose (Vzi *v) ;
+
+#endif	/* VZI_DEFINED */
+
+/******************************************************************/
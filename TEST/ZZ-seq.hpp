@@ -0,0 +1,65 @@
+// generated by ONEhpp from TEST/ZZ-seq.schema - do not edit
+
+#include "ONElib.hpp"
+
+namespace ONE_seq {
+
+static const char *schemaText =
+  "P 3 seq\n"
+  "O S 1 3 DNA             sequence: the DNA string\n"
+  "D I 1 6 STRING          id: (optional) sequence identifier\n"
+  ;
+
+struct S	// sequence: the DNA string
+{ static constexpr char lineType = 'S' ;
+  static constexpr int  nField = 1 ;
+  string_view sequence ;
+
+  static S read (C_1F::OneFile *of)
+  { S r ;
+    r.sequence = string_view ((char*) C_1F::_oneList (of), of->field[0].len & 0xffffffffffffffll) ;
+    return r ;
+  }
+
+  void write (C_1F::OneFile *of) const
+  { C_1F::oneWriteLine (of, 'S', sequence.size(), (void*) sequence.data()) ;
+  }
+} ;
+
+struct I	// id: (optional) sequence identifier
+{ static constexpr char lineType = 'I' ;
+  static constexpr int  nField = 1 ;
+  string_view id ;
+
+  static I read (C_1F::OneFile *of)
+  { I r ;
+    r.id = string_view ((char*) C_1F::_oneList (of), of->field[0].len & 0xffffffffffffffll) ;
+    return r ;
+  }
+
+  void write (C_1F::OneFile *of) const
+  { C_1F::oneWriteLine (of, 'I', id.size(), (void*) id.data()) ;
+  }
+} ;
+
+class File : public ONEfile
+{
+ public:
+  static const ONEschema &schema () { static ONEschema s (schemaText) ; return s ; }
+
+  File (const string &path, int nThreads = 1) // read, failing if the layout differs
+    : ONEfile (path, "r", schema(), "seq", nThreads) { }
+  File (const string &path, bool isBinary, int nThreads) // write
+    : ONEfile (path, isBinary ? "wb" : "w", schema(), "seq", nThreads) { }
+
+  template <class R> R    read () // the current line, which must be of type R
+  { if (lineType() != R::lineType)
+      throw runtime_error (string("reading ") + (lineType() ? string(1,lineType()) : "end of data")
+                           + " as line type " + R::lineType) ;
+    return R::read (handle()) ;
+  }
+  template <class R> void write (const R &r) { r.write (handle()) ; }
+} ;
+
+} // namespace ONE_seq
+
@@ -0,0 +1,455 @@
+/*  File: bench.c
+ *-------------------------------------------------------------------
+ * Description: benchmarks for ONElib - run by "make bench"
+ *   Synthetic seq, aln and rmp files are written and read back as ASCII and binary, with
+ *   and without threads, and the codec, DNA packing and INT_LIST compaction routines are
+ *   timed on their own.  Data come from a pool of objects made in advance, so that making
+ *   them is not timed.  Results are written as JSON, one record per measurement, taking
+ *   the fastest of -R repeats.  ONElib.c is included rather than linked so that the
+ *   static internals can be timed directly; it is compiled with the same flags as the
+ *   library.
+ * Exported functions:
+ *-------------------------------------------------------------------
+ */
+
+#include "ONElib.c"
+#include <stdint.h>
+
+typedef struct {
+  char       *name ;
+  char       *schemaText ;
+  char        objType ;
+} BenchSchema ;
+
+static BenchSchema schemas[] = {
+  { "seq", "P 3 seq\n"
+           "O S 1 3 DNA                  sequence: the DNA string\n"
+           "D I 1 6 STRING               id: sequence identifier\n"
+           "D Q 1 6 STRING               quality: Q values (ascii string = q+33)\n", 'S' },
+  { "aln", "P 3 aln\n"
+           "O A 6 3 INT 3 INT 3 INT 3 INT 3 INT 3 INT  alignment: a, start, end, b, start, end\n"
+           "D D 1 3 INT                  differences: number of diffs\n"
+           "D T 1 8 INT_LIST             trace points in b\n"
+           "D X 1 8 INT_LIST             number of differences per trace panel\n", 'A' },
+  { "rmp", "P 3 rmp\n"
+           "O R 2 3 INT 8 INT_LIST       map: length, site locations\n"
+           "D E 1 8 INT_LIST             enzyme: index of the enzyme for each site\n"
+           "D I 1 9 REAL_LIST            intensities: signal for each site\n", 'R' },
+  { 0, 0, 0 }
+} ;
+
+/**************** pool of synthetic objects ******************/
+
+typedef struct {
+  char      t ;
+  OneField  field[6] ;
+  I64       len ;
+  void     *list ;
+} PoolLine ;
+
+typedef struct {
+  int       nObj ;
+  I64      *start ;		/* lines of object i are line[start[i]..start[i+1]) */
+  PoolLine *line ;
+  I64       nLine, maxLine ;
+} Pool ;
+
+static uint64_t rngState = 0x9e3779b97f4a7c15ULL ;
+
+static inline uint64_t rng (void)	/* xorshift64* */
+{ rngState ^= rngState >> 12 ; rngState ^= rngState << 25 ; rngState ^= rngState >> 27 ;
+  return rngState * 0x2545f4914f6cdd1dULL ;
+}
+
+static PoolLine *poolAdd (Pool *p, char t, I64 len, I64 eltSize)
+{
+  if (p->nLine == p->maxLine)
+    { I64 old = p->maxLine ;
+      p->maxLine = old ? 2*old : 1024 ;
+      resize (p->line, old, p->maxLine, PoolLine) ;
+    }
+  PoolLine *pl = &p->line[p->nLine++] ;
+  memset (pl, 0, sizeof(PoolLine)) ;
+  pl->t = t ; pl->len = len ;
+  if (len) pl->list = myalloc (len*eltSize + 1) ;
+  return pl ;
+}
+
+static Pool *poolCreate (BenchSchema *bs, int nObj, int seqLen)
+{
+  Pool *p = new0 (1, Pool) ;
+  int   i ;
+  I64   j, len ;
+
+  p->nObj = nObj ;
+  p->start = new (nObj+1, I64) ;
+  for (i = 0 ; i < nObj ; ++i)
+    { p->start[i] = p->nLine ;
+      len = seqLen/2 + rng() % seqLen + 1 ;
+      if (bs->objType == 'S')
+	{ char *s = (char*) poolAdd (p, 'S', len, 1)->list ;
+	  for (j = 0 ; j < len ; ++j) s[j] = "acgt"[rng() & 3] ;
+	  PoolLine *pl = poolAdd (p, 'I', 0, 1) ;
+	  pl->list = myalloc (32) ; pl->len = sprintf ((char*) pl->list, "read%d", i) ;
+	  char *q = (char*) poolAdd (p, 'Q', len, 1)->list ;
+	  for (j = 0 ; j < len ; ++j)	/* mostly high qualities, as from a sequencer */
+	    { uint64_t r = rng() ; q[j] = 33 + ((r & 7) ? 30 + (r >> 8) % 11 : (r >> 8) % 30) ; }
+	}
+      else if (bs->objType == 'A')
+	{ PoolLine *pl = poolAdd (p, 'A', 0, 0) ;
+	  I64 aStart = rng() % 1000000, bStart = rng() % 1000000 ;
+	  pl->field[0].i = rng() % 100000 ; pl->field[1].i = aStart ; pl->field[2].i = aStart + len ;
+	  pl->field[3].i = rng() % 100000 ; pl->field[4].i = bStart ; pl->field[5].i = bStart + len ;
+	  pl = poolAdd (p, 'D', 0, 0) ; pl->field[0].i = len / 10 ;
+	  I64 nT = len/100 + 1, *tp = (I64*) poolAdd (p, 'T', nT, sizeof(I64))->list ;
+	  for (j = 0 ; j < nT ; ++j) tp[j] = bStart + 100*j + rng() % 20 ;
+	  I64 *xp = (I64*) poolAdd (p, 'X', nT, sizeof(I64))->list ;
+	  for (j = 0 ; j < nT ; ++j) xp[j] = rng() % 16 ;
+	}
+      else			/* restriction map with a site every ~5kb of a ~50x longer molecule */
+	{ I64 nS = len/100 + 1 ;
+	  PoolLine *pl = poolAdd (p, 'R', nS, sizeof(I64)) ;
+	  I64 *sp = (I64*) pl->list, x = 0 ;
+	  for (j = 0 ; j < nS ; ++j) sp[j] = (x += 1 + rng() % 10000) ;
+	  pl->field[0].i = x + rng() % 10000 ;
+	  I64 *ep = (I64*) poolAdd (p, 'E', nS, sizeof(I64))->list ;
+	  for (j = 0 ; j < nS ; ++j) ep[j] = rng() % 3 ;
+	  double *dp = (double*) poolAdd (p, 'I', nS, sizeof(double))->list ;
+	  for (j = 0 ; j < nS ; ++j) dp[j] = (rng() % 100000) / 1000.0 ;
+	}
+    }
+  p->start[nObj] = p->nLine ;
+  return p ;
+}
+
+static void poolDestroy (Pool *p)
+{ I64 i ;
+  for (i = 0 ; i < p->nLine ; ++i) if (p->line[i].list) free (p->line[i].list) ;
+  free (p->line) ; free (p->start) ; free (p) ;
+}
+
+static inline void poolWriteObject (OneFile *vf, Pool *p, I64 i)
+{ I64 j ;
+  i %= p->nObj ;
+  for (j = p->start[i] ; j < p->start[i+1] ; ++j)
+    { PoolLine *pl = &p->line[j] ;
+      memcpy (vf->field, pl->field, vf->info[(int)pl->t]->nField * sizeof(OneField)) ;
+      oneWriteLine (vf, pl->t, pl->len, pl->list) ;
+    }
+}
+
+/**************** timing and output ******************/
+
+static FILE *out ;
+static int   nResult = 0 ;
+static int   nRepeat = 1 ;
+
+static double clockNow (void)
+{ struct timespec t ; clock_gettime (CLOCK_MONOTONIC, &t) ; return t.tv_sec + 1e-9*t.tv_nsec ; }
+
+static void report (char *bench, char *schema, int nThreads, I64 items, I64 bytes, double secs)
+{
+  fprintf (out, "%s\n    {\"bench\": \"%s\", \"schema\": \"%s\", \"threads\": %d, \"items\": %lld, "
+	   "\"bytes\": %lld, \"seconds\": %.6f, \"MBps\": %.2f, \"us_per_item\": %.4f}",
+	   nResult++ ? "," : "", bench, schema ? schema : "", nThreads, items, bytes, secs,
+	   secs > 0 ? bytes / secs / 1e6 : 0., items ? 1e6 * secs / items : 0.) ;
+  fprintf (stderr, "%-18s %-4s T=%-2d %10lld items %12lld bytes %9.3f s %9.1f MB/s\n",
+	   bench, schema ? schema : "", nThreads, items, bytes, secs,
+	   secs > 0 ? bytes / secs / 1e6 : 0.) ;
+}
+
+static I64 fileSize (char *path)
+{ struct stat st ; return stat (path, &st) ? 0 : st.st_size ; }
+
+/**************** file benchmarks ******************/
+
+typedef struct {
+  OneFile *vf ;
+  Pool    *p ;
+  char     objType ;
+  I64      i0, iN ;		/* objects [i0,iN), counting from 1 for oneGoto() */
+} Job ;
+
+static void *writeThread (void *arg)
+{ Job *job = (Job*) arg ;
+  I64  i ;
+  for (i = job->i0 ; i < job->iN ; ++i) poolWriteObject (job->vf, job->p, i) ;
+  return 0 ;
+}
+
+static void *readThread (void *arg)
+{ Job     *job = (Job*) arg ;
+  OneFile *vf = job->vf ;
+  OneInfo *li = vf->info[(int)job->objType] ;
+  if (job->i0 >= job->iN) return 0 ;
+  if (!oneGoto (vf, job->objType, job->i0)) die ("goto %lld failed", job->i0) ;
+  while (oneReadLine (vf))
+    { if (vf->lineType == job->objType && li->accum.count >= job->iN) break ;
+      if (vf->info[(int)vf->lineType]->listEltSize) _oneList (vf) ;
+    }
+  return 0 ;
+}
+
+static double writeFile (char *path, OneSchema *vs, BenchSchema *bs, Pool *p, I64 n,
+			 bool isBinary, int nThreads)
+{ double    t0 = clockNow () ;
+  OneFile  *vf = oneFileOpenWriteNew (path, vs, bs->name, isBinary, nThreads) ;
+  pthread_t threads[nThreads] ;
+  Job       job[nThreads] ;
+  int       k ;
+
+  if (!vf) die ("failed to open %s to write: %s", path, oneErrorString()) ;
+  for (k = 0 ; k < nThreads ; ++k)
+    { job[k].vf = vf + k ; job[k].p = p ;
+      job[k].i0 = (n * k) / nThreads ; job[k].iN = (n * (k+1)) / nThreads ;
+      pthread_create (&threads[k], 0, writeThread, &job[k]) ;
+    }
+  for (k = 0 ; k < nThreads ; ++k) pthread_join (threads[k], 0) ;
+  oneFileClose (vf) ;
+  return clockNow () - t0 ;
+}
+
+static double readFile (char *path, BenchSchema *bs, int nThreads)
+{ double    t0 = clockNow () ;
+  OneFile  *vf = oneFileOpenRead (path, 0, bs->name, nThreads) ;
+  int       k ;
+
+  if (!vf) die ("failed to open %s to read: %s", path, oneErrorString()) ;
+  if (nThreads == 1) 		/* a plain pass, as for ASCII files */
+    { while (oneReadLine (vf))
+	if (vf->info[(int)vf->lineType]->listEltSize) _oneList (vf) ;
+    }
+  else
+    { pthread_t threads[nThreads] ;
+      Job       job[nThreads] ;
+      I64       n = vf->info[(int)bs->objType]->given.count ;
+      for (k = 0 ; k < nThreads ; ++k)
+	{ job[k].vf = vf + k ; job[k].objType = bs->objType ;
+	  job[k].i0 = 1 + (n * k) / nThreads ; job[k].iN = 1 + (n * (k+1)) / nThreads ;
+	  pthread_create (&threads[k], 0, readThread, &job[k]) ;
+	}
+      for (k = 0 ; k < nThreads ; ++k) pthread_join (threads[k], 0) ;
+    }
+  oneFileClose (vf) ;
+  return clockNow () - t0 ;
+}
+
+static double gotoFile (char *path, BenchSchema *bs, I64 nGoto)
+{ OneFile  *vf = oneFileOpenRead (path, 0, bs->name, 1) ;
+  I64       i, n ;
+  double    t0 ;
+
+  if (!vf) die ("failed to open %s to read: %s", path, oneErrorString()) ;
+  n = vf->info[(int)bs->objType]->given.count ;
+  t0 = clockNow () ;
+  for (i = 0 ; i < nGoto ; ++i)
+    if (!oneGoto (vf, bs->objType, 1 + rng() % n) || !oneReadLine (vf))
+      die ("goto failed in %s", path) ;
+  t0 = clockNow () - t0 ;
+  oneFileClose (vf) ;
+  return t0 ;
+}
+
+#define BEST(t,X) { int r ; t = 1e30 ; for (r = 0 ; r < nRepeat ; ++r) { double x = (X) ; if (x < t) t = x ; } }
+
+static void benchFiles (BenchSchema *bs, Pool *p, I64 n, int maxThreads, char *dir)
+{
+  OneSchema *vs = oneSchemaCreateFromText (bs->schemaText) ;
+  char       binPath[1024], ascPath[1024] ;
+  double     t ;
+  int        k ;
+
+  snprintf (binPath, 1024, "%s/ONEbench-%d.1%s", dir, (int) getpid(), bs->name) ;
+  snprintf (ascPath, 1024, "%s/ONEbench-%d-ascii.1%s", dir, (int) getpid(), bs->name) ;
+
+  BEST (t, writeFile (ascPath, vs, bs, p, n, false, 1)) ;
+  report ("write_ascii", bs->name, 1, n, fileSize (ascPath), t) ;
+  BEST (t, readFile (ascPath, bs, 1)) ;
+  report ("parse_ascii", bs->name, 1, n, fileSize (ascPath), t) ;
+  unlink (ascPath) ;
+
+  for (k = 1 ; k <= maxThreads ; k = (k < maxThreads && 2*k > maxThreads) ? maxThreads : 2*k)
+    { BEST (t, writeFile (binPath, vs, bs, p, n, true, k)) ;
+      report ("write_binary", bs->name, k, n, fileSize (binPath), t) ;
+    }
+  for (k = 1 ; k <= maxThreads ; k = (k < maxThreads && 2*k > maxThreads) ? maxThreads : 2*k)
+    { BEST (t, readFile (binPath, bs, k)) ;
+      report ("read_binary", bs->name, k, n, fileSize (binPath), t) ;
+    }
+
+  I64 nGoto = n < 10000 ? n : 10000 ;
+  BEST (t, gotoFile (binPath, bs, nGoto)) ;
+  report ("goto", bs->name, 1, nGoto, 0, t) ;
+
+  unlink (binPath) ;
+  oneSchemaDestroy (vs) ;
+}
+
+/**************** internal routine benchmarks ******************/
+
+static double huffman (Pool *p, I64 n, bool isDecode, I64 *bytes)
+{ OneCodec *vc = vcCreate () ;
+  char     *buf = 0, *dec = 0 ;
+  I64       i, j, bufSize = 0 ;
+  int       nBits ;
+  double    t, tDecode = 0 ;
+
+  for (i = 0 ; i < p->nLine ; ++i)	/* train on the quality strings */
+    if (p->line[i].t == 'Q') vcAddToTable (vc, p->line[i].len, (char*) p->line[i].list) ;
+  vcCreateCodec (vc, 0) ;
+  for (i = 0 ; i < p->nLine ; ++i) if (p->line[i].len > bufSize) bufSize = p->line[i].len ;
+  buf = new (2*bufSize + 16, char) ; dec = new (bufSize + 16, char) ;
+
+  *bytes = 0 ;
+  t = clockNow () ;
+  for (i = 0 ; i < n ; ++i)
+    for (j = p->start[i % p->nObj] ; j < p->start[i % p->nObj + 1] ; ++j)
+      if (p->line[j].t == 'Q')
+	{ nBits = vcEncode (vc, p->line[j].len, (char*) p->line[j].list, buf) ;
+	  if (isDecode)
+	    { double t1 = clockNow () ;
+	      vcDecode (vc, nBits, buf, dec) ;
+	      tDecode += clockNow () - t1 ;
+	    }
+	  *bytes += p->line[j].len ;
+	}
+  t = clockNow () - t - tDecode ;
+  vcDestroy (vc) ; free (buf) ; free (dec) ;
+  return isDecode ? tDecode : t ;
+}
+
+static double dnaPack (Pool *p, I64 n, bool isUnpack, I64 *bytes)
+{ I64    i, j, maxLen = 0 ;
+  char  *packed, *unpacked ;
+  double t, tUnpack = 0 ;
+
+  for (i = 0 ; i < p->nLine ; ++i) if (p->line[i].len > maxLen) maxLen = p->line[i].len ;
+  packed = new (maxLen/4 + 8, char) ; unpacked = new (maxLen + 8, char) ;
+  *bytes = 0 ;
+  t = clockNow () ;
+  for (i = 0 ; i < n ; ++i)
+    for (j = p->start[i % p->nObj] ; j < p->start[i % p->nObj + 1] ; ++j)
+      if (p->line[j].t == 'S')
+	{ Compress_DNA (p->line[j].len, (char*) p->line[j].list, packed) ;
+	  if (isUnpack)
+	    { double t1 = clockNow () ;
+	      Uncompress_DNA (packed, p->line[j].len, unpacked) ;
+	      tUnpack += clockNow () - t1 ;
+	    }
+	  *bytes += p->line[j].len ;
+	}
+  t = clockNow () - t - tUnpack ;
+  free (packed) ; free (unpacked) ;
+  return isUnpack ? tUnpack : t ;
+}
+
+static double intList (Pool *p, I64 n, bool isDecompact, I64 *bytes)
+{ OneFile  vf ;
+  OneInfo  li ;
+  I64      i, j, maxLen = 0 ;
+  char    *work ;
+  int      used ;
+  double   t, tDecompact = 0 ;
+
+  memset (&vf, 0, sizeof(OneFile)) ; memset (&li, 0, sizeof(OneInfo)) ;
+  { int x = 1 ; vf.isBig = (*(char*)&x == 0) ; }
+  for (i = 0 ; i < p->nLine ; ++i) if (p->line[i].len > maxLen) maxLen = p->line[i].len ;
+  li.bufSize = maxLen + 1 ; li.buffer = new (li.bufSize, I64) ; /* big enough never to grow */
+  work = (char*) new (maxLen + 1, I64) ;
+  *bytes = 0 ;
+  t = clockNow () ;
+  for (i = 0 ; i < n ; ++i)
+    for (j = p->start[i % p->nObj] ; j < p->start[i % p->nObj + 1] ; ++j)
+      if (p->line[j].t == 'T' || p->line[j].t == 'X' || p->line[j].t == 'R' || p->line[j].t == 'E')
+	{ I64 len = p->line[j].len ;
+	  char *c = compactIntList (&vf, &li, len, (char*) p->line[j].list, &used) ;
+	  if (isDecompact)		/* as after a read: first element, then the compacted bytes */
+	    { double t1 = clockNow () ;
+	      *(I64*) work = *(I64*) p->line[j].list ;
+	      memcpy (work + sizeof(I64), c, (len-1)*used) ;
+	      decompactIntList (&vf, len, work, used) ;
+	      tDecompact += clockNow () - t1 ;
+	    }
+	  *bytes += len * sizeof(I64) ;
+	}
+  t = clockNow () - t - tDecompact ;
+  free (li.buffer) ; free (work) ;
+  return isDecompact ? tDecompact : t ;
+}
+
+static void benchInternals (Pool *seqPool, Pool *alnPool, I64 n)
+{ I64    bytes ;
+  double t ;
+  BEST (t, huffman (seqPool, n, false, &bytes)) ; report ("huffman_encode", "seq", 1, n, bytes, t) ;
+  BEST (t, huffman (seqPool, n, true, &bytes)) ;  report ("huffman_decode", "seq", 1, n, bytes, t) ;
+  BEST (t, dnaPack (seqPool, n, false, &bytes)) ; report ("dna_pack", "seq", 1, n, bytes, t) ;
+  BEST (t, dnaPack (seqPool, n, true, &bytes)) ;  report ("dna_unpack", "seq", 1, n, bytes, t) ;
+  BEST (t, intList (alnPool, n, false, &bytes)) ; report ("intlist_compact", "aln", 1, n, bytes, t) ;
+  BEST (t, intList (alnPool, n, true, &bytes)) ;  report ("intlist_decompact", "aln", 1, n, bytes, t) ;
+}
+
+/**************** main ******************/
+
+int main (int argc, char **argv)
+{
+  I64   n = 100000 ;
+  int   seqLen = 1000, maxThreads = 4, poolSize = 4096 ;
+  char *outFileName = "-", *dir = "/tmp", *which = "seq,aln,rmp" ;
+
+  --argc ; ++argv ;		/* drop the program name */
+  while (argc && **argv == '-')
+    if ((!strcmp (*argv, "-n") || !strcmp (*argv, "--objects")) && argc >= 2)
+      { n = atoll (argv[1]) ; argc -= 2 ; argv += 2 ; }
+    else if ((!strcmp (*argv, "-L") || !strcmp (*argv, "--length")) && argc >= 2)
+      { seqLen = atoi (argv[1]) ; argc -= 2 ; argv += 2 ; }
+    else if ((!strcmp (*argv, "-T") || !strcmp (*argv, "--threads")) && argc >= 2)
+      { maxThreads = atoi (argv[1]) ; argc -= 2 ; argv += 2 ; }
+    else if ((!strcmp (*argv, "-R") || !strcmp (*argv, "--repeats")) && argc >= 2)
+      { nRepeat = atoi (argv[1]) ; argc -= 2 ; argv += 2 ; }
+    else if ((!strcmp (*argv, "-s") || !strcmp (*argv, "--schemas")) && argc >= 2)
+      { which = argv[1] ; argc -= 2 ; argv += 2 ; }
+    else if ((!strcmp (*argv, "-d") || !strcmp (*argv, "--dir")) && argc >= 2)
+      { dir = argv[1] ; argc -= 2 ; argv += 2 ; }
+    else if ((!strcmp (*argv, "-o") || !strcmp (*argv, "--output")) && argc >= 2)
+      { outFileName = argv[1] ; argc -= 2 ; argv += 2 ; }
+    else
+      { fprintf (stderr, "ONEbench [options]\n") ;
+	fprintf (stderr, "  -n --objects <n>      objects per schema [%lld]\n", n) ;
+	fprintf (stderr, "  -L --length <n>       mean sequence/alignment length [%d]\n", seqLen) ;
+	fprintf (stderr, "  -T --threads <n>      maximum threads, from 1 in powers of 2 [%d]\n", maxThreads) ;
+	fprintf (stderr, "  -R --repeats <n>      report the fastest of n repeats [%d]\n", nRepeat) ;
+	fprintf (stderr, "  -s --schemas <list>   comma separated from seq,aln,rmp [%s]\n", which) ;
+	fprintf (stderr, "  -d --dir <dir>        directory for temporary files [%s]\n", dir) ;
+	fprintf (stderr, "  -o --output <file>    JSON results [stdout]; a summary goes to stderr\n") ;
+	exit (strcmp (*argv, "-h") ? 1 : 0) ;
+      }
+  if (argc) die ("unexpected argument %s - run with -h to see options", *argv) ;
+  if (n < 1 || seqLen < 1 || maxThreads < 1 || nRepeat < 1) die ("arguments must be positive") ;
+  if (n < poolSize) poolSize = n ;
+
+  out = strcmp (outFileName, "-") ? fopen (outFileName, "w") : stdout ;
+  if (!out) die ("failed to open output file %s", outFileName) ;
+  fprintf (out, "{\n  \"onelib\": \"%d.%d\", \"objects\": %lld, \"length\": %d, \"repeats\": %d,\n"
+	   "  \"results\": [", MAJOR, MINOR, n, seqLen, nRepeat) ;
+
+  BenchSchema *bs ;
+  Pool *seqPool = 0, *alnPool = 0 ;
+  for (bs = schemas ; bs->name ; ++bs)
+    if (strstr (which, bs->name))
+      { Pool *p = poolCreate (bs, poolSize, seqLen) ;
+	benchFiles (bs, p, n, maxThreads, dir) ;
+	if (bs->objType == 'S') seqPool = p ;
+	else if (bs->objType == 'A') alnPool = p ;
+	else poolDestroy (p) ;
+      }
+  if (!seqPool) seqPool = poolCreate (&schemas[0], poolSize, seqLen) ;
+  if (!alnPool) alnPool = poolCreate (&schemas[1], poolSize, seqLen) ;
+  benchInternals (seqPool, alnPool, n) ;
+  poolDestroy (seqPool) ; poolDestroy (alnPool) ;
+
+  fprintf (out, "\n  ]\n}\n") ;
+  if (out != stdout) fclose (out) ;
+  return 0 ;
+}
+
+/********************* end of file ***********************/
@@ -0,0 +1,73 @@
+/*  File: buftest.c
+ *-------------------------------------------------------------------
+ * Description: round trip through the OneIO and memory buffer interfaces - run by "make test"
+ *   Reads a seq file through OneIO callbacks on a FILE*, writes it as a binary image in
+ *   memory with two threads, the second half of the objects going to the slave, then reads
+ *   the image back with oneFileOpenReadBuffer() and writes it to a file, so that the result
+ *   can be compared with the input by ONEview.
+ *   Usage: ONEbuftest <in.1seq> <out.1seq>
+ *-------------------------------------------------------------------
+ */
+
+#include "ONElib.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static char *seqSchemaText =
+  "P 3 seq\n"
+  "O S 1 3 DNA                  sequence: the DNA string\n"
+  "D I 1 6 STRING               id: (optional) sequence identifier\n" ;
+
+static I64 fileRead (void *h, void *buf, I64 n) { return fread (buf, 1, n, (FILE*) h) ; }
+static int fileSeek (void *h, I64 off, int whence) { return fseeko ((FILE*) h, off, whence) ; }
+static I64 fileTell (void *h) { return ftello ((FILE*) h) ; }
+static int fileClose (void *h) { return fclose ((FILE*) h) ; }
+
+static void fail (char *message)
+{ fprintf (stderr, "buftest failed: %s: %s\n", message, oneErrorString ()) ;
+  exit (1) ;
+}
+
+int main (int argc, char **argv)
+{
+  OneIO      io = { fileRead, 0, fileSeek, fileTell, 0, fileClose } ;
+  OneSchema *vs ;
+  OneFile   *vfIn, *vfBuf, *vfOut ;
+  FILE      *f ;
+  void      *buf = 0 ;
+  size_t     size = 0 ;
+  I64        nLines = 0, nCopied = 0 ;
+
+  if (argc != 3) { fprintf (stderr, "usage: ONEbuftest <in.1seq> <out.1seq>\n") ; exit (1) ; }
+  if (!(vs = oneSchemaCreateFromText (seqSchemaText))) fail ("schema") ;
+
+  if (!(f = fopen (argv[1], "r"))) fail ("can't open input") ;
+  if (!(vfIn = oneFileOpenReadIO (&io, f, vs, "seq", 1))) fail ("oneFileOpenReadIO") ;
+  if (!(vfBuf = oneFileOpenWriteBuffer (&buf, &size, vs, "seq", true, 2)))
+    fail ("oneFileOpenWriteBuffer") ;
+  I64 half = vfIn->info['S']->given.count / 2 ;
+  while (oneReadLine (vfIn))
+    { OneFile *vf = vfIn->info['S']->accum.count > half ? vfBuf+1 : vfBuf ;
+      oneWriteLineFrom (vf, vfIn) ;
+      ++nLines ;
+    }
+  oneFileClose (vfIn) ;		/* closes f through io.close */
+  oneFileClose (vfBuf) ;
+  if (!buf || !size) fail ("empty buffer") ;
+
+  if (!(vfBuf = oneFileOpenReadBuffer (buf, size, vs, "seq", 1))) fail ("oneFileOpenReadBuffer") ;
+  if (!(vfOut = oneFileOpenWriteFrom (argv[2], vfBuf, true, 1))) fail ("can't open output") ;
+  while (oneReadLine (vfBuf))
+    { oneWriteLineFrom (vfOut, vfBuf) ;
+      ++nCopied ;
+    }
+  oneFileClose (vfBuf) ;
+  oneFileClose (vfOut) ;
+  free (buf) ;
+  oneSchemaDestroy (vs) ;
+
+  if (nCopied != nLines) { fprintf (stderr, "buftest: %lld lines in, %lld out\n", nLines, nCopied) ; exit (1) ; }
+  printf ("buftest: %lld lines through a %lld byte buffer\n", nLines, (I64) size) ;
+  return 0 ;
+}
@@ -0,0 +1,46 @@
+/*  File: hpptest.cpp
+ *-------------------------------------------------------------------
+ * Description: test of the typed records made by ONEhpp - run by "make hpptest"
+ *   copies a seq file through ONE_seq::S and ONE_seq::I, reversing each sequence
+ * Exported functions:
+ *-------------------------------------------------------------------
+ */
+
+#include "ZZ-seq.hpp"		// made by ONEhpp from the schema of TEST/ZZ-small.1seq
+#include <iostream>
+#include <algorithm>
+
+int main (int argc, char *argv[])
+{
+  if (argc != 3) { cerr << "usage: ONEhpptest <in.1seq> <out.1seq>\n" ; return 1 ; }
+
+  try
+    { ONE_seq::File in (argv[1]) ;
+      ONE_seq::File out (argv[2], true, 1) ;
+      out.inheritProvenance (in) ;
+      out.addProvenance ("ONEhpptest", "1.0", "reverse sequences") ;
+
+      int64_t nSeq = 0, totLen = 0 ;
+      string  rev ;
+      while (in.readLine ())
+	if (in.lineType () == ONE_seq::S::lineType)
+	  { ONE_seq::S s = in.read<ONE_seq::S> () ;
+	    rev.assign (s.sequence.rbegin(), s.sequence.rend()) ;
+	    ++nSeq ; totLen += s.sequence.size() ;
+	    s.sequence = rev ;
+	    out.write (s) ;
+	  }
+	else if (in.lineType () == ONE_seq::I::lineType)
+	  out.write (in.read<ONE_seq::I> ()) ;
+      cout << nSeq << " sequences total length " << totLen << "\n" ;
+
+      try { in.read<ONE_seq::I> () ; } // at end of file, so the line type is wrong
+      catch (const runtime_error &e) { cout << "expected error: " << e.what() << "\n" ; }
+    }
+  catch (const runtime_error &e)
+    { cerr << "FATAL ERROR: " << e.what() << "\n" ; return 1 ; }
+
+  return 0 ;
+}
+
+/****************** end of file *****************/
@@ -0,0 +1,76 @@
+# smoke test of the Python bindings - run by "make pytest", after "make test" has made the file
+# usage: python3 TEST/pyONEtest.py TEST/ZZ-small.1seq
+
+import sys
+import numpy as np
+import ONEcode
+
+def check(ok, what):
+    if not ok: sys.exit("pyONEtest failed: " + what)
+
+def lines(f):  # line types to the end of the file
+    while True:
+        t = f.readLine()
+        if not t or t == '\0': return
+        yield t
+
+name = sys.argv[1]
+
+f = ONEcode.ONEfile(name)
+cols = f.readColumns('S', 1000000)
+n = f.givenCount('S')
+check(len(cols[0]) == n, "readColumns reads every S line")
+check(cols[0].sum() == f.givenTotal('S') and cols[0].max() == f.givenMax('S'), "S lengths")
+check(len(cols["offsets"]) == n + 1 and np.array_equal(np.diff(cols["offsets"]), cols[0]), "offsets")
+check(len(cols["list"]) == cols[0].sum() and cols["list"].dtype == np.uint8, "list")
+check(len(f.readColumns('S', 10)[0]) == 0, "readColumns at the end of the file")
+
+# line by line, the views must give what readColumns gave, and intList() must refuse DNA
+f = ONEcode.ONEfile(name)
+k = 0
+for t in lines(f):
+    if t != 'S': continue
+    dna = f.charList()
+    check(not dna.flags.writeable, "charList view is read-only")
+    check(np.array_equal(dna, cols["list"][cols["offsets"][k]:cols["offsets"][k+1]]), "charList")
+    try:
+        f.intList()
+        check(False, "intList of a DNA line")
+    except ValueError:
+        pass
+    k += 1
+check(k == n, "readLine reads every S line")
+
+# readColumns masks out other line types while it runs, then restores the caller's mask
+f = ONEcode.ONEfile(name)
+f.readColumns('S', 3)
+check({'S', 'I'} <= set(lines(f)), "no mask after readColumns")
+f = ONEcode.ONEfile(name)
+f.setLineTypeMask('I')
+check(len(f.readColumns('S', 3)[0]) == 3, "readColumns with a mask set by the caller")
+check(set(lines(f)) == {'I'}, "caller's mask restored after readColumns")
+
+# parallelMap with 3 reader threads, each taking a range of objects through the index
+f = ONEcode.ONEfile(name, 3)
+batches = f.parallelMap(lambda b: (b["object"], b[0].copy()), 'S', batchSize=2)
+firsts = [o for o, _ in batches]
+check(firsts[0] == 1 and firsts == sorted(set(firsts)) and len(batches) >= 3, "parallelMap batch objects")
+check(np.array_equal(np.concatenate([x for _, x in batches]), cols[0]), "parallelMap func, in object order")
+check(f.parallelMap("count", 'S') == n, "parallelMap count")
+check(f.parallelMap("count", 'S', 'I') == f.givenCount('I'), "parallelMap count of lines in objects")
+s = f.parallelMap("sum", 'S')
+check(s[0] == f.givenTotal('S') and s["count"] == n, "parallelMap sum")
+h = f.parallelMap("histogram", 'S')
+check(np.array_equal(h, np.bincount(cols[0])), "parallelMap histogram")
+h = f.parallelMap("histogram", 'S', maxBin=10)
+check(len(h) == 11 and h.sum() == n and h[10] == (cols[0] >= 10).sum(), "parallelMap histogram maxBin")
+
+def bad(b): raise KeyError("bad batch")
+try:
+    f.parallelMap(bad, 'S', batchSize=1)
+    check(False, "parallelMap with a func that raises")
+except KeyError:
+    pass
+check(f.parallelMap("count", 'S') == n, "parallelMap after a func raised")
+
+print("pyONEtest: %d S lines, %d bases" % (n, cols[0].sum()))
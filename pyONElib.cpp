@@ -1,15 +1,386 @@
 #include <cstring>
+#include <memory>
+#include <algorithm>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "ONElib.hpp"
 
 #include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
 
 namespace py = pybind11;
 
+// A read-only NumPy array over memory owned by the ONEfile, which is kept alive as its base.
+// Like the C++ accessors it borrows the line buffer, so is only valid until the next readLine().
+
+template <class T>
+static py::array_t<T> listView(py::object file, const T *data, int64_t n) {
+    py::array_t<T> a({(py::ssize_t) n}, {(py::ssize_t) sizeof(T)}, data, file);
+    a.attr("setflags")(py::arg("write") = false); // public API; clearing the flag is always allowed
+    return a;
+}
+
+// An array that owns a vector filled without the GIL, moved into a capsule to avoid a copy.
+
+template <class T>
+static py::array_t<T> vectorArray(std::vector<T> &&v) {
+    auto *p = new std::vector<T>(std::move(v));
+    py::capsule owner(p, [](void *q) { delete static_cast<std::vector<T> *>(q); });
+    return py::array_t<T>({(py::ssize_t) p->size()}, {(py::ssize_t) sizeof(T)}, p->data(), owner);
+}
+
+static C_1F::OneInfo *lineInfo(ONEfile &self, const std::string &lineType) {
+    if (lineType.length() != 1)
+        throw std::invalid_argument("lineType must be a single character");
+    char t = lineType[0];
+    C_1F::OneInfo *li = t > 0 ? self.handle()->info[(int) t] : nullptr;
+    if (!li) throw std::invalid_argument(std::string("unknown line type ") + t);
+    return li;
+}
+
+static void checkList(ONEfile &self, C_1F::OneType type, C_1F::OneType alt = C_1F::oneINT) {
+    C_1F::OneFile *of = self.handle();
+    C_1F::OneInfo *li = of->lineType ? of->info[(int) of->lineType] : nullptr;
+    if (!li || !li->listEltSize ||
+        (li->fieldType[li->listField] != type && li->fieldType[li->listField] != alt))
+        throw std::invalid_argument(std::string("current line has no ") + C_1F::oneTypeString[type]);
+}
+
+// A batch of lines of one type as columns: each field's values, with the list length for the
+// list field, plus the list elements concatenated and n+1 offsets into them.  CHAR and the bytes
+// of STRING, DNA and STRING_LIST (0-terminated strings) are uint8.  Filled without the GIL.
+
+struct Columns {
+    C_1F::OneInfo *li;
+    C_1F::OneType listType;
+    int64_t n = 0, firstObject = 0;
+    std::vector<std::vector<int64_t>> ints;
+    std::vector<std::vector<double>> reals;
+    std::vector<std::vector<uint8_t>> chars;
+    std::vector<int64_t> offsets{0}, intList;
+    std::vector<double> realList;
+    std::vector<uint8_t> byteList;
+
+    Columns(C_1F::OneInfo *info)
+        : li(info), listType(info->listEltSize ? info->fieldType[info->listField] : C_1F::oneINT),
+          ints(info->nField), reals(info->nField), chars(info->nField) {}
+
+    void add(C_1F::OneFile *of) {
+        for (int i = 0; i < li->nField; ++i)
+            switch (li->fieldType[i]) {
+            case C_1F::oneINT: ints[i].push_back(of->field[i].i); break;
+            case C_1F::oneREAL: reals[i].push_back(of->field[i].r); break;
+            case C_1F::oneCHAR: chars[i].push_back(of->field[i].c); break;
+            default: ints[i].push_back(of->field[i].len & 0xffffffffffffffll); break;
+            }
+        ++n;
+        if (!li->listEltSize) return;
+        int64_t len = of->field[li->listField].len & 0xffffffffffffffll;
+        char *p = (char *) C_1F::_oneList(of);
+        switch (listType) {
+        case C_1F::oneINT_LIST:
+            intList.insert(intList.end(), (int64_t *) p, (int64_t *) p + len);
+            offsets.push_back(intList.size());
+            break;
+        case C_1F::oneREAL_LIST:
+            realList.insert(realList.end(), (double *) p, (double *) p + len);
+            offsets.push_back(realList.size());
+            break;
+        case C_1F::oneSTRING_LIST: {
+            char *e = p;
+            for (int64_t j = 0; j < len; ++j) e += strlen(e) + 1;
+            byteList.insert(byteList.end(), p, e);
+            offsets.push_back(byteList.size());
+            break;
+        }
+        default:
+            byteList.insert(byteList.end(), p, p + len);
+            offsets.push_back(byteList.size());
+            break;
+        }
+    }
+
+    py::dict toDict() { // moves the data into the arrays
+        py::dict d;
+        for (int i = 0; i < li->nField; ++i)
+            switch (li->fieldType[i]) {
+            case C_1F::oneREAL: d[py::int_(i)] = vectorArray(std::move(reals[i])); break;
+            case C_1F::oneCHAR: d[py::int_(i)] = vectorArray(std::move(chars[i])); break;
+            default: d[py::int_(i)] = vectorArray(std::move(ints[i])); break;
+            }
+        if (li->listEltSize) {
+            if (listType == C_1F::oneINT_LIST) d["list"] = vectorArray(std::move(intList));
+            else if (listType == C_1F::oneREAL_LIST) d["list"] = vectorArray(std::move(realList));
+            else d["list"] = vectorArray(std::move(byteList));
+            d["offsets"] = vectorArray(std::move(offsets));
+        }
+        return d;
+    }
+};
+
+// Sets a line type mask for the lifetime of the object, restoring any mask the caller set.
+
+struct ScopedMask {
+    C_1F::OneFile *of;
+    bool isMask, lineMask[128];
+    ScopedMask(C_1F::OneFile *f, const char *types) : of(f), isMask(f->isMask) {
+        memcpy(lineMask, of->lineMask, 128);
+        C_1F::oneSetLineTypeMask(of, types);
+    }
+    ~ScopedMask() {
+        of->isMask = isMask;
+        memcpy(of->lineMask, lineMask, 128);
+    }
+};
+
+// Read up to n lines of one type from the current position into a column batch.  Other line
+// types are skipped by the line type mask, so are never decoded.
+
+static py::dict readColumns(ONEfile &self, const std::string &lineType, int64_t n) {
+    C_1F::OneInfo *li = lineInfo(self, lineType);
+    C_1F::OneFile *of = self.handle();
+    if (of->isWrite) throw std::runtime_error("readColumns needs a file open for reading");
+
+    Columns c(li);
+    {
+        py::gil_scoped_release release;
+        char mask[2] = {lineType[0], 0};
+        ScopedMask scope(of, mask);
+        while (c.n < n && C_1F::oneReadLine(of)) c.add(of);
+    }
+    return c.toDict();
+}
+
+// Parallel pass over all the objects of type T.  Reader thread k of the file takes the k'th
+// contiguous range of objects, found through the object index, and collects the lines of
+// type L within them.  With a reducer name the threads reduce their lines themselves and the
+// results are merged.  Otherwise the threads fill Columns batches into a bounded queue, and
+// the calling thread applies func to each batch holding the GIL, while decoding goes on
+// without it.  Results are returned in object order.  Errors in the threads, including C++
+// exceptions such as bad_alloc, are caught into job->error and raised in the calling thread.
+
+struct ParallelJob {
+    C_1F::OneFile *of;
+    char T, L;
+    int64_t i0, iN, batchSize;
+    int reducer; // 0 for func, 1 count, 2 sum, 3 histogram
+    int field;
+    int64_t maxBin;  // histogram values from maxBin up are counted in hist[maxBin]
+    int64_t count = 0;
+    std::vector<int64_t> intSum, hist;
+    std::vector<double> realSum;
+    std::string error;
+};
+
+struct BatchQueue {
+    std::mutex lock;
+    std::condition_variable filled, freed;
+    std::deque<std::pair<std::pair<int, int64_t>, std::unique_ptr<Columns>>> q; // (job, seq), batch
+    size_t max;
+    int nDone = 0;
+    bool isStop = false;
+};
+
+static void parallelRead(ParallelJob *job, int k, BatchQueue *bq) {
+    C_1F::OneFile *of = job->of;
+    C_1F::OneInfo *lt = of->info[(int) job->T], *ll = of->info[(int) job->L];
+    char mask[130], *m = mask; // all the object types, to see where T objects end, and L
+    for (int t = 'A'; t <= 'z'; ++t)
+        if (of->info[t] && of->info[t]->isObject) *m++ = t;
+    *m++ = job->L;
+    *m = 0;
+    ScopedMask scope(of, mask);
+    std::unique_ptr<Columns> c;
+    int64_t seq = 0;
+    bool isIn = true; // false after a line of another object type, until the next T
+
+    auto push = [&]() {
+        std::unique_lock<std::mutex> lk(bq->lock);
+        bq->freed.wait(lk, [&] { return bq->q.size() < bq->max || bq->isStop; });
+        if (bq->isStop) return false;
+        bq->q.emplace_back(std::make_pair(k, seq++), std::move(c));
+        bq->filled.notify_all();
+        return true;
+    };
+
+    if (job->i0 < job->iN && !(C_1F::oneGoto(of, job->T, job->i0) && C_1F::oneReadLine(of)))
+        job->error = std::string("can't read object ") + job->T + " " + std::to_string(job->i0);
+    else if (job->i0 < job->iN)
+        do {
+            if (of->lineType == job->T) {
+                if (lt->accum.count >= job->iN) break;
+                isIn = true;
+            } else if (!lt->contains[(int) of->lineType])
+                isIn = false;
+            if (of->lineType != job->L || !isIn) continue;
+            switch (job->reducer) {
+            case 0:
+                if (!c) { c.reset(new Columns(ll)); c->firstObject = lt->accum.count; }
+                c->add(of);
+                if (c->n == job->batchSize && !push()) return;
+                break;
+            case 1: ++job->count; break;
+            case 2:
+                ++job->count;
+                for (int i = 0; i < ll->nField; ++i)
+                    if (ll->fieldType[i] == C_1F::oneREAL) job->realSum[i] += of->field[i].r;
+                    else if (ll->fieldType[i] != C_1F::oneCHAR)
+                        job->intSum[i] += ll->fieldType[i] == C_1F::oneINT ? of->field[i].i
+                                                                           : of->field[i].len & 0xffffffffffffffll;
+                break;
+            case 3: {
+                int64_t x = ll->fieldType[job->field] == C_1F::oneINT ? of->field[job->field].i
+                                                                      : of->field[job->field].len & 0xffffffffffffffll;
+                if (x < 0) { job->error = "negative value in histogram field"; return; }
+                if (x > job->maxBin) x = job->maxBin;
+                if (x >= (int64_t) job->hist.size()) job->hist.resize(x + 1);
+                ++job->hist[x];
+                break;
+            }
+            }
+        } while (C_1F::oneReadLine(of));
+    if (c) push();
+}
+
+static void parallelThread(ParallelJob *job, int k, BatchQueue *bq) {
+    try {
+        parallelRead(job, k, bq);
+    } catch (const std::exception &e) {
+        job->error = e.what();
+    } catch (...) {
+        job->error = "unknown error in reader thread";
+    }
+    std::lock_guard<std::mutex> lk(bq->lock);
+    ++bq->nDone;
+    bq->filled.notify_all();
+}
+
+static py::object parallelMap(ONEfile &self, py::object func, const std::string &objectType,
+                              const std::string &lineType, int field, int64_t batchSize, int64_t maxBin) {
+    C_1F::OneInfo *lt = lineInfo(self, objectType);
+    C_1F::OneInfo *ll = lineInfo(self, lineType.empty() ? objectType : lineType);
+    C_1F::OneFile *of = self.handle();
+    char T = objectType[0], L = lineType.empty() ? T : lineType[0];
+    if (of->isWrite) throw std::runtime_error("parallelMap needs a file open for reading");
+    if (!lt->isObject) throw std::invalid_argument(std::string(1, T) + " is not an object type");
+    if (L != T && !lt->contains[(int) L])
+        throw std::invalid_argument(std::string(1, L) + " lines are not in " + T + " objects");
+    if (batchSize < 1) throw std::invalid_argument("batchSize must be positive");
+    if (maxBin < 0) throw std::invalid_argument("maxBin must not be negative");
+
+    int reducer = 0;
+    if (py::isinstance<py::str>(func)) {
+        std::string name = func.cast<std::string>();
+        if (name == "count") reducer = 1;
+        else if (name == "sum") reducer = 2;
+        else if (name == "histogram") reducer = 3;
+        else throw std::invalid_argument("unknown reducer " + name + " - use count, sum or histogram");
+    }
+    if (reducer == 3) {
+        if (field < 0) field = ll->listEltSize ? ll->listField : 0;
+        if (field >= ll->nField || (ll->fieldType[field] != C_1F::oneINT && field != ll->listField))
+            throw std::invalid_argument("histogram field must be an INT field or the list field");
+    }
+
+    int nThreads = of->share > 0 ? of->share : 1;
+    int64_t n = lt->given.count;
+    std::vector<ParallelJob> jobs(nThreads);
+    for (int k = 0; k < nThreads; ++k) {
+        ParallelJob &j = jobs[k];
+        j.of = of + k; j.T = T; j.L = L; j.batchSize = batchSize;
+        j.reducer = reducer; j.field = field; j.maxBin = maxBin;
+        j.i0 = 1 + (n * k) / nThreads;
+        j.iN = 1 + (n * (k + 1)) / nThreads;
+        j.intSum.assign(ll->nField, 0);
+        j.realSum.assign(ll->nField, 0.);
+    }
+    BatchQueue bq;
+    bq.max = 2 * nThreads;
+    std::vector<std::thread> threads;
+    std::vector<std::pair<std::pair<int, int64_t>, py::object>> results;
+
+    {
+        py::gil_scoped_release release;
+        for (int k = 0; k < nThreads; ++k) threads.emplace_back(parallelThread, &jobs[k], k, &bq);
+    }
+    auto stop = [&]() { // with the GIL released
+        { std::lock_guard<std::mutex> lk(bq.lock); bq.isStop = true; }
+        bq.freed.notify_all();
+        for (auto &t : threads) t.join();
+    };
+    if (!reducer)
+        try {
+            while (true) {
+                std::pair<std::pair<int, int64_t>, std::unique_ptr<Columns>> b;
+                {
+                    py::gil_scoped_release release;
+                    std::unique_lock<std::mutex> lk(bq.lock);
+                    bq.filled.wait(lk, [&] { return !bq.q.empty() || bq.nDone == nThreads; });
+                    if (bq.q.empty()) break;
+                    b = std::move(bq.q.front());
+                    bq.q.pop_front();
+                    bq.freed.notify_all();
+                }
+                py::dict d = b.second->toDict();
+                d["object"] = py::int_(b.second->firstObject);
+                results.emplace_back(b.first, func(d));
+            }
+        } catch (...) {
+            { py::gil_scoped_release release; stop(); }
+            throw;
+        }
+    { py::gil_scoped_release release; stop(); }
+
+    for (auto &j : jobs)
+        if (!j.error.empty()) throw std::runtime_error(j.error);
+    switch (reducer) {
+    case 0: {
+        std::sort(results.begin(), results.end(),
+                  [](const auto &a, const auto &b) { return a.first < b.first; });
+        py::list out;
+        for (auto &r : results) out.append(r.second);
+        return std::move(out);
+    }
+    case 1: {
+        int64_t total = 0;
+        for (auto &j : jobs) total += j.count;
+        return py::int_(total);
+    }
+    case 2: {
+        py::dict d;
+        for (int i = 0; i < ll->nField; ++i) {
+            int64_t is = 0;
+            double rs = 0.;
+            for (auto &j : jobs) { is += j.intSum[i]; rs += j.realSum[i]; }
+            if (ll->fieldType[i] == C_1F::oneREAL) d[py::int_(i)] = py::float_(rs);
+            else if (ll->fieldType[i] != C_1F::oneCHAR) d[py::int_(i)] = py::int_(is);
+        }
+        int64_t count = 0;
+        for (auto &j : jobs) count += j.count;
+        d["count"] = py::int_(count);
+        return std::move(d);
+    }
+    default: {
+        std::vector<int64_t> hist;
+        for (auto &j : jobs) {
+            if (j.hist.size() > hist.size()) hist.resize(j.hist.size());
+            for (size_t x = 0; x < j.hist.size(); ++x) hist[x] += j.hist[x];
+        }
+        return vectorArray(std::move(hist));
+    }
+    }
+}
+
 PYBIND11_MODULE(ONEcode, m) {
-    py::class_<ONEschema>(m, "ONEschema")
+    // ONEschema and ONEfile are move-only, so they live in their default unique_ptr holders and
+    // no binding takes or returns one by value; ONEfile& arguments are borrowed
+    py::class_<ONEschema, std::unique_ptr<ONEschema>>(m, "ONEschema")
         .def(py::init<const std::string &>());
 
-    py::class_<ONEfile>(m, "ONEfile")
+    py::class_<ONEfile, std::unique_ptr<ONEfile>>(m, "ONEfile")
         .def(py::init<const std::string &>())
         .def(py::init<const std::string &, int>())
         .def(py::init<const std::string &, const std::string &, const ONEschema &, const std::string &, int>())
@@ -23,58 +394,72 @@ PYBIND11_MODULE(ONEcode, m) {
         .def("setReal", &ONEfile::setReal)
         .def("getChar", &ONEfile::getChar)
         .def("setChar", &ONEfile::setChar)
-        .def("getIntList", &ONEfile::getIntList)
-        .def("getRealList", &ONEfile::getRealList)
-        .def("getDNAchar", &ONEfile::getDNAchar)
-        .def("getDNA2bit", &ONEfile::getDNA2bit)
+        .def("getIntList", [](ONEfile &self) { // copies, so stay valid
+            checkList(self, C_1F::oneINT_LIST);
+            auto s = self.intList();
+            return py::array_t<int64_t>(s.size(), s.data());
+        })
+        .def("getRealList", [](ONEfile &self) {
+            checkList(self, C_1F::oneREAL_LIST);
+            auto s = self.realList();
+            return py::array_t<double>(s.size(), s.data());
+        })
+        .def("getDNAchar", [](ONEfile &self) {
+            checkList(self, C_1F::oneDNA);
+            return py::bytes(self.dna().data(), self.dna().size());
+        })
+        .def("getDNA2bit", [](ONEfile &self) {
+            checkList(self, C_1F::oneDNA);
+            auto s = self.dna2bit();
+            return py::bytes((const char *) s.data(), s.size());
+        })
         .def("getString", &ONEfile::getString)
+
+        // zero-copy read-only NumPy views of the current list, valid until the next readLine()
+        .def("intList", [](py::object file) {
+            ONEfile &self = file.cast<ONEfile &>();
+            checkList(self, C_1F::oneINT_LIST);
+            auto s = self.intList();
+            return listView<int64_t>(file, s.data(), s.size());
+        })
+        .def("realList", [](py::object file) {
+            ONEfile &self = file.cast<ONEfile &>();
+            checkList(self, C_1F::oneREAL_LIST);
+            auto s = self.realList();
+            return listView<double>(file, s.data(), s.size());
+        })
+        .def("charList", [](py::object file) { // bytes of a STRING or DNA
+            ONEfile &self = file.cast<ONEfile &>();
+            checkList(self, C_1F::oneSTRING, C_1F::oneDNA);
+            auto s = self.stringView();
+            return listView<uint8_t>(file, (const uint8_t *) s.data(), s.size());
+        })
+        .def("dna2bit", [](py::object file) {
+            ONEfile &self = file.cast<ONEfile &>();
+            checkList(self, C_1F::oneDNA);
+            auto s = self.dna2bit();
+            return listView<uint8_t>(file, s.data(), s.size());
+        })
+        .def("setLineTypeMask", [](ONEfile &self, py::object lineTypes) { // None for all
+            if (lineTypes.is_none()) return self.setLineTypeMask(nullptr);
+            return self.setLineTypeMask(lineTypes.cast<std::string>().c_str());
+        }, py::arg("lineTypes") = py::none())
+        .def("readColumns", &readColumns, py::arg("lineType"), py::arg("n"))
+        .def("parallelMap", &parallelMap, py::arg("func"), py::arg("objectType"),
+             py::arg("lineType") = "", py::arg("field") = -1, py::arg("batchSize") = 65536,
+             py::arg("maxBin") = 1 << 20)
         .def("getStringList", &ONEfile::getStringList)
         .def("getComment", &ONEfile::getComment)
         .def("gotoObject", &ONEfile::gotoObject)
         .def("lineType", &ONEfile::lineType)
         .def("lineNumber", &ONEfile::lineNumber)
         
-        // Updated function bindings to handle string-to-char conversion
-        .def("givenCount", [](ONEfile &self, const std::string &lineType) {
-            if (lineType.length() != 1) {
-                throw std::invalid_argument("lineType must be a single character");
-            }
-            return self.givenCount(static_cast<unsigned char>(lineType[0]));
-        })
-        
-        .def("givenMax", [](ONEfile &self, const std::string &lineType) {
-            if (lineType.length() != 1) {
-                throw std::invalid_argument("lineType must be a single character");
-            }
-            return self.givenMax(static_cast<unsigned char>(lineType[0]));
-        })
-
-        .def("givenTotal", [](ONEfile &self, const std::string &lineType) {
-            if (lineType.length() != 1) {
-                throw std::invalid_argument("lineType must be a single character");
-            }
-            return self.givenTotal(static_cast<unsigned char>(lineType[0]));
-        })
-
-        .def("currentCount", [](ONEfile &self, const std::string &lineType) {
-            if (lineType.length() != 1) {
-                throw std::invalid_argument("lineType must be a single character");
-            }
-            return self.currentCount(static_cast<unsigned char>(lineType[0]));
-        })
-
-        .def("currentMax", [](ONEfile &self, const std::string &lineType) {
-            if (lineType.length() != 1) {
-                throw std::invalid_argument("lineType must be a single character");
-            }
-            return self.currentMax(static_cast<unsigned char>(lineType[0]));
-        })
-
-        .def("currentTotal", [](ONEfile &self, const std::string &lineType) {
-            if (lineType.length() != 1) {
-                throw std::invalid_argument("lineType must be a single character");
-            }
-            return self.currentTotal(static_cast<unsigned char>(lineType[0]));
-        });
+        // counts from the header ("given") and of lines read so far ("current")
+        .def("givenCount", [](ONEfile &self, const std::string &t) { return lineInfo(self, t)->given.count; })
+        .def("givenMax", [](ONEfile &self, const std::string &t) { return lineInfo(self, t)->given.max; })
+        .def("givenTotal", [](ONEfile &self, const std::string &t) { return lineInfo(self, t)->given.total; })
+        .def("currentCount", [](ONEfile &self, const std::string &t) { return lineInfo(self, t)->accum.count; })
+        .def("currentMax", [](ONEfile &self, const std::string &t) { return lineInfo(self, t)->accum.max; })
+        .def("currentTotal", [](ONEfile &self, const std::string &t) { return lineInfo(self, t)->accum.total; });
 }
 